@@ -1,17 +1,43 @@
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <unordered_set>
 
+#include <csgfile.hpp>
 #include <csgparser.hpp>
-
-using namespace json11;
+#include <csgthreads.hpp>
+#include <csgvalidator.hpp>
+#include <csgwriter.hpp>
 
 void printHelp() {
 
-  std::cout << "Usage: csg2json <input_file> <output_file>\n"
+  std::cout << "Usage: csg2json [--float] [--share] [--from <ext>] [--to <ext>] <input_file> <output_file>\n"
+               "       csg2json [--float] [--share] --batch <output_dir> [--to <ext>] [--threads <n>] <input>...\n"
                "  csg2json converts CSG files to CSGJS and vice versa.\n"
+               "  Both can also be converted to (and from) binary CSG files (.csgb)\n"
+               "  which are loaded without parsing.\n"
+               "  Options:\n"
+               "    --float        write numbers with single precision (as used by the viewer)\n"
+               "    --share        write repeated subtrees of CSGJS output once (as definitions)\n"
+               "    --from <ext>   input format (csg, csgjs or csgb) instead of the file extension\n"
+               "    --to <ext>     output format instead of the file extension\n"
+               "    --batch <dir>  convert many files concurrently into the directory; inputs are\n"
+               "                   files, directories (their .csg, .csgjs and .csgb files)\n"
+               "                   or @manifest files listing one input file per line\n"
+               "                   (csg, csgjs (default) or csgb in batch mode)\n"
+               "    --threads <n>  number of batch conversion threads (hardware threads by default)\n"
+               "  File name \"-\" stands for standard input or output; CSG input is then converted\n"
+               "  to CSG or CSGJS while it is being read, with bounded memory.\n"
                "  Example:\n"
-               "    csg2json input.csg output.csgjs\n";
+               "    csg2json input.csg output.csgjs\n"
+               "    csg2json input.csg output.csgb\n"
+               "    csg2json --from csg --to csgjs - -\n"
+               "    csg2json --batch out --to csgb parts @more_parts.txt\n";
 }
 
 //! Extracts file extension
@@ -34,38 +60,348 @@ std::string toLower (const std::string& theString) {
   return aRes;
 }
 
+//! Extracts file name without directory and extension
+std::string getFileStem (const std::string& theFilePath) {
+
+  std::string::size_type aStart = theFilePath.find_last_of ("/\\");
+  std::string aName = aStart == std::string::npos ? theFilePath : theFilePath.substr (aStart + 1);
+
+  std::string::size_type anIdx = aName.rfind (".");
+  return anIdx == std::string::npos ? aName : aName.substr (0, anIdx);
+}
+
+//! Checks if the extension is one of CSG formats
+bool isCsgExtension (const std::string& theExt) {
+
+  return theExt == "csg" || theExt == "csgjs" || theExt == "csgb";
+}
+
+//! File of batch conversion
+struct BatchFile {
+  std::string inputPath;
+  std::string outputPath;
+  std::string error;  //!< empty if the file is converted
+  double size;        //!< size of the input in bytes
+};
+
+//! Appends input files given by command line argument: a file, a directory or @manifest
+void collectInputs (const std::string& theArg, std::vector<std::string>& theInputs) {
+
+  if (!theArg.empty() && theArg[0] == '@') {
+    std::ifstream aManifest (theArg.substr (1));
+    if (!aManifest) {
+      throw std::runtime_error ("Cannot open file: " + theArg.substr (1));
+    }
+
+    std::string aLine;
+    while (std::getline (aManifest, aLine)) {
+      aLine.erase (aLine.find_last_not_of (" \t\r") + 1);
+      if (!aLine.empty()) {
+        theInputs.push_back (aLine);
+      }
+    }
+  }
+  else if (csg::isDirectory (theArg)) {
+    for (auto& aName : csg::listDirectory (theArg)) {
+      if (isCsgExtension (toLower (getFileExtension (aName)))) {
+        theInputs.push_back (theArg + "/" + aName);
+      }
+    }
+  }
+  else {
+    theInputs.push_back (theArg);
+  }
+}
+
+//! Reads document of any CSG format without printing anything (throws std::runtime_error on failure)
+csg::Document readDocument (const std::string& theFilePath) {
+
+  const std::string anExt = toLower (getFileExtension (theFilePath));
+
+  if (anExt == "csg") {
+    return csg::Parser::parseDocument (theFilePath);
+  }
+
+  if (anExt == "csgb") {
+    return csg::Parser::parseBinary (theFilePath);
+  }
+
+  if (anExt != "csgjs") {
+    throw std::runtime_error ("Unrecognized extension: " + anExt);
+  }
+
+  return csg::Parser::parseJSONDocument (theFilePath);
+}
+
+//! Converts one file of batch, the failure is stored in the file
+void convertFile (BatchFile& theFile,
+                  const std::string& theOutputExt,
+                  const csg::NumberPrecision thePrecision,
+                  const bool toShareSubtrees) {
+
+  try {
+    csg::Document aData = readDocument (theFile.inputPath);
+
+    std::vector<csg::Diagnostic> aDiagnostics = csg::Validator::validate (aData);
+    if (!aDiagnostics.empty()) {
+      throw std::runtime_error ("Validation error: " + aDiagnostics.front().path + ": " + aDiagnostics.front().message
+                              + (aDiagnostics.size() > 1 ? " (and " + std::to_string (aDiagnostics.size() - 1) + " more)" : ""));
+    }
+
+    if (theOutputExt == "csg") {
+      csg::Parser::write (aData, theFile.outputPath, thePrecision);
+    }
+    else if (theOutputExt == "csgjs") {
+      csg::Parser::writeJSON (aData, theFile.outputPath, thePrecision, toShareSubtrees);
+    }
+    else {
+      csg::Parser::writeBinary (aData, theFile.outputPath);
+    }
+  }
+  catch (std::runtime_error& anError) {
+    theFile.error = anError.what();
+  }
+  catch (std::bad_alloc&) {
+    theFile.error = "Out of memory";
+  }
+}
+
+//! Converts input files into the output directory on several threads, prints failures and summary
+int convertBatch (const std::vector<std::string>& theArgs,
+                  const std::string& theOutputDir,
+                  const std::string& theOutputExt,
+                  const int theNbThreads,
+                  const csg::NumberPrecision thePrecision,
+                  const bool toShareSubtrees) {
+
+  if (!isCsgExtension (theOutputExt)) {
+    std::cout << "Unrecognized extension: " << theOutputExt << std::endl;
+    return 1;
+  }
+
+  if (!csg::isDirectory (theOutputDir)) {
+    std::cout << "Output directory does not exist: " << theOutputDir << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> anInputs;
+
+  try {
+    for (auto& anArg : theArgs) {
+      collectInputs (anArg, anInputs);
+    }
+  }
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
+    return 1;
+  }
+
+  std::vector<BatchFile> aFiles (anInputs.size());
+  std::unordered_set<std::string> anOutputs;
+
+  for (size_t anIndex = 0; anIndex < anInputs.size(); ++anIndex) {
+    BatchFile& aFile = aFiles[anIndex];
+    aFile.inputPath = anInputs[anIndex];
+    aFile.outputPath = theOutputDir + "/" + getFileStem (aFile.inputPath) + "." + theOutputExt;
+
+    std::ifstream aStream (aFile.inputPath, std::ios::binary | std::ios::ate);
+    aFile.size = aStream ? static_cast<double> (aStream.tellg()) : 0.0;
+
+    // files of the same name from different directories would overwrite each other
+    if (!anOutputs.insert (aFile.outputPath).second) {
+      aFile.error = "Output file is written for another input: " + aFile.outputPath;
+    }
+    else if (aFile.outputPath == aFile.inputPath) {
+      aFile.error = "Output file is the same as input";
+    }
+  }
+
+  auto aStart = std::chrono::steady_clock::now();
+
+  // the largest files go first, so a thread does not end up with one of them at the end
+  std::vector<int> anOrder (aFiles.size());
+  for (size_t anIndex = 0; anIndex < anOrder.size(); ++anIndex) {
+    anOrder[anIndex] = static_cast<int> (anIndex);
+  }
+
+  std::stable_sort (anOrder.begin(), anOrder.end(), [&] (const int theLeft, const int theRight) {
+    return aFiles[theLeft].size > aFiles[theRight].size;
+  });
+
+  csg::parallelFor (static_cast<int> (aFiles.size()), theNbThreads, [&] (const int theIndex) {
+    BatchFile& aFile = aFiles[anOrder[theIndex]];
+    if (aFile.error.empty()) {
+      convertFile (aFile, theOutputExt, thePrecision, toShareSubtrees);
+    }
+  });
+
+  auto aStop = std::chrono::steady_clock::now();
+  const double aTime = std::chrono::duration<double> (aStop - aStart).count();
+
+  size_t aNbFailed = 0;
+  double aBytes = 0.0;
+
+  for (auto& aFile : aFiles) {
+    if (!aFile.error.empty()) {
+      std::cout << "Failed: " << aFile.inputPath << ": " << aFile.error << std::endl;
+      ++aNbFailed;
+    }
+    else {
+      aBytes += aFile.size;
+    }
+  }
+
+  std::cout << "Converted " << aFiles.size() - aNbFailed << " of " << aFiles.size() << " files ("
+            << aBytes / (1024.0 * 1024.0) << " MB) in " << aTime << " s, "
+            << (aTime > 0.0 ? aBytes / (1024.0 * 1024.0) / aTime : 0.0) << " MB/s";
+
+  if (aNbFailed != 0) {
+    std::cout << ", " << aNbFailed << " failed";
+  }
+
+  std::cout << std::endl;
+
+  return aNbFailed == 0 ? 0 : 1;
+}
+
+//! Converts CSG text to CSG or CSGJS while it is being read
+int convertStream (const std::string& theInputPath,
+                   const std::string& theOutputPath,
+                   const std::string& theOutputExt,
+                   const csg::NumberPrecision thePrecision) {
+
+  try {
+    csg::OutputFile aFile (theOutputPath);
+    csg::CsgStreamWriter aWriter (aFile,
+                                  theOutputExt == "csg" ? csg::CsgStreamWriter::FORMAT_CSG
+                                                        : csg::CsgStreamWriter::FORMAT_CSGJS,
+                                  thePrecision);
+
+    csg::Parser::parseEvents (theInputPath, aWriter);
+    aWriter.finish();
+    aFile.close();
+  }
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
 int main (int argc, char ** argv) {
 
-  if (argc != 3) {
+  csg::NumberPrecision aPrecision = csg::PRECISION_DOUBLE;
+  bool toShareSubtrees = false;
+
+  bool isBatch = false;
+  std::string anOutputDir;
+  std::string anInputFormat;
+  std::string anOutputFormat;
+  int aNbThreads = 0;
+
+  std::vector<std::string> anArgs;
+
+  for (int anIndex = 1; anIndex < argc; ++anIndex) {
+    const std::string anArg = argv[anIndex];
+    const bool hasValue = anIndex + 1 < argc;
+
+    if (anArg == "--float") {
+      aPrecision = csg::PRECISION_FLOAT;
+    }
+    else if (anArg == "--share") {
+      toShareSubtrees = true;
+    }
+    else if (anArg == "--batch" && hasValue) {
+      isBatch = true;
+      anOutputDir = argv[++anIndex];
+    }
+    else if (anArg == "--from" && hasValue) {
+      anInputFormat = toLower (argv[++anIndex]);
+    }
+    else if (anArg == "--to" && hasValue) {
+      anOutputFormat = toLower (argv[++anIndex]);
+    }
+    else if (anArg == "--threads" && hasValue) {
+      aNbThreads = std::atoi (argv[++anIndex]);
+    }
+    else {
+      anArgs.push_back (anArg);
+    }
+  }
+
+  if (isBatch) {
+    if (anArgs.empty()) {
+      printHelp();
+      return 0;
+    }
+
+    return convertBatch (anArgs, anOutputDir, anOutputFormat.empty() ? "csgjs" : anOutputFormat, aNbThreads, aPrecision, toShareSubtrees);
+  }
+
+  if (anArgs.size() != 2) {
     printHelp();
     return 0;
   }
 
-  Json aData;
+  const std::string anInputPath = anArgs[0];
+  const std::string anOutputPath = anArgs[1];
 
-  std::string anInputExt = toLower (getFileExtension (argv[1]));
+  std::string anInputExt = anInputFormat.empty() ? toLower (getFileExtension (anInputPath)) : anInputFormat;
+  std::string anOutputExt = anOutputFormat.empty() ? toLower (getFileExtension (anOutputPath)) : anOutputFormat;
 
-  if (anInputExt == "csg") {
-    aData = csg::Parser::parse (argv[1]);
+  // messages must not be mixed into the output
+  if (anOutputPath == "-") {
+    std::cout.rdbuf (std::cerr.rdbuf());
   }
-  else if (anInputExt == "csgjs") {
-    aData = csg::Parser::parseJSON (argv[1]);
-  }
-  else {
-    std::cout << "Unrecognized extension: " << anInputExt << std::endl;
-    return 1;
+
+  // repeated subtrees can be found only in the whole document
+  if (anInputExt == "csg" && (anOutputExt == "csg" || anOutputExt == "csgjs")
+   && (anInputPath == "-" || anOutputPath == "-") && !(toShareSubtrees && anOutputExt == "csgjs")) {
+    return convertStream (anInputPath, anOutputPath, anOutputExt, aPrecision);
   }
 
-  std::string anOutputExt = toLower (getFileExtension (argv[2]));
+  // the compact document keeps memory usage low for large files
+  csg::Document aData;
 
-  if (anOutputExt == "csg") {
-    csg::Parser::write (aData, argv[2]);
+  try {
+    if (anInputExt == "csg") {
+      aData = csg::Parser::parseDocument (anInputPath);
+    }
+    else if (anInputExt == "csgjs") {
+      aData = csg::Parser::parseJSONDocument (anInputPath);
+      csg::Parser::validate (aData);
+    }
+    else if (anInputExt == "csgb") {
+      aData = csg::Parser::parseBinary (anInputPath);
+    }
+    else {
+      std::cout << "Unrecognized extension: " << anInputExt << std::endl;
+      return 1;
+    }
   }
-  else if (anOutputExt == "csgjs") {
-    csg::Parser::writeJSON (aData, argv[2]);
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
+    return 1;
   }
-  else {
-    std::cout << "Unrecognized extension: " << anOutputExt << std::endl;
+
+  try {
+    if (anOutputExt == "csg") {
+      csg::Parser::write (aData, anOutputPath, aPrecision);
+    }
+    else if (anOutputExt == "csgjs") {
+      csg::Parser::writeJSON (aData, anOutputPath, aPrecision, toShareSubtrees);
+    }
+    else if (anOutputExt == "csgb") {
+      csg::Parser::writeBinary (aData, anOutputPath);
+    }
+    else {
+      std::cout << "Unrecognized extension: " << anOutputExt << std::endl;
+      return 1;
+    }
+  }
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
     return 1;
   }
  
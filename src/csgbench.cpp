@@ -0,0 +1,1113 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <csgfile.hpp>
+#include <csggenerator.hpp>
+#include <csgheap.hpp>
+#include <csgparser.hpp>
+#include <csgthreads.hpp>
+#include <csgwriter.hpp>
+#include <csgframework/CsgEvaluator.hpp>
+#include <csgframework/CsgLoader.hpp>
+#include <csgframework/CsgScene.hpp>
+#include <csgframework/CsgSharing.hpp>
+#include <stdgl/VoxelData.hpp>
+
+namespace {
+
+  //! Name of temporary output file.
+  const char* THE_OUTPUT_FILE = "csgbench_output";
+
+  //! Presets of generated scenes (see csg::SceneParameters::preset).
+  const char* THE_PRESETS[] = { "openscad", "flat", "instanced" };
+
+  //! Names of all stages in the order of running.
+  const char* THE_STAGES[] = {
+    "parse",
+    "parse-threads",
+    "parse-events",
+    "parse-document",
+    "parse-peg",
+    "parse-json",
+    "parse-json-document",
+    "read-binary",
+    "validate",
+    "write",
+    "write-json",
+    "load-tree",
+    "load-document",
+    "load-file",
+    "load-file-arena",
+    "copy",
+    "copy-arena",
+    "initialize-bounds",
+    "to-positive-form",
+    "grow-bounds",
+    "clip-bounds",
+    "distance",
+    "voxel-fill",
+    "regroup",
+    "build-scene",
+    "scene-initialize-bounds",
+    "scene-grow-bounds",
+    "scene-clip-bounds",
+    "scene-distance",
+    "scene-voxel-fill",
+    "share-subtrees",
+    "shared-scene-distance",
+    "find-instances"
+  };
+
+  //! Stage which is run only on request (the reference parser is slow).
+  const char* THE_OPTIONAL_STAGE = "parse-peg";
+
+  //! Default relative slowdown of median time reported as regression.
+  const double THE_DEFAULT_THRESHOLD = 0.1;
+
+  //! Settings of the benchmark.
+  struct Settings {
+    int nbPrimitives;            //!< primitives of generated scenes (0 skips them)
+    int nbRuns;                  //!< runs of every stage
+    int nbPoints;                //!< points of distance evaluation
+    int gridSize;                //!< resolution of voxel grid
+    std::set<std::string> stages; //!< stages to run
+
+    Settings() : nbPrimitives (10000), nbRuns (5), nbPoints (256), gridSize (12) {}
+
+    bool isSelected (const std::string& theStage) const { return stages.count (theStage) != 0; }
+  };
+
+  //! Measurements of one stage on one scene.
+  struct StageResult {
+    std::string scene;
+    std::string stage;
+    std::vector<double> times; //!< wall-clock time of every run (in seconds)
+    double bytes;              //!< bytes processed by a run (0 if not applicable)
+    double points;             //!< points evaluated by a run (0 if not applicable)
+    double heapPeak;           //!< maximum of peak heap memory of the runs (in bytes)
+    double peakRss;            //!< peak resident memory of the process after the stage (in bytes)
+
+    StageResult() : bytes (0.0), points (0.0), heapPeak (0.0), peakRss (0.0) {}
+  };
+
+  //! Scene files of the benchmark.
+  struct Scene {
+    std::string name;
+    std::string csgPath;
+    std::string jsonPath;
+    std::string binaryPath;
+    std::vector<std::string> temporaryFiles;
+  };
+
+  //! Returns size of the given file in bytes.
+  double fileSize (const std::string& theFilePath) {
+
+    std::ifstream aStream (theFilePath, std::ios::binary | std::ios::ate);
+    return static_cast<double> (aStream.tellg());
+  }
+
+  //! Extracts file extension in lower case.
+  std::string getFileExtension (const std::string& theFileName) {
+
+    std::string anExt;
+    std::string::size_type anIdx = theFileName.rfind (".");
+    if (anIdx != std::string::npos) {
+      anExt = theFileName.substr (anIdx + 1);
+    }
+
+    std::transform (anExt.begin(), anExt.end(), anExt.begin(), ::tolower);
+    return anExt;
+  }
+
+  //! Returns value of sorted samples at the given fraction (linear interpolation between ranks).
+  double percentile (const std::vector<double>& theSorted, const double theFraction) {
+
+    if (theSorted.empty()) {
+      return 0.0;
+    }
+
+    const double aRank = theFraction * (theSorted.size() - 1);
+    const size_t aLower = static_cast<size_t> (aRank);
+    const size_t anUpper = std::min (aLower + 1, theSorted.size() - 1);
+
+    return theSorted[aLower] + (theSorted[anUpper] - theSorted[aLower]) * (aRank - aLower);
+  }
+
+  //! Runs the stage the given number of times measuring time and heap memory of every run.
+  //! The preparation is called before every run and is not measured.
+  template<typename Prepare, typename Run>
+  StageResult measure (const std::string& theStage, const int theNbRuns, Prepare thePrepare, Run theRun) {
+
+    StageResult aResult;
+    aResult.stage = theStage;
+
+    for (int aRun = 0; aRun < theNbRuns; ++aRun) {
+      thePrepare();
+      csg::resetHeapPeak();
+
+      auto aStart = std::chrono::steady_clock::now();
+      theRun();
+      auto aStop = std::chrono::steady_clock::now();
+
+      aResult.times.push_back (std::chrono::duration<double> (aStop - aStart).count());
+      aResult.heapPeak = std::max (aResult.heapPeak, csg::heapPeak());
+    }
+
+    aResult.peakRss = csg::peakResidentMemory();
+    return aResult;
+  }
+
+  //! Runs the stage which needs no preparation.
+  template<typename Run>
+  StageResult measure (const std::string& theStage, const int theNbRuns, Run theRun) {
+
+    return measure (theStage, theNbRuns, []() {}, theRun);
+  }
+
+  //! Handler counting parsed objects and instructions.
+  class CountingHandler : public csg::Handler {
+
+  public:
+
+    CountingHandler() : m_nbNodes (0) {}
+
+    virtual void object (const std::string&, const json11::Json::object&) { ++m_nbNodes; }
+
+    virtual void beginInstruction (const std::string&, const json11::Json::object&) { ++m_nbNodes; }
+
+    virtual void beginMatrix (const std::string&, const json11::Json::array&) { ++m_nbNodes; }
+
+    virtual void endInstruction() {}
+
+    //! Returns number of parsed objects and instructions.
+    int nbNodes() const { return m_nbNodes; }
+
+  private:
+
+    int m_nbNodes;
+
+  };
+
+  //! Checks if the boxes are the same.
+  bool isSameBox (const Box4f& theBox1, const Box4f& theBox2) {
+
+    if (!theBox1.IsValid() || !theBox2.IsValid()) {
+      return theBox1.IsValid() == theBox2.IsValid();
+    }
+
+    return theBox1.CornerMin() == theBox2.CornerMin() && theBox1.CornerMax() == theBox2.CornerMax();
+  }
+
+  //! Checks if the nodes of the scenes have the same bounds.
+  bool isSameBounds (const CsgScene& theScene1, const CsgScene& theScene2) {
+
+    if (theScene1.NbNodes() != theScene2.NbNodes()) {
+      return false;
+    }
+
+    for (int aNode = 0; aNode < theScene1.NbNodes(); ++aNode) {
+      if (!isSameBox (theScene1.Bounds (aNode), theScene2.Bounds (aNode))) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //! Returns SAH cost of the tree: sum of areas of bounds of operations relative to the area
+  //! of the root weighted by numbers of their children (expected number of bounds tested by
+  //! random ray when children of operations are culled by their bounds).
+  double hierarchyCost (const CsgNode* theTree) {
+
+    const CsgScene aScene (theTree);
+
+    double aCost = 0.0;
+    for (int aNode = 0; aNode < aScene.NbNodes(); ++aNode) {
+      if (!aScene.IsLeaf (aNode) && aScene.Bounds (aNode).IsValid() && std::isfinite (aScene.Bounds (aNode).Area())) {
+        aCost += aScene.Bounds (aNode).Area() * aScene.NbChildren (aNode);
+      }
+    }
+
+    const Box4f& aRootBounds = aScene.Bounds (aScene.Root());
+    return aRootBounds.IsValid() && aRootBounds.Area() > 0.f ? aCost / aRootBounds.Area() : 0.0;
+  }
+
+  //! Converts stage result to JSON.
+  json11::Json toJson (const StageResult& theResult) {
+
+    std::vector<double> aTimes = theResult.times;
+    std::sort (aTimes.begin(), aTimes.end());
+
+    const double aMedian = percentile (aTimes, 0.5);
+
+    json11::Json::object anObject;
+    anObject["scene"] = theResult.scene;
+    anObject["stage"] = theResult.stage;
+    anObject["runs"] = static_cast<int> (aTimes.size());
+    anObject["min"] = aTimes.front();
+    anObject["p10"] = percentile (aTimes, 0.1);
+    anObject["median"] = aMedian;
+    anObject["p90"] = percentile (aTimes, 0.9);
+    anObject["max"] = aTimes.back();
+    anObject["heap-peak"] = theResult.heapPeak;
+    anObject["peak-rss"] = theResult.peakRss;
+
+    if (theResult.bytes > 0.0) {
+      anObject["bytes"] = theResult.bytes;
+      anObject["bytes-per-second"] = aMedian > 0.0 ? theResult.bytes / aMedian : 0.0;
+    }
+
+    if (theResult.points > 0.0) {
+      anObject["points"] = theResult.points;
+      anObject["points-per-second"] = aMedian > 0.0 ? theResult.points / aMedian : 0.0;
+    }
+
+    return anObject;
+  }
+
+  //! Prints stage result.
+  void printResult (const StageResult& theResult) {
+
+    const json11::Json aResult = toJson (theResult);
+
+    std::cout << "[" << theResult.scene << "] " << theResult.stage << ": "
+              << aResult["median"].number_value() * 1e3 << " ms (p90 "
+              << aResult["p90"].number_value() * 1e3 << " ms)";
+
+    if (theResult.bytes > 0.0) {
+      std::cout << ", " << aResult["bytes-per-second"].number_value() / (1024.0 * 1024.0) << " MB/s";
+    }
+
+    if (theResult.points > 0.0) {
+      std::cout << ", " << aResult["points-per-second"].number_value() << " points/s";
+    }
+
+    std::cout << ", heap peak " << theResult.heapPeak / (1024.0 * 1024.0) << " MB" << std::endl;
+  }
+
+  //! Runs selected stages on the scene, throws std::runtime_error if results of stages differ.
+  void runScene (const Scene& theScene, const Settings& theSettings, std::vector<StageResult>& theResults) {
+
+    const int aNbRuns = theSettings.nbRuns;
+
+    const double aBytes = fileSize (theScene.csgPath);
+    const double aJsonBytes = fileSize (theScene.jsonPath);
+    const double aBinaryBytes = fileSize (theScene.binaryPath);
+
+    std::cout << "Scene " << theScene.name << ": " << aBytes / (1024.0 * 1024.0) << " MB (csg), "
+              << aJsonBytes / (1024.0 * 1024.0) << " MB (csgjs), "
+              << aBinaryBytes / (1024.0 * 1024.0) << " MB (csgb)" << std::endl;
+
+    auto aRecord = [&] (StageResult theResult, const double theBytes, const double thePoints) {
+      theResult.scene = theScene.name;
+      theResult.bytes = theBytes;
+      theResult.points = thePoints;
+      printResult (theResult);
+      theResults.push_back (theResult);
+    };
+
+    auto aCheck = [] (const bool theCondition, const std::string& theMessage) {
+      if (!theCondition) {
+        throw std::runtime_error (theMessage);
+      }
+    };
+
+    // reference results, the stages producing them are measured if selected
+    json11::Json aData;
+    if (theSettings.isSelected ("parse")) {
+      aRecord (measure ("parse", aNbRuns, [&]() {
+        aData = csg::Parser::parse (theScene.csgPath);
+      }), aBytes, 0.0);
+    }
+    else {
+      aData = csg::Parser::parse (theScene.csgPath);
+    }
+
+    aCheck (!aData.is_null(), "Cannot parse " + theScene.csgPath);
+
+    csg::Document aDocument;
+    if (theSettings.isSelected ("parse-document")) {
+      aRecord (measure ("parse-document", aNbRuns, [&]() {
+        aDocument = csg::Document();
+      }, [&]() {
+        aDocument = csg::Parser::parseDocument (theScene.csgPath);
+      }), aBytes, 0.0);
+    }
+    else {
+      aDocument = csg::Parser::parseDocument (theScene.csgPath);
+    }
+
+    aCheck (aDocument.toJson() == aData, "Document differs from JSON representation");
+
+    if (theSettings.isSelected ("parse-threads") && csg::hardwareThreads() > 1) {
+      json11::Json aResult;
+      aRecord (measure ("parse-threads", aNbRuns, [&]() {
+        aResult = csg::Parser::parse (theScene.csgPath, csg::Parser::ENGINE_DIRECT, csg::hardwareThreads());
+      }), aBytes, 0.0);
+
+      aCheck (aResult == aData, "Parallel parsing produced different result");
+    }
+
+    if (theSettings.isSelected ("parse-events")) {
+      aRecord (measure ("parse-events", aNbRuns, [&]() {
+        CountingHandler aHandler;
+        csg::Parser::parseEvents (theScene.csgPath, aHandler);
+      }), aBytes, 0.0);
+    }
+
+    if (theSettings.isSelected ("parse-peg")) {
+      json11::Json aResult;
+      aRecord (measure ("parse-peg", aNbRuns, [&]() {
+        aResult = csg::Parser::parse (theScene.csgPath, csg::Parser::ENGINE_PEG);
+      }), aBytes, 0.0);
+
+      aCheck (aResult == aData, "Parsing engines produced different results");
+    }
+
+    if (theSettings.isSelected ("parse-json")) {
+      json11::Json aResult;
+      aRecord (measure ("parse-json", aNbRuns, [&]() {
+        aResult = csg::Parser::parseJSON (theScene.jsonPath);
+      }), aJsonBytes, 0.0);
+
+      aCheck (csg::Document::fromJson (aResult).toJson() == aData, "CSGJS file differs from JSON representation");
+    }
+
+    if (theSettings.isSelected ("parse-json-document")) {
+      csg::Document aResult;
+      aRecord (measure ("parse-json-document", aNbRuns, [&]() {
+        aResult = csg::Document();
+      }, [&]() {
+        aResult = csg::Parser::parseJSONDocument (theScene.jsonPath);
+      }), aJsonBytes, 0.0);
+
+      aCheck (aResult.toJson() == aData, "CSGJS file differs from JSON representation");
+    }
+
+    if (theSettings.isSelected ("read-binary")) {
+      csg::Document aResult;
+      aRecord (measure ("read-binary", aNbRuns, [&]() {
+        aResult = csg::Document();
+      }, [&]() {
+        aResult = csg::Parser::parseBinary (theScene.binaryPath);
+      }), aBinaryBytes, 0.0);
+
+      aCheck (aResult.toJson() == aData, "Binary file differs from JSON representation");
+    }
+
+    if (theSettings.isSelected ("validate")) {
+      size_t aNbDiagnostics = 0;
+      aRecord (measure ("validate", aNbRuns, [&]() {
+        aNbDiagnostics = csg::Validator::validate (aDocument).size();
+      }), 0.0, 0.0);
+
+      if (aNbDiagnostics != 0) {
+        std::cout << "  " << aNbDiagnostics << " diagnostics" << std::endl;
+      }
+    }
+
+    if (theSettings.isSelected ("write")) {
+      const StageResult aResult = measure ("write", aNbRuns, [&]() {
+        csg::Parser::write (aDocument, THE_OUTPUT_FILE);
+      });
+
+      aRecord (aResult, fileSize (THE_OUTPUT_FILE), 0.0);
+
+      // shortest numbers should be read back exactly
+      aCheck (csg::Parser::parseDocument (THE_OUTPUT_FILE).toJson() == aData, "Written CSG file differs from JSON representation");
+    }
+
+    if (theSettings.isSelected ("write-json")) {
+      const StageResult aResult = measure ("write-json", aNbRuns, [&]() {
+        csg::Parser::writeJSON (aDocument, THE_OUTPUT_FILE);
+      });
+
+      aRecord (aResult, fileSize (THE_OUTPUT_FILE), 0.0);
+
+      aCheck (csg::Parser::parseJSONDocument (THE_OUTPUT_FILE).toJson() == aData, "Written CSGJS file differs from JSON representation");
+    }
+
+    std::remove (THE_OUTPUT_FILE);
+
+    // the tree stages need the tree, CsgLoader doesn't read every valid scene
+    std::unique_ptr<CsgNode> aTree;
+    try {
+      if (theSettings.isSelected ("load-tree")) {
+        aRecord (measure ("load-tree", aNbRuns, [&]() {
+          aTree.reset();
+        }, [&]() {
+          aTree.reset (CsgLoader::LoadTree (aData));
+        }), 0.0, 0.0);
+      }
+      else {
+        aTree.reset (CsgLoader::LoadDocument (aDocument));
+      }
+    }
+    catch (std::runtime_error& anError) {
+      std::cout << "  tree stages are skipped: " << anError.what() << std::endl;
+      return;
+    }
+
+    const int aNbPrimitives = aTree->NbPrimitives();
+
+    if (theSettings.isSelected ("load-document")) {
+      std::unique_ptr<CsgNode> aResult;
+      aRecord (measure ("load-document", aNbRuns, [&]() {
+        aResult.reset();
+      }, [&]() {
+        aResult.reset (CsgLoader::LoadDocument (aDocument));
+      }), 0.0, 0.0);
+
+      aCheck (aResult->NbPrimitives() == aNbPrimitives, "Loading paths produced different trees");
+    }
+
+    if (theSettings.isSelected ("load-file")) {
+      std::unique_ptr<CsgNode> aResult;
+      aRecord (measure ("load-file", aNbRuns, [&]() {
+        aResult.reset();
+      }, [&]() {
+        aResult.reset (CsgLoader::LoadFile (theScene.csgPath));
+      }), aBytes, 0.0);
+
+      aCheck (aResult->NbPrimitives() == aNbPrimitives, "Loading paths produced different trees");
+    }
+
+    if (theSettings.isSelected ("load-file-arena")) {
+      CsgTreeArena anArena;
+      CsgNode* aResult = NULL;
+      aRecord (measure ("load-file-arena", aNbRuns, [&]() {
+        anArena.Release();
+      }, [&]() {
+        aResult = CsgLoader::LoadFile (theScene.csgPath, &anArena);
+      }), aBytes, 0.0);
+
+      aCheck (aResult->NbPrimitives() == aNbPrimitives, "Loading paths produced different trees");
+    }
+
+    // copies are released in the same run
+    if (theSettings.isSelected ("copy")) {
+      aRecord (measure ("copy", aNbRuns, [&]() {
+        delete aTree->DeepCopy();
+      }), 0.0, 0.0);
+    }
+
+    if (theSettings.isSelected ("copy-arena")) {
+      CsgTreeArena anArena;
+      aRecord (measure ("copy-arena", aNbRuns, [&]() {
+        aTree->DeepCopy (&anArena);
+        anArena.Release();
+      }), 0.0, 0.0);
+
+      aCheck (aTree->DeepCopy (&anArena)->NbPrimitives() == aNbPrimitives, "Tree copies are different");
+    }
+
+    // the bounds are initialized anyway, the points are sampled inside
+    if (theSettings.isSelected ("initialize-bounds")) {
+      aRecord (measure ("initialize-bounds", aNbRuns, [&]() {
+        aTree->InitializeBounds();
+      }), 0.0, 0.0);
+    }
+    else {
+      aTree->InitializeBounds();
+    }
+
+    const bool isScenePositive = theSettings.isSelected ("scene-grow-bounds") || theSettings.isSelected ("scene-clip-bounds");
+
+    std::unique_ptr<CsgNode> aPositiveTree;
+    if (theSettings.isSelected ("to-positive-form")) {
+      aRecord (measure ("to-positive-form", aNbRuns, [&]() {
+        aPositiveTree.reset (aTree->DeepCopy());
+      }, [&]() {
+        aPositiveTree->ToPositiveForm();
+      }), 0.0, 0.0);
+    }
+    else if (theSettings.isSelected ("grow-bounds") || theSettings.isSelected ("clip-bounds") || isScenePositive) {
+      aPositiveTree.reset (aTree->DeepCopy());
+      aPositiveTree->ToPositiveForm();
+    }
+
+    if (aPositiveTree) {
+      aPositiveTree->InitializeBounds();
+    }
+
+    // the scene passes start from the same state as the tree ones
+    CsgScene aPositiveScene;
+    if (isScenePositive) {
+      aPositiveScene.Build (aPositiveTree.get());
+    }
+
+    // bounds of single primitive are final
+    const bool isTreeGrown = theSettings.isSelected ("grow-bounds") && !aPositiveTree->IsLeaf();
+    if (isTreeGrown) {
+      aRecord (measure ("grow-bounds", aNbRuns, [&]() {
+        static_cast<CsgOperationNode*> (aPositiveTree.get())->GrowBounds();
+      }), 0.0, 0.0);
+    }
+
+    if (theSettings.isSelected ("clip-bounds")) {
+      aRecord (measure ("clip-bounds", aNbRuns, [&]() {
+        aPositiveTree->ClipBounds (aPositiveTree->Bounds());
+      }), 0.0, 0.0);
+    }
+
+    Box4f aBounds = aTree->Bounds();
+    if (!aBounds.IsValid()) {
+      aBounds = Box4f (Vec4f (-1.f, -1.f, -1.f, 1.f), Vec4f (1.f, 1.f, 1.f, 1.f));
+    }
+
+    // the same points on every platform (unlike std::uniform_real_distribution)
+    std::mt19937 aGenerator (42);
+    Array4f aPoints;
+
+    for (int anIndex = 0; anIndex < theSettings.nbPoints; ++anIndex) {
+      Vec4f aPoint (0.f, 0.f, 0.f, 1.f);
+      for (int anAxis = 0; anAxis < 3; ++anAxis) {
+        const float aFraction = static_cast<float> (aGenerator() / 4294967296.0);
+        aPoint[anAxis] = aBounds.CornerMin()[anAxis] + aFraction * (aBounds.CornerMax()[anAxis] - aBounds.CornerMin()[anAxis]);
+      }
+
+      aPoints.push_back (aPoint);
+    }
+
+    std::vector<float> aDistances;
+    if (theSettings.isSelected ("distance")) {
+      aRecord (measure ("distance", aNbRuns, [&]() {
+        aDistances.clear();
+      }, [&]() {
+        for (size_t anIndex = 0; anIndex < aPoints.size(); ++anIndex) {
+          aDistances.push_back (CsgEvaluator::Distance (aPoints[anIndex], aTree.get()));
+        }
+      }), 0.0, static_cast<double> (aPoints.size()));
+    }
+
+    VoxelData aVoxels (theSettings.gridSize, theSettings.gridSize, theSettings.gridSize,
+                       aBounds.CornerMin(), aBounds.CornerMax());
+
+    const int aNbVoxels = aVoxels.SizeX * aVoxels.SizeY * aVoxels.SizeZ;
+
+    if (theSettings.isSelected ("voxel-fill")) {
+      aRecord (measure ("voxel-fill", aNbRuns, [&]() {
+        CsgEvaluator::FillVoxels (aTree.get(), aVoxels);
+      }), 0.0, static_cast<double> (aNbVoxels));
+    }
+
+    if (theSettings.isSelected ("regroup")) {
+      std::unique_ptr<CsgNode> aRegroupedTree;
+      aRecord (measure ("regroup", aNbRuns, [&]() {
+        aRegroupedTree.reset (aTree->DeepCopy());
+        aRegroupedTree->InitializeBounds();
+      }, [&]() {
+        aRegroupedTree->Regroup();
+      }), 0.0, 0.0);
+
+      std::cout << "[" << theScene.name << "] regroup: height " << aTree->Height() << " -> " << aRegroupedTree->Height()
+                << ", SAH cost " << hierarchyCost (aTree.get()) << " -> " << hierarchyCost (aRegroupedTree.get()) << std::endl;
+
+      for (size_t anIndex = 0; anIndex < aDistances.size(); ++anIndex) {
+        aCheck (CsgEvaluator::Distance (aPoints[anIndex], aRegroupedTree.get()) == aDistances[anIndex],
+                "Regrouped tree distances differ from tree distances");
+      }
+    }
+
+    // the same passes over compiled scene
+    CsgScene aScene;
+    if (theSettings.isSelected ("build-scene")) {
+      aRecord (measure ("build-scene", aNbRuns, [&]() {
+        aScene.Build (aTree.get());
+      }), 0.0, 0.0);
+    }
+    else {
+      aScene.Build (aTree.get());
+    }
+
+    aCheck (aScene.NbPrimitives() == aNbPrimitives, "Scene has different number of primitives");
+
+    if (theSettings.isSelected ("scene-initialize-bounds")) {
+      aRecord (measure ("scene-initialize-bounds", aNbRuns, [&]() {
+        aScene.InitializeBounds();
+      }), 0.0, 0.0);
+
+      aCheck (isSameBounds (aScene, CsgScene (aTree.get())), "Scene bounds differ from tree bounds");
+    }
+
+    if (theSettings.isSelected ("scene-grow-bounds") && aPositiveScene.NbNodes() > 1) {
+      aRecord (measure ("scene-grow-bounds", aNbRuns, [&]() {
+        aPositiveScene.GrowBounds();
+      }), 0.0, 0.0);
+    }
+
+    if (theSettings.isSelected ("scene-clip-bounds")) {
+      aRecord (measure ("scene-clip-bounds", aNbRuns, [&]() {
+        aPositiveScene.ClipBounds (aPositiveScene.Bounds (aPositiveScene.Root()));
+      }), 0.0, 0.0);
+    }
+
+    if (isScenePositive && isTreeGrown == theSettings.isSelected ("scene-grow-bounds")
+     && theSettings.isSelected ("clip-bounds") == theSettings.isSelected ("scene-clip-bounds")) {
+      aCheck (isSameBounds (aPositiveScene, CsgScene (aPositiveTree.get())), "Scene bounds differ from tree bounds");
+    }
+
+    if (theSettings.isSelected ("scene-distance")) {
+      std::vector<float> aSceneDistances;
+      std::vector<float> aValues;
+
+      aRecord (measure ("scene-distance", aNbRuns, [&]() {
+        aSceneDistances.clear();
+      }, [&]() {
+        for (size_t anIndex = 0; anIndex < aPoints.size(); ++anIndex) {
+          aSceneDistances.push_back (CsgEvaluator::Distance (aPoints[anIndex], aScene, aValues));
+        }
+      }), 0.0, static_cast<double> (aPoints.size()));
+
+      aCheck (aDistances.empty() || aDistances == aSceneDistances, "Scene distances differ from tree distances");
+    }
+
+    if (theSettings.isSelected ("scene-voxel-fill")) {
+      VoxelData aSceneVoxels (theSettings.gridSize, theSettings.gridSize, theSettings.gridSize,
+                              aBounds.CornerMin(), aBounds.CornerMax());
+
+      aRecord (measure ("scene-voxel-fill", aNbRuns, [&]() {
+        CsgEvaluator::FillVoxels (aScene, aSceneVoxels);
+      }), 0.0, static_cast<double> (aNbVoxels));
+
+      aCheck (!theSettings.isSelected ("voxel-fill") || std::equal (aVoxels.Data, aVoxels.Data + aNbVoxels, aSceneVoxels.Data),
+              "Scene voxels differ from tree voxels");
+    }
+
+    // identical subtrees merged into shared nodes
+    std::unique_ptr<CsgNode> aSharedTree;
+    if (theSettings.isSelected ("share-subtrees")) {
+      int aNbMerged = 0;
+      aRecord (measure ("share-subtrees", aNbRuns, [&]() {
+        aSharedTree.reset (aTree->DeepCopy());
+      }, [&]() {
+        aNbMerged = CsgSharing::ShareSubtrees (aSharedTree.get());
+      }), 0.0, 0.0);
+
+      std::cout << "[" << theScene.name << "] share-subtrees: nodes " << aScene.NbNodes() << " -> "
+                << CsgSharing::NbUniqueNodes (aSharedTree.get()) << ", merged subtrees " << aNbMerged << std::endl;
+
+      for (size_t anIndex = 0; anIndex < aDistances.size(); ++anIndex) {
+        aCheck (CsgEvaluator::Distance (aPoints[anIndex], aSharedTree.get()) == aDistances[anIndex],
+                "Shared tree distances differ from tree distances");
+      }
+    }
+    else if (theSettings.isSelected ("shared-scene-distance")) {
+      aSharedTree.reset (aTree->DeepCopy());
+      CsgSharing::ShareSubtrees (aSharedTree.get());
+    }
+
+    if (theSettings.isSelected ("shared-scene-distance")) {
+      const CsgScene aSharedScene (aSharedTree.get());
+
+      std::vector<float> aSharedDistances;
+      std::vector<float> aValues;
+
+      aRecord (measure ("shared-scene-distance", aNbRuns, [&]() {
+        aSharedDistances.clear();
+      }, [&]() {
+        for (size_t anIndex = 0; anIndex < aPoints.size(); ++anIndex) {
+          aSharedDistances.push_back (CsgEvaluator::Distance (aPoints[anIndex], aSharedScene, aValues));
+        }
+      }), 0.0, static_cast<double> (aPoints.size()));
+
+      aCheck (aDistances.empty() || aDistances == aSharedDistances, "Shared scene distances differ from tree distances");
+    }
+
+    if (theSettings.isSelected ("find-instances")) {
+      std::vector<CsgInstanceGroup> aGroups;
+      aRecord (measure ("find-instances", aNbRuns, [&]() {
+        CsgSharing::FindInstances (aTree.get(), aGroups);
+      }), 0.0, 0.0);
+
+      size_t aNbInstances = 0;
+      int aNbInstancedPrimitives = 0;
+
+      for (auto& aGroup : aGroups) {
+        aNbInstances += aGroup.Nodes.size() - 1;
+        aNbInstancedPrimitives += static_cast<int> (aGroup.Nodes.size() - 1) * aGroup.Nodes.front()->NbPrimitives();
+      }
+
+      std::cout << "[" << theScene.name << "] find-instances: groups " << aGroups.size() << ", instances " << aNbInstances
+                << ", primitives replaced by instances " << aNbInstancedPrimitives << " of " << aNbPrimitives << std::endl;
+
+      // instances nested in a subtree which has mirrored copy only are found as well
+      auto aPair = [] (const float theShift) {
+        Mat4f aTransform = Mat4f::Identity();
+        aTransform (0, 3) = theShift;
+        return new CsgOperationNode (CSG_OP_UNION, new CsgPrimitiveNode (CSG_BOX, aTransform),
+                                                   new CsgPrimitiveNode (CSG_SPHERE, aTransform));
+      };
+      auto aPart = [&aPair] () {
+        return new CsgOperationNode (CSG_OP_UNION, aPair (0.f), aPair (3.f));
+      };
+
+      CsgOperationNode* aMirrored = aPart();
+      for (int anIndex = 0; anIndex < 4; ++anIndex) {
+        CsgOperationNode* aPairNode = static_cast<CsgOperationNode*> (aMirrored->Child (anIndex / 2));
+        Mat4f aTransform = static_cast<CsgPrimitiveNode*> (aPairNode->Child (anIndex % 2))->Transform();
+        aTransform.row (0) = -aTransform.row (0);
+        CsgNode::Destroy (aPairNode->Child (anIndex % 2));
+        aPairNode->SetChild (anIndex % 2, new CsgPrimitiveNode (anIndex % 2 == 0 ? CSG_BOX : CSG_SPHERE, aTransform));
+      }
+
+      std::unique_ptr<CsgNode> aMirrorTree (new CsgOperationNode (CSG_OP_UNION, aPart(), aMirrored));
+      CsgSharing::FindInstances (aMirrorTree.get(), aGroups);
+      aCheck (aGroups.size() == 2, "Instances nested in mirrored subtrees are not found");
+    }
+  }
+
+  //! Writes generated scene and its CSGJS and binary copies to temporary files.
+  Scene generateScene (const std::string& thePreset, const int theNbPrimitives) {
+
+    Scene aScene;
+    aScene.name = thePreset;
+    aScene.csgPath = "csgbench_" + thePreset + ".csg";
+    aScene.jsonPath = "csgbench_" + thePreset + ".csgjs";
+    aScene.binaryPath = "csgbench_" + thePreset + ".csgb";
+    aScene.temporaryFiles.push_back (aScene.csgPath);
+    aScene.temporaryFiles.push_back (aScene.jsonPath);
+    aScene.temporaryFiles.push_back (aScene.binaryPath);
+
+    csg::SceneParameters aParameters = csg::SceneParameters::preset (thePreset);
+    aParameters.seed = 42;
+    aParameters.nbPrimitives = theNbPrimitives;
+
+    {
+      csg::OutputFile aFile (aScene.csgPath);
+      csg::CsgStreamWriter aWriter (aFile, csg::CsgStreamWriter::FORMAT_CSG);
+      csg::SceneGenerator (aParameters).generate (aWriter);
+      aWriter.finish();
+      aFile.close();
+    }
+
+    const csg::Document aDocument = csg::Parser::parseDocument (aScene.csgPath);
+    csg::Parser::writeJSON (aDocument, aScene.jsonPath);
+    csg::Parser::writeBinary (aDocument, aScene.binaryPath);
+
+    return aScene;
+  }
+
+  //! Prepares scene of the given CSG, CSGJS or binary file (the other formats are written to temporary files).
+  Scene openScene (const std::string& theFilePath) {
+
+    Scene aScene;
+    aScene.name = theFilePath;
+
+    const std::string anExt = getFileExtension (theFilePath);
+
+    csg::Document aDocument;
+    if (anExt == "csg") {
+      aScene.csgPath = theFilePath;
+      aDocument = csg::Parser::parseDocument (theFilePath);
+    }
+    else if (anExt == "csgjs" || anExt == "json") {
+      aScene.jsonPath = theFilePath;
+      aDocument = csg::Parser::parseJSONDocument (theFilePath);
+    }
+    else if (anExt == "csgb") {
+      aScene.binaryPath = theFilePath;
+      aDocument = csg::Parser::parseBinary (theFilePath);
+    }
+    else {
+      throw std::runtime_error ("Unrecognized extension: " + theFilePath);
+    }
+
+    if (aScene.csgPath.empty()) {
+      aScene.csgPath = "csgbench_scene.csg";
+      aScene.temporaryFiles.push_back (aScene.csgPath);
+      csg::Parser::write (aDocument, aScene.csgPath);
+    }
+
+    if (aScene.jsonPath.empty()) {
+      aScene.jsonPath = "csgbench_scene.csgjs";
+      aScene.temporaryFiles.push_back (aScene.jsonPath);
+      csg::Parser::writeJSON (aDocument, aScene.jsonPath);
+    }
+
+    if (aScene.binaryPath.empty()) {
+      aScene.binaryPath = "csgbench_scene.csgb";
+      aScene.temporaryFiles.push_back (aScene.binaryPath);
+      csg::Parser::writeBinary (aDocument, aScene.binaryPath);
+    }
+
+    return aScene;
+  }
+
+  //! Reads results written by --json.
+  json11::Json readResults (const std::string& theFilePath) {
+
+    csg::InputFile aFile (theFilePath);
+    aFile.load();
+
+    std::string anError;
+    json11::Json aData = json11::Json::parse (std::string (aFile.data(), aFile.size()), anError);
+
+    if (!anError.empty() || !aData["results"].is_array()) {
+      throw std::runtime_error ("Invalid results file " + theFilePath + (anError.empty() ? "" : ": " + anError));
+    }
+
+    return aData;
+  }
+
+  //! Compares median times of two result files, returns number of regressions.
+  //! A stage is slower if its median exceeds the baseline median by more than the threshold
+  //! and the runs don't overlap with the baseline runs (p10 above baseline p90), so noise
+  //! of short stages is not reported.
+  int compareResults (const std::string& theBaselinePath, const std::string& theCurrentPath, const double theThreshold) {
+
+    const json11::Json aBaseline = readResults (theBaselinePath);
+    const json11::Json aCurrent = readResults (theCurrentPath);
+
+    std::map<std::string, json11::Json> aBaselineStages;
+    for (auto& aResult : aBaseline["results"].array_items()) {
+      aBaselineStages[aResult["scene"].string_value() + " " + aResult["stage"].string_value()] = aResult;
+    }
+
+    int aNbRegressions = 0;
+    int aNbImprovements = 0;
+
+    for (auto& aResult : aCurrent["results"].array_items()) {
+      const std::string aKey = aResult["scene"].string_value() + " " + aResult["stage"].string_value();
+      const std::string aName = "[" + aResult["scene"].string_value() + "] " + aResult["stage"].string_value();
+
+      auto anIter = aBaselineStages.find (aKey);
+      if (anIter == aBaselineStages.end()) {
+        std::cout << aName << ": not in baseline" << std::endl;
+        continue;
+      }
+
+      const json11::Json& aBase = anIter->second;
+      const double aBaseMedian = aBase["median"].number_value();
+      const double aMedian = aResult["median"].number_value();
+      const double aRatio = aBaseMedian > 0.0 ? aMedian / aBaseMedian : 1.0;
+
+      std::cout << aName << ": " << aBaseMedian * 1e3 << " ms -> " << aMedian * 1e3 << " ms ("
+                << (aRatio >= 1.0 ? "+" : "") << (aRatio - 1.0) * 100.0 << "%)";
+
+      if (aRatio > 1.0 + theThreshold && aResult["p10"].number_value() > aBase["p90"].number_value()) {
+        std::cout << " REGRESSION";
+        ++aNbRegressions;
+      }
+      else if (aRatio < 1.0 - theThreshold && aResult["p90"].number_value() < aBase["p10"].number_value()) {
+        std::cout << " improved";
+        ++aNbImprovements;
+      }
+
+      std::cout << std::endl;
+      aBaselineStages.erase (anIter);
+    }
+
+    for (auto& aStage : aBaselineStages) {
+      std::cout << "[" << aStage.second["scene"].string_value() << "] " << aStage.second["stage"].string_value()
+                << ": missing in " << theCurrentPath << std::endl;
+    }
+
+    std::cout << aNbRegressions << " regressions, " << aNbImprovements << " improvements" << std::endl;
+    return aNbRegressions;
+  }
+}
+
+void printHelp() {
+
+  std::cout << "Usage: csgbench [options] [scene files]\n"
+               "  csgbench measures every stage of the pipeline (parsing, validation, writing, loading\n"
+               "  of CSG-tree, bounds, distance evaluation and voxel fill) on generated scenes (openscad,\n"
+               "  flat and instanced presets of csggen) and on the given CSG, CSGJS or .csgb files,\n"
+               "  and checks that different paths produce the same results.\n"
+               "  Options:\n"
+               "    --primitives <n>   number of primitives of generated scenes (10000, 0 skips them)\n"
+               "    --runs <n>         number of runs of every stage (5)\n"
+               "    --stages <list>    comma separated stages to run (all but parse-peg by default):\n"
+               "                       parse, parse-threads, parse-events, parse-document, parse-peg,\n"
+               "                       parse-json, parse-json-document, read-binary, validate, write,\n"
+               "                       write-json, load-tree, load-document, load-file, load-file-arena,\n"
+               "                       copy, copy-arena, initialize-bounds, to-positive-form, grow-bounds,\n"
+               "                       clip-bounds, distance, voxel-fill, regroup,\n"
+               "                       build-scene and scene-* passes over compiled scene (CsgScene):\n"
+               "                       scene-initialize-bounds, scene-grow-bounds, scene-clip-bounds,\n"
+               "                       scene-distance, scene-voxel-fill,\n"
+               "                       share-subtrees (merging identical subtrees, CsgSharing),\n"
+               "                       shared-scene-distance, find-instances\n"
+               "    --points <n>       number of points of distance evaluation (256)\n"
+               "    --grid <n>         resolution of voxel grid (12, at least 9)\n"
+               "    --json <file>      writes results (median, percentiles, throughput, peak memory)\n"
+               "                       as JSON, \"-\" stands for standard output\n"
+               "  csgbench --compare [--threshold <percent>] <baseline.json> <current.json>\n"
+               "    compares median times of two result files, reports stages slower by more than\n"
+               "    the threshold (10 percent) and exits with 1 if there are such regressions.\n"
+               "  Example:\n"
+               "    csgbench --primitives 100000 --json before.json\n"
+               "    csgbench --runs 9 --stages parse,parse-document models/*.csg\n"
+               "    csgbench --compare before.json after.json\n";
+}
+
+int main (int argc, char ** argv) {
+
+  Settings aSettings;
+  std::string aJsonPath;
+  std::vector<std::string> aFiles;
+  bool isCompare = false;
+  double aThreshold = THE_DEFAULT_THRESHOLD;
+
+  const std::set<std::string> aKnownStages (THE_STAGES, THE_STAGES + sizeof (THE_STAGES) / sizeof (THE_STAGES[0]));
+  aSettings.stages = aKnownStages;
+  aSettings.stages.erase (THE_OPTIONAL_STAGE);
+
+  for (int anIndex = 1; anIndex < argc; ++anIndex) {
+    const std::string anArg = argv[anIndex];
+
+    if (anArg == "--compare") {
+      isCompare = true;
+      continue;
+    }
+
+    if (anArg.compare (0, 2, "--") != 0) {
+      aFiles.push_back (anArg);
+      continue;
+    }
+
+    if (anIndex + 1 == argc) {
+      printHelp();
+      return 1;
+    }
+
+    const std::string aValue = argv[++anIndex];
+
+    if (anArg == "--primitives") {
+      aSettings.nbPrimitives = std::atoi (aValue.c_str());
+    }
+    else if (anArg == "--runs") {
+      aSettings.nbRuns = std::atoi (aValue.c_str());
+    }
+    else if (anArg == "--points") {
+      aSettings.nbPoints = std::atoi (aValue.c_str());
+    }
+    else if (anArg == "--grid") {
+      aSettings.gridSize = std::atoi (aValue.c_str());
+    }
+    else if (anArg == "--threshold") {
+      aThreshold = std::atof (aValue.c_str()) / 100.0;
+    }
+    else if (anArg == "--json") {
+      aJsonPath = aValue;
+    }
+    else if (anArg == "--stages") {
+      aSettings.stages.clear();
+
+      std::stringstream aStream (aValue);
+      for (std::string aStage; std::getline (aStream, aStage, ',');) {
+        if (aKnownStages.count (aStage) == 0) {
+          std::cout << "Unknown stage: " << aStage << std::endl;
+          return 1;
+        }
+
+        aSettings.stages.insert (aStage);
+      }
+    }
+    else {
+      printHelp();
+      return 1;
+    }
+  }
+
+  if (isCompare) {
+    if (aFiles.size() != 2) {
+      printHelp();
+      return 1;
+    }
+
+    try {
+      return compareResults (aFiles[0], aFiles[1], aThreshold) > 0 ? 1 : 0;
+    }
+    catch (std::runtime_error& anError) {
+      std::cout << "Error: " << anError.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (aSettings.nbPrimitives < 0 || aSettings.nbRuns <= 0 || aSettings.nbPoints <= 0 || aSettings.gridSize <= 8
+   || (aSettings.nbPrimitives == 0 && aFiles.empty())) {
+    printHelp();
+    return 1;
+  }
+
+  // results go to standard output, the progress is printed to standard error then
+  std::streambuf* anOutput = std::cout.rdbuf();
+  if (aJsonPath == "-") {
+    std::cout.rdbuf (std::cerr.rdbuf());
+  }
+
+  std::vector<StageResult> aResults;
+  int aStatus = 0;
+
+  std::vector<std::string> aScenes;
+  if (aSettings.nbPrimitives > 0) {
+    aScenes.assign (THE_PRESETS, THE_PRESETS + sizeof (THE_PRESETS) / sizeof (THE_PRESETS[0]));
+  }
+
+  const size_t aNbGenerated = aScenes.size();
+  aScenes.insert (aScenes.end(), aFiles.begin(), aFiles.end());
+
+  for (size_t anIndex = 0; anIndex < aScenes.size(); ++anIndex) {
+    Scene aScene;
+
+    try {
+      aScene = anIndex < aNbGenerated ? generateScene (aScenes[anIndex], aSettings.nbPrimitives)
+                                      : openScene (aScenes[anIndex]);
+      runScene (aScene, aSettings, aResults);
+    }
+    catch (std::runtime_error& anError) {
+      std::cout << "Error: " << aScenes[anIndex] << ": " << anError.what() << std::endl;
+      aStatus = 1;
+    }
+
+    for (size_t aFile = 0; aFile < aScene.temporaryFiles.size(); ++aFile) {
+      std::remove (aScene.temporaryFiles[aFile].c_str());
+    }
+  }
+
+  std::cout.rdbuf (anOutput);
+
+  if (!aJsonPath.empty()) {
+    json11::Json::array aStages;
+    for (size_t anIndex = 0; anIndex < aResults.size(); ++anIndex) {
+      aStages.push_back (toJson (aResults[anIndex]));
+    }
+
+    json11::Json::object aData;
+    aData["primitives"] = aSettings.nbPrimitives;
+    aData["runs"] = aSettings.nbRuns;
+    aData["points"] = aSettings.nbPoints;
+    aData["grid"] = aSettings.gridSize;
+    aData["threads"] = csg::hardwareThreads();
+    aData["results"] = aStages;
+
+    const std::string aText = json11::Json (aData).dump() + "\n";
+
+    try {
+      csg::OutputFile aFile (aJsonPath);
+      aFile.write (aText.data(), aText.size());
+      aFile.close();
+    }
+    catch (std::runtime_error& anError) {
+      std::cout << "Error: " << anError.what() << std::endl;
+      return 1;
+    }
+  }
+
+  return aStatus;
+}
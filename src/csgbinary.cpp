@@ -0,0 +1,356 @@
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <csgbinary.hpp>
+#include <csgfile.hpp>
+
+namespace csg {
+
+namespace {
+
+  const char THE_MAGIC[4] = { 'C', 'S', 'G', 'B' };
+
+  //! Version of the layout (increased on every incompatible change).
+  const uint32_t THE_FORMAT_VERSION = 2;
+
+  //! Written in native byte order, reads differently on machines of other byte order.
+  const uint32_t THE_BYTE_ORDER_MARK = 0x01020304;
+
+  //! Alignment of tables (enough for all entry types).
+  const uint64_t THE_ALIGNMENT = 8;
+
+  enum TableId {
+    TABLE_NODES,
+    TABLE_PROPERTIES,
+    TABLE_VALUES,
+    TABLE_NUMBERS,
+    TABLE_MATRIX_NUMBERS,
+    TABLE_MATRICES,
+    TABLE_STRING_OFFSETS,
+    TABLE_STRINGS,
+    TABLE_NB
+  };
+
+  //! Location of table in the file.
+  struct TableLocation {
+    uint64_t offset;
+    uint64_t size; //!< number of entries
+  };
+
+  struct Header {
+    char magic[4];
+    uint32_t formatVersion;
+    uint32_t byteOrder;
+    int32_t majorVersion;
+    int32_t minorVersion;
+    uint32_t versionName; //!< index in string table
+    Document::Node root;
+    TableLocation tables[TABLE_NB];
+  };
+
+  // pool entries are stored as is, so their layout is a part of the format
+  static_assert (sizeof (Document::Node) == 24, "Unexpected layout of Document::Node");
+  static_assert (sizeof (Document::Property) == 24, "Unexpected layout of Document::Property");
+  static_assert (offsetof (Document::Property, value) == 8, "Unexpected layout of Document::Property");
+  static_assert (sizeof (Document::Value) == 16, "Unexpected layout of Document::Value");
+  static_assert (sizeof (Header) % THE_ALIGNMENT == 0, "Unexpected layout of header");
+
+  //! Contents of table to be written.
+  struct TableData {
+    const void* data;
+    uint64_t size;
+    uint64_t entrySize;
+  };
+
+  //! Numbers of entries the indices of the document may refer to.
+  struct Limits {
+    uint64_t nbNames;
+    uint64_t nbNodes;
+    uint64_t nbProperties;
+    uint64_t nbValues;
+    uint64_t nbNumbers;
+    uint64_t nbMatrices;
+  };
+
+  uint64_t alignOffset (const uint64_t theOffset) {
+    return (theOffset + THE_ALIGNMENT - 1) / THE_ALIGNMENT * THE_ALIGNMENT;
+  }
+
+  void throwCorrupted (const std::string& theFilePath) {
+    throw std::runtime_error ("Corrupted binary CSG file: " + theFilePath);
+  }
+
+  //! Returns entries of the table checking that it lies within the file.
+  template<typename T>
+  const T* locateTable (const TableLocation& theLocation,
+                        const char* theData,
+                        const uint64_t theSize,
+                        const std::string& theFilePath,
+                        size_t& theNbEntries) {
+
+    if (theLocation.offset % THE_ALIGNMENT != 0
+     || theLocation.offset > theSize
+     || theLocation.size > (theSize - theLocation.offset) / sizeof (T)) {
+      throwCorrupted (theFilePath);
+    }
+
+    theNbEntries = static_cast<size_t> (theLocation.size);
+    return reinterpret_cast<const T*> (theData + theLocation.offset);
+  }
+
+  //! Checks that the range [theFirst, theFirst + theSize) lies within [0, theLimit).
+  bool isValidRange (const uint64_t theFirst, const uint64_t theSize, const uint64_t theLimit) {
+    return theFirst <= theLimit && theSize <= theLimit - theFirst;
+  }
+
+  //! Checks that indices of the value refer to existing entries.
+  //! Items of arrays should precede the array in values table (that rules out cycles),
+  //! so their end is limited by theItemsLimit.
+  bool isValidValue (const Document::Value& theValue, const Limits& theLimits, const uint64_t theItemsLimit) {
+
+    // enumerations and booleans are checked as raw data
+    uint32_t aType = 0;
+    std::memcpy (&aType, &theValue.type, sizeof aType);
+
+    switch (aType) {
+      case Document::VALUE_NUMBER:
+        return true;
+      case Document::VALUE_BOOLEAN: {
+        unsigned char aBoolean = 0;
+        std::memcpy (&aBoolean, &theValue.boolean, sizeof aBoolean);
+        return aBoolean <= 1;
+      }
+      case Document::VALUE_STRING:
+        return theValue.string < theLimits.nbNames;
+      case Document::VALUE_ARRAY:
+        return isValidRange (theValue.items, theValue.size, theItemsLimit);
+      case Document::VALUE_NUMBERS:
+        return isValidRange (theValue.items, theValue.size, theLimits.nbNumbers);
+      case Document::VALUE_MATRIX:
+        return theValue.size == 4 && theValue.items < theLimits.nbMatrices;
+      default:
+        return false;
+    }
+  }
+
+  //! Checks that indices of the node refer to existing entries.
+  //! Children of each node precede it in nodes table (that rules out cycles),
+  //! so their end is limited by theChildrenLimit.
+  bool isValidNode (const Document::Node& theNode,
+                    const Document::Property* theProperties,
+                    const Limits& theLimits,
+                    const uint64_t theChildrenLimit) {
+
+    uint32_t aKind = 0;
+    std::memcpy (&aKind, &theNode.kind, sizeof aKind);
+
+    if (aKind > Document::NODE_MATRIX
+     || !isValidRange (theNode.children, theNode.nbChildren, theChildrenLimit)
+     || !isValidRange (theNode.properties, theNode.nbProperties, theLimits.nbProperties)
+     || (aKind == Document::NODE_OBJECT && theNode.nbChildren != 0)
+     || theNode.type >= theLimits.nbNames) {
+      return false;
+    }
+
+    if (aKind == Document::NODE_MATRIX) {
+      return theNode.nbProperties == 1;
+    }
+
+    for (Document::Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+      if (theProperties[theNode.properties + anIndex].name >= theLimits.nbNames) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+}
+
+void BinaryFormat::write (const Document& theDocument, std::ostream& theStream) {
+
+  // the version name is not necessarily interned
+  std::vector<const std::string*> aNames;
+  for (const std::string& aName : theDocument.m_names) {
+    aNames.push_back (&aName);
+  }
+
+  Document::Index aVersionName = theDocument.find (theDocument.versionName());
+  if (aVersionName == Document::INVALID_INDEX) {
+    aVersionName = static_cast<Document::Index> (aNames.size());
+    aNames.push_back (&theDocument.versionName());
+  }
+
+  std::vector<uint32_t> aStringOffsets;
+  std::string aStrings;
+
+  for (const std::string* aName : aNames) {
+    aStringOffsets.push_back (static_cast<uint32_t> (aStrings.size()));
+    aStrings += *aName;
+  }
+  aStringOffsets.push_back (static_cast<uint32_t> (aStrings.size()));
+
+  TableData aTables[TABLE_NB] = {
+    { theDocument.m_nodeTable.data,         theDocument.m_nodeTable.size,         sizeof (Document::Node) },
+    { theDocument.m_propertyTable.data,     theDocument.m_propertyTable.size,     sizeof (Document::Property) },
+    { theDocument.m_valueTable.data,        theDocument.m_valueTable.size,        sizeof (Document::Value) },
+    { theDocument.m_numberTable.data,       theDocument.m_numberTable.size,       sizeof (double) },
+    { theDocument.m_matrixNumberTable.data, theDocument.m_matrixNumberTable.size, sizeof (double) },
+    { theDocument.m_matrixTable.data,       theDocument.m_matrixTable.size,       sizeof (float) },
+    { aStringOffsets.data(),                aStringOffsets.size(),                sizeof (uint32_t) },
+    { aStrings.data(),                      aStrings.size(),                      sizeof (char) }
+  };
+
+  Header aHeader;
+  std::memset (&aHeader, 0, sizeof aHeader);
+  std::memcpy (aHeader.magic, THE_MAGIC, sizeof THE_MAGIC);
+  aHeader.formatVersion = THE_FORMAT_VERSION;
+  aHeader.byteOrder = THE_BYTE_ORDER_MARK;
+  aHeader.majorVersion = theDocument.majorVersion();
+  aHeader.minorVersion = theDocument.minorVersion();
+  aHeader.versionName = aVersionName;
+  aHeader.root = theDocument.root();
+
+  uint64_t anOffset = sizeof aHeader;
+  for (int aTable = 0; aTable < TABLE_NB; ++aTable) {
+    aHeader.tables[aTable].offset = anOffset;
+    aHeader.tables[aTable].size = aTables[aTable].size;
+    anOffset = alignOffset (anOffset + aTables[aTable].size * aTables[aTable].entrySize);
+  }
+
+  const char aPadding[THE_ALIGNMENT] = {};
+
+  theStream.write (reinterpret_cast<const char*> (&aHeader), sizeof aHeader);
+  for (int aTable = 0; aTable < TABLE_NB; ++aTable) {
+    const uint64_t aSize = aTables[aTable].size * aTables[aTable].entrySize;
+
+    theStream.write (static_cast<const char*> (aTables[aTable].data), aSize);
+    theStream.write (aPadding, alignOffset (aSize) - aSize);
+  }
+
+  if (!theStream) {
+    throw std::runtime_error ("Cannot write binary CSG data");
+  }
+}
+
+Document BinaryFormat::read (const std::string& theFilePath) {
+
+  std::shared_ptr<InputFile> aFile (new InputFile (theFilePath));
+  if (!aFile->isMapped()) {
+    aFile->load();
+  }
+
+  const char* aData = aFile->data();
+  const uint64_t aSize = aFile->size();
+
+  if (aSize < sizeof (Header) || std::memcmp (aData, THE_MAGIC, sizeof THE_MAGIC) != 0) {
+    throw std::runtime_error ("Not a binary CSG file: " + theFilePath);
+  }
+
+  Header aHeader;
+  std::memcpy (&aHeader, aData, sizeof aHeader);
+
+  if (aHeader.formatVersion != THE_FORMAT_VERSION) {
+    throw std::runtime_error ("Unsupported version of binary CSG file: " + theFilePath);
+  }
+
+  if (aHeader.byteOrder != THE_BYTE_ORDER_MARK) {
+    throw std::runtime_error ("Unsupported byte order of binary CSG file: " + theFilePath);
+  }
+
+  // mapped files are page aligned, loaded ones are aligned by the allocator
+  if (reinterpret_cast<uintptr_t> (aData) % THE_ALIGNMENT != 0) {
+    throw std::runtime_error ("Misaligned binary CSG data: " + theFilePath);
+  }
+
+  Document aDocument;
+
+  aDocument.m_nodeTable.data = locateTable<Document::Node> (
+    aHeader.tables[TABLE_NODES], aData, aSize, theFilePath, aDocument.m_nodeTable.size);
+  aDocument.m_propertyTable.data = locateTable<Document::Property> (
+    aHeader.tables[TABLE_PROPERTIES], aData, aSize, theFilePath, aDocument.m_propertyTable.size);
+  aDocument.m_valueTable.data = locateTable<Document::Value> (
+    aHeader.tables[TABLE_VALUES], aData, aSize, theFilePath, aDocument.m_valueTable.size);
+  aDocument.m_numberTable.data = locateTable<double> (
+    aHeader.tables[TABLE_NUMBERS], aData, aSize, theFilePath, aDocument.m_numberTable.size);
+  aDocument.m_matrixNumberTable.data = locateTable<double> (
+    aHeader.tables[TABLE_MATRIX_NUMBERS], aData, aSize, theFilePath, aDocument.m_matrixNumberTable.size);
+  aDocument.m_matrixTable.data = locateTable<float> (
+    aHeader.tables[TABLE_MATRICES], aData, aSize, theFilePath, aDocument.m_matrixTable.size);
+
+  size_t aNbStrings = 0;
+  size_t aNbChars = 0;
+  const uint32_t* aStringOffsets = locateTable<uint32_t> (
+    aHeader.tables[TABLE_STRING_OFFSETS], aData, aSize, theFilePath, aNbStrings);
+  const char* aStrings = locateTable<char> (
+    aHeader.tables[TABLE_STRINGS], aData, aSize, theFilePath, aNbChars);
+
+  if (aNbStrings < Document::TYPE_NB + 1) {
+    throwCorrupted (theFilePath);
+  }
+
+  // names are interned in the same order, the known types come first
+  for (size_t anIndex = 0; anIndex + 1 < aNbStrings; ++anIndex) {
+    const uint32_t aBegin = aStringOffsets[anIndex];
+    const uint32_t anEnd = aStringOffsets[anIndex + 1];
+
+    if (aBegin > anEnd || anEnd > aNbChars
+     || aDocument.intern (std::string (aStrings + aBegin, aStrings + anEnd)) != anIndex) {
+      throwCorrupted (theFilePath);
+    }
+  }
+
+  if (aHeader.versionName >= aDocument.m_names.size()
+   || aDocument.m_matrixTable.size != aDocument.m_matrixNumberTable.size
+   || aDocument.m_matrixTable.size % Document::MATRIX_SIZE != 0) {
+    throwCorrupted (theFilePath);
+  }
+
+  Limits aLimits;
+  aLimits.nbNames = aDocument.m_names.size();
+  aLimits.nbNodes = aDocument.m_nodeTable.size;
+  aLimits.nbProperties = aDocument.m_propertyTable.size;
+  aLimits.nbValues = aDocument.m_valueTable.size;
+  aLimits.nbNumbers = aDocument.m_numberTable.size;
+  aLimits.nbMatrices = aDocument.m_matrixTable.size / Document::MATRIX_SIZE;
+
+  // the document is used without further checks, so all indices are validated once
+  const Document::Property* aProperties = aDocument.m_propertyTable.data;
+
+  for (uint64_t anIndex = 0; anIndex < aLimits.nbNodes; ++anIndex) {
+    if (!isValidNode (aDocument.m_nodeTable.data[anIndex], aProperties, aLimits, anIndex)) {
+      throwCorrupted (theFilePath);
+    }
+  }
+
+  for (uint64_t anIndex = 0; anIndex < aLimits.nbProperties; ++anIndex) {
+    if (!isValidValue (aProperties[anIndex].value, aLimits, aLimits.nbValues)) {
+      throwCorrupted (theFilePath);
+    }
+  }
+
+  for (uint64_t anIndex = 0; anIndex < aLimits.nbValues; ++anIndex) {
+    if (!isValidValue (aDocument.m_valueTable.data[anIndex], aLimits, anIndex)) {
+      throwCorrupted (theFilePath);
+    }
+  }
+
+  // the root is a pseudo node without type and properties
+  if (aHeader.root.type != Document::INVALID_INDEX
+   || aHeader.root.nbProperties != 0
+   || !isValidRange (aHeader.root.children, aHeader.root.nbChildren, aLimits.nbNodes)) {
+    throwCorrupted (theFilePath);
+  }
+
+  aDocument.m_versionName = aDocument.m_names[aHeader.versionName];
+  aDocument.m_majorVersion = aHeader.majorVersion;
+  aDocument.m_minorVersion = aHeader.minorVersion;
+  aDocument.m_root = aHeader.root;
+  aDocument.m_root.kind = Document::NODE_INSTRUCTION;
+  aDocument.m_file = aFile;
+
+  return aDocument;
+}
+
+} // csg
@@ -0,0 +1,36 @@
+#ifndef HEADER_CSG_BINARY
+#define HEADER_CSG_BINARY
+
+#include <ostream>
+#include <string>
+
+#include <csgdocument.hpp>
+
+namespace csg {
+
+//! Binary CSG container (.csgb).
+//! The file keeps the pools of a document as they are in memory, so loading
+//! it is mapping the file, checking its tables and pointing the document to them.
+//! Layout (all tables start at 8-byte aligned offsets):
+//!   header: magic, format version, byte order mark, CSG version and table locations;
+//!   node, property and value tables (Document::Node, Property and Value entries);
+//!   number table (doubles of VALUE_NUMBERS arrays);
+//!   matrix tables (16 doubles and 16 floats per VALUE_MATRIX matrix, row by row);
+//!   string table (offsets of interned names followed by their characters).
+//! Entries are stored in native byte order, files of other byte order are rejected.
+class BinaryFormat {
+
+public:
+
+  //! Writes the document (throws std::runtime_error on I/O error).
+  static void write (const Document& theDocument, std::ostream& theStream);
+
+  //! Loads document from the file (throws std::runtime_error on I/O error or corrupted file).
+  //! Mapped files are not copied: the document keeps the mapping while it is alive.
+  static Document read (const std::string& theFilePath);
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_BINARY
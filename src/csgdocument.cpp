@@ -0,0 +1,677 @@
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+#include <csgdocument.hpp>
+#include <csgfile.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Names of Document::NodeType values.
+  const char* THE_TYPE_NAMES[Document::TYPE_NB] = {
+    "group",
+    "multmatrix",
+    "union",
+    "difference",
+    "intersection",
+    "smin",
+    "cube",
+    "sphere",
+    "cylinder",
+    "cone"
+  };
+
+  //! Value of DocumentBuilder::m_definitionStart outside of definitions.
+  const size_t THE_NO_DEFINITION = static_cast<size_t> (-1);
+
+  //! Checks if the value is an array of 4 numbers.
+  bool isMatrixRow (const json11::Json& theValue) {
+
+    if (theValue.number_items().size() == 4) {
+      return true;
+    }
+
+    if (theValue.array_items().size() != 4) {
+      return false;
+    }
+
+    for (auto& anItem : theValue.array_items()) {
+      if (!anItem.is_number()) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //! Replays JSON representation of CSG tree as parsing events.
+  void replayJson (const json11::Json& theData, DocumentBuilder& theBuilder) {
+
+    if (theData.is_array()) {
+      for (auto& anObject: theData.array_items()) {
+        replayJson (anObject, theBuilder);
+      }
+
+      return;
+    }
+
+    if (theData.is_null()) {
+      throw std::runtime_error ("Unexpected NULL object");
+    }
+
+    if (!theData.is_object()) {
+      throw std::runtime_error ("Dictionary expected: " + theData.dump());
+    }
+
+    const std::string& aType = theData["type"].string_value();
+
+    // reference to shared subtree: {"use": <index of definition>}
+    if (aType.empty() && !theData["use"].is_null()) {
+      const json11::Json& anIndex = theData["use"];
+
+      if (!anIndex.is_number() || anIndex.number_value() < 0.0
+       || anIndex.number_value() != std::floor (anIndex.number_value())) {
+        throw std::runtime_error ("Invalid definition reference: " + theData.dump());
+      }
+
+      theBuilder.useDefinition (static_cast<size_t> (anIndex.number_value()));
+      return;
+    }
+
+    if (aType == "CSG file") {
+      theBuilder.version (theData["version-name"].string_value(),
+                          theData["version-major"].int_value(),
+                          theData["version-minor"].int_value());
+
+      // definitions may refer to the preceding ones only, that rules out cycles
+      for (auto& aDefinition : theData["definitions"].array_items()) {
+        theBuilder.beginDefinition();
+        replayJson (aDefinition, theBuilder);
+        theBuilder.endDefinition();
+      }
+
+      replayJson (theData["contents"], theBuilder);
+      return;
+    }
+
+    auto& aProperties = theData["properties"];
+    auto& anObjects = theData["objects"];
+
+    if (aProperties.is_array()) {
+      theBuilder.beginMatrix (aType, aProperties.array_items());
+    }
+    else if (!aProperties.is_object()) {
+      throw std::runtime_error ("Object properties should be represented with a dictionary");
+    }
+    else if (anObjects.is_null()) {
+      theBuilder.object (aType, aProperties.object_items());
+      return;
+    }
+    else {
+      theBuilder.beginInstruction (aType, aProperties.object_items());
+    }
+
+    replayJson (anObjects.is_array() ? anObjects : json11::Json::array(), theBuilder);
+    theBuilder.endInstruction();
+  }
+
+  //! Converts value of the document to JSON.
+  json11::Json valueToJson (const Document& theDocument, const Document::Value& theValue) {
+
+    switch (theValue.type) {
+      case Document::VALUE_NUMBER:
+        return theValue.number;
+      case Document::VALUE_BOOLEAN:
+        return theValue.boolean;
+      case Document::VALUE_STRING:
+        return theDocument.name (theValue.string);
+      case Document::VALUE_NUMBERS:
+        return json11::Json::number_array (theDocument.numbers (theValue),
+                                           theDocument.numbers (theValue) + theValue.size);
+      case Document::VALUE_MATRIX: {
+        json11::Json::array aRows;
+        for (Document::Index aRow = 0; aRow < theValue.size; ++aRow) {
+          const double* aNumbers = theDocument.matrixNumbers (theValue) + aRow * 4;
+          aRows.push_back (json11::Json::number_array (aNumbers, aNumbers + 4));
+        }
+
+        return aRows;
+      }
+      case Document::VALUE_ARRAY:
+        break;
+    }
+
+    json11::Json::array anArray;
+    anArray.reserve (theValue.size);
+
+    const Document::Value* anItems = theDocument.items (theValue);
+    for (Document::Index anIndex = 0; anIndex < theValue.size; ++anIndex) {
+      anArray.push_back (valueToJson (theDocument, anItems[anIndex]));
+    }
+
+    return anArray;
+  }
+
+  //! Converts node of the document to JSON.
+  json11::Json nodeToJson (const Document& theDocument, const Document::Node& theNode) {
+
+    json11::Json aProperties;
+
+    if (theNode.kind == Document::NODE_MATRIX) {
+      aProperties = valueToJson (theDocument, theDocument.matrix (theNode));
+    }
+    else {
+      json11::Json::object aMap;
+
+      const Document::Property* aProps = theDocument.properties (theNode);
+      for (Document::Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+        aMap[theDocument.name (aProps[anIndex].name)] = valueToJson (theDocument, aProps[anIndex].value);
+      }
+
+      aProperties = std::move (aMap);
+    }
+
+    if (theNode.kind == Document::NODE_OBJECT) {
+      return json11::Json::object ({
+        { "type", theDocument.name (theNode.type) },
+        { "properties", aProperties },
+      });
+    }
+
+    json11::Json::array anObjects;
+    anObjects.reserve (theNode.nbChildren);
+
+    const Document::Node* aChildren = theDocument.children (theNode);
+    for (Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+      anObjects.push_back (nodeToJson (theDocument, aChildren[anIndex]));
+    }
+
+    return json11::Json::object ({
+      { "type", theDocument.name (theNode.type) },
+      { "properties", aProperties },
+      { "objects", anObjects },
+    });
+  }
+}
+
+// definitions of constants used by reference (e.g. as fill values of vectors)
+const Document::Index Document::INVALID_INDEX;
+const Document::Index Document::MATRIX_SIZE;
+
+Document::Document()
+  : m_versionName ("undefined"),
+    m_majorVersion (0),
+    m_minorVersion (0) {
+
+  m_root.type = INVALID_INDEX;
+  m_root.kind = NODE_INSTRUCTION;
+  m_root.properties = 0;
+  m_root.nbProperties = 0;
+  m_root.children = 0;
+  m_root.nbChildren = 0;
+
+  for (int aType = 0; aType < TYPE_NB; ++aType) {
+    intern (THE_TYPE_NAMES[aType]);
+  }
+
+  bindTables();
+}
+
+Document Document::fromJson (const json11::Json& theData) {
+
+  Document aDocument;
+  DocumentBuilder aBuilder (aDocument);
+
+  replayJson (theData, aBuilder);
+  aBuilder.finish();
+
+  return aDocument;
+}
+
+json11::Json Document::toJson() const {
+
+  json11::Json::array aContents;
+  aContents.reserve (m_root.nbChildren);
+
+  const Node* aChildren = children (m_root);
+  for (Index anIndex = 0; anIndex < m_root.nbChildren; ++anIndex) {
+    aContents.push_back (nodeToJson (*this, aChildren[anIndex]));
+  }
+
+  return json11::Json::object ({
+    { "type", "CSG file" },
+    { "version-name", m_versionName },
+    { "version-major", m_majorVersion },
+    { "version-minor", m_minorVersion },
+    { "contents", aContents },
+  });
+}
+
+const Document::Value* Document::property (const Node& theNode, const Index theName) const {
+
+  if (theNode.kind == NODE_MATRIX) {
+    return NULL;
+  }
+
+  const Property* aProps = properties (theNode);
+  for (Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+    if (aProps[anIndex].name == theName) {
+      return &aProps[anIndex].value;
+    }
+  }
+
+  return NULL;
+}
+
+Document::Index Document::find (const std::string& theName) const {
+
+  auto anIter = m_nameIndices.find (theName);
+  return anIter != m_nameIndices.end() ? anIter->second : INVALID_INDEX;
+}
+
+Document::NodeType Document::nodeType (const std::string& theName) {
+
+  for (int aType = 0; aType < TYPE_NB; ++aType) {
+    if (theName == THE_TYPE_NAMES[aType]) {
+      return static_cast<NodeType> (aType);
+    }
+  }
+
+  return TYPE_NB;
+}
+
+void Document::bindTables() {
+
+  m_nodeTable.bind (m_nodes);
+  m_propertyTable.bind (m_properties);
+  m_valueTable.bind (m_values);
+  m_numberTable.bind (m_numbers);
+  m_matrixNumberTable.bind (m_matrixNumbers);
+  m_matrixTable.bind (m_matrices);
+}
+
+Document::Index Document::intern (const std::string& theName) {
+
+  auto anIter = m_nameIndices.find (theName);
+  if (anIter != m_nameIndices.end()) {
+    return anIter->second;
+  }
+
+  const Index anIndex = static_cast<Index> (m_names.size());
+  m_names.push_back (theName);
+  m_nameIndices.insert (std::make_pair (theName, anIndex));
+
+  return anIndex;
+}
+
+void Document::dumpString (const std::string& theValue, std::string& theOut) {
+
+  theOut += '"';
+  for (size_t anIndex = 0; anIndex < theValue.size(); ++anIndex) {
+    const unsigned char aChar = static_cast<unsigned char> (theValue[anIndex]);
+
+    if (aChar == '\\') {
+      theOut += "\\\\";
+    }
+    else if (aChar == '"') {
+      theOut += "\\\"";
+    }
+    else if (aChar == '\b') {
+      theOut += "\\b";
+    }
+    else if (aChar == '\f') {
+      theOut += "\\f";
+    }
+    else if (aChar == '\n') {
+      theOut += "\\n";
+    }
+    else if (aChar == '\r') {
+      theOut += "\\r";
+    }
+    else if (aChar == '\t') {
+      theOut += "\\t";
+    }
+    else if (aChar <= 0x1f) {
+      char aBuffer[8];
+      snprintf (aBuffer, sizeof aBuffer, "\\u%04x", aChar);
+      theOut += aBuffer;
+    }
+    else if (aChar == 0xe2 && anIndex + 2 < theValue.size()
+          && static_cast<unsigned char> (theValue[anIndex + 1]) == 0x80
+          && (static_cast<unsigned char> (theValue[anIndex + 2]) == 0xa8
+           || static_cast<unsigned char> (theValue[anIndex + 2]) == 0xa9)) {
+      theOut += static_cast<unsigned char> (theValue[anIndex + 2]) == 0xa8 ? "\\u2028" : "\\u2029";
+      anIndex += 2;
+    }
+    else {
+      theOut += theValue[anIndex];
+    }
+  }
+  theOut += '"';
+}
+
+void Document::dumpNumber (const double theValue, std::string& theOut, const NumberPrecision thePrecision) {
+
+  if (std::isfinite (theValue)) {
+    char aBuffer[MAX_NUMBER_LENGTH];
+    theOut.append (aBuffer, formatNumber (theValue, thePrecision, aBuffer));
+  }
+  else {
+    theOut += "null";
+  }
+}
+
+void Document::dumpName (const Index theName, std::string& theOut) const {
+
+  dumpString (m_names[theName], theOut);
+}
+
+void Document::dump (const Value& theValue, std::string& theOut, const NumberPrecision thePrecision) const {
+
+  switch (theValue.type) {
+    case VALUE_NUMBER:
+      dumpNumber (theValue.number, theOut, thePrecision);
+      return;
+    case VALUE_BOOLEAN:
+      theOut += theValue.boolean ? "true" : "false";
+      return;
+    case VALUE_STRING:
+      dumpName (theValue.string, theOut);
+      return;
+    case VALUE_MATRIX:
+    case VALUE_NUMBERS:
+    case VALUE_ARRAY:
+      break;
+  }
+
+  theOut += "[";
+  for (Index anIndex = 0; anIndex < theValue.size; ++anIndex) {
+    if (anIndex != 0) {
+      theOut += ", ";
+    }
+
+    if (theValue.type == VALUE_MATRIX) {
+      const double* aRow = matrixNumbers (theValue) + anIndex * 4;
+
+      theOut += "[";
+      for (int aColumn = 0; aColumn < 4; ++aColumn) {
+        theOut += aColumn == 0 ? "" : ", ";
+        dumpNumber (aRow[aColumn], theOut, thePrecision);
+      }
+      theOut += "]";
+    }
+    else if (theValue.type == VALUE_NUMBERS) {
+      dumpNumber (numbers (theValue)[anIndex], theOut, thePrecision);
+    }
+    else {
+      dump (items (theValue)[anIndex], theOut, thePrecision);
+    }
+  }
+  theOut += "]";
+}
+
+DocumentBuilder::DocumentBuilder (Document& theDocument)
+  : m_document (theDocument),
+    m_levels (1),
+    m_depth (0),
+    m_definitionStart (THE_NO_DEFINITION) {}
+
+void DocumentBuilder::finish() {
+
+  if (m_depth != 0) {
+    throw std::runtime_error ("Unexpected end of CSG tree");
+  }
+
+  placeChildren (m_document.m_root, m_levels.front().children);
+
+  m_document.m_nodes.shrink_to_fit();
+  m_document.m_properties.shrink_to_fit();
+  m_document.m_values.shrink_to_fit();
+  m_document.m_numbers.shrink_to_fit();
+  m_document.m_matrixNumbers.shrink_to_fit();
+  m_document.m_matrices.shrink_to_fit();
+
+  m_document.bindTables();
+}
+
+void DocumentBuilder::version (const std::string& theName, const int theMajor, const int theMinor) {
+
+  m_document.m_versionName = theName;
+  m_document.m_majorVersion = theMajor;
+  m_document.m_minorVersion = theMinor;
+}
+
+void DocumentBuilder::object (const std::string& theType, const json11::Json::object& theProperties) {
+
+  m_levels[m_depth].children.push_back (createNode (theType, Document::NODE_OBJECT, theProperties));
+}
+
+void DocumentBuilder::beginInstruction (const std::string& theType, const json11::Json::object& theProperties) {
+
+  if (++m_depth == m_levels.size()) {
+    m_levels.push_back (Level());
+  }
+
+  m_levels[m_depth].node = createNode (theType, Document::NODE_INSTRUCTION, theProperties);
+}
+
+void DocumentBuilder::beginMatrix (const std::string& theType, const json11::Json::array& theMatrix) {
+
+  // zero-initialized, so padding bytes are the same in binary files
+  Document::Property aMatrix = Document::Property();
+  aMatrix.name = Document::INVALID_INDEX;
+  aMatrix.value = createArray (theMatrix);
+
+  if (++m_depth == m_levels.size()) {
+    m_levels.push_back (Level());
+  }
+
+  Document::Node& aNode = m_levels[m_depth].node;
+  aNode.type = m_document.intern (theType);
+  aNode.kind = Document::NODE_MATRIX;
+  aNode.properties = static_cast<Document::Index> (m_document.m_properties.size());
+  aNode.nbProperties = 1;
+  aNode.children = 0;
+  aNode.nbChildren = 0;
+
+  m_document.m_properties.push_back (aMatrix);
+}
+
+void DocumentBuilder::endInstruction() {
+
+  if (m_depth == 0) {
+    throw std::runtime_error ("Unexpected end of instruction");
+  }
+
+  Level& aLevel = m_levels[m_depth--];
+
+  placeChildren (aLevel.node, aLevel.children);
+  m_levels[m_depth].children.push_back (aLevel.node);
+}
+
+void DocumentBuilder::beginDefinition() {
+
+  if (m_depth != 0 || m_definitionStart != THE_NO_DEFINITION) {
+    throw std::runtime_error ("Unexpected definition");
+  }
+
+  m_definitionStart = m_levels.front().children.size();
+}
+
+void DocumentBuilder::endDefinition() {
+
+  std::vector<Document::Node>& aNodes = m_levels.front().children;
+
+  if (m_depth != 0 || m_definitionStart == THE_NO_DEFINITION || aNodes.size() != m_definitionStart + 1) {
+    throw std::runtime_error ("Definition should be a single object or instruction");
+  }
+
+  // the node itself is placed by its references, its children are already in the pool
+  m_definitions.push_back (aNodes.back());
+  aNodes.pop_back();
+
+  m_definitionStart = THE_NO_DEFINITION;
+}
+
+void DocumentBuilder::useDefinition (const size_t theIndex) {
+
+  if (theIndex >= m_definitions.size()) {
+    throw std::runtime_error ("Unknown definition: " + std::to_string (theIndex));
+  }
+
+  m_levels[m_depth].children.push_back (m_definitions[theIndex]);
+}
+
+Document::Node DocumentBuilder::createNode (const std::string& theType,
+                                            const Document::NodeKind theKind,
+                                            const json11::Json::object& theProperties) {
+
+  Document::Node aNode = Document::Node();
+  aNode.type = m_document.intern (theType);
+  aNode.kind = theKind;
+  aNode.children = 0;
+  aNode.nbChildren = 0;
+
+  // values are created first, arrays among them append their items to the pools
+  Document::Property aProperty = Document::Property();
+  std::vector<Document::Property>& aProperties = m_document.m_properties;
+
+  const size_t aFirst = aProperties.size();
+  for (auto& aPair : theProperties) {
+    aProperty.name = m_document.intern (aPair.first);
+    aProperty.value = createValue (aPair.second);
+    aProperties.push_back (aProperty);
+  }
+
+  aNode.properties = static_cast<Document::Index> (aFirst);
+  aNode.nbProperties = static_cast<Document::Index> (aProperties.size() - aFirst);
+
+  return aNode;
+}
+
+Document::Value DocumentBuilder::createValue (const json11::Json& theValue) {
+
+  Document::Value aValue = Document::Value();
+  aValue.size = 0;
+
+  switch (theValue.type()) {
+    case json11::Json::NUMBER:
+      aValue.type = Document::VALUE_NUMBER;
+      aValue.number = theValue.number_value();
+      return aValue;
+    case json11::Json::BOOL:
+      aValue.type = Document::VALUE_BOOLEAN;
+      aValue.boolean = theValue.bool_value();
+      return aValue;
+    case json11::Json::STRING:
+      aValue.type = Document::VALUE_STRING;
+      aValue.string = m_document.intern (theValue.string_value());
+      return aValue;
+    case json11::Json::ARRAY:
+      break;
+    default:
+      throw std::runtime_error ("Unsupported property value: " + theValue.dump());
+  }
+
+  // compact arrays of numbers are copied as is
+  if (!theValue.number_items().empty()) {
+    std::vector<double>& aNumbers = m_document.m_numbers;
+
+    aValue.type = Document::VALUE_NUMBERS;
+    aValue.items = static_cast<Document::Index> (aNumbers.size());
+    aValue.size = static_cast<Document::Index> (theValue.number_items().size());
+
+    aNumbers.insert (aNumbers.end(), theValue.number_items().begin(), theValue.number_items().end());
+    return aValue;
+  }
+
+  return createArray (theValue.array_items());
+}
+
+Document::Value DocumentBuilder::createArray (const json11::Json::array& theItems) {
+
+  Document::Value aValue = Document::Value();
+  aValue.size = static_cast<Document::Index> (theItems.size());
+
+  bool isNumeric = !theItems.empty();
+  bool isMatrix = theItems.size() == 4;
+  for (auto& anItem : theItems) {
+    isNumeric = isNumeric && anItem.is_number();
+    isMatrix = isMatrix && isMatrixRow (anItem);
+  }
+
+  if (isMatrix) {
+    return createMatrix (theItems);
+  }
+
+  if (isNumeric) {
+    std::vector<double>& aNumbers = m_document.m_numbers;
+
+    aValue.type = Document::VALUE_NUMBERS;
+    aValue.items = static_cast<Document::Index> (aNumbers.size());
+
+    for (auto& anItem : theItems) {
+      aNumbers.push_back (anItem.number_value());
+    }
+
+    return aValue;
+  }
+
+  // nested arrays append their items first, so the items of this array
+  // are collected on top of the shared stack to be appended at once
+  const size_t aFirst = m_values.size();
+
+  for (auto& anItem : theItems) {
+    const Document::Value anItemValue = createValue (anItem);
+    m_values.push_back (anItemValue);
+  }
+
+  std::vector<Document::Value>& aValues = m_document.m_values;
+
+  aValue.type = Document::VALUE_ARRAY;
+  aValue.items = static_cast<Document::Index> (aValues.size());
+
+  aValues.insert (aValues.end(), m_values.begin() + aFirst, m_values.end());
+  m_values.resize (aFirst);
+
+  return aValue;
+}
+
+Document::Value DocumentBuilder::createMatrix (const json11::Json::array& theRows) {
+
+  Document::Value aValue = Document::Value();
+  aValue.type = Document::VALUE_MATRIX;
+  aValue.size = 4;
+  aValue.items = static_cast<Document::Index> (m_document.m_matrices.size() / Document::MATRIX_SIZE);
+
+  for (auto& aRow : theRows) {
+    // rows are usually compact, indexing them would expand the items
+    const json11::Json::number_array& aNumbers = aRow.number_items();
+
+    for (size_t anIndex = 0; anIndex < 4; ++anIndex) {
+      const double aNumber = !aNumbers.empty() ? aNumbers[anIndex] : aRow.array_items()[anIndex].number_value();
+
+      m_document.m_matrixNumbers.push_back (aNumber);
+      m_document.m_matrices.push_back (static_cast<float> (aNumber));
+    }
+  }
+
+  return aValue;
+}
+
+void DocumentBuilder::placeChildren (Document::Node& theNode, std::vector<Document::Node>& theChildren) {
+
+  std::vector<Document::Node>& aNodes = m_document.m_nodes;
+
+  theNode.children = static_cast<Document::Index> (aNodes.size());
+  theNode.nbChildren = static_cast<Document::Index> (theChildren.size());
+
+  aNodes.insert (aNodes.end(), theChildren.begin(), theChildren.end());
+
+  // the level is reused by the next instruction of the same depth
+  theChildren.clear();
+}
+
+} // csg
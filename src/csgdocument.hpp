@@ -0,0 +1,343 @@
+#ifndef HEADER_CSG_DOCUMENT
+#define HEADER_CSG_DOCUMENT
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <json11/json11.hpp>
+
+#include <csghandler.hpp>
+#include <csgnumbers.hpp>
+
+namespace csg {
+
+class InputFile;
+
+//! Compact in-memory representation of CSG file.
+//! Nodes, properties and values are stored by value in a few contiguous pools
+//! and refer to each other by indices: children of each instruction and items
+//! of each array occupy adjacent pool entries. Type names, property names and
+//! strings are interned, so every name is stored once per document.
+//! Pools are accessed through tables which point either to the vectors
+//! of the document or to the mapped binary file (see BinaryFormat),
+//! so the document can be moved but not copied.
+//! Repeated subtrees read from CSGJS definitions are shared: nodes referencing
+//! a definition are copies of its root and point to the same ranges of pools.
+class Document {
+
+public:
+
+  //! Index of pool entry or interned name.
+  typedef uint32_t Index;
+
+  //! Index meaning "no entry".
+  static const Index INVALID_INDEX = 0xFFFFFFFF;
+
+  //! Known node types. Their names are interned first, so the type
+  //! of a node can be compared to these values directly.
+  enum NodeType {
+    TYPE_GROUP,
+    TYPE_MULTMATRIX,
+    TYPE_UNION,
+    TYPE_DIFFERENCE,
+    TYPE_INTERSECTION,
+    TYPE_SMIN,
+    TYPE_CUBE,
+    TYPE_SPHERE,
+    TYPE_CYLINDER,
+    TYPE_CONE,
+    TYPE_NB
+  };
+
+  //! Syntactic kind of node.
+  enum NodeKind {
+    NODE_OBJECT,      //!< object without children: cube(size = 1);
+    NODE_INSTRUCTION, //!< instruction with properties: union() { ... }
+    NODE_MATRIX       //!< instruction with matrix: multmatrix([[...]]) { ... }
+  };
+
+  //! Type of property value.
+  enum ValueType {
+    VALUE_NUMBER,
+    VALUE_BOOLEAN,
+    VALUE_STRING,
+    VALUE_ARRAY,  //!< array of values of any type
+    VALUE_NUMBERS, //!< non-empty array of numbers only
+    VALUE_MATRIX   //!< array of 4 arrays of 4 numbers (transformation matrix)
+  };
+
+  //! Number of items of VALUE_MATRIX matrix.
+  static const Index MATRIX_SIZE = 16;
+
+  //! Property value.
+  struct Value {
+
+    ValueType type;
+
+    //! Number of array items (rows of VALUE_MATRIX).
+    Index size;
+
+    union {
+      double number;
+      bool boolean;
+      Index string; //!< interned string
+      Index items;  //!< first item in values (VALUE_ARRAY) or numbers (VALUE_NUMBERS) pool,
+                    //!< or index of matrix in matrix pools (VALUE_MATRIX)
+    };
+  };
+
+  //! Named property of node.
+  struct Property {
+    Index name;
+    Index reserved; //!< always zero (explicit padding, so stored properties are deterministic)
+    Value value;
+  };
+
+  //! Object or instruction.
+  struct Node {
+    Index type;
+    NodeKind kind;
+
+    //! Range of properties (matrix nodes have one unnamed property holding the matrix).
+    Index properties;
+    Index nbProperties;
+
+    //! Range of children in nodes pool.
+    Index children;
+    Index nbChildren;
+  };
+
+public:
+
+  //! Creates empty document.
+  Document();
+
+  Document (Document&& theOther) = default;
+  Document& operator= (Document&& theOther) = default;
+
+  //! Converts JSON representation of CSG file (or its part) to document
+  //! (throws std::runtime_error if the data is not a CSG tree).
+  //! Subtrees listed in "definitions" of the file are shared by the nodes
+  //! referencing them ({"use": <index of definition>}).
+  static Document fromJson (const json11::Json& theData);
+
+  //! Converts document to JSON representation of CSG file (shared subtrees are expanded).
+  json11::Json toJson() const;
+
+public:
+
+  const std::string& versionName() const { return m_versionName; }
+  int majorVersion() const { return m_majorVersion; }
+  int minorVersion() const { return m_minorVersion; }
+
+  //! Returns pseudo node which children are top-level nodes of the file.
+  const Node& root() const { return m_root; }
+
+  //! Returns the first child of the node.
+  const Node* children (const Node& theNode) const { return m_nodeTable.data + theNode.children; }
+
+  //! Returns the first property of the node.
+  const Property* properties (const Node& theNode) const { return m_propertyTable.data + theNode.properties; }
+
+  //! Returns property with the given interned name (NULL if there is no such property).
+  const Value* property (const Node& theNode, const Index theName) const;
+
+  //! Returns matrix of NODE_MATRIX node.
+  const Value& matrix (const Node& theNode) const { return m_propertyTable.data[theNode.properties].value; }
+
+  //! Returns the first item of VALUE_ARRAY array.
+  const Value* items (const Value& theArray) const { return m_valueTable.data + theArray.items; }
+
+  //! Returns the first number of VALUE_NUMBERS array.
+  const double* numbers (const Value& theArray) const { return m_numberTable.data + theArray.items; }
+
+  //! Returns MATRIX_SIZE numbers of VALUE_MATRIX matrix (row by row).
+  const double* matrixNumbers (const Value& theMatrix) const {
+    return m_matrixNumberTable.data + size_t (theMatrix.items) * MATRIX_SIZE;
+  }
+
+  //! Returns numbers of VALUE_MATRIX matrix rounded to single precision (row by row).
+  const float* matrixFloats (const Value& theMatrix) const {
+    return m_matrixTable.data + size_t (theMatrix.items) * MATRIX_SIZE;
+  }
+
+  //! Returns interned name (or string value).
+  const std::string& name (const Index theName) const { return m_names[theName]; }
+
+  //! Returns index of interned name (INVALID_INDEX if the document does not use it).
+  Index find (const std::string& theName) const;
+
+  //! Returns total number of nodes.
+  size_t nbNodes() const { return m_nodeTable.size; }
+
+  //! Returns index of the node in the nodes pool (the root is not in the pool).
+  Index nodeIndex (const Node& theNode) const { return static_cast<Index> (&theNode - m_nodeTable.data); }
+
+  //! Returns known type of the node type name (TYPE_NB if the type is unknown).
+  static NodeType nodeType (const std::string& theName);
+
+  //! Appends JSON serialization of the string (escaped the same way as by json11).
+  static void dumpString (const std::string& theValue, std::string& theOut);
+
+  //! Appends the number in the shortest form which is read back with the given precision
+  //! (non-finite numbers are written as null).
+  static void dumpNumber (const double theValue, std::string& theOut,
+                          const NumberPrecision thePrecision = PRECISION_DOUBLE);
+
+  //! Appends JSON serialization of the interned name (string) to the string.
+  void dumpName (const Index theName, std::string& theOut) const;
+
+  //! Appends JSON serialization of the value to the string.
+  //! Numbers are written in the shortest form which is read back with the given precision.
+  void dump (const Value& theValue, std::string& theOut,
+             const NumberPrecision thePrecision = PRECISION_DOUBLE) const;
+
+private:
+
+  friend class DocumentBuilder;
+  friend class CsgJsonReader;
+  friend class BinaryFormat;
+
+  Document (const Document&);
+  Document& operator= (const Document&);
+
+  //! Returns index of the name interning it if necessary.
+  Index intern (const std::string& theName);
+
+  //! Points tables to the pool vectors (should be called after the pools are filled).
+  void bindTables();
+
+private:
+
+  //! Read-only view of pool contents.
+  template<typename T>
+  struct Table {
+    const T* data;
+    size_t size;
+
+    Table() : data (NULL), size (0) {}
+
+    void bind (const std::vector<T>& thePool) {
+      data = thePool.data();
+      size = thePool.size();
+    }
+  };
+
+private:
+
+  std::string m_versionName;
+  int m_majorVersion;
+  int m_minorVersion;
+
+  Node m_root;
+
+  std::vector<Node> m_nodes;
+  std::vector<Property> m_properties;
+  std::vector<Value> m_values;
+  std::vector<double> m_numbers;
+  std::vector<double> m_matrixNumbers;
+  std::vector<float> m_matrices;
+
+  Table<Node> m_nodeTable;
+  Table<Property> m_propertyTable;
+  Table<Value> m_valueTable;
+  Table<double> m_numberTable;
+  Table<double> m_matrixNumberTable;
+  Table<float> m_matrixTable;
+
+  //! Mapped binary file the tables point to (if any).
+  std::shared_ptr<InputFile> m_file;
+
+  std::vector<std::string> m_names;
+  std::unordered_map<std::string, Index> m_nameIndices;
+
+};
+
+//! Builds document from parsing events.
+//! Children are kept aside until their instruction ends and then appended
+//! to the nodes pool at once, that makes the children of each node adjacent.
+class DocumentBuilder : public Handler {
+
+public:
+
+  //! Creates builder filling the given (empty) document.
+  explicit DocumentBuilder (Document& theDocument);
+
+  //! Places top-level nodes and releases unused pool capacity.
+  //! Should be called after the last event.
+  void finish();
+
+  virtual void version (const std::string& theName, const int theMajor, const int theMinor);
+
+  virtual void object (const std::string& theType, const json11::Json::object& theProperties);
+
+  virtual void beginInstruction (const std::string& theType, const json11::Json::object& theProperties);
+
+  virtual void beginMatrix (const std::string& theType, const json11::Json::array& theMatrix);
+
+  virtual void endInstruction();
+
+  //! Starts shared subtree: the next top-level object or instruction becomes
+  //! a definition instead of being added to the document.
+  void beginDefinition();
+
+  //! Ends shared subtree started by beginDefinition
+  //! (throws std::runtime_error if it is not a single top-level node).
+  void endDefinition();
+
+  //! Adds node referencing the definition with the given index (in the order of
+  //! endDefinition calls) to the current instruction. The node shares properties
+  //! and children of the definition. Throws std::runtime_error if there is no such definition.
+  void useDefinition (const size_t theIndex);
+
+private:
+
+  //! Creates node of the given kind with the properties.
+  Document::Node createNode (const std::string& theType,
+                             const Document::NodeKind theKind,
+                             const json11::Json::object& theProperties);
+
+  //! Converts property value (arrays are appended to the pools).
+  Document::Value createValue (const json11::Json& theValue);
+
+  //! Converts array appending its items to the pools.
+  Document::Value createArray (const json11::Json::array& theItems);
+
+  //! Appends 4x4 matrix to the matrix pools.
+  Document::Value createMatrix (const json11::Json::array& theRows);
+
+  //! Appends nodes of the level to the pool and makes them children of the node.
+  void placeChildren (Document::Node& theNode, std::vector<Document::Node>& theChildren);
+
+private:
+
+  //! Instruction being read.
+  struct Level {
+    Document::Node node;
+    std::vector<Document::Node> children;
+  };
+
+  Document& m_document;
+
+  //! Levels of instructions being read (the first one is the root);
+  //! levels are reused, so only the first m_depth + 1 of them are valid.
+  std::vector<Level> m_levels;
+  size_t m_depth;
+
+  //! Reusable stack of items of arrays being converted.
+  std::vector<Document::Value> m_values;
+
+  //! Root nodes of shared subtrees.
+  std::vector<Document::Node> m_definitions;
+
+  //! Number of top-level nodes preceding the definition being read.
+  size_t m_definitionStart;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_DOCUMENT
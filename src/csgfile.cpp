@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <windows.h>
+#else
+  #include <dirent.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+#include <csgfile.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Size of portions not mapped input is loaded by.
+  const size_t THE_LOAD_CHUNK = 1 << 20;
+
+#ifdef _WIN32
+  int openFile (const char* thePath) { return ::_open (thePath, _O_RDONLY | _O_BINARY); }
+  int createFile (const char* thePath) { return ::_open (thePath, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE); }
+  int readFile (int theFd, char* theBuffer, size_t theSize) { return ::_read (theFd, theBuffer, static_cast<unsigned> (theSize)); }
+  int writeFile (int theFd, const char* theData, size_t theSize) { return ::_write (theFd, theData, static_cast<unsigned> (theSize)); }
+  int closeFile (int theFd) { return ::_close (theFd); }
+#else
+  int openFile (const char* thePath) { return ::open (thePath, O_RDONLY); }
+  int createFile (const char* thePath) { return ::open (thePath, O_WRONLY | O_CREAT | O_TRUNC, 0666); }
+  ssize_t readFile (int theFd, char* theBuffer, size_t theSize) { return ::read (theFd, theBuffer, theSize); }
+  ssize_t writeFile (int theFd, const char* theData, size_t theSize) { return ::write (theFd, theData, theSize); }
+  int closeFile (int theFd) { return ::close (theFd); }
+#endif
+}
+
+InputFile::InputFile (const std::string& theFilePath)
+  : m_filePath (theFilePath),
+    m_fd (-1),
+    m_isOwned (false),
+    m_mapping (NULL),
+    m_data (NULL),
+    m_size (0) {
+
+  if (theFilePath == "-") {
+    m_fd = 0; // standard input
+#ifdef _WIN32
+    ::_setmode (m_fd, _O_BINARY);
+#endif
+  }
+  else {
+    m_fd = openFile (theFilePath.c_str());
+    m_isOwned = true;
+  }
+
+  if (m_fd < 0) {
+    throw std::runtime_error ("Cannot open file: " + theFilePath);
+  }
+
+#ifndef _WIN32
+  struct stat aStat;
+
+  // standard input may be redirected from regular file as well
+  if (::fstat (m_fd, &aStat) == 0 && S_ISREG (aStat.st_mode)
+   && aStat.st_size > 0 && ::lseek (m_fd, 0, SEEK_CUR) == 0) {
+
+    void* aMapping = ::mmap (NULL, aStat.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+
+    if (aMapping != MAP_FAILED) {
+      ::madvise (aMapping, aStat.st_size, MADV_SEQUENTIAL);
+
+      m_mapping = aMapping;
+      m_data = static_cast<const char*> (aMapping);
+      m_size = aStat.st_size;
+    }
+  }
+#endif
+}
+
+InputFile::~InputFile() {
+
+#ifndef _WIN32
+  if (m_mapping != NULL) {
+    ::munmap (m_mapping, m_size);
+  }
+#endif
+
+  if (m_isOwned) {
+    closeFile (m_fd);
+  }
+}
+
+void InputFile::load() {
+
+  if (isMapped()) {
+    return;
+  }
+
+  size_t aSize = m_buffer.size();
+
+  for (;;) {
+    m_buffer.resize (aSize + THE_LOAD_CHUNK);
+
+    const size_t aCount = read (m_buffer.data() + aSize, THE_LOAD_CHUNK);
+    if (aCount == 0) {
+      break;
+    }
+
+    aSize += aCount;
+  }
+
+  m_buffer.resize (aSize);
+
+  m_data = m_buffer.data();
+  m_size = m_buffer.size();
+}
+
+size_t InputFile::read (char* theBuffer, const size_t theSize) {
+
+  for (;;) {
+    const auto aCount = readFile (m_fd, theBuffer, theSize);
+
+    if (aCount >= 0) {
+      return static_cast<size_t> (aCount);
+    }
+
+    if (errno != EINTR) {
+      throw std::runtime_error ("Cannot read file: " + m_filePath);
+    }
+  }
+}
+
+OutputFile::OutputFile (const std::string& theFilePath)
+  : m_filePath (theFilePath),
+    m_fd (-1),
+    m_isOwned (false) {
+
+  if (theFilePath == "-") {
+    m_fd = 1; // standard output
+#ifdef _WIN32
+    ::_setmode (m_fd, _O_BINARY);
+#endif
+  }
+  else {
+    m_fd = createFile (theFilePath.c_str());
+    m_isOwned = true;
+  }
+
+  if (m_fd < 0) {
+    throw std::runtime_error ("Cannot create file: " + theFilePath);
+  }
+}
+
+OutputFile::~OutputFile() {
+
+  if (m_isOwned && m_fd >= 0) {
+    closeFile (m_fd);
+  }
+}
+
+void OutputFile::write (const char* theData, const size_t theSize) {
+
+  size_t aWritten = 0;
+
+  while (aWritten < theSize) {
+    const auto aCount = writeFile (m_fd, theData + aWritten, theSize - aWritten);
+
+    if (aCount >= 0) {
+      aWritten += static_cast<size_t> (aCount);
+    }
+    else if (errno != EINTR) {
+      throw std::runtime_error ("Cannot write file: " + m_filePath);
+    }
+  }
+}
+
+void OutputFile::close() {
+
+  if (!m_isOwned || m_fd < 0) {
+    return;
+  }
+
+  const int aResult = closeFile (m_fd);
+  m_fd = -1;
+
+  if (aResult != 0) {
+    throw std::runtime_error ("Cannot write file: " + m_filePath);
+  }
+}
+
+bool isDirectory (const std::string& thePath) {
+
+  struct stat aStat;
+  return ::stat (thePath.c_str(), &aStat) == 0 && (aStat.st_mode & S_IFMT) == S_IFDIR;
+}
+
+std::vector<std::string> listDirectory (const std::string& thePath) {
+
+  std::vector<std::string> aNames;
+
+#ifdef _WIN32
+  WIN32_FIND_DATAA anEntry;
+  HANDLE aFind = ::FindFirstFileA ((thePath + "\\*").c_str(), &anEntry);
+  if (aFind == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error ("Cannot open directory: " + thePath);
+  }
+
+  do {
+    if ((anEntry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+      aNames.push_back (anEntry.cFileName);
+    }
+  } while (::FindNextFileA (aFind, &anEntry));
+
+  ::FindClose (aFind);
+#else
+  DIR* aDir = ::opendir (thePath.c_str());
+  if (aDir == NULL) {
+    throw std::runtime_error ("Cannot open directory: " + thePath);
+  }
+
+  while (const dirent* anEntry = ::readdir (aDir)) {
+    struct stat aStat;
+
+    // d_type is not filled by all file systems
+    const std::string aPath = thePath + "/" + anEntry->d_name;
+    if (::stat (aPath.c_str(), &aStat) == 0 && S_ISREG (aStat.st_mode)) {
+      aNames.push_back (anEntry->d_name);
+    }
+  }
+
+  ::closedir (aDir);
+#endif
+
+  std::sort (aNames.begin(), aNames.end());
+  return aNames;
+}
+
+int64_t modificationTime (const std::string& thePath) {
+
+  struct stat aStat;
+  if (::stat (thePath.c_str(), &aStat) != 0) {
+    return 0;
+  }
+
+#if defined(__linux__)
+  return static_cast<int64_t> (aStat.st_mtim.tv_sec) * 1000000000 + aStat.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+  return static_cast<int64_t> (aStat.st_mtimespec.tv_sec) * 1000000000 + aStat.st_mtimespec.tv_nsec;
+#else
+  return static_cast<int64_t> (aStat.st_mtime) * 1000000000;
+#endif
+}
+
+} // csg
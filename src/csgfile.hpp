@@ -0,0 +1,106 @@
+#ifndef HEADER_CSG_FILE
+#define HEADER_CSG_FILE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace csg {
+
+//! Read-only input file.
+//! Regular files are memory-mapped, so their contents are accessed without copying.
+//! Other inputs (pipes, standard input given as "-") are consumed by read calls.
+class InputFile {
+
+public:
+
+  //! Opens the given file (throws std::runtime_error on failure).
+  explicit InputFile (const std::string& theFilePath);
+
+  //! Unmaps and closes the file.
+  ~InputFile();
+
+public:
+
+  //! Checks if file contents are mapped to memory.
+  bool isMapped() const { return m_mapping != NULL; }
+
+  //! Returns file contents (the file should be mapped or loaded).
+  const char* data() const { return m_data; }
+
+  //! Returns size of file contents (the file should be mapped or loaded).
+  size_t size() const { return m_size; }
+
+  //! Reads the rest of not mapped input into memory.
+  void load();
+
+  //! Reads next portion of not mapped input, returns 0 at the end of input.
+  size_t read (char* theBuffer, const size_t theSize);
+
+private:
+
+  InputFile (const InputFile&);
+  InputFile& operator= (const InputFile&);
+
+private:
+
+  std::string m_filePath;
+
+  int m_fd;
+  bool m_isOwned;
+
+  void* m_mapping;
+  std::vector<char> m_buffer;
+
+  const char* m_data;
+  size_t m_size;
+
+};
+
+//! Output file written by unbuffered write calls (callers pass large blocks).
+//! Standard output is given as "-".
+class OutputFile {
+
+public:
+
+  //! Creates (truncates) the given file (throws std::runtime_error on failure).
+  explicit OutputFile (const std::string& theFilePath);
+
+  //! Closes the file (errors are ignored, call close() to check them).
+  ~OutputFile();
+
+public:
+
+  //! Writes the whole block (throws std::runtime_error on failure).
+  void write (const char* theData, const size_t theSize);
+
+  //! Closes the file (throws std::runtime_error on failure).
+  void close();
+
+private:
+
+  OutputFile (const OutputFile&);
+  OutputFile& operator= (const OutputFile&);
+
+private:
+
+  std::string m_filePath;
+
+  int m_fd;
+  bool m_isOwned;
+
+};
+
+//! Checks if the path names existing directory.
+bool isDirectory (const std::string& thePath);
+
+//! Returns sorted names of regular files in the directory (throws std::runtime_error on failure).
+std::vector<std::string> listDirectory (const std::string& thePath);
+
+//! Returns modification time of the file in nanoseconds since the epoch
+//! (with the precision of the file system, 0 if the file can't be accessed).
+int64_t modificationTime (const std::string& thePath);
+
+} // csg
+
+#endif // HEADER_CSG_FILE
@@ -0,0 +1,223 @@
+#include "CsgEvaluator.hpp"
+#include "CsgScene.hpp"
+
+#include "VoxelData.hpp"
+
+#include <Eigen/Geometry>
+
+const float CsgEvaluator::MaxDistance = 1.0e15f;
+
+// =======================================================================
+// function : SplitTransform
+// purpose  :
+// =======================================================================
+void CsgEvaluator::SplitTransform (const Mat4f& theTransform, Mat4f& theInverseRotation, Vec3f& theScaling)
+{
+  Mat4f aMatWithoutScale = theTransform;
+  for (int i = 0; i < 3; ++i)
+  {
+    float aScaleI = aMatWithoutScale.col (i).head<3>().norm();
+    theScaling[i] = aScaleI;
+    aMatWithoutScale.col (i).head<3>() *= 1.f / aScaleI;
+  }
+
+  theInverseRotation = aMatWithoutScale.inverse();
+}
+
+// =======================================================================
+// function : PrimitiveDistance
+// purpose  :
+// =======================================================================
+float CsgEvaluator::PrimitiveDistance (const Vec4f& thePoint,
+                                       const int theTypeId,
+                                       const Mat4f& theInverseRotation,
+                                       const Vec3f& theScaling)
+{
+  float aDistance = MaxDistance;
+
+  Vec4f aTransformedPos = theInverseRotation * thePoint;
+  aTransformedPos /= aTransformedPos.w();
+  const Vec3f& aPoint = aTransformedPos.head<3>();
+
+  switch (theTypeId)
+  {
+    case CSG_SPHERE:
+    {
+      aDistance = aPoint.norm() - theScaling.x(); // only uniform scaling for spheres
+      break;
+    }
+    case CSG_BOX:
+    {
+      Vec3f d = aPoint.cwiseAbs() - theScaling;
+      aDistance = std::min (std::max (d.x(), std::max (d.y(), d.z())), 0.f)
+                    + (d.cwiseMax (Vec3f (0.f, 0.f, 0.f))).norm();
+      break;
+    }
+  }
+
+  return aDistance;
+}
+
+// =======================================================================
+// function : PrimitiveDistance
+// purpose  :
+// =======================================================================
+float CsgEvaluator::PrimitiveDistance (const Vec4f& thePoint, const CsgPrimitiveNode* theNode)
+{
+  Mat4f anInverseRotation;
+  Vec3f aScaling;
+
+  SplitTransform (theNode->Transform(), anInverseRotation, aScaling);
+
+  return PrimitiveDistance (thePoint, theNode->TypeID(), anInverseRotation, aScaling);
+}
+
+// =======================================================================
+// function : Combine
+// purpose  :
+// =======================================================================
+float CsgEvaluator::Combine (const CsgOperation theOperation, const float theLftValue, const float theRghValue)
+{
+  switch (theOperation)
+  {
+    case CSG_OP_UNION:
+    {
+      return std::min (theLftValue, theRghValue);
+    }
+    case CSG_OP_INTER:
+    {
+      return std::max (theLftValue, theRghValue);
+    }
+    case CSG_OP_MINUS:
+    {
+      return std::max (theLftValue, -theRghValue);
+    }
+    default:
+    {
+      return MaxDistance;
+    }
+  }
+}
+
+// =======================================================================
+// function : Distance
+// purpose  :
+// =======================================================================
+float CsgEvaluator::Distance (const Vec4f& thePoint, const CsgNode* theNode)
+{
+  if (theNode->IsLeaf())
+  {
+    return PrimitiveDistance (thePoint, static_cast<const CsgPrimitiveNode*> (theNode));
+  }
+
+  const CsgOperationNode* anOpNode = static_cast<const CsgOperationNode*> (theNode);
+
+  float aDistance = Distance (thePoint, anOpNode->Child (0));
+
+  for (int anIndex = 1; anIndex < anOpNode->NbChildren(); ++anIndex)
+  {
+    aDistance = Combine (anOpNode->Operation(), aDistance, Distance (thePoint, anOpNode->Child (anIndex)));
+  }
+
+  return aDistance;
+}
+
+// =======================================================================
+// function : Distance
+// purpose  :
+// =======================================================================
+float CsgEvaluator::Distance (const Vec4f& thePoint, const CsgScene& theScene, std::vector<float>& theValues)
+{
+  if (theScene.NbNodes() == 0)
+  {
+    return MaxDistance;
+  }
+
+  theValues.resize (theScene.NbNodes());
+
+  // children precede their parents, so their values are ready
+  for (int aNode = 0; aNode < theScene.NbNodes(); ++aNode)
+  {
+    const int aPrimitive = theScene.Primitive (aNode);
+
+    float aDistance = MaxDistance;
+
+    if (aPrimitive >= 0)
+    {
+      aDistance = PrimitiveDistance (thePoint,
+                                     theScene.TypeID (aNode),
+                                     theScene.InverseRotation (aPrimitive),
+                                     theScene.Scaling (aPrimitive));
+    }
+    else
+    {
+      const CsgOperation anOperation = static_cast<CsgOperation> (theScene.TypeID (aNode));
+
+      aDistance = theValues[theScene.Child (aNode, 0)];
+
+      for (int anIndex = 1; anIndex < theScene.NbChildren (aNode); ++anIndex)
+      {
+        aDistance = Combine (anOperation, aDistance, theValues[theScene.Child (aNode, anIndex)]);
+      }
+    }
+
+    theValues[aNode] = aDistance;
+  }
+
+  return theValues.back();
+}
+
+namespace
+{
+  //! Samples the distance function at the voxel centers.
+  template<typename Function>
+  void fillVoxels (VoxelData& theVoxels, Function theDistance)
+  {
+    const float aMinPointX = theVoxels.MinCorner.x() + 0.5f * theVoxels.CellSize.x();
+    const float aMinPointY = theVoxels.MinCorner.y() + 0.5f * theVoxels.CellSize.y();
+    const float aMinPointZ = theVoxels.MinCorner.z() + 0.5f * theVoxels.CellSize.z();
+
+    Vec4f aQuery (0.f, 0.f, 0.f, 1.f);
+
+    for (int aX = 0; aX < theVoxels.SizeX; ++aX)
+    {
+      aQuery[0] = aMinPointX + aX * theVoxels.CellSize.x();
+
+      for (int aY = 0; aY < theVoxels.SizeY; ++aY)
+      {
+        aQuery[1] = aMinPointY + aY * theVoxels.CellSize.y();
+
+        for (int aZ = 0; aZ < theVoxels.SizeZ; ++aZ)
+        {
+          aQuery[2] = aMinPointZ + aZ * theVoxels.CellSize.z();
+
+          theVoxels.Value (aX, aY, aZ) = theDistance (aQuery);
+        }
+      }
+    }
+  }
+}
+
+// =======================================================================
+// function : FillVoxels
+// purpose  :
+// =======================================================================
+void CsgEvaluator::FillVoxels (const CsgNode* theNode, VoxelData& theVoxels)
+{
+  fillVoxels (theVoxels, [theNode] (const Vec4f& thePoint) {
+    return Distance (thePoint, theNode);
+  });
+}
+
+// =======================================================================
+// function : FillVoxels
+// purpose  :
+// =======================================================================
+void CsgEvaluator::FillVoxels (const CsgScene& theScene, VoxelData& theVoxels)
+{
+  std::vector<float> aValues;
+
+  fillVoxels (theVoxels, [&theScene, &aValues] (const Vec4f& thePoint) {
+    return Distance (thePoint, theScene, aValues);
+  });
+}
@@ -0,0 +1,57 @@
+#ifndef HEADER_CSG_EVALUATOR
+#define HEADER_CSG_EVALUATOR
+
+#include "CsgTree.hpp"
+
+#include <vector>
+
+class CsgScene;
+class VoxelData;
+
+//! Evaluates signed distance of CSG tree (negative inside the solid).
+//! Distances of operations are exact only outside of the solid (min/max of the children),
+//! which is sufficient for sampling and sphere tracing.
+class CsgEvaluator
+{
+private:
+
+  CsgEvaluator();
+
+public:
+
+  //! Distance returned for primitives of unsupported types.
+  static const float MaxDistance;
+
+public:
+
+  //! Splits transformation of primitive into inverse of its rotation and translation and scaling.
+  static void SplitTransform (const Mat4f& theTransform, Mat4f& theInverseRotation, Vec3f& theScaling);
+
+  //! Returns signed distance from the point to the primitive given by split transformation.
+  static float PrimitiveDistance (const Vec4f& thePoint,
+                                  const int theTypeId,
+                                  const Mat4f& theInverseRotation,
+                                  const Vec3f& theScaling);
+
+  //! Returns signed distance from the point to the primitive.
+  static float PrimitiveDistance (const Vec4f& thePoint, const CsgPrimitiveNode* theNode);
+
+  //! Combines distance of operation accumulated so far with distance of its next child.
+  static float Combine (const CsgOperation theOperation, const float theLftValue, const float theRghValue);
+
+  //! Returns signed distance from the point to the CSG tree.
+  static float Distance (const Vec4f& thePoint, const CsgNode* theNode);
+
+  //! Returns signed distance from the point to the scene (the same as for its tree).
+  //! Distances of the nodes are kept in the given buffer, which is reused between calls.
+  static float Distance (const Vec4f& thePoint, const CsgScene& theScene, std::vector<float>& theValues);
+
+  //! Fills voxel grid with distances to the CSG tree sampled at the voxel centers.
+  static void FillVoxels (const CsgNode* theNode, VoxelData& theVoxels);
+
+  //! Fills voxel grid with distances to the scene sampled at the voxel centers.
+  static void FillVoxels (const CsgScene& theScene, VoxelData& theVoxels);
+
+};
+
+#endif // HEADER_CSG_EVALUATOR
@@ -3,40 +3,420 @@
 #include <Eigen/Geometry>
 
 #include <iostream>
+#include <vector>
 
 namespace {
 
-  CsgNode* loadNode (const json11::Json theData, const Mat4f& theTransform);
+  CsgNode* loadNode (const json11::Json theData, const Mat4f& theTransform, CsgTreeArena* theArena);
 
+  //! Returns array item as a number (compact number arrays are read without expanding).
+  float item (const json11::Json& theArray, const size_t theIndex) {
+
+    auto& aNumbers = theArray.number_items();
+    return (float)(theIndex < aNumbers.size() ? aNumbers[theIndex] : theArray[theIndex].number_value());
+  }
+
+  //! Reads OpenScad compatibility matrix.
+  Mat4f readMatrix (const json11::Json::array& theMatrix) {
+
+    static const json11::Json aNull;
+
+    Mat4f aMatrix = Mat4f::Identity();
+
+    for (size_t i = 0; i < 4; ++i) {
+      auto& anInputRow = i < theMatrix.size() ? theMatrix[i] : aNull;
+      aMatrix.row (i) = Vec4f (item (anInputRow, 0),
+                               item (anInputRow, 1),
+                               item (anInputRow, 2),
+                               item (anInputRow, 3));
+    }
+
+    return aMatrix;
+  }
+
+  //! Returns property value (null if there is no such property).
+  const json11::Json& property (const json11::Json::object& theProperties, const std::string& theName) {
+
+    static const json11::Json aNull;
+
+    auto anIter = theProperties.find (theName);
+    return anIter != theProperties.end() ? anIter->second : aNull;
+  }
+
+  //! Creates box primitive of the given size.
+  CsgNode* createBox (const float theSizeX, const float theSizeY, const float theSizeZ,
+                      const Mat4f& theTransform, CsgTreeArena* theArena) {
+
+    Eigen::Affine3f aBoxTransform;
+    aBoxTransform = Eigen::Scaling (theSizeX, theSizeY, theSizeZ);
+    return CsgTreeArena::Create<CsgPrimitiveNode> (theArena, CSG_BOX, Mat4f (theTransform * aBoxTransform.matrix()));
+  }
+
+  //! Creates sphere primitive of the given radius (unit sphere if the radius is not positive).
+  CsgNode* createSphere (const double theRadius, const Mat4f& theTransform, CsgTreeArena* theArena) {
+
+    Eigen::Affine3f aSphereTransform;
+    aSphereTransform = Eigen::Scaling ((float)(theRadius > 0.0 ? theRadius : 1.0));
+    return CsgTreeArena::Create<CsgPrimitiveNode> (theArena, CSG_SPHERE, Mat4f (theTransform * aSphereTransform.matrix()));
+  }
+
+  //! Creates CSG primitive of the given type.
+  CsgNode* createPrimitive (const std::string& theType,
+                            const json11::Json::object& theProperties,
+                            const Mat4f& theTransform,
+                            CsgTreeArena* theArena) {
+
+    if (theType == "cube") {
+
+      auto& aCubeSize = property (theProperties, "size");
+
+      if (aCubeSize.is_null()) {
+        return createBox (1.0f, 1.0f, 1.0f, theTransform, theArena);
+      }
+      return createBox (item (aCubeSize, 0), item (aCubeSize, 1), item (aCubeSize, 2), theTransform, theArena);
+    }
+    else if (theType == "sphere") {
+
+      return createSphere (property (theProperties, "r").number_value(), theTransform, theArena);
+    }
+    // else if (theType == "cylinder") {
+    // }
+    // else if (theType == "cone") {
+    // }
+
+    throw std::runtime_error ("Unknown object type: " + json11::Json (theType).dump());
+  }
+
+  //! Creates operation node of the nodes of the range (single node is returned as is),
+  //! removes the nodes from the vector. Children of unions and intersections of the same
+  //! operation (and unions subtracted by difference) are moved to the new node directly.
+  CsgNode* combineNodes (const CsgOperation theOp,
+                         std::vector<CsgNode*>& theNodes,
+                         const size_t theStartIndex,
+                         CsgTreeArena* theArena) {
+
+    if (theNodes.size() <= theStartIndex) {
+      throw std::runtime_error ("The range should contain at least one element");
+    }
+
+    if (theNodes.size() == theStartIndex + 1) {
+      CsgNode* aNode = theNodes.back();
+      theNodes.pop_back();
+      return aNode;
+    }
+
+    CsgOperationNode* aResult = CsgTreeArena::Create<CsgOperationNode> (theArena, theOp);
+    aResult->Reserve (static_cast<int> (theNodes.size() - theStartIndex));
+
+    for (size_t anIndex = theStartIndex; anIndex < theNodes.size(); ++anIndex) {
+      CsgNode* aNode = theNodes[anIndex];
+
+      const int aMergedOp = theOp != CSG_OP_MINUS ? theOp : (anIndex == theStartIndex ? -1 : CSG_OP_UNION);
+
+      if (aNode->TypeID() != aMergedOp) {
+        aResult->AddChild (aNode);
+        continue;
+      }
+
+      CsgOperationNode* anOperation = static_cast<CsgOperationNode*> (aNode);
+      for (int aChild = 0; aChild < anOperation->NbChildren(); ++aChild) {
+        aResult->AddChild (anOperation->Child (aChild));
+      }
+
+      anOperation->SetChildren (std::vector<CsgNode*>());
+      CsgNode::Destroy (anOperation);
+    }
+
+    theNodes.resize (theStartIndex);
+    return aResult;
+  }
+
+  //! Creates operation node of the instruction from its children
+  //! (the nodes starting from the given index), removes the children from the vector.
+  CsgNode* combineChildren (const std::string& theType,
+                            std::vector<CsgNode*>& theNodes,
+                            const size_t theStartIndex,
+                            CsgTreeArena* theArena) {
+
+    if (theType == "group" || theType == "multmatrix" || theType == "union") {
+      // OpenScad compatibility: union of single object is the object
+      return combineNodes (CSG_OP_UNION, theNodes, theStartIndex, theArena);
+    }
+    else if (theType == "difference" || theType == "intersection") {
+
+      if (theNodes.size() <= theStartIndex) {
+        throw std::runtime_error ("Unexpected NULL object");
+      }
+      else if (theNodes.size() == theStartIndex + 1) {
+        throw std::runtime_error ("The range should contain at least one element");
+      }
+
+      return combineNodes (theType == "difference" ? CSG_OP_MINUS : CSG_OP_INTER, theNodes, theStartIndex, theArena);
+    }
+
+    throw std::runtime_error ("Unknown object type: " + json11::Json (theType).dump());
+  }
+
+  //! Builds CSG-tree from parsing events of CSG file.
+  class TreeBuilder : public csg::Handler {
+
+  public:
+
+    TreeBuilder (CsgTreeArena* theArena) : myLevels (1), myArena (theArena) {
+
+      myLevels.back().Transform = Mat4f::Identity();
+    }
+
+    ~TreeBuilder() {
+
+      for (auto& aLevel : myLevels) {
+        for (auto aNode : aLevel.Nodes) {
+          CsgNode::Destroy (aNode);
+        }
+      }
+    }
+
+    //! Returns union of top-level nodes (the caller takes ownership).
+    CsgNode* Result() {
+
+      return combineNodes (CSG_OP_UNION, myLevels.front().Nodes, 0, myArena);
+    }
+
+    virtual void object (const std::string& theType, const json11::Json::object& theProperties) {
+
+      if (theType == "cube" || theType == "sphere" || theType == "cylinder" || theType == "cone") {
+        myLevels.back().Nodes.push_back (createPrimitive (theType, theProperties, myLevels.back().Transform, myArena));
+      }
+      else {
+        // instruction without children (e.g. OpenScad empty group)
+        beginInstruction (theType, theProperties);
+        endInstruction();
+      }
+    }
+
+    virtual void beginInstruction (const std::string& theType, const json11::Json::object&) {
+
+      myLevels.push_back (Level (theType, myLevels.back().Transform));
+    }
+
+    virtual void beginMatrix (const std::string& theType, const json11::Json::array& theMatrix) {
+
+      if (theType == "multmatrix") {
+        myLevels.push_back (Level (theType, myLevels.back().Transform * readMatrix (theMatrix)));
+      }
+      else {
+        myLevels.push_back (Level (theType, myLevels.back().Transform));
+      }
+    }
+
+    virtual void endInstruction() {
+
+      CsgNode* aNode = combineChildren (myLevels.back().Type, myLevels.back().Nodes, 0, myArena);
+
+      myLevels.pop_back();
+      myLevels.back().Nodes.push_back (aNode);
+    }
+
+  private:
+
+    //! Instruction being loaded.
+    struct Level {
+
+      Level() {}
+
+      Level (const std::string& theType, const Mat4f& theTransform)
+        : Type (theType),
+          Transform (theTransform) {}
+
+      std::string Type;
+      Mat4f Transform;
+      std::vector<CsgNode*> Nodes;
+    };
+
+  private:
+
+    std::vector<Level, Eigen::aligned_allocator<Level> > myLevels;
+
+    //! Arena of the nodes (NULL for the heap).
+    CsgTreeArena* myArena;
+
+  };
+
+  //! Builds CSG-tree from compact CSG document.
+  class DocumentLoader {
+
+  public:
+
+    DocumentLoader (const csg::Document& theDocument, CsgTreeArena* theArena)
+      : myDocument (theDocument),
+        myArena (theArena),
+        mySizeName (theDocument.find ("size")),
+        myRadiusName (theDocument.find ("r")) {}
+
+    ~DocumentLoader() {
+
+      for (auto aNode : myNodes) {
+        CsgNode::Destroy (aNode);
+      }
+    }
+
+    //! Returns union of top-level nodes (the caller takes ownership).
+    CsgNode* Result() {
+
+      LoadChildren (myDocument.root(), Mat4f::Identity());
+      return combineNodes (CSG_OP_UNION, myNodes, 0, myArena);
+    }
+
+  private:
+
+    //! Loads children of the node appending them to the nodes being loaded.
+    void LoadChildren (const csg::Document::Node& theNode, const Mat4f& theTransform) {
+
+      const csg::Document::Node* aChildren = myDocument.children (theNode);
+      for (csg::Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+        LoadNode (aChildren[anIndex], theTransform);
+      }
+    }
+
+    //! Loads the node appending it to the nodes being loaded.
+    void LoadNode (const csg::Document::Node& theNode, const Mat4f& theTransform) {
+
+      switch (theNode.kind == csg::Document::NODE_OBJECT ? theNode.type : csg::Document::INVALID_INDEX) {
+        case csg::Document::TYPE_CUBE: {
+          const csg::Document::Value* aSize = myDocument.property (theNode, mySizeName);
+
+          if (aSize == NULL) {
+            myNodes.push_back (createBox (1.0f, 1.0f, 1.0f, theTransform, myArena));
+          }
+          else {
+            myNodes.push_back (createBox (Item (aSize, 0), Item (aSize, 1), Item (aSize, 2), theTransform, myArena));
+          }
+          return;
+        }
+        case csg::Document::TYPE_SPHERE: {
+          const csg::Document::Value* aRadius = myDocument.property (theNode, myRadiusName);
+
+          const bool isNumber = aRadius != NULL && aRadius->type == csg::Document::VALUE_NUMBER;
+          myNodes.push_back (createSphere (isNumber ? aRadius->number : 0.0, theTransform, myArena));
+          return;
+        }
+        case csg::Document::TYPE_CYLINDER:
+        case csg::Document::TYPE_CONE: {
+          std::string aType;
+          myDocument.dumpName (theNode.type, aType);
+          throw std::runtime_error ("Unknown object type: " + aType);
+        }
+        default:
+          break;
+      }
+
+      const size_t aStartIndex = myNodes.size();
+
+      if (theNode.kind == csg::Document::NODE_MATRIX && theNode.type == csg::Document::TYPE_MULTMATRIX) {
+        LoadChildren (theNode, theTransform * ReadMatrix (myDocument.matrix (theNode)));
+      }
+      else {
+        LoadChildren (theNode, theTransform);
+      }
+
+      CsgNode* aNode = combineChildren (myDocument.name (theNode.type), myNodes, aStartIndex, myArena);
+      myNodes.push_back (aNode);
+    }
+
+    //! Reads OpenScad compatibility matrix.
+    Mat4f ReadMatrix (const csg::Document::Value& theMatrix) {
+
+      Mat4f aMatrix = Mat4f::Identity();
+
+      // 4x4 matrices are kept in single precision by the document already
+      if (theMatrix.type == csg::Document::VALUE_MATRIX) {
+        const float* aNumbers = myDocument.matrixFloats (theMatrix);
+
+        for (int i = 0; i < 4; ++i) {
+          aMatrix.row (i) = Vec4f (aNumbers[i * 4], aNumbers[i * 4 + 1], aNumbers[i * 4 + 2], aNumbers[i * 4 + 3]);
+        }
+
+        return aMatrix;
+      }
+
+      for (csg::Document::Index i = 0; i < 4; ++i) {
+        const bool hasRow = theMatrix.type == csg::Document::VALUE_ARRAY && i < theMatrix.size;
+        const csg::Document::Value* anInputRow = hasRow ? myDocument.items (theMatrix) + i : NULL;
+
+        aMatrix.row (i) = Vec4f (Item (anInputRow, 0),
+                                 Item (anInputRow, 1),
+                                 Item (anInputRow, 2),
+                                 Item (anInputRow, 3));
+      }
+
+      return aMatrix;
+    }
+
+    //! Returns array item as a number (0 if there is no such numeric item).
+    float Item (const csg::Document::Value* theArray, const csg::Document::Index theIndex) {
+
+      if (theArray == NULL || theIndex >= theArray->size || theArray->type == csg::Document::VALUE_MATRIX) {
+        return 0.0f;
+      }
+
+      if (theArray->type == csg::Document::VALUE_NUMBERS) {
+        return (float)myDocument.numbers (*theArray)[theIndex];
+      }
+
+      const csg::Document::Value& anItem = myDocument.items (*theArray)[theIndex];
+      return anItem.type == csg::Document::VALUE_NUMBER ? (float)anItem.number : 0.0f;
+    }
+
+  private:
+
+    const csg::Document& myDocument;
+
+    //! Arena of the nodes (NULL for the heap).
+    CsgTreeArena* myArena;
+
+    //! Interned names of primitive properties.
+    csg::Document::Index mySizeName;
+    csg::Document::Index myRadiusName;
+
+    //! Loaded nodes not combined yet.
+    std::vector<CsgNode*> myNodes;
+
+  };
+
+  //! Loads the items of JSON array starting from the given index and creates operation node of them.
   CsgNode* collectNodes (const CsgOperation theOp,
                          const json11::Json theData,
                          const int theStartIndex,
-                         const Mat4f& theTransform) {
+                         const Mat4f& theTransform,
+                         CsgTreeArena* theArena) {
 
     auto& anItems = theData.array_items();
 
-    size_t anActualSize = anItems.size() - theStartIndex;
+    std::vector<CsgNode*> aNodes;
 
-    if (anActualSize == 0) {
-      throw std::runtime_error ("The range should contain at least one element");
+    try {
+      for (size_t anIndex = theStartIndex; anIndex < anItems.size(); ++anIndex) {
+        aNodes.push_back (loadNode (anItems[anIndex], theTransform, theArena));
+      }
+
+      return combineNodes (theOp, aNodes, 0, theArena);
     }
-    else if (anActualSize == 1) {
-      return loadNode (anItems[theStartIndex], theTransform);
+    catch (...) {
+      for (auto aNode : aNodes) {
+        CsgNode::Destroy (aNode);
+      }
+      throw;
     }
-
-    return new CsgOperationNode (theOp,
-                                 loadNode (anItems[theStartIndex], theTransform),
-                                 collectNodes (theOp, theData, theStartIndex + 1, theTransform));
   }
 
-  CsgNode* loadNode (const json11::Json theData, const Mat4f& theTransform) {
+  CsgNode* loadNode (const json11::Json theData, const Mat4f& theTransform, CsgTreeArena* theArena) {
 
     if (theData.is_null()) {
       throw std::runtime_error ("Unexpected NULL object");
     }
 
     if (theData.is_array()) {
-      return loadNode (theData.array_items()[0], theTransform);
+      return collectNodes (CSG_OP_UNION, theData, 0, theTransform, theArena);
     }
 
     if (!theData.is_object()) {
@@ -51,11 +431,11 @@ namespace {
       //                           " " << theData["version-major"].dump() <<
       //                           "." << theData["version-minor"].dump() << std::endl;
 
-      return loadNode (theData["contents"], theTransform);
+      return loadNode (theData["contents"], theTransform, theArena);
     }
     else if (aType == "group") {
 
-      return collectNodes (CSG_OP_UNION, theData["objects"], 0, theTransform);
+      return collectNodes (CSG_OP_UNION, theData["objects"], 0, theTransform, theArena);
     }
     else if (aType == "multmatrix") {
 
@@ -63,79 +443,64 @@ namespace {
 
       // OpenScad compatibility matrix
       if (theData["properties"].is_array()) {
-
-        for (int i = 0; i < 4; ++i) {
-          auto anInputRow = theData["properties"][i];
-          aMatrix.row (i) = Vec4f ((float)anInputRow[0].number_value(),
-                                   (float)anInputRow[1].number_value(),
-                                   (float)anInputRow[2].number_value(),
-                                   (float)anInputRow[3].number_value());
-        }
+        aMatrix = readMatrix (theData["properties"].array_items());
       }
       else {
         // TODO: fetch matrix
       }
 
-      return collectNodes (CSG_OP_UNION, theData["objects"], 0, theTransform * aMatrix);
+      return collectNodes (CSG_OP_UNION, theData["objects"], 0, theTransform * aMatrix, theArena);
     }
     else if (aType == "union") {
-      CsgNode* aFirstNode = loadNode (theData["objects"][0], theTransform);
 
-      // OpenScad compatibility
-      if (theData["objects"].array_items().size() == 1) {
-        return aFirstNode;
+      // OpenScad compatibility: union of single object is the object
+      if (theData["objects"].array_items().empty()) {
+        throw std::runtime_error ("Unexpected NULL object");
       }
 
-      CsgNode* aSecondNode = collectNodes (CSG_OP_UNION, theData["objects"], 1, theTransform);
-      return new CsgOperationNode (CSG_OP_UNION, aFirstNode, aSecondNode);
+      return collectNodes (CSG_OP_UNION, theData["objects"], 0, theTransform, theArena);
     }
-    else if (aType == "difference") {
-      CsgNode* aFirstNode = loadNode (theData["objects"][0], theTransform);
-      CsgNode* aSecondNode = collectNodes (CSG_OP_UNION, theData["objects"], 1, theTransform);
-      return new CsgOperationNode (CSG_OP_MINUS, aFirstNode, aSecondNode);
-    }
-    else if (aType == "intersection") {
-      CsgNode* aFirstNode = loadNode (theData["objects"][0], theTransform);
-      CsgNode* aSecondNode = collectNodes (CSG_OP_INTER, theData["objects"], 1, theTransform);
-      return new CsgOperationNode (CSG_OP_INTER, aFirstNode, aSecondNode);
-    }
-    // else if (aType == "smin") {
-    // }
-    else if (aType == "cube") {
+    else if (aType == "difference" || aType == "intersection") {
 
-      auto aCubeSize = theData["properties"]["size"];
-      
-      Eigen::Affine3f aBoxTransform;
-      if (aCubeSize.is_null()) {
-        aBoxTransform = Eigen::Scaling (1.0f, 1.0f, 1.0f);
+      const size_t aNbObjects = theData["objects"].array_items().size();
+
+      if (aNbObjects == 0) {
+        throw std::runtime_error ("Unexpected NULL object");
       }
-      else {
-        aBoxTransform = Eigen::Scaling ((float)aCubeSize[0].number_value(),
-                                        (float)aCubeSize[1].number_value(),
-                                        (float)aCubeSize[2].number_value());
+      else if (aNbObjects == 1) {
+        throw std::runtime_error ("The range should contain at least one element");
       }
-      return new CsgPrimitiveNode (CSG_BOX, theTransform * aBoxTransform.matrix());
-    }
-    else if (aType == "sphere") {
-
-      double aRadius = theData["properties"]["r"].number_value();
 
-      Eigen::Affine3f aSphereTransform;
-      aSphereTransform = Eigen::Scaling ((float)(aRadius > 0.0 ? aRadius : 1.0));
-      return new CsgPrimitiveNode (CSG_SPHERE, theTransform * aSphereTransform.matrix());
+      return collectNodes (aType == "difference" ? CSG_OP_MINUS : CSG_OP_INTER, theData["objects"], 0, theTransform, theArena);
     }
-    // else if (aType == "cylinder") {
-    // }
-    // else if (aType == "cone") {
+    // else if (aType == "smin") {
     // }
     else {
-      throw std::runtime_error ("Unknown object type: " + theData["type"].dump());
+      return createPrimitive (aType, theData["properties"].object_items(), theTransform, theArena);
     }
   }
 }
 
-CsgNode* CsgLoader::LoadTree (const json11::Json theSerializedTree)
+CsgNode* CsgLoader::LoadTree (const json11::Json theSerializedTree, CsgTreeArena* theArena)
 {
+  // references to shared subtrees are resolved by the document
+  if (!theSerializedTree["definitions"].is_null()) {
+    return LoadDocument (csg::Document::fromJson (theSerializedTree), theArena);
+  }
+
   Mat4f theTransform = Mat4f::Identity();
-  return loadNode (theSerializedTree, theTransform);
-}
\ No newline at end of file
+  return loadNode (theSerializedTree, theTransform, theArena);
+}
+
+CsgNode* CsgLoader::LoadFile (const std::string& theFilePath, CsgTreeArena* theArena)
+{
+  TreeBuilder aBuilder (theArena);
+  csg::Parser::parseEvents (theFilePath, aBuilder);
+  return aBuilder.Result();
+}
+
+CsgNode* CsgLoader::LoadDocument (const csg::Document& theDocument, CsgTreeArena* theArena)
+{
+  DocumentLoader aLoader (theDocument, theArena);
+  return aLoader.Result();
+}
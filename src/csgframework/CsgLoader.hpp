@@ -5,6 +5,8 @@
 
 #include <CsgTree.hpp>
 
+//! Loads CSG-tree from CSG scene. The tree is created in the given arena if specified,
+//! otherwise the caller owns it.
 class CsgLoader
 {
 private:
@@ -13,8 +15,17 @@ private:
 
 public:
 
-  //! Loads CSG-tree from JSON.
-  static CsgNode* LoadTree (const json11::Json theSerializedTree);
+  //! Loads CSG-tree from JSON (subtrees shared by CSGJS definitions are loaded for each reference).
+  static CsgNode* LoadTree (const json11::Json theSerializedTree, CsgTreeArena* theArena = NULL);
+
+  //! Loads CSG-tree from CSG file directly, without intermediate JSON.
+  //! Throws std::runtime_error on syntax error or incorrect CSG-tree.
+  static CsgNode* LoadFile (const std::string& theFilePath, CsgTreeArena* theArena = NULL);
+
+  //! Loads CSG-tree from compact CSG document.
+  //! Shared subtrees of the document are loaded for each reference.
+  //! Throws std::runtime_error on incorrect CSG-tree.
+  static CsgNode* LoadDocument (const csg::Document& theDocument, CsgTreeArena* theArena = NULL);
 
 };
 
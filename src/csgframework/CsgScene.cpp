@@ -0,0 +1,351 @@
+#include "CsgScene.hpp"
+#include "CsgEvaluator.hpp"
+
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+  //! Returns bounds of primitive with the given transformation (see CsgPrimitiveNode::InitializeBounds).
+  Box4f PrimitiveBounds (const Mat4f& theTransform, const bool theIsComplement)
+  {
+    if (theIsComplement)
+    {
+      return Box4f (
+        -Vec4f (std::numeric_limits<float>::max(),
+                std::numeric_limits<float>::max(),
+                std::numeric_limits<float>::max(),
+                1.f),
+         Vec4f (std::numeric_limits<float>::max(),
+                std::numeric_limits<float>::max(),
+                std::numeric_limits<float>::max(),
+                1.f));
+    }
+
+    Box4f aBounds;
+
+    for (int aX = 0; aX < 2; ++aX)
+    {
+      for (int aY = 0; aY < 2; ++aY)
+      {
+        for (int aZ = 0; aZ < 2; ++aZ)
+        {
+          const Vec4f aCorner (aX == 0 ? -1.f : 1.f,
+                               aY == 0 ? -1.f : 1.f,
+                               aZ == 0 ? -1.f : 1.f,
+                               1.f);
+
+          aBounds.Add (theTransform * aCorner);
+        }
+      }
+    }
+
+    return aBounds;
+  }
+}
+
+// =======================================================================
+// function : Build
+// purpose  :
+// =======================================================================
+void CsgScene::Build (const CsgNode* theRoot)
+{
+  myTypes.clear();
+  myChildren.clear();
+  myChildOffsets.assign (1, 0);
+  myParents.clear();
+  myPrimitives.clear();
+  myComplements.clear();
+  myBounds.clear();
+  myTransforms.clear();
+  myInverseRotations.clear();
+  myScalings.clear();
+  myMaterials.clear();
+
+  if (theRoot == NULL)
+  {
+    return;
+  }
+
+  // nodes to visit (operations are visited twice: before and after their children)
+  std::vector<std::pair<const CsgNode*, bool> > aStack (1, std::make_pair (theRoot, false));
+
+  // indices of added nodes which parent is not added yet
+  std::vector<int> aResults;
+
+  // indices of added shared nodes
+  std::unordered_map<const CsgNode*, int> aSharedNodes;
+
+  while (!aStack.empty())
+  {
+    const CsgNode* aNode = aStack.back().first;
+    const bool isVisited = aStack.back().second;
+
+    aStack.pop_back();
+
+    if (aNode->IsShared() && !isVisited)
+    {
+      std::unordered_map<const CsgNode*, int>::const_iterator aShared = aSharedNodes.find (aNode);
+
+      if (aShared != aSharedNodes.end())
+      {
+        aResults.push_back (aShared->second);
+        continue;
+      }
+    }
+
+    if (!aNode->IsLeaf() && !isVisited)
+    {
+      const CsgOperationNode* anOperation = static_cast<const CsgOperationNode*> (aNode);
+
+      aStack.push_back (std::make_pair (aNode, true));
+
+      for (int aChild = anOperation->NbChildren() - 1; aChild >= 0; --aChild)
+      {
+        aStack.push_back (std::make_pair (anOperation->Child (aChild), false));
+      }
+      continue;
+    }
+
+    const int anIndex = AddNode (aNode);
+
+    if (!aNode->IsLeaf())
+    {
+      // the children are the last added nodes without parent
+      const size_t aNbChildren = static_cast<const CsgOperationNode*> (aNode)->NbChildren();
+
+      for (size_t aChild = aResults.size() - aNbChildren; aChild < aResults.size(); ++aChild)
+      {
+        myChildren.push_back (aResults[aChild]);
+
+        if (myParents[aResults[aChild]] < 0)
+        {
+          myParents[aResults[aChild]] = anIndex;
+        }
+      }
+
+      aResults.resize (aResults.size() - aNbChildren);
+    }
+
+    myChildOffsets.push_back (static_cast<int> (myChildren.size()));
+    aResults.push_back (anIndex);
+
+    if (aNode->IsShared())
+    {
+      aSharedNodes[aNode] = anIndex;
+    }
+  }
+}
+
+// =======================================================================
+// function : AddNode
+// purpose  :
+// =======================================================================
+int CsgScene::AddNode (const CsgNode* theNode)
+{
+  const int anIndex = NbNodes();
+
+  myTypes.push_back (theNode->TypeID());
+  myParents.push_back (-1);
+  myComplements.push_back (theNode->IsComplement() ? 1 : 0);
+  myBounds.push_back (theNode->Bounds());
+
+  if (!theNode->IsLeaf())
+  {
+    myPrimitives.push_back (-1);
+    return anIndex;
+  }
+
+  const CsgPrimitiveNode* aPrimitive = static_cast<const CsgPrimitiveNode*> (theNode);
+
+  Mat4f anInverseRotation;
+  Vec3f aScaling;
+
+  CsgEvaluator::SplitTransform (aPrimitive->Transform(), anInverseRotation, aScaling);
+
+  myPrimitives.push_back (NbPrimitives());
+  myTransforms.push_back (aPrimitive->Transform());
+  myInverseRotations.push_back (anInverseRotation);
+  myScalings.push_back (aScaling);
+  myMaterials.push_back (aPrimitive->Material());
+
+  return anIndex;
+}
+
+// =======================================================================
+// function : OperationBounds
+// purpose  :
+// =======================================================================
+Box4f CsgScene::OperationBounds (const int theNode) const
+{
+  Box4f aBounds = myBounds[Child (theNode, 0)];
+
+  if (myTypes[theNode] == CSG_OP_MINUS)
+  {
+    return aBounds;
+  }
+
+  for (int anIndex = 1; anIndex < NbChildren (theNode); ++anIndex)
+  {
+    if (myTypes[theNode] == CSG_OP_UNION)
+    {
+      aBounds = tools::Combine (aBounds, myBounds[Child (theNode, anIndex)]);
+    }
+    else
+    {
+      aBounds = tools::Intersect (aBounds, myBounds[Child (theNode, anIndex)]);
+    }
+  }
+
+  return aBounds;
+}
+
+// =======================================================================
+// function : ToTree
+// purpose  :
+// =======================================================================
+CsgNode* CsgScene::ToTree (CsgTreeArena* theArena) const
+{
+  std::vector<CsgNode*> aResults (NbNodes(), NULL);
+
+  // marks that the node is a child of some created operation
+  std::vector<char> isAttached (NbNodes(), 0);
+
+  try
+  {
+    for (int aNode = 0; aNode < NbNodes(); ++aNode)
+    {
+      CsgNode* aResult = NULL;
+
+      if (IsLeaf (aNode))
+      {
+        const int aPrimitive = myPrimitives[aNode];
+
+        aResult = CsgTreeArena::Create<CsgPrimitiveNode> (theArena, myTypes[aNode], myTransforms[aPrimitive], myMaterials[aPrimitive]);
+      }
+      else
+      {
+        CsgOperationNode* anOperation = CsgTreeArena::Create<CsgOperationNode> (theArena, static_cast<CsgOperation> (myTypes[aNode]));
+
+        aResult = anOperation;
+        aResults[aNode] = aResult;
+
+        anOperation->Reserve (NbChildren (aNode));
+
+        // nodes shared in the scene are shared in the tree
+        for (int anIndex = 0; anIndex < NbChildren (aNode); ++anIndex)
+        {
+          CsgNode* aChild = aResults[Child (aNode, anIndex)];
+
+          if (isAttached[Child (aNode, anIndex)] != 0)
+          {
+            aChild->AddReference();
+          }
+
+          anOperation->AddChild (aChild);
+          isAttached[Child (aNode, anIndex)] = 1;
+        }
+      }
+
+      aResult->SetComplement (myComplements[aNode] != 0);
+      aResult->SetBounds (myBounds[aNode]);
+
+      aResults[aNode] = aResult;
+    }
+  }
+  catch (...)
+  {
+    for (int aNode = 0; aNode < NbNodes(); ++aNode)
+    {
+      if (isAttached[aNode] == 0)
+      {
+        CsgNode::Destroy (aResults[aNode]);
+      }
+    }
+
+    throw;
+  }
+
+  return aResults.empty() ? NULL : aResults.back();
+}
+
+// =======================================================================
+// function : InitializeBounds
+// purpose  :
+// =======================================================================
+void CsgScene::InitializeBounds()
+{
+  for (int aNode = 0; aNode < NbNodes(); ++aNode)
+  {
+    const int aPrimitive = myPrimitives[aNode];
+
+    if (aPrimitive >= 0)
+    {
+      myBounds[aNode] = PrimitiveBounds (myTransforms[aPrimitive], myComplements[aNode] != 0);
+    }
+    else
+    {
+      myBounds[aNode] = OperationBounds (aNode);
+    }
+  }
+}
+
+// =======================================================================
+// function : GrowBounds
+// purpose  :
+// =======================================================================
+bool CsgScene::GrowBounds()
+{
+  bool aResult = false;
+
+  for (int aNode = 0; aNode < NbNodes(); ++aNode)
+  {
+    if (myPrimitives[aNode] >= 0)
+    {
+      continue;
+    }
+
+    const float aBaseArea = myBounds[aNode].Area();
+
+    myBounds[aNode] = OperationBounds (aNode);
+
+    aResult |= myBounds[aNode].Area() < aBaseArea;
+  }
+
+  return aResult;
+}
+
+// =======================================================================
+// function : ClipBounds
+// purpose  :
+// =======================================================================
+bool CsgScene::ClipBounds (const Box4f& theBounds)
+{
+  bool aResult = false;
+
+  if (NbNodes() == 0)
+  {
+    return aResult;
+  }
+
+  // bounds of the parents of nodes (shared nodes are clipped with all of their parents)
+  std::vector<Box4f, Eigen::aligned_allocator<Box4f> > aClipBounds (NbNodes());
+  aClipBounds[Root()] = theBounds;
+
+  // parents follow their children, so they are clipped first
+  for (int aNode = NbNodes() - 1; aNode >= 0; --aNode)
+  {
+    const float aBaseArea = myBounds[aNode].Area();
+
+    myBounds[aNode] = tools::Intersect (myBounds[aNode], aClipBounds[aNode]);
+
+    aResult |= myBounds[aNode].Area() < aBaseArea;
+
+    for (int anIndex = 0; anIndex < NbChildren (aNode); ++anIndex)
+    {
+      aClipBounds[Child (aNode, anIndex)] = tools::Combine (aClipBounds[Child (aNode, anIndex)], myBounds[aNode]);
+    }
+  }
+
+  return aResult;
+}
@@ -0,0 +1,195 @@
+#ifndef HEADER_CSG_SCENE
+#define HEADER_CSG_SCENE
+
+#include "CsgTree.hpp"
+
+#include <vector>
+
+//! Compiled form of CSG tree for traversal-heavy passes.
+//! Nodes are stored in postorder (children precede their parent, the root is the last node)
+//! as structure of arrays: type identifiers, child ranges and parent indices, complement flags
+//! and bounds. Primitives refer to separate aligned table of transforms and materials,
+//! which also keeps the data used by distance evaluation (inverse rotation and scaling),
+//! so evaluators and bounds passes are linear loops over the arrays instead of recursive
+//! virtual calls chasing pointers. The scene is built without recursion, so deep trees
+//! (e.g. long chains of unions) are handled as well. Shared subtrees of the tree (see CsgSharing)
+//! are stored once and referred by all of their parents, so they are evaluated once per point.
+class CsgScene
+{
+public:
+
+  //! Creates empty scene.
+  CsgScene()
+  {
+    //
+  }
+
+  //! Creates scene of the given CSG tree.
+  explicit CsgScene (const CsgNode* theRoot)
+  {
+    Build (theRoot);
+  }
+
+public:
+
+  //! Builds scene of the given CSG tree (complement flags, bounds and shared nodes are kept).
+  void Build (const CsgNode* theRoot);
+
+  //! Creates CSG tree of the scene (NULL for empty scene, shared nodes stay shared) in the
+  //! given arena if specified, otherwise the caller owns the result.
+  CsgNode* ToTree (CsgTreeArena* theArena = NULL) const;
+
+  //! Returns number of nodes.
+  int NbNodes() const
+  {
+    return static_cast<int> (myTypes.size());
+  }
+
+  //! Returns number of primitives (shared primitives are counted once).
+  int NbPrimitives() const
+  {
+    return static_cast<int> (myTransforms.size());
+  }
+
+  //! Returns index of the root node (-1 for empty scene).
+  int Root() const
+  {
+    return NbNodes() - 1;
+  }
+
+public:
+
+  //! Returns type identifier of the node (CsgOperation or CsgPrimitiveId).
+  int TypeID (const int theNode) const
+  {
+    return myTypes[theNode];
+  }
+
+  //! Determines if the node is a leaf.
+  bool IsLeaf (const int theNode) const
+  {
+    return myPrimitives[theNode] >= 0;
+  }
+
+  //! Returns number of children of the node (0 for leaves).
+  int NbChildren (const int theNode) const
+  {
+    return myChildOffsets[theNode + 1] - myChildOffsets[theNode];
+  }
+
+  //! Returns index of the specified child of operation node (the last child is the preceding node,
+  //! unless it is shared child, which keeps the index of its first occurrence).
+  int Child (const int theNode, const int theIndex) const
+  {
+    return myChildren[myChildOffsets[theNode] + theIndex];
+  }
+
+  //! Returns index of the parent node (-1 for the root, the first parent for shared nodes).
+  int Parent (const int theNode) const
+  {
+    return myParents[theNode];
+  }
+
+  //! Returns index of primitive of the leaf node (-1 for operations).
+  int Primitive (const int theNode) const
+  {
+    return myPrimitives[theNode];
+  }
+
+  //! Checks if the node is complement.
+  bool IsComplement (const int theNode) const
+  {
+    return myComplements[theNode] != 0;
+  }
+
+  //! Returns bounding box of the node.
+  const Box4f& Bounds (const int theNode) const
+  {
+    return myBounds[theNode];
+  }
+
+public:
+
+  //! Returns transformation of the primitive.
+  const Mat4f& Transform (const int thePrimitive) const
+  {
+    return myTransforms[thePrimitive];
+  }
+
+  //! Returns inverse of the transformation without scaling (see CsgEvaluator::SplitTransform).
+  const Mat4f& InverseRotation (const int thePrimitive) const
+  {
+    return myInverseRotations[thePrimitive];
+  }
+
+  //! Returns scaling of the transformation along the axes.
+  const Vec3f& Scaling (const int thePrimitive) const
+  {
+    return myScalings[thePrimitive];
+  }
+
+  //! Returns material of the primitive.
+  const CsgShapeMaterial& Material (const int thePrimitive) const
+  {
+    return myMaterials[thePrimitive];
+  }
+
+public:
+
+  //! Computes initial bounds of all nodes (see CsgNode::InitializeBounds).
+  void InitializeBounds();
+
+  //! Updates bounds of operations from their children (see CsgOperationNode::GrowBounds).
+  //! Returns true if some bounds got smaller.
+  bool GrowBounds();
+
+  //! Clips bounds of the root with the given box and bounds of other nodes with the bounds
+  //! of their parents (see CsgNode::ClipBounds), shared nodes are clipped with the union
+  //! of bounds of all their parents. Returns true if some bounds got smaller.
+  bool ClipBounds (const Box4f& theBounds);
+
+private:
+
+  //! Appends node to the arrays.
+  int AddNode (const CsgNode* theNode);
+
+  //! Returns bounds of operation node from the bounds of its children.
+  Box4f OperationBounds (const int theNode) const;
+
+private:
+
+  //! Type identifiers of nodes.
+  std::vector<int> myTypes;
+
+  //! Child indices of all nodes (children of node N are stored
+  //! from myChildOffsets[N] to myChildOffsets[N + 1]).
+  std::vector<int> myChildren;
+  std::vector<int> myChildOffsets;
+
+  //! Parent indices of nodes (-1 for the root, the first parent for shared nodes).
+  std::vector<int> myParents;
+
+  //! Primitive indices of nodes (-1 for operations).
+  std::vector<int> myPrimitives;
+
+  //! Complement flags of nodes.
+  std::vector<char> myComplements;
+
+  //! Bounds of nodes.
+  std::vector<Box4f, Eigen::aligned_allocator<Box4f> > myBounds;
+
+  //! Transformations of primitives.
+  std::vector<Mat4f, Eigen::aligned_allocator<Mat4f> > myTransforms;
+
+  //! Inverse transformations of primitives without scaling.
+  std::vector<Mat4f, Eigen::aligned_allocator<Mat4f> > myInverseRotations;
+
+  //! Scaling of transformations of primitives.
+  Array3f myScalings;
+
+  //! Materials of primitives.
+  std::vector<CsgShapeMaterial, Eigen::aligned_allocator<CsgShapeMaterial> > myMaterials;
+
+};
+
+#endif // HEADER_CSG_SCENE
@@ -0,0 +1,587 @@
+#include "CsgSharing.hpp"
+
+#include <Eigen/LU>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+const float CsgSharing::Tolerance = 1.0e-4f;
+
+namespace
+{
+  //! Number of quantization steps per unit used by signatures of instances.
+  static const float THE_QUANTIZATION = 64.f;
+
+  //! Mixes the value into the hash.
+  void HashCombine (size_t& theHash, const size_t theValue)
+  {
+    theHash ^= theValue + 0x9e3779b9 + (theHash << 6) + (theHash >> 2);
+  }
+
+  //! Mixes bits of the float into the hash (zeros of both signs are the same).
+  void HashFloat (size_t& theHash, const float theValue)
+  {
+    uint32_t aBits = 0;
+
+    if (theValue != 0.f)
+    {
+      std::memcpy (&aBits, &theValue, sizeof (aBits));
+    }
+
+    HashCombine (theHash, aBits);
+  }
+
+  //! Mixes quantized value into the hash, returns false for infinite values.
+  bool HashQuantized (size_t& theHash, const float theValue)
+  {
+    if (!std::isfinite (theValue))
+    {
+      return false;
+    }
+
+    HashCombine (theHash, static_cast<size_t> (std::llround (theValue * THE_QUANTIZATION)));
+
+    return true;
+  }
+
+  // =======================================================================
+  // function : CollectNodes
+  // purpose  : Returns nodes of the tree in postorder (shared nodes are visited once)
+  // =======================================================================
+  void CollectNodes (const CsgNode* theRoot, std::vector<const CsgNode*>& theNodes)
+  {
+    std::vector<std::pair<const CsgNode*, bool> > aStack (1, std::make_pair (theRoot, false));
+
+    std::unordered_set<const CsgNode*> aShared;
+
+    while (!aStack.empty())
+    {
+      const CsgNode* aNode = aStack.back().first;
+      const bool isVisited = aStack.back().second;
+
+      aStack.pop_back();
+
+      if (!isVisited && aNode->IsShared() && !aShared.insert (aNode).second)
+      {
+        continue;
+      }
+
+      if (!aNode->IsLeaf() && !isVisited)
+      {
+        const CsgOperationNode* anOperation = static_cast<const CsgOperationNode*> (aNode);
+
+        aStack.push_back (std::make_pair (aNode, true));
+
+        for (int anIndex = anOperation->NbChildren() - 1; anIndex >= 0; --anIndex)
+        {
+          aStack.push_back (std::make_pair (anOperation->Child (anIndex), false));
+        }
+        continue;
+      }
+
+      theNodes.push_back (aNode);
+    }
+  }
+
+  // =======================================================================
+  // function : NodeHash
+  // purpose  : Returns structural hash of the node from the hashes of its children
+  // =======================================================================
+  size_t NodeHash (const CsgNode* theNode, const std::unordered_map<const CsgNode*, size_t>& theHashes)
+  {
+    size_t aHash = static_cast<size_t> (theNode->TypeID());
+
+    HashCombine (aHash, theNode->IsComplement() ? 1 : 0);
+
+    if (theNode->IsLeaf())
+    {
+      const CsgPrimitiveNode* aPrimitive = static_cast<const CsgPrimitiveNode*> (theNode);
+
+      for (int anIndex = 0; anIndex < 16; ++anIndex)
+      {
+        HashFloat (aHash, aPrimitive->Transform().data()[anIndex]);
+      }
+
+      for (int anIndex = 0; anIndex < 4; ++anIndex)
+      {
+        HashFloat (aHash, aPrimitive->Material().Color[anIndex]);
+      }
+
+      return aHash;
+    }
+
+    const CsgOperationNode* anOperation = static_cast<const CsgOperationNode*> (theNode);
+
+    HashCombine (aHash, static_cast<size_t> (anOperation->NbChildren()));
+
+    for (int anIndex = 0; anIndex < anOperation->NbChildren(); ++anIndex)
+    {
+      HashCombine (aHash, theHashes.find (anOperation->Child (anIndex))->second);
+    }
+
+    return aHash;
+  }
+
+  // =======================================================================
+  // function : IsSame
+  // purpose  : Checks if the nodes are identical (children are compared by address,
+  //            so they should be merged before)
+  // =======================================================================
+  bool IsSame (const CsgNode* theNode1, const CsgNode* theNode2)
+  {
+    if (theNode1->TypeID() != theNode2->TypeID()
+     || theNode1->IsLeaf() != theNode2->IsLeaf()
+     || theNode1->IsComplement() != theNode2->IsComplement())
+    {
+      return false;
+    }
+
+    if (theNode1->IsLeaf())
+    {
+      const CsgPrimitiveNode* aPrimitive1 = static_cast<const CsgPrimitiveNode*> (theNode1);
+      const CsgPrimitiveNode* aPrimitive2 = static_cast<const CsgPrimitiveNode*> (theNode2);
+
+      return aPrimitive1->Transform() == aPrimitive2->Transform()
+          && aPrimitive1->Material().Color == aPrimitive2->Material().Color;
+    }
+
+    const CsgOperationNode* anOperation1 = static_cast<const CsgOperationNode*> (theNode1);
+    const CsgOperationNode* anOperation2 = static_cast<const CsgOperationNode*> (theNode2);
+
+    if (anOperation1->NbChildren() != anOperation2->NbChildren())
+    {
+      return false;
+    }
+
+    for (int anIndex = 0; anIndex < anOperation1->NbChildren(); ++anIndex)
+    {
+      if (anOperation1->Child (anIndex) != anOperation2->Child (anIndex))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // =======================================================================
+  // function : IsRigid
+  // purpose  : Checks if the transformation is rotation and translation
+  // =======================================================================
+  bool IsRigid (const Mat4f& theTransform)
+  {
+    const Mat3f aRotation = theTransform.topLeftCorner<3, 3>();
+
+    return (aRotation.transpose() * aRotation - Mat3f::Identity()).cwiseAbs().maxCoeff() <= CsgSharing::Tolerance
+        && aRotation.determinant() > 0.f
+        && theTransform.row (3).isApprox (Vec4f (0.f, 0.f, 0.f, 1.f).transpose());
+  }
+
+  // =======================================================================
+  // function : IsInstance
+  // purpose  : Checks if the transformation maps the original subtree onto the other one
+  // =======================================================================
+  bool IsInstance (const CsgNode* theOriginal, const CsgNode* theNode, const Mat4f& theTransform)
+  {
+    std::vector<std::pair<const CsgNode*, const CsgNode*> > aStack (1, std::make_pair (theOriginal, theNode));
+
+    while (!aStack.empty())
+    {
+      const CsgNode* aNode1 = aStack.back().first;
+      const CsgNode* aNode2 = aStack.back().second;
+
+      aStack.pop_back();
+
+      if (aNode1->TypeID() != aNode2->TypeID()
+       || aNode1->IsLeaf() != aNode2->IsLeaf()
+       || aNode1->IsComplement() != aNode2->IsComplement())
+      {
+        return false;
+      }
+
+      if (aNode1->IsLeaf())
+      {
+        const CsgPrimitiveNode* aPrimitive1 = static_cast<const CsgPrimitiveNode*> (aNode1);
+        const CsgPrimitiveNode* aPrimitive2 = static_cast<const CsgPrimitiveNode*> (aNode2);
+
+        const float aScale = std::max (1.f, aPrimitive2->Transform().cwiseAbs().maxCoeff());
+
+        if (aPrimitive1->Material().Color != aPrimitive2->Material().Color
+         || (theTransform * aPrimitive1->Transform() - aPrimitive2->Transform()).cwiseAbs().maxCoeff() > CsgSharing::Tolerance * aScale)
+        {
+          return false;
+        }
+        continue;
+      }
+
+      const CsgOperationNode* anOperation1 = static_cast<const CsgOperationNode*> (aNode1);
+      const CsgOperationNode* anOperation2 = static_cast<const CsgOperationNode*> (aNode2);
+
+      if (anOperation1->NbChildren() != anOperation2->NbChildren())
+      {
+        return false;
+      }
+
+      for (int anIndex = 0; anIndex < anOperation1->NbChildren(); ++anIndex)
+      {
+        aStack.push_back (std::make_pair (anOperation1->Child (anIndex), anOperation2->Child (anIndex)));
+      }
+    }
+
+    return true;
+  }
+
+  //! Data of subtree used to find its instances.
+  struct SubtreeInfo
+  {
+    size_t Signature;    //!< hash invariant to rigid transformations
+    int    FirstLeaf;    //!< index of the first primitive of the subtree
+    int    NbPrimitives; //!< number of primitives of the subtree
+    bool   IsValid;      //!< marks that the frames of primitives are invertible
+  };
+}
+
+// =======================================================================
+// function : Hash
+// purpose  :
+// =======================================================================
+size_t CsgSharing::Hash (const CsgNode* theNode)
+{
+  if (theNode == NULL)
+  {
+    return 0;
+  }
+
+  std::vector<const CsgNode*> aNodes;
+  CollectNodes (theNode, aNodes);
+
+  std::unordered_map<const CsgNode*, size_t> aHashes;
+
+  for (size_t anIndex = 0; anIndex < aNodes.size(); ++anIndex)
+  {
+    aHashes[aNodes[anIndex]] = NodeHash (aNodes[anIndex], aHashes);
+  }
+
+  return aHashes[theNode];
+}
+
+// =======================================================================
+// function : ShareSubtrees
+// purpose  :
+// =======================================================================
+int CsgSharing::ShareSubtrees (CsgNode* theRoot)
+{
+  if (theRoot == NULL)
+  {
+    return 0;
+  }
+
+  std::vector<const CsgNode*> aNodes;
+  CollectNodes (theRoot, aNodes);
+
+  std::unordered_map<const CsgNode*, size_t> aHashes;
+
+  // the first occurrences of subtrees by their hashes
+  std::unordered_multimap<size_t, CsgNode*> anOriginals;
+
+  // merged subtrees and their first occurrences
+  std::unordered_map<const CsgNode*, CsgNode*> aMerged;
+
+  // references to merged subtrees replaced in their parents
+  std::vector<CsgNode*> aReleased;
+
+  // children are visited before their parents, so they are merged already
+  for (size_t aNodeIndex = 0; aNodeIndex < aNodes.size(); ++aNodeIndex)
+  {
+    // the nodes belong to the given tree
+    CsgNode* aNode = const_cast<CsgNode*> (aNodes[aNodeIndex]);
+
+    if (!aNode->IsLeaf())
+    {
+      CsgOperationNode* anOperation = static_cast<CsgOperationNode*> (aNode);
+
+      for (int anIndex = 0; anIndex < anOperation->NbChildren(); ++anIndex)
+      {
+        std::unordered_map<const CsgNode*, CsgNode*>::const_iterator anOriginal = aMerged.find (anOperation->Child (anIndex));
+
+        if (anOriginal != aMerged.end())
+        {
+          aReleased.push_back (anOperation->Child (anIndex));
+
+          anOriginal->second->AddReference();
+          anOperation->SetChild (anIndex, anOriginal->second);
+        }
+      }
+    }
+
+    const size_t aHash = NodeHash (aNode, aHashes);
+    aHashes[aNode] = aHash;
+
+    bool isMerged = false;
+
+    for (std::unordered_multimap<size_t, CsgNode*>::const_iterator anOriginal = anOriginals.find (aHash);
+         anOriginal != anOriginals.end() && anOriginal->first == aHash; ++anOriginal)
+    {
+      if (IsSame (anOriginal->second, aNode))
+      {
+        // bounds clipped in different places are combined
+        anOriginal->second->SetBounds (tools::Combine (anOriginal->second->Bounds(), aNode->Bounds()));
+
+        aMerged[aNode] = anOriginal->second;
+        isMerged = true;
+        break;
+      }
+    }
+
+    if (!isMerged)
+    {
+      anOriginals.insert (std::make_pair (aHash, aNode));
+    }
+  }
+
+  // merged subtrees are released after the pass, so their addresses are not reused
+  for (size_t anIndex = 0; anIndex < aReleased.size(); ++anIndex)
+  {
+    CsgNode::Destroy (aReleased[anIndex]);
+  }
+
+  return static_cast<int> (aReleased.size());
+}
+
+// =======================================================================
+// function : NbUniqueNodes
+// purpose  :
+// =======================================================================
+int CsgSharing::NbUniqueNodes (const CsgNode* theRoot)
+{
+  if (theRoot == NULL)
+  {
+    return 0;
+  }
+
+  std::vector<const CsgNode*> aNodes;
+  CollectNodes (theRoot, aNodes);
+
+  return static_cast<int> (aNodes.size());
+}
+
+// =======================================================================
+// function : FindInstances
+// purpose  :
+// =======================================================================
+void CsgSharing::FindInstances (const CsgNode* theRoot,
+                                std::vector<CsgInstanceGroup>& theGroups,
+                                const int theMinPrimitives)
+{
+  theGroups.clear();
+
+  if (theRoot == NULL)
+  {
+    return;
+  }
+
+  std::vector<const CsgNode*> aNodes;
+  CollectNodes (theRoot, aNodes);
+
+  std::unordered_map<const CsgNode*, int> anIndices;
+
+  std::vector<SubtreeInfo> anInfos (aNodes.size());
+
+  // inverse transformations of the first primitives of subtrees, the frames of subtrees
+  // are compared relative to them, so the signatures don't depend on placement
+  std::vector<Mat4f, Eigen::aligned_allocator<Mat4f> > anInverses (aNodes.size());
+
+  for (size_t aNodeIndex = 0; aNodeIndex < aNodes.size(); ++aNodeIndex)
+  {
+    const CsgNode* aNode = aNodes[aNodeIndex];
+    SubtreeInfo& anInfo = anInfos[aNodeIndex];
+
+    anIndices[aNode] = static_cast<int> (aNodeIndex);
+
+    anInfo.Signature = static_cast<size_t> (aNode->TypeID());
+    anInfo.IsValid = true;
+
+    HashCombine (anInfo.Signature, aNode->IsComplement() ? 1 : 0);
+
+    if (aNode->IsLeaf())
+    {
+      const CsgPrimitiveNode* aPrimitive = static_cast<const CsgPrimitiveNode*> (aNode);
+
+      anInfo.FirstLeaf = static_cast<int> (aNodeIndex);
+      anInfo.NbPrimitives = 1;
+
+      const Mat3f aLinear = aPrimitive->Transform().topLeftCorner<3, 3>();
+
+      // the shape of primitive (its scaling and shear) doesn't change under rotation
+      const Mat3f aShape = aLinear.transpose() * aLinear;
+
+      for (int anIndex = 0; anIndex < 9; ++anIndex)
+      {
+        anInfo.IsValid &= HashQuantized (anInfo.Signature, aShape.data()[anIndex]);
+      }
+
+      for (int anIndex = 0; anIndex < 4; ++anIndex)
+      {
+        HashFloat (anInfo.Signature, aPrimitive->Material().Color[anIndex]);
+      }
+
+      anInfo.IsValid &= std::abs (aLinear.determinant()) > 0.f;
+
+      if (anInfo.IsValid)
+      {
+        anInverses[aNodeIndex] = aPrimitive->Transform().inverse();
+      }
+      continue;
+    }
+
+    const CsgOperationNode* anOperation = static_cast<const CsgOperationNode*> (aNode);
+
+    const SubtreeInfo& aFirstInfo = anInfos[anIndices[anOperation->Child (0)]];
+
+    anInfo.FirstLeaf = aFirstInfo.FirstLeaf;
+    anInfo.NbPrimitives = 0;
+
+    HashCombine (anInfo.Signature, static_cast<size_t> (anOperation->NbChildren()));
+
+    for (int anIndex = 0; anIndex < anOperation->NbChildren(); ++anIndex)
+    {
+      const SubtreeInfo& aChildInfo = anInfos[anIndices[anOperation->Child (anIndex)]];
+
+      anInfo.NbPrimitives += aChildInfo.NbPrimitives;
+      anInfo.IsValid &= aChildInfo.IsValid;
+
+      HashCombine (anInfo.Signature, aChildInfo.Signature);
+
+      if (!anInfo.IsValid)
+      {
+        break;
+      }
+
+      // placement of the child relative to the frame of the subtree
+      const Mat4f aPlacement = anInverses[anInfo.FirstLeaf]
+        * static_cast<const CsgPrimitiveNode*> (aNodes[aChildInfo.FirstLeaf])->Transform();
+
+      for (int aRow = 0; aRow < 3; ++aRow)
+      {
+        for (int aCol = 0; aCol < 4; ++aCol)
+        {
+          anInfo.IsValid &= HashQuantized (anInfo.Signature, aPlacement (aRow, aCol));
+        }
+      }
+    }
+  }
+
+  // number of candidate subtrees with the same signature
+  std::unordered_map<size_t, int> aCounts;
+
+  for (size_t aNodeIndex = 0; aNodeIndex < aNodes.size(); ++aNodeIndex)
+  {
+    if (anInfos[aNodeIndex].IsValid && anInfos[aNodeIndex].NbPrimitives >= theMinPrimitives)
+    {
+      ++aCounts[anInfos[aNodeIndex].Signature];
+    }
+  }
+
+  // subtrees are visited from the root, so the largest instances are found first
+  std::vector<const CsgNode*> aStack (1, theRoot);
+
+  std::unordered_set<const CsgNode*> aShared;
+
+  // subtrees without instances are not reported, and their children are searched
+  // in the next round (they may contain instances found by other subtrees)
+  std::vector<CsgInstanceGroup> aResult;
+
+  while (!aStack.empty())
+  {
+    // groups of subtrees by the signatures of their originals
+    std::unordered_multimap<size_t, size_t> aGroups;
+
+    theGroups.clear();
+
+    while (!aStack.empty())
+    {
+      const CsgNode* aNode = aStack.back();
+      aStack.pop_back();
+
+      if (aNode->IsShared() && !aShared.insert (aNode).second)
+      {
+        continue;
+      }
+
+      const int aNodeIndex = anIndices[aNode];
+      const SubtreeInfo& anInfo = anInfos[aNodeIndex];
+
+      if (anInfo.IsValid && anInfo.NbPrimitives >= theMinPrimitives && aCounts[anInfo.Signature] > 1)
+      {
+        const Mat4f& aFrame = static_cast<const CsgPrimitiveNode*> (aNodes[anInfo.FirstLeaf])->Transform();
+
+        bool isFound = false;
+
+        for (std::unordered_multimap<size_t, size_t>::const_iterator aGroup = aGroups.find (anInfo.Signature);
+             aGroup != aGroups.end() && aGroup->first == anInfo.Signature && !isFound; ++aGroup)
+        {
+          CsgInstanceGroup& anInstances = theGroups[aGroup->second];
+
+          const Mat4f aTransform = aFrame * anInverses[anInfos[anIndices[anInstances.Nodes.front()]].FirstLeaf];
+
+          if (IsRigid (aTransform) && IsInstance (anInstances.Nodes.front(), aNode, aTransform))
+          {
+            anInstances.Nodes.push_back (aNode);
+            anInstances.Transforms.push_back (aTransform);
+
+            isFound = true;
+          }
+        }
+
+        if (!isFound)
+        {
+          aGroups.insert (std::make_pair (anInfo.Signature, theGroups.size()));
+
+          theGroups.push_back (CsgInstanceGroup());
+          theGroups.back().Nodes.push_back (aNode);
+          theGroups.back().Transforms.push_back (Mat4f::Identity());
+        }
+        continue;
+      }
+
+      if (!aNode->IsLeaf())
+      {
+        const CsgOperationNode* anOperation = static_cast<const CsgOperationNode*> (aNode);
+
+        for (int anIndex = anOperation->NbChildren() - 1; anIndex >= 0; --anIndex)
+        {
+          aStack.push_back (anOperation->Child (anIndex));
+        }
+      }
+    }
+
+    for (size_t anIndex = 0; anIndex < theGroups.size(); ++anIndex)
+    {
+      if (theGroups[anIndex].Nodes.size() > 1)
+      {
+        aResult.push_back (theGroups[anIndex]);
+      }
+    }
+
+    // children of the last singletons are pushed first, so the next round keeps preorder
+    for (size_t anIndex = theGroups.size(); anIndex-- > 0;)
+    {
+      const CsgNode* anOriginal = theGroups[anIndex].Nodes.front();
+
+      if (theGroups[anIndex].Nodes.size() == 1 && !anOriginal->IsLeaf())
+      {
+        const CsgOperationNode* anOperation = static_cast<const CsgOperationNode*> (anOriginal);
+
+        for (int aChild = anOperation->NbChildren() - 1; aChild >= 0; --aChild)
+        {
+          aStack.push_back (anOperation->Child (aChild));
+        }
+      }
+    }
+  }
+
+  theGroups.swap (aResult);
+}
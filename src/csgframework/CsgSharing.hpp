@@ -0,0 +1,62 @@
+#ifndef HEADER_CSG_SHARING
+#define HEADER_CSG_SHARING
+
+#include "CsgTree.hpp"
+
+#include <vector>
+
+//! Group of subtrees which are the same up to rigid transformations.
+struct CsgInstanceGroup
+{
+  //! Subtrees of the group (the first one is the original of the others).
+  std::vector<const CsgNode*> Nodes;
+
+  //! Rigid transformations mapping the original onto the subtrees (identity for the original).
+  std::vector<Mat4f, Eigen::aligned_allocator<Mat4f> > Transforms;
+};
+
+//! Finds repeated subtrees of CSG tree.
+//! Structural hash of a subtree covers its operations, complement flags, primitive types,
+//! transformations and materials. Identical subtrees are merged into a single node shared
+//! by all of their parents (hash-consing), so the tree becomes directed acyclic graph, which
+//! takes less memory and is evaluated once per point in CsgScene. Subtrees placed with
+//! different rigid transformations can't be shared, as the tree has no transformation nodes,
+//! so they are reported as groups of instances instead.
+//! All passes over the tree handle shared nodes: modifying passes (ToPositiveForm,
+//! ToGeneralForm) copy shared children before changing them, Regroup keeps them as operands
+//! and regroups every shared node once, ClipBounds doesn't clip them, and the shared node
+//! is deleted with its last parent.
+class CsgSharing
+{
+private:
+
+  CsgSharing();
+
+public:
+
+  //! Relative tolerance of comparison of transformations of instances.
+  static const float Tolerance;
+
+public:
+
+  //! Returns structural hash of the subtree (equal for identical subtrees).
+  static size_t Hash (const CsgNode* theNode);
+
+  //! Merges identical subtrees of the tree into shared nodes, returns number of replaced
+  //! references. Bounds of shared nodes are combined from all merged subtrees.
+  static int ShareSubtrees (CsgNode* theRoot);
+
+  //! Returns number of distinct nodes of the tree (shared nodes are counted once).
+  static int NbUniqueNodes (const CsgNode* theRoot);
+
+  //! Finds groups of subtrees (with at least the given number of primitives) which are the
+  //! same up to rigid transformations, so they could be replaced by instances of the first
+  //! subtree of the group. Subtrees of found instances are not searched further, subtrees
+  //! without instances (e.g. with a mirrored copy only) are searched for smaller ones.
+  static void FindInstances (const CsgNode* theRoot,
+                             std::vector<CsgInstanceGroup>& theGroups,
+                             const int theMinPrimitives = 2);
+
+};
+
+#endif // HEADER_CSG_SHARING
@@ -1,5 +1,9 @@
 #include "CsgTree.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
 namespace tools
 {
   //=======================================================================
@@ -48,6 +52,51 @@ namespace tools
     return aResult;
   }
 
+  // =======================================================================
+  // function : OperationBounds
+  // purpose  :
+  // =======================================================================
+  Box4f OperationBounds (const CsgOperationNode* theNode)
+  {
+    if (theNode->Operation() == CSG_OP_MINUS)
+    {
+      return theNode->Child (0)->Bounds();
+    }
+
+    Box4f aBounds = theNode->Child (0)->Bounds();
+
+    for (int anIndex = 1; anIndex < theNode->NbChildren(); ++anIndex)
+    {
+      if (theNode->Operation() == CSG_OP_UNION)
+      {
+        aBounds = Combine (aBounds, theNode->Child (anIndex)->Bounds());
+      }
+      else
+      {
+        aBounds = Intersect (aBounds, theNode->Child (anIndex)->Bounds());
+      }
+    }
+
+    return aBounds;
+  }
+
+  // =======================================================================
+  // function : UnshareChild
+  // purpose  : Replaces shared child with its copy, so it can be modified in place
+  // =======================================================================
+  CsgNode* UnshareChild (CsgOperationNode* theNode, const int theIndex)
+  {
+    CsgNode* aChild = theNode->Child (theIndex);
+
+    if (aChild->IsShared())
+    {
+      theNode->SetChild (theIndex, aChild->DeepCopy (theNode->Arena()));
+      CsgNode::Destroy (aChild);
+    }
+
+    return theNode->Child (theIndex);
+  }
+
   //! Describes operation to apply to CSG tree node.
   enum NodeAction
   {
@@ -76,10 +125,13 @@ namespace tools
         aNode->SetOperation (theAction == ACTION_COMP ?
           CSG_OP_UNION : CSG_OP_INTER);
 
-        RemoveDifferences (aNode->Child<0>(),
-          theAction == ACTION_COMP ? ACTION_COMP : ACTION_NONE);
-        RemoveDifferences (aNode->Child<1>(),
-          theAction == ACTION_COMP ? ACTION_NONE : ACTION_COMP);
+        RemoveDifferences (UnshareChild (aNode, 0), theAction);
+
+        for (int anIndex = 1; anIndex < aNode->NbChildren(); ++anIndex)
+        {
+          RemoveDifferences (UnshareChild (aNode, anIndex),
+            theAction == ACTION_COMP ? ACTION_NONE : ACTION_COMP);
+        }
       }
       else
       {
@@ -89,10 +141,303 @@ namespace tools
             CSG_OP_UNION : CSG_OP_INTER);
         }
 
-        RemoveDifferences (aNode->Child<0>(), theAction);
-        RemoveDifferences (aNode->Child<1>(), theAction);
+        for (int anIndex = 0; anIndex < aNode->NbChildren(); ++anIndex)
+        {
+          RemoveDifferences (UnshareChild (aNode, anIndex), theAction);
+        }
+      }
+    }
+  }
+
+  //! Operand of union or intersection cluster.
+  struct Operand
+  {
+    CsgNode* Node;
+    Box4f    Bounds;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  typedef std::vector<Operand, Eigen::aligned_allocator<Operand> > OperandArray;
+
+  //! Number of bins used to estimate SAH cost of splits.
+  static const int THE_NB_BINS = 32;
+
+  // =======================================================================
+  // function : SplitOperands
+  // purpose  : Reorders operands of the range and returns index of the split
+  //            (binned SAH over the centers of operand bounds)
+  // =======================================================================
+  size_t SplitOperands (OperandArray& theOperands, const size_t theBegin, const size_t theEnd)
+  {
+    Box4f aCenters;
+
+    for (size_t anIndex = theBegin; anIndex < theEnd; ++anIndex)
+    {
+      aCenters.Add (theOperands[anIndex].Bounds.Center());
+    }
+
+    const Vec4f aSize = aCenters.Size();
+
+    float aBestCost = std::numeric_limits<float>::max();
+    int aBestAxis = -1;
+    int aBestBin = 0;
+
+    for (int anAxis = 0; anAxis < 3; ++anAxis)
+    {
+      if (aSize[anAxis] <= 0.f)
+      {
+        continue;
+      }
+
+      Box4f aBinBounds[THE_NB_BINS];
+      int aBinCounts[THE_NB_BINS] = {};
+
+      const float aScale = THE_NB_BINS / aSize[anAxis];
+
+      for (size_t anIndex = theBegin; anIndex < theEnd; ++anIndex)
+      {
+        const int aBin = std::min (THE_NB_BINS - 1, static_cast<int> (
+          (theOperands[anIndex].Bounds.Center (anAxis) - aCenters.CornerMin()[anAxis]) * aScale));
+
+        aBinBounds[aBin].Combine (theOperands[anIndex].Bounds);
+        ++aBinCounts[aBin];
+      }
+
+      // areas and counts of operands to the right of each split
+      float aRghAreas[THE_NB_BINS];
+      int aRghCounts[THE_NB_BINS];
+
+      Box4f aRghBounds;
+      int aRghCount = 0;
+
+      for (int aBin = THE_NB_BINS - 1; aBin > 0; --aBin)
+      {
+        aRghBounds.Combine (aBinBounds[aBin]);
+        aRghCount += aBinCounts[aBin];
+
+        aRghAreas[aBin] = aRghCount > 0 ? aRghBounds.Area() : 0.f;
+        aRghCounts[aBin] = aRghCount;
+      }
+
+      Box4f aLftBounds;
+      int aLftCount = 0;
+
+      for (int aBin = 1; aBin < THE_NB_BINS; ++aBin)
+      {
+        aLftBounds.Combine (aBinBounds[aBin - 1]);
+        aLftCount += aBinCounts[aBin - 1];
+
+        if (aLftCount == 0 || aRghCounts[aBin] == 0)
+        {
+          continue;
+        }
+
+        const float aCost = aLftBounds.Area() * aLftCount + aRghAreas[aBin] * aRghCounts[aBin];
+
+        if (aCost < aBestCost)
+        {
+          aBestCost = aCost;
+          aBestAxis = anAxis;
+          aBestBin = aBin;
+        }
+      }
+    }
+
+    // coincident centers can't be split spatially
+    if (aBestAxis < 0)
+    {
+      return (theBegin + theEnd) / 2;
+    }
+
+    const float aMinCenter = aCenters.CornerMin()[aBestAxis];
+    const float aScale = THE_NB_BINS / aSize[aBestAxis];
+
+    Operand* aMiddle = std::partition (&theOperands[theBegin], &theOperands[0] + theEnd,
+      [aBestAxis, aBestBin, aMinCenter, aScale] (const Operand& theOperand)
+      {
+        return std::min (THE_NB_BINS - 1, static_cast<int> (
+          (theOperand.Bounds.Center (aBestAxis) - aMinCenter) * aScale)) < aBestBin;
+      });
+
+    return aMiddle - &theOperands[0];
+  }
+
+  // =======================================================================
+  // function : BuildHierarchy
+  // purpose  : Makes the root a binary tree of operations over operands of the range
+  // =======================================================================
+  void BuildHierarchy (CsgOperationNode* theRoot, OperandArray& theOperands, const size_t theBegin, const size_t theEnd)
+  {
+    struct Task
+    {
+      size_t Begin;
+      size_t End;
+      CsgOperationNode* Parent;
+    };
+
+    // new operations (parents precede their children)
+    std::vector<CsgOperationNode*> aNodes;
+
+    std::vector<Task> aTasks;
+    aTasks.push_back (Task { theBegin, theEnd, theRoot });
+
+    while (!aTasks.empty())
+    {
+      const Task aTask = aTasks.back();
+      aTasks.pop_back();
+
+      const size_t aSplit = SplitOperands (theOperands, aTask.Begin, aTask.End);
+
+      const size_t aBounds[3] = { aTask.Begin, aSplit, aTask.End };
+
+      for (int aPart = 0; aPart < 2; ++aPart)
+      {
+        if (aBounds[aPart + 1] - aBounds[aPart] == 1)
+        {
+          aTask.Parent->AddChild (theOperands[aBounds[aPart]].Node);
+          continue;
+        }
+
+        CsgOperationNode* aNode = CsgTreeArena::Create<CsgOperationNode> (theRoot->Arena(), theRoot->Operation());
+        aTask.Parent->AddChild (aNode);
+        aNodes.push_back (aNode);
+
+        aTasks.push_back (Task { aBounds[aPart], aBounds[aPart + 1], aNode });
       }
     }
+
+    for (size_t anIndex = aNodes.size(); anIndex > 0; --anIndex)
+    {
+      aNodes[anIndex - 1]->SetBounds (OperationBounds (aNodes[anIndex - 1]));
+    }
+  }
+
+  // =======================================================================
+  // function : Regroup
+  // purpose  : Shared nodes are regrouped on the first visit only
+  // =======================================================================
+  void Regroup (CsgNode* theNode, std::unordered_set<const CsgNode*>& theRegrouped)
+  {
+    if (theNode->IsLeaf())
+    {
+      return;
+    }
+
+    if (theNode->IsShared() && !theRegrouped.insert (theNode).second)
+    {
+      return;
+    }
+
+    CsgOperationNode* aNode =
+      static_cast<CsgOperationNode*> (theNode);
+
+    if (aNode->Operation() == CSG_OP_MINUS)
+    {
+      // A - B - C = A - (B | C), so subtrahends are regrouped as union
+      if (aNode->NbChildren() > 2)
+      {
+        CsgOperationNode* aSubtrahend = CsgTreeArena::Create<CsgOperationNode> (aNode->Arena(), CSG_OP_UNION);
+
+        for (int anIndex = 1; anIndex < aNode->NbChildren(); ++anIndex)
+        {
+          aSubtrahend->AddChild (aNode->Child (anIndex));
+        }
+
+        aSubtrahend->SetBounds (OperationBounds (aSubtrahend));
+
+        std::vector<CsgNode*> aChildren (1, aNode->Child (0));
+        aChildren.push_back (aSubtrahend);
+        aNode->SetChildren (aChildren);
+      }
+
+      for (int anIndex = 0; anIndex < aNode->NbChildren(); ++anIndex)
+      {
+        Regroup (aNode->Child (anIndex), theRegrouped);
+      }
+
+      return;
+    }
+
+    // collect operands of the cluster of the same operations
+    std::vector<CsgNode*> aStack;
+
+    for (int anIndex = aNode->NbChildren() - 1; anIndex >= 0; --anIndex)
+    {
+      aStack.push_back (aNode->Child (anIndex));
+    }
+
+    std::vector<CsgOperationNode*> anInnerNodes;
+
+    OperandArray aBounded;
+    std::vector<CsgNode*> anUnbounded;
+
+    while (!aStack.empty())
+    {
+      CsgNode* aChild = aStack.back();
+      aStack.pop_back();
+
+      // shared operations are kept as operands, as other parents refer to them
+      if (aChild->TypeID() == aNode->Operation() && !aChild->IsComplement() && !aChild->IsShared())
+      {
+        CsgOperationNode* anInner = static_cast<CsgOperationNode*> (aChild);
+
+        for (int anIndex = anInner->NbChildren() - 1; anIndex >= 0; --anIndex)
+        {
+          aStack.push_back (anInner->Child (anIndex));
+        }
+
+        anInnerNodes.push_back (anInner);
+        continue;
+      }
+
+      Regroup (aChild, theRegrouped);
+
+      // complements and empty operands are left at the top of the cluster
+      if (aChild->Bounds().IsValid() && std::isfinite (aChild->Bounds().Area()))
+      {
+        Operand anOperand;
+        anOperand.Node = aChild;
+        anOperand.Bounds = aChild->Bounds();
+        aBounded.push_back (anOperand);
+      }
+      else
+      {
+        anUnbounded.push_back (aChild);
+      }
+    }
+
+    for (size_t anIndex = 0; anIndex < anInnerNodes.size(); ++anIndex)
+    {
+      anInnerNodes[anIndex]->SetChildren (std::vector<CsgNode*>());
+      CsgNode::Destroy (anInnerNodes[anIndex]);
+    }
+
+    aNode->SetChildren (std::vector<CsgNode*>());
+
+    if (aBounded.size() > 1 && !anUnbounded.empty())
+    {
+      CsgOperationNode* aHierarchy = CsgTreeArena::Create<CsgOperationNode> (aNode->Arena(), aNode->Operation());
+      BuildHierarchy (aHierarchy, aBounded, 0, aBounded.size());
+      aHierarchy->SetBounds (OperationBounds (aHierarchy));
+
+      aNode->AddChild (aHierarchy);
+    }
+    else if (aBounded.size() > 1)
+    {
+      BuildHierarchy (aNode, aBounded, 0, aBounded.size());
+    }
+    else if (aBounded.size() == 1)
+    {
+      aNode->AddChild (aBounded.front().Node);
+    }
+
+    for (size_t anIndex = 0; anIndex < anUnbounded.size(); ++anIndex)
+    {
+      aNode->AddChild (anUnbounded[anIndex]);
+    }
+
+    aNode->SetBounds (OperationBounds (aNode));
   }
 }
 
@@ -110,8 +455,14 @@ int CsgNode::Height() const
   const CsgOperationNode* anOperation =
     static_cast<const CsgOperationNode*> (this);
 
-  return std::max (anOperation->Child<0>()->Height(),
-                   anOperation->Child<1>()->Height()) + 1;
+  int aHeight = 0;
+
+  for (int anIndex = 0; anIndex < anOperation->NbChildren(); ++anIndex)
+  {
+    aHeight = std::max (aHeight, anOperation->Child (anIndex)->Height());
+  }
+
+  return aHeight + 1;
 }
 
 // =======================================================================
@@ -120,6 +471,11 @@ int CsgNode::Height() const
 // =======================================================================
 bool CsgNode::ClipBounds (const Box4f& theBounds)
 {
+  if (IsShared())
+  {
+    return false;
+  }
+
   float aBaseArea = myBounds.Area();
 
   myBounds = tools::Intersect (myBounds, theBounds);
@@ -136,6 +492,17 @@ void CsgNode::ToPositiveForm()
   tools::RemoveDifferences (this, tools::ACTION_NONE);
 }
 
+// =======================================================================
+// function : Regroup
+// purpose  :
+// =======================================================================
+void CsgNode::Regroup()
+{
+  std::unordered_set<const CsgNode*> aRegrouped;
+
+  tools::Regroup (this, aRegrouped);
+}
+
 // =======================================================================
 // function : ToGeneralForm
 // purpose  :
@@ -150,58 +517,176 @@ void CsgNode::ToGeneralForm()
   CsgOperationNode* aNode =
     static_cast<CsgOperationNode*> (this);
 
-  CsgNode* aLftChild = aNode->Child<0>();
-  CsgNode* aRghChild = aNode->Child<1>();
+  std::vector<CsgNode*> aPositives;
+  std::vector<CsgNode*> aNegatives;
+
+  for (int anIndex = 0; anIndex < aNode->NbChildren(); ++anIndex)
+  {
+    CsgNode* aChild = tools::UnshareChild (aNode, anIndex);
+
+    if (!aChild->IsLeaf())
+    {
+      aChild->ToGeneralForm();
+    }
+
+    (aChild->IsComplement() ? aNegatives : aPositives).push_back (aChild);
+  }
+
+  if (aNegatives.empty())
+  {
+    return;
+  }
+
+  for (size_t anIndex = 0; anIndex < aNegatives.size(); ++anIndex)
+  {
+    aNegatives[anIndex]->SetComplement (false);
+  }
 
-  if (!aLftChild->IsLeaf())
+  if (aPositives.empty())
   {
-    aLftChild->ToGeneralForm();
+    aNode->SetOperation (aNode->Operation() == CSG_OP_UNION ?
+      CSG_OP_INTER : CSG_OP_UNION);
+
+    aNode->SetComplement (true);
+    return;
   }
 
-  if (!aRghChild->IsLeaf())
+  // P & ~N = P - N, P | ~N = ~(N - P)
+  const bool isInter = aNode->Operation() == CSG_OP_INTER;
+
+  std::vector<CsgNode*>& aMinuends = isInter ? aPositives : aNegatives;
+  std::vector<CsgNode*>& aSubtrahends = isInter ? aNegatives : aPositives;
+
+  CsgNode* aMinuend = aMinuends.front();
+
+  if (aMinuends.size() > 1)
   {
-    aRghChild->ToGeneralForm();
+    aMinuend = CsgTreeArena::Create<CsgOperationNode> (myArena, CSG_OP_INTER, aMinuends);
+    aMinuend->SetBounds (tools::OperationBounds (static_cast<CsgOperationNode*> (aMinuend)));
   }
 
-  if (aLftChild->IsComplement() || aRghChild->IsComplement())
+  aSubtrahends.insert (aSubtrahends.begin(), aMinuend);
+
+  aNode->SetChildren (aSubtrahends);
+  aNode->SetOperation (CSG_OP_MINUS);
+
+  if (!isInter)
   {
-    if (aLftChild->IsComplement())
+    aNode->SetComplement (true);
+  }
+}
+
+// =======================================================================
+// function : ~CsgOperationNode
+// purpose  :
+// =======================================================================
+CsgOperationNode::~CsgOperationNode()
+{
+  // children of the node in arena are released with the arena
+  if (myArena == NULL)
+  {
+    std::vector<CsgNode*> aNodes (myChildren, myChildren + myNbChildren);
+
+    // descendants are detached before deletion, so deep trees don't recurse
+    while (!aNodes.empty())
     {
-      if (aRghChild->IsComplement())
-      {
-        aNode->SetOperation (aNode->Operation() == CSG_OP_UNION ?
-          CSG_OP_INTER : CSG_OP_UNION);
+      CsgNode* aNode = aNodes.back();
+      aNodes.pop_back();
 
-        aNode->SetComplement (true);
-      }
-      else
+      // shared nodes are still referred by other parents
+      if (!aNode->RemoveReference() || aNode->Arena() != NULL)
       {
-        if (aNode->Operation() == CSG_OP_INTER)
-        {
-          aNode->SwapChildren();
-        }
-        else
-        {
-          aNode->SetComplement (true);
-        }
-
-        aNode->SetOperation (CSG_OP_MINUS);
+        continue;
       }
-    }
-    else
-    {
-      if (aNode->Operation() != CSG_OP_INTER)
+
+      if (!aNode->IsLeaf())
       {
-        aNode->SwapChildren();
+        CsgOperationNode* anOperation = static_cast<CsgOperationNode*> (aNode);
 
-        aNode->SetComplement (true);
+        aNodes.insert (aNodes.end(), anOperation->myChildren, anOperation->myChildren + anOperation->myNbChildren);
+        anOperation->myNbChildren = 0;
       }
 
-      aNode->SetOperation (CSG_OP_MINUS);
+      delete aNode;
     }
+  }
 
-    aLftChild->SetComplement (false);
-    aRghChild->SetComplement (false);
+  if (myIsHeapStorage)
+  {
+    delete[] myChildren;
+  }
+}
+
+// =======================================================================
+// function : SetChildren
+// purpose  :
+// =======================================================================
+void CsgOperationNode::SetChildren (const std::vector<CsgNode*>& theChildren)
+{
+  if (static_cast<int> (theChildren.size()) > myCapacity)
+  {
+    Reserve (static_cast<int> (theChildren.size()));
+  }
+
+  std::copy (theChildren.begin(), theChildren.end(), myChildren);
+
+  myNbChildren = static_cast<int> (theChildren.size());
+}
+
+// =======================================================================
+// function : Reserve
+// purpose  :
+// =======================================================================
+void CsgOperationNode::Reserve (const int theCapacity)
+{
+  if (theCapacity <= myCapacity)
+  {
+    return;
+  }
+
+  CsgNode** aChildren = myArena != NULL
+    ? static_cast<CsgNode**> (myArena->Allocate (theCapacity * sizeof (CsgNode*)))
+    : new CsgNode*[theCapacity];
+
+  if (myNbChildren > 0)
+  {
+    std::copy (myChildren, myChildren + myNbChildren, aChildren);
+  }
+
+  if (myIsHeapStorage)
+  {
+    delete[] myChildren;
+  }
+
+  myChildren = aChildren;
+  myCapacity = theCapacity;
+  myIsHeapStorage = myArena == NULL;
+}
+
+// =======================================================================
+// function : SetArena
+// purpose  :
+// =======================================================================
+void CsgOperationNode::SetArena (CsgTreeArena* theArena)
+{
+  CsgNode::SetArena (theArena);
+
+  if (myIsHeapStorage)
+  {
+    CsgNode** aChildren = myChildren;
+    const int aNbChildren = myNbChildren;
+
+    myChildren = NULL;
+    myNbChildren = 0;
+    myCapacity = 0;
+    myIsHeapStorage = false;
+
+    Reserve (aNbChildren);
+
+    std::copy (aChildren, aChildren + aNbChildren, myChildren);
+    myNbChildren = aNbChildren;
+
+    delete[] aChildren;
   }
 }
 
@@ -215,8 +700,16 @@ bool CsgOperationNode::IsConvex() const
   {
     return false;
   }
-  
-  return Child<0>()->IsConvex() && Child<1>()->IsConvex();
+
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
+  {
+    if (!myChildren[anIndex]->IsConvex())
+    {
+      return false;
+    }
+  }
+
+  return true;
 }
 
 // =======================================================================
@@ -225,7 +718,14 @@ bool CsgOperationNode::IsConvex() const
 // =======================================================================
 int CsgOperationNode::NbPrimitives() const
 {
-  return Child<0>()->NbPrimitives() + Child<1>()->NbPrimitives();
+  int aResult = 0;
+
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
+  {
+    aResult += myChildren[anIndex]->NbPrimitives();
+  }
+
+  return aResult;
 }
 
 // =======================================================================
@@ -236,8 +736,10 @@ int CsgOperationNode::NbOperations() const
 {
   int aResult = 1;
 
-  aResult += Child<0>()->NbOperations();
-  aResult += Child<1>()->NbOperations();
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
+  {
+    aResult += myChildren[anIndex]->NbOperations();
+  }
 
   return aResult;
 }
@@ -246,12 +748,18 @@ int CsgOperationNode::NbOperations() const
 // function : DeepCopy
 // purpose  :
 // =======================================================================
-CsgNode* CsgOperationNode::DeepCopy() const
+CsgNode* CsgOperationNode::DeepCopy (CsgTreeArena* theArena) const
 {
-  CsgOperationNode* aCopy = new CsgOperationNode (myOperation);
+  CsgOperationNode* aCopy = CsgTreeArena::Create<CsgOperationNode> (theArena, myOperation);
+
+  aCopy->SetComplement (myIsComplement);
+  aCopy->SetBounds (myBounds);
+  aCopy->Reserve (myNbChildren);
 
-  aCopy->SetChild<0> (Child<0>()->DeepCopy());
-  aCopy->SetChild<1> (Child<1>()->DeepCopy());
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
+  {
+    aCopy->AddChild (myChildren[anIndex]->DeepCopy (theArena));
+  }
 
   return aCopy;
 }
@@ -262,21 +770,12 @@ CsgNode* CsgOperationNode::DeepCopy() const
 // =======================================================================
 void CsgOperationNode::InitializeBounds()
 {
-  Child<0>()->InitializeBounds();
-  Child<1>()->InitializeBounds();
-
-  if (myOperation == CSG_OP_UNION)
-  {
-    myBounds = tools::Combine (Child<0>()->Bounds(), Child<1>()->Bounds());
-  }
-  else if (myOperation == CSG_OP_INTER)
-  {
-    myBounds = tools::Intersect (Child<0>()->Bounds(), Child<1>()->Bounds());
-  }
-  else if (myOperation == CSG_OP_MINUS)
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
   {
-    myBounds = Child<0>()->Bounds();
+    myChildren[anIndex]->InitializeBounds();
   }
+
+  myBounds = tools::OperationBounds (this);
 }
 
 // =======================================================================
@@ -287,30 +786,17 @@ bool CsgOperationNode::GrowBounds()
 {
   bool aResult = false;
 
-  if (!Child<0>()->IsLeaf())
-  {
-    aResult |= static_cast<CsgOperationNode*> (Child<0>())->GrowBounds();
-  }
-
-  if (!Child<1>()->IsLeaf())
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
   {
-    aResult |= static_cast<CsgOperationNode*> (Child<1>())->GrowBounds();
+    if (!myChildren[anIndex]->IsLeaf())
+    {
+      aResult |= static_cast<CsgOperationNode*> (myChildren[anIndex])->GrowBounds();
+    }
   }
 
   float aBaseArea = myBounds.Area();
 
-  if (myOperation == CSG_OP_UNION)
-  {
-    myBounds = tools::Combine (Child<0>()->Bounds(), Child<1>()->Bounds());
-  }
-  else if (myOperation == CSG_OP_INTER)
-  {
-    myBounds = tools::Intersect (Child<0>()->Bounds(), Child<1>()->Bounds());
-  }
-  else // minus
-  {
-    myBounds = Child<0>()->Bounds();
-  }
+  myBounds = tools::OperationBounds (this);
 
   aResult |= myBounds.Area() < aBaseArea;
 
@@ -323,10 +809,17 @@ bool CsgOperationNode::GrowBounds()
 // =======================================================================
 bool CsgOperationNode::ClipBounds (const Box4f& theBounds)
 {
+  if (IsShared())
+  {
+    return false;
+  }
+
   bool aResult = CsgNode::ClipBounds (theBounds);
 
-  aResult |= Child<0>()->ClipBounds (myBounds);
-  aResult |= Child<1>()->ClipBounds (myBounds);
+  for (int anIndex = 0; anIndex < myNbChildren; ++anIndex)
+  {
+    aResult |= myChildren[anIndex]->ClipBounds (myBounds);
+  }
 
   return aResult;
 }
@@ -335,11 +828,12 @@ bool CsgOperationNode::ClipBounds (const Box4f& theBounds)
 // function : DeepCopy
 // purpose  :
 // =======================================================================
-CsgNode* CsgPrimitiveNode::DeepCopy() const
+CsgNode* CsgPrimitiveNode::DeepCopy (CsgTreeArena* theArena) const
 {
-  CsgPrimitiveNode* aCopy = new CsgPrimitiveNode (myTypeId, myTransform, myMaterial);
+  CsgPrimitiveNode* aCopy = CsgTreeArena::Create<CsgPrimitiveNode> (theArena, myTypeId, myTransform, myMaterial);
 
   aCopy->SetComplement (myIsComplement);
+  aCopy->SetBounds (myBounds);
 
   return aCopy;
 }
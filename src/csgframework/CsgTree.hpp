@@ -2,6 +2,12 @@
 #define HEADER_CSG_TREE
 
 #include "Box.hpp"
+#include "CsgTreeArena.hpp"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
 
 //! Boolean operation id.
 enum CsgOperation
@@ -40,8 +46,10 @@ class CsgNode
 {
 public:
 
+  friend class CsgTreeArena;
+
   //! Creates new CSG tree node.
-  CsgNode() : myIsComplement (false)
+  CsgNode() : myIsComplement (false), myArena (NULL), myNbReferences (1)
   {
     //
   }
@@ -52,6 +60,37 @@ public:
     //
   }
 
+  //! Releases reference to the node and deletes the node created on the heap with its last
+  //! reference (nodes of arena are released with the arena).
+  static void Destroy (CsgNode* theNode)
+  {
+    if (theNode != NULL && theNode->RemoveReference() && theNode->myArena == NULL)
+    {
+      delete theNode;
+    }
+  }
+
+public:
+
+  //! Adds reference to the node which becomes a child of one more parent
+  //! (the node is created with single reference of its owner).
+  void AddReference()
+  {
+    ++myNbReferences;
+  }
+
+  //! Removes reference to the node, returns true if it was the last one.
+  bool RemoveReference()
+  {
+    return --myNbReferences == 0;
+  }
+
+  //! Checks if the node is shared by several parents (see CsgSharing).
+  //! Passes modifying nodes in place copy shared children first.
+  bool IsShared() const
+  {
+    return myNbReferences > 1;
+  }
 
 public:
 
@@ -73,8 +112,15 @@ public:
   //! Returns total number of CSG operations.
   virtual int NbOperations() const = 0;
 
-  //! Returns deep copy of the given CSG node.
-  virtual CsgNode* DeepCopy() const = 0;
+  //! Returns deep copy of the given CSG node (created in the given arena if specified).
+  //! Shared subtrees are copied for every reference, so the copy is a tree.
+  virtual CsgNode* DeepCopy (CsgTreeArena* theArena = NULL) const = 0;
+
+  //! Returns arena owning the node (NULL for nodes created on the heap).
+  CsgTreeArena* Arena() const
+  {
+    return myArena;
+  }
 
   //! Checks if CSG node is convex.
   virtual bool IsConvex() const = 0;
@@ -109,9 +155,26 @@ public:
   //! Transforms CSG tree to positive form.
   void ToPositiveForm();
 
-  //! Clips the bounds with specified bounding box.
+  //! Regroups operands of unions and intersections (including nested operations of the same
+  //! kind and subtrahends of differences) into spatially coherent binary trees using surface
+  //! area heuristic over their bounds, so the bounds of operations work as bounding volume
+  //! hierarchy. Bounds should be initialized (see InitializeBounds), and they are kept
+  //! for the new operations. Complement and empty operands stay at the top of their groups.
+  //! Shared nodes are kept as operands and regrouped once for all of their parents.
+  void Regroup();
+
+  //! Clips the bounds with specified bounding box (shared subtrees are not clipped,
+  //! as they are bounded by each of their parents).
   virtual bool ClipBounds (const Box4f& theBounds);
 
+protected:
+
+  //! Marks that the node is created in the arena.
+  virtual void SetArena (CsgTreeArena* theArena)
+  {
+    myArena = theArena;
+  }
+
 protected:
 
   //! Bounds of CSG node.
@@ -120,17 +183,34 @@ protected:
   //! Marks that CSG tree if complement.
   bool myIsComplement;
 
+  //! Arena owning the node.
+  CsgTreeArena* myArena;
+
+  //! Number of references to the node (parents and owner).
+  int myNbReferences;
+
+public:
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
 };
 
 
 //! Describes specific CSG operation node.
+//! Union and intersection nodes combine any number of children, and difference node
+//! subtracts the rest of children from the first one, so the depth of CSG tree follows
+//! the nesting of operations rather than the number of their operands.
 class CsgOperationNode : public CsgNode
 {
 public:
 
   //! Creates new CSG operation node.
   CsgOperationNode (CsgOperation theOperation = CSG_OP_UNION)
-    : myOperation (theOperation)
+    : myOperation (theOperation),
+      myChildren (NULL),
+      myNbChildren (0),
+      myCapacity (0),
+      myIsHeapStorage (false)
   {
     //
   }
@@ -139,19 +219,32 @@ public:
   CsgOperationNode (CsgOperation theOperation,
                     CsgNode* theLftNode,
                     CsgNode* theRghNode)
-    : myOperation (theOperation)
+    : myOperation (theOperation),
+      myChildren (NULL),
+      myNbChildren (0),
+      myCapacity (0),
+      myIsHeapStorage (false)
   {
-    myChildren.first = theLftNode;
-    myChildren.second = theRghNode;
+    AddChild (theLftNode);
+    AddChild (theRghNode);
   }
 
-  //! Releases resources of CSG operation node.
-  virtual ~CsgOperationNode()
+  //! Creates new CSG operation node of the given children.
+  CsgOperationNode (CsgOperation theOperation,
+                    const std::vector<CsgNode*>& theChildren)
+    : myOperation (theOperation),
+      myChildren (NULL),
+      myNbChildren (0),
+      myCapacity (0),
+      myIsHeapStorage (false)
   {
-    delete myChildren.first;
-    delete myChildren.second;
+    SetChildren (theChildren);
   }
 
+  //! Releases resources of CSG operation node (heap subtree is released without recursion,
+  //! shared children are deleted with their last reference).
+  virtual ~CsgOperationNode();
+
 public:
 
   //! Returns type identifier of CSG node.
@@ -178,33 +271,48 @@ public:
     myOperation = theOperation;
   }
 
+  //! Returns number of child nodes.
+  int NbChildren() const
+  {
+    return myNbChildren;
+  }
+
   //! Returns specified child of CSG node.
-  template<int N>
-  CsgNode* Child()
+  CsgNode* Child (const int theIndex)
   {
-    return N == 0 ? myChildren.first : myChildren.second;
+    return myChildren[theIndex];
   }
 
   //! Returns specified child of CSG node.
-  template<int N>
-  const CsgNode* Child() const
+  const CsgNode* Child (const int theIndex) const
   {
-    return N == 0 ? myChildren.first : myChildren.second;
+    return myChildren[theIndex];
   }
 
-  //! Sets specified child of CSG node.
-  template<int N>
-  void SetChild (CsgNode* theChild)
+  //! Sets specified child of CSG node (the previous child is not released).
+  void SetChild (const int theIndex, CsgNode* theChild)
   {
-    (N == 0 ? myChildren.first : myChildren.second) = theChild;
+    myChildren[theIndex] = theChild;
   }
 
-  //! Transposes children of CSG node.
-  void SwapChildren()
+  //! Appends child to CSG node.
+  void AddChild (CsgNode* theChild)
   {
-    std::swap (myChildren.first, myChildren.second);
+    if (myNbChildren == myCapacity)
+    {
+      Reserve (std::max (2 * myCapacity, 2));
+    }
+
+    myChildren[myNbChildren++] = theChild;
   }
 
+  //! Replaces child nodes (the previous children are not released).
+  void SetChildren (const std::vector<CsgNode*>& theChildren);
+
+  //! Reserves storage for the given number of children
+  //! (in the arena of the node if any).
+  void Reserve (const int theCapacity);
+
   //! Checks if CSG node is convex.
   virtual bool IsConvex() const;
 
@@ -214,8 +322,8 @@ public:
   //! Returns total number of CSG operations.
   virtual int NbOperations() const;
 
-  //! Returns deep copy of the given CSG node.
-  virtual CsgNode* DeepCopy() const;
+  //! Returns deep copy of the given CSG node (created in the given arena if specified).
+  virtual CsgNode* DeepCopy (CsgTreeArena* theArena = NULL) const;
 
   //! Computes initial bounds of CSG node.
   virtual void InitializeBounds();
@@ -226,13 +334,27 @@ public:
   //! Performs clipping bounds via preorder traversal.
   virtual bool ClipBounds (const Box4f& theBounds);
 
+protected:
+
+  //! Marks that the node is created in the arena (moves its children into the arena).
+  virtual void SetArena (CsgTreeArena* theArena);
+
 protected:
 
   //! CSG operation to apply.
   CsgOperation myOperation;
 
-  //! Pair of child CSG nodes.
-  std::pair<CsgNode*, CsgNode*> myChildren;
+  //! Child CSG nodes.
+  CsgNode** myChildren;
+
+  //! Number of child CSG nodes.
+  int myNbChildren;
+
+  //! Size of storage of child CSG nodes.
+  int myCapacity;
+
+  //! Marks that the storage of child CSG nodes is allocated on the heap.
+  bool myIsHeapStorage;
 
 };
 
@@ -305,8 +427,8 @@ public:
   //! Computes initial bounds of CSG node.
   virtual void InitializeBounds();
 
-  //! Returns deep copy of the given CSG node.
-  virtual CsgNode* DeepCopy() const;
+  //! Returns deep copy of the given CSG node (created in the given arena if specified).
+  virtual CsgNode* DeepCopy (CsgTreeArena* theArena = NULL) const;
 
 protected:
 
@@ -316,5 +438,29 @@ protected:
 
 };
 
+namespace tools
+{
+  //! Returns bounding box of both boxes (invalid boxes are ignored).
+  Box4f Combine (const Box4f& theBox1, const Box4f& theBox2);
+
+  //! Returns bounding box of the intersection of boxes (invalid if they don't overlap).
+  Box4f Intersect (const Box4f& theBox1, const Box4f& theBox2);
+}
+
+//! Creates node in the given arena (see CsgTreeArena::Create).
+template<class Node, class... Args>
+Node* CsgTreeArena::Create (CsgTreeArena* theArena, Args&&... theArgs)
+{
+  if (theArena == NULL)
+  {
+    return new Node (std::forward<Args> (theArgs)...);
+  }
+
+  Node* aNode = ::new (theArena->Allocate (sizeof (Node))) Node (std::forward<Args> (theArgs)...);
+  static_cast<CsgNode*> (aNode)->SetArena (theArena);
+
+  return aNode;
+}
+
 #endif // HEADER_CSG_TREE
 
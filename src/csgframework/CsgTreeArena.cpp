@@ -0,0 +1,71 @@
+#include "CsgTreeArena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+const size_t CsgTreeArena::Alignment;
+const size_t CsgTreeArena::DefaultBlockSize;
+
+// =======================================================================
+// function : CsgTreeArena
+// purpose  :
+// =======================================================================
+CsgTreeArena::CsgTreeArena (const size_t theBlockSize)
+: myCursor (NULL),
+  myEnd (NULL),
+  myBlockSize (theBlockSize),
+  myNbBytes (0)
+{
+  //
+}
+
+// =======================================================================
+// function : Allocate
+// purpose  :
+// =======================================================================
+void* CsgTreeArena::Allocate (const size_t theSize)
+{
+  const size_t aSize = (std::max (theSize, static_cast<size_t> (1)) + Alignment - 1) & ~(Alignment - 1);
+
+  if (myCursor == NULL || static_cast<size_t> (myEnd - myCursor) < aSize)
+  {
+    // large requests get blocks of their own
+    const size_t aBlockSize = std::max (myBlockSize, aSize) + Alignment;
+
+    myBlocks.reserve (myBlocks.size() + 1);
+
+    void* aBlock = ::operator new (aBlockSize);
+    myBlocks.push_back (aBlock);
+
+    const uintptr_t anAddress = reinterpret_cast<uintptr_t> (aBlock);
+
+    myCursor = static_cast<char*> (aBlock) + ((Alignment - anAddress % Alignment) % Alignment);
+    myEnd = static_cast<char*> (aBlock) + aBlockSize;
+  }
+
+  void* aResult = myCursor;
+
+  myCursor += aSize;
+  myNbBytes += aSize;
+
+  return aResult;
+}
+
+// =======================================================================
+// function : Release
+// purpose  :
+// =======================================================================
+void CsgTreeArena::Release()
+{
+  for (size_t anIndex = 0; anIndex < myBlocks.size(); ++anIndex)
+  {
+    ::operator delete (myBlocks[anIndex]);
+  }
+
+  myBlocks.clear();
+
+  myCursor = NULL;
+  myEnd = NULL;
+  myNbBytes = 0;
+}
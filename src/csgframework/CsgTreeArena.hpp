@@ -0,0 +1,83 @@
+#ifndef HEADER_CSG_TREE_ARENA
+#define HEADER_CSG_TREE_ARENA
+
+#include <cstddef>
+#include <vector>
+
+class CsgNode;
+
+//! Contiguous storage of CSG tree nodes released at once.
+//! Nodes (and child lists of operations) are placed one after another into large blocks,
+//! so building and copying of big trees doesn't allocate every node separately, and the
+//! whole tree is released by freeing the blocks only: nodes are not destroyed one by one.
+//! Nodes created in the arena must not be deleted, they are valid until the arena is
+//! released or destroyed.
+class CsgTreeArena
+{
+public:
+
+  //! Alignment of allocated memory (required by Eigen fixed-size types).
+  static const size_t Alignment = 16;
+
+  //! Default size of memory blocks.
+  static const size_t DefaultBlockSize = 1 << 20;
+
+public:
+
+  //! Creates empty arena with the given size of memory blocks.
+  explicit CsgTreeArena (const size_t theBlockSize = DefaultBlockSize);
+
+  //! Releases memory of the arena.
+  ~CsgTreeArena()
+  {
+    Release();
+  }
+
+public:
+
+  //! Allocates aligned memory of the given size.
+  void* Allocate (const size_t theSize);
+
+  //! Releases all memory of the arena at once (nodes are not destroyed).
+  void Release();
+
+  //! Returns number of allocated bytes.
+  size_t NbBytes() const
+  {
+    return myNbBytes;
+  }
+
+  //! Returns number of memory blocks.
+  size_t NbBlocks() const
+  {
+    return myBlocks.size();
+  }
+
+  //! Creates node in the given arena (on the heap if the arena is NULL),
+  //! defined in CsgTree.hpp as it needs complete CsgNode.
+  template<class Node, class... Args>
+  static Node* Create (CsgTreeArena* theArena, Args&&... theArgs);
+
+private:
+
+  CsgTreeArena (const CsgTreeArena&);
+  CsgTreeArena& operator= (const CsgTreeArena&);
+
+private:
+
+  //! Allocated memory blocks.
+  std::vector<void*> myBlocks;
+
+  //! Free memory of the last block.
+  char* myCursor;
+  char* myEnd;
+
+  //! Size of memory blocks.
+  size_t myBlockSize;
+
+  //! Number of allocated bytes.
+  size_t myNbBytes;
+
+};
+
+#endif // HEADER_CSG_TREE_ARENA
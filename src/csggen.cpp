@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <csgfile.hpp>
+#include <csggenerator.hpp>
+#include <csgparser.hpp>
+#include <csgwriter.hpp>
+
+namespace {
+
+  void printHelp() {
+
+    std::cout << "Usage: csggen [options] <output_file>\n"
+                 "  csggen writes deterministic synthetic CSG scene (CSG, CSGJS or binary .csgb\n"
+                 "  by the file extension) for scale and stress testing; the same options and seed\n"
+                 "  always give the same file. Top-level objects are random trees of operations\n"
+                 "  over primitives placed by multmatrix instructions.\n"
+                 "  Options (applied in order, so options after --preset override it):\n"
+                 "    --preset <name>        openscad (deep multmatrix nesting), flat (one wide union)\n"
+                 "                           or instanced (repeated objects)\n"
+                 "    --seed <n>             seed of random generator (1)\n"
+                 "    --primitives <n>       number of primitives (10000)\n"
+                 "    --primitive-mix <w,w,w,w>  weights of cube, sphere, cylinder and cone (1,1,0,0);\n"
+                 "                           CsgLoader doesn't read cylinders and cones yet\n"
+                 "    --operation-mix <w,w,w,w>  weights of union, difference, intersection and group (1,1,1,0)\n"
+                 "    --depth <n>            nesting depth of operations in top-level objects (2)\n"
+                 "    --fan-out <n>          maximum number of children of operations (2)\n"
+                 "    --matrix-depth <n>     nested multmatrix instructions around every node (1)\n"
+                 "    --instancing <r>       fraction of top-level objects repeating previous ones (0)\n"
+                 "    --distribution <name>  placement of top-level objects: uniform, clustered or grid\n"
+                 "    --extent <x>           half size of the cube objects are placed in (100)\n"
+                 "    --size <x>             typical size of primitives (3)\n"
+                 "    --flat                 put all top-level objects into one union\n"
+                 "    --share                write repeated subtrees of CSGJS output once (as definitions)\n"
+                 "    --to <ext>             output format (csg, csgjs or csgb) instead of the file extension\n"
+                 "  File name \"-\" stands for standard output (CSG and CSGJS only).\n"
+                 "  Example:\n"
+                 "    csggen --primitives 1000000 scene.csg\n"
+                 "    csggen --preset flat --distribution grid --primitives 100000 flat.csgjs\n"
+                 "    csggen --instancing 0.9 --share parts.csgjs\n";
+  }
+
+  //! Extracts file extension in lower case.
+  std::string getFileExtension (const std::string& theFileName) {
+
+    std::string anExt;
+    std::string::size_type anIdx = theFileName.rfind (".");
+    if (anIdx != std::string::npos) {
+      anExt = theFileName.substr (anIdx + 1);
+    }
+
+    // no Unicode please
+    std::transform (anExt.begin(), anExt.end(), anExt.begin(), ::tolower);
+    return anExt;
+  }
+
+  //! Converts option value to number (throws std::runtime_error if it is not a number).
+  double toNumber (const std::string& theOption, const std::string& theValue) {
+
+    char* anEnd = NULL;
+    const double aNumber = std::strtod (theValue.c_str(), &anEnd);
+
+    if (theValue.empty() || *anEnd != '\0') {
+      throw std::runtime_error ("Invalid value of " + theOption + ": " + theValue);
+    }
+
+    return aNumber;
+  }
+
+  //! Reads comma separated weights of the mix.
+  void readMix (const std::string& theOption, const std::string& theValue, double* theWeights, const int theNbWeights) {
+
+    std::string::size_type aStart = 0;
+
+    for (int anIndex = 0; anIndex < theNbWeights; ++anIndex) {
+      const std::string::size_type anEnd = std::min (theValue.find (',', aStart), theValue.size());
+      theWeights[anIndex] = toNumber (theOption, theValue.substr (aStart, anEnd - aStart));
+
+      if ((anEnd == theValue.size()) != (anIndex + 1 == theNbWeights)) {
+        throw std::runtime_error (theOption + " expects " + std::to_string (theNbWeights) + " weights: " + theValue);
+      }
+
+      aStart = anEnd + 1;
+    }
+  }
+}
+
+int main (int argc, char ** argv) {
+
+  csg::SceneParameters aParameters;
+  std::string anOutputExt;
+  std::string anOutputPath;
+  bool toShareSubtrees = false;
+
+  try {
+    for (int anIndex = 1; anIndex < argc; ++anIndex) {
+      const std::string anArg = argv[anIndex];
+
+      if (anArg == "--flat") {
+        aParameters.isFlat = true;
+        continue;
+      }
+
+      if (anArg == "--share") {
+        toShareSubtrees = true;
+        continue;
+      }
+
+      if (anArg.compare (0, 2, "--") != 0) {
+        anOutputPath = anArg;
+        continue;
+      }
+
+      if (anIndex + 1 == argc) {
+        throw std::runtime_error ("Missing value of " + anArg);
+      }
+
+      const std::string aValue = argv[++anIndex];
+
+      if (anArg == "--preset") {
+        aParameters = csg::SceneParameters::preset (aValue);
+      }
+      else if (anArg == "--seed") {
+        aParameters.seed = static_cast<uint64_t> (toNumber (anArg, aValue));
+      }
+      else if (anArg == "--primitives") {
+        aParameters.nbPrimitives = static_cast<int> (toNumber (anArg, aValue));
+      }
+      else if (anArg == "--primitive-mix") {
+        readMix (anArg, aValue, aParameters.primitiveMix, csg::SceneParameters::PRIMITIVE_NB);
+      }
+      else if (anArg == "--operation-mix") {
+        readMix (anArg, aValue, aParameters.operationMix, csg::SceneParameters::OPERATION_NB);
+      }
+      else if (anArg == "--depth") {
+        aParameters.depth = static_cast<int> (toNumber (anArg, aValue));
+      }
+      else if (anArg == "--fan-out") {
+        aParameters.fanOut = static_cast<int> (toNumber (anArg, aValue));
+      }
+      else if (anArg == "--matrix-depth") {
+        aParameters.matrixDepth = static_cast<int> (toNumber (anArg, aValue));
+      }
+      else if (anArg == "--instancing") {
+        aParameters.instancing = toNumber (anArg, aValue);
+      }
+      else if (anArg == "--distribution") {
+        if (aValue == "uniform") {
+          aParameters.distribution = csg::SceneParameters::DISTRIBUTION_UNIFORM;
+        }
+        else if (aValue == "clustered") {
+          aParameters.distribution = csg::SceneParameters::DISTRIBUTION_CLUSTERED;
+        }
+        else if (aValue == "grid") {
+          aParameters.distribution = csg::SceneParameters::DISTRIBUTION_GRID;
+        }
+        else {
+          throw std::runtime_error ("Unknown distribution: " + aValue);
+        }
+      }
+      else if (anArg == "--extent") {
+        aParameters.extent = toNumber (anArg, aValue);
+      }
+      else if (anArg == "--size") {
+        aParameters.size = toNumber (anArg, aValue);
+      }
+      else if (anArg == "--to") {
+        anOutputExt = aValue;
+      }
+      else {
+        throw std::runtime_error ("Unknown option: " + anArg);
+      }
+    }
+  }
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
+    return 1;
+  }
+
+  if (anOutputPath.empty()) {
+    printHelp();
+    return 0;
+  }
+
+  if (anOutputExt.empty()) {
+    anOutputExt = getFileExtension (anOutputPath);
+  }
+
+  try {
+    csg::SceneGenerator aGenerator (aParameters);
+
+    if (anOutputExt == "csgb" || (anOutputExt == "csgjs" && toShareSubtrees)) {
+      if (anOutputPath == "-") {
+        throw std::runtime_error ("Binary and shared output can't be written to standard output");
+      }
+
+      // repeated subtrees can be found only in the whole document
+      csg::Document aDocument;
+      csg::DocumentBuilder aBuilder (aDocument);
+      aGenerator.generate (aBuilder);
+      aBuilder.finish();
+
+      if (anOutputExt == "csgb") {
+        csg::Parser::writeBinary (aDocument, anOutputPath);
+      }
+      else {
+        csg::Parser::writeJSON (aDocument, anOutputPath, csg::PRECISION_DOUBLE, true);
+      }
+
+      return 0;
+    }
+
+    if (anOutputExt != "csg" && anOutputExt != "csgjs") {
+      throw std::runtime_error ("Unrecognized extension: " + anOutputExt);
+    }
+
+    csg::OutputFile aFile (anOutputPath);
+    csg::CsgStreamWriter aWriter (aFile, anOutputExt == "csg" ? csg::CsgStreamWriter::FORMAT_CSG
+                                                              : csg::CsgStreamWriter::FORMAT_CSGJS);
+    aGenerator.generate (aWriter);
+    aWriter.finish();
+    aFile.close();
+  }
+  catch (std::runtime_error& anError) {
+    std::cerr << anError.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <csggenerator.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Names of SceneParameters::Primitive values.
+  const char* THE_PRIMITIVE_NAMES[SceneParameters::PRIMITIVE_NB] = {
+    "cube",
+    "sphere",
+    "cylinder",
+    "cone"
+  };
+
+  //! Names of SceneParameters::Operation values.
+  const char* THE_OPERATION_NAMES[SceneParameters::OPERATION_NB] = {
+    "union",
+    "difference",
+    "intersection",
+    "group"
+  };
+
+  //! Upper limit of primitives in one top-level object.
+  const int THE_MAX_OBJECT_SIZE = 1 << 20;
+
+  const double THE_PI = 3.14159265358979323846;
+
+  //! Rounds the number to the given number of decimal places.
+  double roundTo (const double theValue, const int theDigits) {
+
+    const double aScale = std::pow (10.0, theDigits);
+    const double aValue = std::round (theValue * aScale) / aScale;
+
+    // no negative zeros in the output
+    return aValue == 0.0 ? 0.0 : aValue;
+  }
+
+  //! Checks that the weights are not negative and not all zero.
+  bool isValidMix (const double* theWeights, const int theNbWeights) {
+
+    double aSum = 0.0;
+    for (int anIndex = 0; anIndex < theNbWeights; ++anIndex) {
+      if (!(theWeights[anIndex] >= 0.0)) {
+        return false;
+      }
+
+      aSum += theWeights[anIndex];
+    }
+
+    return aSum > 0.0;
+  }
+}
+
+SceneParameters::SceneParameters()
+  : seed (1),
+    nbPrimitives (10000),
+    depth (2),
+    fanOut (2),
+    matrixDepth (1),
+    instancing (0.0),
+    distribution (DISTRIBUTION_UNIFORM),
+    extent (100.0),
+    size (3.0),
+    isFlat (false) {
+
+  // CsgLoader reads neither cylinders nor cones yet
+  primitiveMix[PRIMITIVE_CUBE] = 1.0;
+  primitiveMix[PRIMITIVE_SPHERE] = 1.0;
+  primitiveMix[PRIMITIVE_CYLINDER] = 0.0;
+  primitiveMix[PRIMITIVE_CONE] = 0.0;
+
+  operationMix[OPERATION_UNION] = 1.0;
+  operationMix[OPERATION_DIFFERENCE] = 1.0;
+  operationMix[OPERATION_INTERSECTION] = 1.0;
+  operationMix[OPERATION_GROUP] = 0.0;
+}
+
+SceneParameters SceneParameters::preset (const std::string& theName) {
+
+  SceneParameters aParameters;
+
+  if (theName == "openscad") {
+    // transformations of modules nested in modules
+    aParameters.depth = 3;
+    aParameters.matrixDepth = 3;
+  }
+  else if (theName == "flat") {
+    // lots of placed primitives side by side
+    aParameters.depth = 0;
+    aParameters.matrixDepth = 0;
+    aParameters.isFlat = true;
+  }
+  else if (theName == "instanced") {
+    // the same parts placed many times
+    aParameters.instancing = 0.9;
+  }
+  else {
+    throw std::runtime_error ("Unknown preset: " + theName);
+  }
+
+  return aParameters;
+}
+
+uint64_t SceneGenerator::Random::next() {
+
+  uint64_t aValue = (m_state += 0x9E3779B97F4A7C15ULL);
+  aValue = (aValue ^ (aValue >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  aValue = (aValue ^ (aValue >> 27)) * 0x94D049BB133111EBULL;
+  return aValue ^ (aValue >> 31);
+}
+
+double SceneGenerator::Random::uniform (const double theMin, const double theMax) {
+
+  return theMin + (theMax - theMin) * ((next() >> 11) * (1.0 / 9007199254740992.0));
+}
+
+double SceneGenerator::Random::normal (const double theMean, const double theDeviation) {
+
+  // Box-Muller transform, the first uniform number is never zero
+  const double aRadius = std::sqrt (-2.0 * std::log (1.0 - uniform (0.0, 1.0)));
+  return theMean + theDeviation * aRadius * std::cos (2.0 * THE_PI * uniform (0.0, 1.0));
+}
+
+int SceneGenerator::Random::integer (const int theMin, const int theMax) {
+
+  return theMin + static_cast<int> (next() % static_cast<uint64_t> (theMax - theMin + 1));
+}
+
+int SceneGenerator::Random::pick (const double* theWeights, const int theNbWeights) {
+
+  double aSum = 0.0;
+  for (int anIndex = 0; anIndex < theNbWeights; ++anIndex) {
+    aSum += theWeights[anIndex];
+  }
+
+  double aValue = uniform (0.0, aSum);
+  for (int anIndex = 0; anIndex < theNbWeights; ++anIndex) {
+    if (aValue < theWeights[anIndex]) {
+      return anIndex;
+    }
+
+    aValue -= theWeights[anIndex];
+  }
+
+  // rounding errors, the last type of non-zero weight is chosen
+  int anIndex = theNbWeights - 1;
+  while (theWeights[anIndex] == 0.0) {
+    --anIndex;
+  }
+
+  return anIndex;
+}
+
+SceneGenerator::SceneGenerator (const SceneParameters& theParameters)
+  : m_parameters (theParameters),
+    m_handler (NULL),
+    m_random (theParameters.seed) {
+
+  if (m_parameters.nbPrimitives < 0
+   || m_parameters.depth < 0
+   || m_parameters.fanOut < 2
+   || m_parameters.matrixDepth < 0
+   || !(m_parameters.instancing >= 0.0 && m_parameters.instancing <= 1.0)
+   || !(m_parameters.extent >= 0.0)
+   || !(m_parameters.size > 0.0)) {
+    throw std::runtime_error ("Invalid scene parameters: counts and depths should not be negative, fan-out should be at least 2, "
+                              "instancing should be in [0, 1] range and size should be positive");
+  }
+
+  if (!isValidMix (m_parameters.primitiveMix, SceneParameters::PRIMITIVE_NB)
+   || (m_parameters.depth > 0 && !isValidMix (m_parameters.operationMix, SceneParameters::OPERATION_NB))) {
+    throw std::runtime_error ("Mix of primitives or operations should have positive weights");
+  }
+}
+
+void SceneGenerator::generate (Handler& theHandler) {
+
+  m_handler = &theHandler;
+  m_random = Random (m_parameters.seed);
+  m_objectSeeds.clear();
+  m_objectBudgets.clear();
+  m_objectSizes.clear();
+
+  // about as many clusters as objects in each of them
+  m_clusters.clear();
+  if (m_parameters.distribution == SceneParameters::DISTRIBUTION_CLUSTERED) {
+    const int aNbClusters = std::max (1, static_cast<int> (std::cbrt (m_parameters.nbPrimitives)));
+    for (int anIndex = 0; anIndex < aNbClusters * 3; ++anIndex) {
+      m_clusters.push_back (m_random.uniform (-m_parameters.extent, m_parameters.extent));
+    }
+  }
+
+  m_handler->version ("OpenSCAD", 2, 3);
+
+  if (m_parameters.isFlat) {
+    m_handler->beginInstruction ("union", json11::Json::object());
+  }
+
+  int aMaxObjectSize = 1;
+  for (int aLevel = 0; aLevel < m_parameters.depth && aMaxObjectSize < THE_MAX_OBJECT_SIZE; ++aLevel) {
+    aMaxObjectSize *= m_parameters.fanOut;
+  }
+
+  for (int aNbGenerated = 0; aNbGenerated < m_parameters.nbPrimitives;) {
+    const int aRemaining = m_parameters.nbPrimitives - aNbGenerated;
+
+    // grid cells are assigned per primitive, so objects of any size fill the grid evenly
+    double aPosition[3];
+    placeObject (aNbGenerated, aPosition);
+
+    const bool isInstance = !m_objectSeeds.empty() && m_random.uniform (0.0, 1.0) < m_parameters.instancing;
+    const size_t anOriginal = !m_objectSeeds.empty() ? m_random.next() % m_objectSeeds.size() : 0;
+
+    if (isInstance && m_objectSizes[anOriginal] <= aRemaining) {
+      aNbGenerated += generateObject (m_objectSeeds[anOriginal], m_objectBudgets[anOriginal], aPosition);
+      continue;
+    }
+
+    const uint64_t aSeed = m_random.next();
+    const int aBudget = std::min (aRemaining, aMaxObjectSize);
+    const int aSize = generateObject (aSeed, aBudget, aPosition);
+
+    // objects are remembered only if they may be repeated
+    if (m_parameters.instancing > 0.0) {
+      m_objectSeeds.push_back (aSeed);
+      m_objectBudgets.push_back (aBudget);
+      m_objectSizes.push_back (aSize);
+    }
+
+    aNbGenerated += aSize;
+  }
+
+  if (m_parameters.isFlat) {
+    m_handler->endInstruction();
+  }
+
+  m_handler = NULL;
+}
+
+int SceneGenerator::generateObject (const uint64_t theSeed, const int theBudget, const double* thePosition) {
+
+  // the contents depend on the seed only, so instances are identical subtrees
+  Random aRandom (theSeed);
+
+  beginTransform (thePosition, m_random.uniform (0.0, 360.0));
+  const int aSize = generateNode (aRandom, 0, theBudget);
+  m_handler->endInstruction();
+
+  return aSize;
+}
+
+int SceneGenerator::generateNode (Random& theRandom, const int theLevel, const int theBudget) {
+
+  for (int aLevel = 0; aLevel < m_parameters.matrixDepth; ++aLevel) {
+    const double anOffset[3] = {
+      theRandom.uniform (-m_parameters.size, m_parameters.size),
+      theRandom.uniform (-m_parameters.size, m_parameters.size),
+      theRandom.uniform (-m_parameters.size, m_parameters.size)
+    };
+
+    beginTransform (anOffset, theRandom.uniform (0.0, 360.0));
+  }
+
+  int aSize = 1;
+
+  if (theLevel >= m_parameters.depth || theBudget < 2) {
+    generatePrimitive (theRandom);
+  }
+  else {
+    const int anOperation = theRandom.pick (m_parameters.operationMix, SceneParameters::OPERATION_NB);
+    const int aNbChildren = std::min (theRandom.integer (2, m_parameters.fanOut), theBudget);
+
+    m_handler->beginInstruction (THE_OPERATION_NAMES[anOperation], json11::Json::object());
+
+    // the budget is shared evenly, the first children take the remainder
+    aSize = 0;
+    for (int aChild = 0; aChild < aNbChildren; ++aChild) {
+      const int aBudget = theBudget / aNbChildren + (aChild < theBudget % aNbChildren ? 1 : 0);
+      aSize += generateNode (theRandom, theLevel + 1, aBudget);
+    }
+
+    m_handler->endInstruction();
+  }
+
+  for (int aLevel = 0; aLevel < m_parameters.matrixDepth; ++aLevel) {
+    m_handler->endInstruction();
+  }
+
+  return aSize;
+}
+
+void SceneGenerator::generatePrimitive (Random& theRandom) {
+
+  const int aType = theRandom.pick (m_parameters.primitiveMix, SceneParameters::PRIMITIVE_NB);
+  const double aSize = m_parameters.size;
+
+  json11::Json::object aProperties;
+
+  switch (aType) {
+    case SceneParameters::PRIMITIVE_CUBE:
+      aProperties["size"] = json11::Json::array {
+        roundTo (theRandom.uniform (0.5, 1.5) * aSize, 3),
+        roundTo (theRandom.uniform (0.5, 1.5) * aSize, 3),
+        roundTo (theRandom.uniform (0.5, 1.5) * aSize, 3)
+      };
+      aProperties["center"] = theRandom.uniform (0.0, 1.0) < 0.5;
+      break;
+    case SceneParameters::PRIMITIVE_SPHERE:
+      aProperties["$fn"] = 16;
+      aProperties["r"] = roundTo (theRandom.uniform (0.25, 0.75) * aSize, 3);
+      break;
+    default:
+      aProperties["$fn"] = 16;
+      aProperties["h"] = roundTo (theRandom.uniform (0.5, 1.5) * aSize, 3);
+      aProperties["r"] = roundTo (theRandom.uniform (0.25, 0.75) * aSize, 3);
+      aProperties["center"] = theRandom.uniform (0.0, 1.0) < 0.5;
+      break;
+  }
+
+  m_handler->object (THE_PRIMITIVE_NAMES[aType], aProperties);
+}
+
+void SceneGenerator::beginTransform (const double* theTranslation, const double theAngle) {
+
+  const double aCos = roundTo (std::cos (theAngle * THE_PI / 180.0), 6);
+  const double aSin = roundTo (std::sin (theAngle * THE_PI / 180.0), 6);
+  const double aMinusSin = roundTo (-std::sin (theAngle * THE_PI / 180.0), 6);
+
+  m_handler->beginMatrix ("multmatrix", json11::Json::array {
+    json11::Json::array { aCos, aMinusSin, 0, roundTo (theTranslation[0], 3) },
+    json11::Json::array { aSin,  aCos, 0, roundTo (theTranslation[1], 3) },
+    json11::Json::array { 0, 0, 1, roundTo (theTranslation[2], 3) },
+    json11::Json::array { 0, 0, 0, 1 }
+  });
+}
+
+void SceneGenerator::placeObject (const int theIndex, double* thePosition) {
+
+  const double anExtent = m_parameters.extent;
+
+  switch (m_parameters.distribution) {
+    case SceneParameters::DISTRIBUTION_UNIFORM: {
+      for (int anAxis = 0; anAxis < 3; ++anAxis) {
+        thePosition[anAxis] = m_random.uniform (-anExtent, anExtent);
+      }
+      break;
+    }
+    case SceneParameters::DISTRIBUTION_CLUSTERED: {
+      const size_t aCluster = m_random.next() % (m_clusters.size() / 3);
+      const double aDeviation = anExtent / 10.0;
+
+      for (int anAxis = 0; anAxis < 3; ++anAxis) {
+        thePosition[anAxis] = m_random.normal (m_clusters[aCluster * 3 + anAxis], aDeviation);
+      }
+      break;
+    }
+    case SceneParameters::DISTRIBUTION_GRID: {
+      const int aNbCells = std::max (1, static_cast<int> (std::ceil (std::cbrt (m_parameters.nbPrimitives))));
+      const double aStep = 2.0 * anExtent / aNbCells;
+
+      int aCell = theIndex;
+      for (int anAxis = 0; anAxis < 3; ++anAxis) {
+        thePosition[anAxis] = -anExtent + aStep * (aCell % aNbCells + 0.5);
+        aCell /= aNbCells;
+      }
+      break;
+    }
+  }
+}
+
+} // csg
@@ -0,0 +1,165 @@
+#ifndef HEADER_CSG_GENERATOR
+#define HEADER_CSG_GENERATOR
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <csghandler.hpp>
+
+namespace csg {
+
+//! Parameters of synthetic scene.
+struct SceneParameters {
+
+  //! Primitive types of the mix.
+  enum Primitive {
+    PRIMITIVE_CUBE,
+    PRIMITIVE_SPHERE,
+    PRIMITIVE_CYLINDER,
+    PRIMITIVE_CONE,
+    PRIMITIVE_NB
+  };
+
+  //! Operation types of the mix.
+  enum Operation {
+    OPERATION_UNION,
+    OPERATION_DIFFERENCE,
+    OPERATION_INTERSECTION,
+    OPERATION_GROUP,
+    OPERATION_NB
+  };
+
+  //! Placement of top-level objects.
+  enum Distribution {
+    DISTRIBUTION_UNIFORM,   //!< uniformly in the cube of the given extent
+    DISTRIBUTION_CLUSTERED, //!< normally around a few random centers
+    DISTRIBUTION_GRID       //!< at the nodes of regular grid filling the cube
+  };
+
+  //! Seed of random generator (scenes of the same parameters are identical).
+  uint64_t seed;
+
+  //! Total number of primitives.
+  int nbPrimitives;
+
+  //! Relative weights of primitive and operation types.
+  double primitiveMix[PRIMITIVE_NB];
+  double operationMix[OPERATION_NB];
+
+  //! Maximum nesting depth of operations in top-level object (0 makes objects primitives).
+  int depth;
+
+  //! Maximum number of children of operations (at least 2).
+  int fanOut;
+
+  //! Number of nested multmatrix instructions placing every node inside objects
+  //! (OpenSCAD writes one per transformation of the source).
+  int matrixDepth;
+
+  //! Fraction of top-level objects which repeat one of the previous objects at another place.
+  double instancing;
+
+  Distribution distribution;
+
+  //! Half size of the cube top-level objects are placed in.
+  double extent;
+
+  //! Typical size of primitives.
+  double size;
+
+  //! Puts all top-level objects into one union instead of separate statements.
+  bool isFlat;
+
+  //! Creates parameters of OpenSCAD-like scene of cubes and spheres.
+  SceneParameters();
+
+  //! Returns parameters of the named scene (throws std::runtime_error on unknown name):
+  //! "openscad" (deep multmatrix nesting of exported assemblies), "flat" (one wide union
+  //! of placed primitives) or "instanced" (most objects repeat previous ones).
+  static SceneParameters preset (const std::string& theName);
+};
+
+//! Generator of deterministic synthetic CSG scenes for scale and stress testing.
+//! Scene is a sequence of top-level objects, each is a random tree of operations
+//! over primitives placed by multmatrix instructions. Objects are produced one by one
+//! as parsing events, so the scene can be written by CsgStreamWriter or built by
+//! DocumentBuilder at any size with memory bounded by the nesting depth.
+//! Numbers are rounded the way OpenSCAD writes them, so the output looks like exported files.
+class SceneGenerator {
+
+public:
+
+  //! Creates generator of the scene (throws std::runtime_error on invalid parameters).
+  explicit SceneGenerator (const SceneParameters& theParameters);
+
+  //! Reports the scene to the handler.
+  void generate (Handler& theHandler);
+
+private:
+
+  //! Deterministic random generator (splitmix64), independent of the standard library.
+  class Random {
+
+  public:
+
+    explicit Random (const uint64_t theSeed) : m_state (theSeed) {}
+
+    //! Returns next random 64-bit number.
+    uint64_t next();
+
+    //! Returns random number in [theMin, theMax) range.
+    double uniform (const double theMin, const double theMax);
+
+    //! Returns normally distributed random number.
+    double normal (const double theMean, const double theDeviation);
+
+    //! Returns random integer in [theMin, theMax] range.
+    int integer (const int theMin, const int theMax);
+
+    //! Returns random index of the weights with the probability proportional to the weight.
+    int pick (const double* theWeights, const int theNbWeights);
+
+  private:
+
+    uint64_t m_state;
+
+  };
+
+  //! Generates top-level object, returns the number of its primitives.
+  int generateObject (const uint64_t theSeed, const int theBudget, const double* thePosition);
+
+  //! Generates node of object within the budget of primitives, returns the number of its primitives.
+  int generateNode (Random& theRandom, const int theLevel, const int theBudget);
+
+  //! Generates primitive.
+  void generatePrimitive (Random& theRandom);
+
+  //! Begins multmatrix instruction of translation and rotation around Z axis.
+  void beginTransform (const double* theTranslation, const double theAngle);
+
+  //! Finds position of the next top-level object.
+  void placeObject (const int theIndex, double* thePosition);
+
+private:
+
+  SceneParameters m_parameters;
+
+  Handler* m_handler;
+
+  //! Generator of placement and of seeds of top-level objects.
+  Random m_random;
+
+  //! Centers of clusters.
+  std::vector<double> m_clusters;
+
+  //! Seeds, budgets and numbers of primitives of generated objects (instances repeat them).
+  std::vector<uint64_t> m_objectSeeds;
+  std::vector<int> m_objectBudgets;
+  std::vector<int> m_objectSizes;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_GENERATOR
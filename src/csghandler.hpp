@@ -0,0 +1,37 @@
+#ifndef HEADER_CSG_HANDLER
+#define HEADER_CSG_HANDLER
+
+#include <string>
+
+#include <json11/json11.hpp>
+
+namespace csg {
+
+//! Receives parsed data while CSG file is being read (see Parser::parseEvents).
+class Handler {
+
+public:
+
+  //! Releases resources of the handler.
+  virtual ~Handler() {}
+
+  //! Called for version comment.
+  virtual void version (const std::string& theName, const int theMajor, const int theMinor) {}
+
+  //! Called for CSG object (leaf of the tree).
+  virtual void object (const std::string& theType, const json11::Json::object& theProperties) = 0;
+
+  //! Called when CSG instruction with properties begins.
+  virtual void beginInstruction (const std::string& theType, const json11::Json::object& theProperties) = 0;
+
+  //! Called when CSG instruction with matrix (OpenScad multmatrix) begins.
+  virtual void beginMatrix (const std::string& theType, const json11::Json::array& theMatrix) = 0;
+
+  //! Called when CSG instruction (of either kind) ends.
+  virtual void endInstruction() = 0;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_HANDLER
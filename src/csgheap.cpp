@@ -0,0 +1,103 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #include <psapi.h>
+  #ifdef _MSC_VER
+    #pragma comment (lib, "psapi.lib")
+  #endif
+#else
+  #include <sys/resource.h>
+#endif
+
+#include <csgheap.hpp>
+
+namespace {
+
+  //! Size of allocation header keeping block size (preserves alignment).
+  const size_t THE_HEAP_HEADER = 16;
+
+  //! Currently allocated heap memory (in bytes).
+  std::atomic<size_t> THE_HEAP_SIZE (0);
+
+  //! Peak of allocated heap memory since the last reset (in bytes).
+  std::atomic<size_t> THE_HEAP_PEAK (0);
+
+  //! Allocated heap memory at the last reset (in bytes).
+  size_t THE_HEAP_BASE = 0;
+}
+
+void* operator new (size_t theSize) {
+
+  char* aBlock = static_cast<char*> (std::malloc (theSize + THE_HEAP_HEADER));
+
+  if (aBlock == NULL) {
+    throw std::bad_alloc();
+  }
+
+  *reinterpret_cast<size_t*> (aBlock) = theSize;
+
+  const size_t aSize = THE_HEAP_SIZE += theSize;
+  for (size_t aPeak = THE_HEAP_PEAK; aSize > aPeak && !THE_HEAP_PEAK.compare_exchange_weak (aPeak, aSize);) {}
+
+  return aBlock + THE_HEAP_HEADER;
+}
+
+void operator delete (void* thePointer) noexcept {
+
+  if (thePointer == NULL) {
+    return;
+  }
+
+  char* aBlock = static_cast<char*> (thePointer) - THE_HEAP_HEADER;
+
+  THE_HEAP_SIZE -= *reinterpret_cast<size_t*> (aBlock);
+
+  std::free (aBlock);
+}
+
+namespace csg {
+
+void resetHeapPeak() {
+
+  THE_HEAP_BASE = THE_HEAP_SIZE;
+  THE_HEAP_PEAK = THE_HEAP_BASE;
+}
+
+double heapPeak() {
+
+  return static_cast<double> (THE_HEAP_PEAK - THE_HEAP_BASE);
+}
+
+double heapUsed() {
+
+  return static_cast<double> (THE_HEAP_SIZE) - static_cast<double> (THE_HEAP_BASE);
+}
+
+double peakResidentMemory() {
+
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS aCounters;
+  if (!GetProcessMemoryInfo (GetCurrentProcess(), &aCounters, sizeof aCounters)) {
+    return 0.0;
+  }
+
+  return static_cast<double> (aCounters.PeakWorkingSetSize);
+#else
+  struct rusage anUsage;
+  if (getrusage (RUSAGE_SELF, &anUsage) != 0) {
+    return 0.0;
+  }
+
+#if defined(__APPLE__)
+  return static_cast<double> (anUsage.ru_maxrss);
+#else
+  // kilobytes on Linux and BSD
+  return static_cast<double> (anUsage.ru_maxrss) * 1024.0;
+#endif
+#endif
+}
+
+} // csg
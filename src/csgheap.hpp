@@ -0,0 +1,25 @@
+#ifndef HEADER_CSG_HEAP
+#define HEADER_CSG_HEAP
+
+namespace csg {
+
+//! Heap memory tracking of tools (csgbench, csgstat).
+//! csgheap.cpp replaces global operator new and delete, so it is linked
+//! to executables only, not to the csgparser library.
+
+//! Starts tracking of peak heap memory.
+void resetHeapPeak();
+
+//! Returns peak heap memory allocated since the last reset (in bytes).
+double heapPeak();
+
+//! Returns heap memory allocated since the last reset and still in use (in bytes).
+double heapUsed();
+
+//! Returns peak resident memory of the process (in bytes, 0 if unknown).
+//! Unlike heap tracking it can't be reset and covers all allocations (mapped files included).
+double peakResidentMemory();
+
+} // csg
+
+#endif // HEADER_CSG_HEAP
@@ -0,0 +1,601 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <csgjsonreader.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Maximum nesting depth of JSON values accepted by json11.
+  const int THE_MAX_DEPTH = 200;
+
+  //! Keys of CSG node objects.
+  enum NodeKey {
+    KEY_TYPE       = 1,
+    KEY_PROPERTIES = 2,
+    KEY_OBJECTS    = 4,
+    KEY_USE        = 8
+  };
+
+  //! Keys of CSG file object.
+  enum FileKey {
+    KEY_FILE_TYPE    = 1,
+    KEY_VERSION_NAME = 2,
+    KEY_MAJOR        = 4,
+    KEY_MINOR        = 8,
+    KEY_DEFINITIONS  = 16,
+    KEY_CONTENTS     = 32
+  };
+
+  bool isDigit (const char theChar) {
+    return theChar >= '0' && theChar <= '9';
+  }
+
+  //! Checks if the character may be a part of JSON number.
+  bool isNumberChar (const char theChar) {
+    return isDigit (theChar) || theChar == '-' || theChar == '+'
+        || theChar == '.' || theChar == 'e' || theChar == 'E';
+  }
+}
+
+CsgJsonReader::CsgJsonReader (const char* theBegin, const char* theEnd, Document& theDocument)
+  : m_cur (theBegin),
+    m_end (theEnd),
+    m_document (theDocument),
+    m_levels (1),
+    m_depth (0) {}
+
+bool CsgJsonReader::read() {
+
+  try {
+    readFile();
+  }
+  catch (Unsupported&) {
+    return false;
+  }
+
+  // the same as DocumentBuilder::finish
+  std::vector<Document::Node>& aNodes = m_document.m_nodes;
+
+  m_document.m_root.children = static_cast<Document::Index> (aNodes.size());
+  m_document.m_root.nbChildren = static_cast<Document::Index> (m_levels.front().size());
+  aNodes.insert (aNodes.end(), m_levels.front().begin(), m_levels.front().end());
+
+  m_document.m_nodes.shrink_to_fit();
+  m_document.m_properties.shrink_to_fit();
+  m_document.m_values.shrink_to_fit();
+  m_document.m_numbers.shrink_to_fit();
+  m_document.m_matrixNumbers.shrink_to_fit();
+  m_document.m_matrices.shrink_to_fit();
+
+  m_document.bindTables();
+  return true;
+}
+
+Document CsgJsonReader::readDocument (const char* theBegin, const char* theEnd) {
+
+  {
+    Document aDocument;
+    if (CsgJsonReader (theBegin, theEnd, aDocument).read()) {
+      return aDocument;
+    }
+  }
+
+  std::string anError;
+  json11::Json aData = json11::Json::parse (std::string (theBegin, theEnd), anError);
+
+  if (!anError.empty()) {
+    throw std::runtime_error (anError);
+  }
+
+  return Document::fromJson (aData);
+}
+
+void CsgJsonReader::skipWhitespace() {
+
+  while (m_cur != m_end && (*m_cur == ' ' || *m_cur == '\n' || *m_cur == '\r' || *m_cur == '\t')) {
+    ++m_cur;
+  }
+}
+
+bool CsgJsonReader::accept (const char theChar) {
+
+  skipWhitespace();
+
+  if (peek() != theChar) {
+    return false;
+  }
+
+  ++m_cur;
+  return true;
+}
+
+void CsgJsonReader::expect (const char theChar) {
+
+  if (!accept (theChar)) {
+    throw Unsupported();
+  }
+}
+
+void CsgJsonReader::checkDepth (const int theDepth) {
+
+  if (theDepth > THE_MAX_DEPTH) {
+    throw Unsupported();
+  }
+}
+
+void CsgJsonReader::readString() {
+
+  if (!accept ('"')) {
+    throw Unsupported();
+  }
+
+  // escapes and control characters are left to json11
+  const char* aBegin = m_cur;
+  while (m_cur != m_end && *m_cur != '"') {
+    if (*m_cur == '\\' || static_cast<unsigned char> (*m_cur) < 0x20) {
+      throw Unsupported();
+    }
+
+    ++m_cur;
+  }
+
+  if (m_cur == m_end) {
+    throw Unsupported();
+  }
+
+  m_token.assign (aBegin, m_cur++);
+}
+
+double CsgJsonReader::readNumber() {
+
+  skipWhitespace();
+
+  const char* aBegin = m_cur;
+  bool isInteger = true;
+  while (m_cur != m_end && isNumberChar (*m_cur)) {
+    isInteger = isInteger && (isDigit (*m_cur) || *m_cur == '-');
+    ++m_cur;
+  }
+
+  // JSON numbers have no leading zeros, parseNumber accepts them
+  const char* aDigits = aBegin != m_cur && *aBegin == '-' ? aBegin + 1 : aBegin;
+  if (m_cur - aDigits > 1 && aDigits[0] == '0' && isDigit (aDigits[1])) {
+    throw Unsupported();
+  }
+
+  double aValue = 0.0;
+  if (!parseNumber (aBegin, m_cur, aValue)) {
+    throw Unsupported();
+  }
+
+  // json11 reads short integers by atoi which has no negative zero
+  if (aValue == 0.0 && isInteger && m_cur - aBegin <= 9) {
+    aValue = 0.0;
+  }
+
+  return aValue;
+}
+
+void CsgJsonReader::readFile() {
+
+  int aKeys = 0;
+
+  std::string aVersionName;
+  double aVersion[2] = { 0.0, 0.0 };
+
+  expect ('{');
+
+  do {
+    readString();
+
+    int aKey = 0;
+    if (m_token == "type") {
+      aKey = KEY_FILE_TYPE;
+    }
+    else if (m_token == "version-name") {
+      aKey = KEY_VERSION_NAME;
+    }
+    else if (m_token == "version-major") {
+      aKey = KEY_MAJOR;
+    }
+    else if (m_token == "version-minor") {
+      aKey = KEY_MINOR;
+    }
+    else if (m_token == "definitions") {
+      aKey = KEY_DEFINITIONS;
+    }
+    else if (m_token == "contents") {
+      aKey = KEY_CONTENTS;
+    }
+
+    // definitions should be known before their references are read
+    if (aKey == 0 || (aKeys & aKey) != 0 || (aKey == KEY_DEFINITIONS && (aKeys & KEY_CONTENTS) != 0)) {
+      throw Unsupported();
+    }
+
+    aKeys |= aKey;
+    expect (':');
+
+    switch (aKey) {
+      case KEY_FILE_TYPE:
+        readString();
+        if (m_token != "CSG file") {
+          throw Unsupported();
+        }
+        break;
+      case KEY_VERSION_NAME:
+        readString();
+        aVersionName = m_token;
+        break;
+      case KEY_MAJOR:
+      case KEY_MINOR: {
+        double& aNumber = aVersion[aKey == KEY_MAJOR ? 0 : 1];
+        aNumber = readNumber();
+
+        // converted the same way as by json11 int_value()
+        if (!(aNumber > -2147483648.0 && aNumber < 2147483648.0)) {
+          throw Unsupported();
+        }
+        break;
+      }
+      case KEY_DEFINITIONS:
+        expect ('[');
+        readDefinitions();
+        break;
+      case KEY_CONTENTS:
+        expect ('[');
+        readNodeList (1);
+        break;
+    }
+  }
+  while (accept (','));
+
+  expect ('}');
+  skipWhitespace();
+
+  if (m_cur != m_end || (aKeys & (KEY_FILE_TYPE | KEY_CONTENTS)) != (KEY_FILE_TYPE | KEY_CONTENTS)) {
+    throw Unsupported();
+  }
+
+  m_document.m_versionName = aVersionName;
+  m_document.m_majorVersion = static_cast<int> (aVersion[0]);
+  m_document.m_minorVersion = static_cast<int> (aVersion[1]);
+}
+
+void CsgJsonReader::readDefinitions() {
+
+  if (accept (']')) {
+    return;
+  }
+
+  do {
+    // the node itself is placed by its references, its children are placed by readNode
+    expect ('{');
+    readNode (2);
+
+    m_definitions.push_back (m_levels.front().back());
+    m_levels.front().pop_back();
+  }
+  while (accept (','));
+
+  expect (']');
+}
+
+void CsgJsonReader::readNodeList (const int theDepth) {
+
+  checkDepth (theDepth);
+
+  if (accept (']')) {
+    return;
+  }
+
+  do {
+    // nested lists are flattened the same way as by Document::fromJson
+    if (accept ('{')) {
+      readNode (theDepth + 1);
+    }
+    else if (accept ('[')) {
+      readNodeList (theDepth + 1);
+    }
+    else {
+      throw Unsupported();
+    }
+  }
+  while (accept (','));
+
+  expect (']');
+}
+
+void CsgJsonReader::readNode (const int theDepth) {
+
+  checkDepth (theDepth + 1);
+
+  if (++m_depth == m_levels.size()) {
+    m_levels.push_back (std::vector<Document::Node>());
+  }
+
+  // zero-initialized, so padding bytes are the same in binary files
+  Document::Node aNode = Document::Node();
+  aNode.kind = Document::NODE_OBJECT;
+
+  Document::Property aMatrix = Document::Property();
+  aMatrix.name = Document::INVALID_INDEX;
+
+  double aUse = 0.0;
+  int aKeys = 0;
+
+  const size_t aFirstProperty = m_properties.size();
+
+  if (!accept ('}')) {
+    do {
+      readString();
+
+      int aKey = 0;
+      if (m_token == "type") {
+        aKey = KEY_TYPE;
+      }
+      else if (m_token == "properties") {
+        aKey = KEY_PROPERTIES;
+      }
+      else if (m_token == "objects") {
+        aKey = KEY_OBJECTS;
+      }
+      else if (m_token == "use") {
+        aKey = KEY_USE;
+      }
+
+      if (aKey == 0 || (aKeys & aKey) != 0) {
+        throw Unsupported();
+      }
+
+      aKeys |= aKey;
+      expect (':');
+
+      switch (aKey) {
+        case KEY_TYPE:
+          readString();
+          if (m_token == "CSG file") {
+            throw Unsupported();
+          }
+
+          aNode.type = m_document.intern (m_token);
+          break;
+        case KEY_PROPERTIES:
+          if (accept ('{')) {
+            readProperties (theDepth + 1);
+          }
+          else if (accept ('[')) {
+            aNode.kind = Document::NODE_MATRIX;
+            aMatrix.value = readArray (theDepth + 1);
+          }
+          else {
+            throw Unsupported();
+          }
+          break;
+        case KEY_OBJECTS:
+          expect ('[');
+          readNodeList (theDepth + 1);
+          break;
+        case KEY_USE:
+          aUse = readNumber();
+          break;
+      }
+    }
+    while (accept (','));
+
+    expect ('}');
+  }
+
+  std::vector<Document::Node>& aChildren = m_levels[m_depth--];
+  std::vector<Document::Node>& aSiblings = m_levels[m_depth];
+
+  if (aKeys == KEY_USE) {
+    if (!(aUse >= 0.0 && aUse < m_definitions.size()) || aUse != static_cast<size_t> (aUse)) {
+      throw Unsupported();
+    }
+
+    aSiblings.push_back (m_definitions[static_cast<size_t> (aUse)]);
+    return;
+  }
+
+  if ((aKeys & KEY_USE) != 0 || (aKeys & KEY_TYPE) == 0 || (aKeys & KEY_PROPERTIES) == 0) {
+    throw Unsupported();
+  }
+
+  std::vector<Document::Property>& aProperties = m_document.m_properties;
+  aNode.properties = static_cast<Document::Index> (aProperties.size());
+
+  if (aNode.kind == Document::NODE_MATRIX) {
+    aNode.nbProperties = 1;
+    aProperties.push_back (aMatrix);
+  }
+  else {
+    // properties are ordered by name the same way as in json11 objects
+    auto aBegin = m_properties.begin() + aFirstProperty;
+    std::sort (aBegin, m_properties.end(),
+      [this] (const Document::Property& theLeft, const Document::Property& theRight) {
+        return m_document.name (theLeft.name) < m_document.name (theRight.name);
+      });
+
+    for (auto anIter = aBegin; anIter != m_properties.end(); ++anIter) {
+      if (anIter != aBegin && anIter->name == (anIter - 1)->name) {
+        throw Unsupported();
+      }
+    }
+
+    aNode.nbProperties = static_cast<Document::Index> (m_properties.size() - aFirstProperty);
+    aProperties.insert (aProperties.end(), aBegin, m_properties.end());
+    m_properties.resize (aFirstProperty);
+
+    if ((aKeys & KEY_OBJECTS) != 0) {
+      aNode.kind = Document::NODE_INSTRUCTION;
+    }
+  }
+
+  if (aNode.kind != Document::NODE_OBJECT) {
+    std::vector<Document::Node>& aNodes = m_document.m_nodes;
+
+    aNode.children = static_cast<Document::Index> (aNodes.size());
+    aNode.nbChildren = static_cast<Document::Index> (aChildren.size());
+    aNodes.insert (aNodes.end(), aChildren.begin(), aChildren.end());
+  }
+
+  // the level is reused by the next node of the same depth
+  aChildren.clear();
+  aSiblings.push_back (aNode);
+}
+
+void CsgJsonReader::readProperties (const int theDepth) {
+
+  checkDepth (theDepth);
+
+  if (accept ('}')) {
+    return;
+  }
+
+  do {
+    readString();
+
+    Document::Property aProperty = Document::Property();
+    aProperty.name = m_document.intern (m_token);
+
+    expect (':');
+    aProperty.value = readValue (theDepth + 1);
+    m_properties.push_back (aProperty);
+  }
+  while (accept (','));
+
+  expect ('}');
+}
+
+Document::Value CsgJsonReader::readValue (const int theDepth) {
+
+  checkDepth (theDepth);
+  skipWhitespace();
+
+  Document::Value aValue = Document::Value();
+  aValue.size = 0;
+
+  const char aChar = peek();
+
+  if (aChar == '"') {
+    readString();
+    aValue.type = Document::VALUE_STRING;
+    aValue.string = m_document.intern (m_token);
+  }
+  else if (aChar == '-' || isDigit (aChar)) {
+    aValue.type = Document::VALUE_NUMBER;
+    aValue.number = readNumber();
+  }
+  else if (aChar == '[') {
+    ++m_cur;
+    aValue = readArray (theDepth);
+  }
+  else if (m_end - m_cur >= 4 && std::memcmp (m_cur, "true", 4) == 0) {
+    m_cur += 4;
+    aValue.type = Document::VALUE_BOOLEAN;
+    aValue.boolean = true;
+  }
+  else if (m_end - m_cur >= 5 && std::memcmp (m_cur, "false", 5) == 0) {
+    m_cur += 5;
+    aValue.type = Document::VALUE_BOOLEAN;
+    aValue.boolean = false;
+  }
+  else {
+    throw Unsupported();
+  }
+
+  return aValue;
+}
+
+Document::Value CsgJsonReader::readArray (const int theDepth) {
+
+  checkDepth (theDepth);
+
+  // numbers are decoded straight into the pool while the array is numeric,
+  // other arrays collect their items on top of the shared stack
+  std::vector<double>& aNumbers = m_document.m_numbers;
+  const size_t aFirstNumber = aNumbers.size();
+  const size_t aFirst = m_values.size();
+  bool isNumeric = true;
+
+  if (!accept (']')) {
+    do {
+      skipWhitespace();
+
+      const char aChar = peek();
+      if (isNumeric && (aChar == '-' || isDigit (aChar))) {
+        checkDepth (theDepth + 1);
+        aNumbers.push_back (readNumber());
+      }
+      else {
+        if (isNumeric) {
+          Document::Value anItem = Document::Value();
+          anItem.type = Document::VALUE_NUMBER;
+
+          for (size_t anIndex = aFirstNumber; anIndex < aNumbers.size(); ++anIndex) {
+            anItem.number = aNumbers[anIndex];
+            m_values.push_back (anItem);
+          }
+
+          aNumbers.resize (aFirstNumber);
+          isNumeric = false;
+        }
+
+        const Document::Value anItem = readValue (theDepth + 1);
+        m_values.push_back (anItem);
+      }
+    }
+    while (accept (','));
+
+    expect (']');
+  }
+
+  Document::Value aValue = Document::Value();
+
+  if (isNumeric && aNumbers.size() != aFirstNumber) {
+    aValue.type = Document::VALUE_NUMBERS;
+    aValue.items = static_cast<Document::Index> (aFirstNumber);
+    aValue.size = static_cast<Document::Index> (aNumbers.size() - aFirstNumber);
+    return aValue;
+  }
+
+  // 4 rows of 4 numbers are the last 16 numbers of the pool, they are moved to the matrix pools
+  const Document::Value* aRows = m_values.data() + aFirst;
+  bool isMatrix = m_values.size() - aFirst == 4;
+  for (size_t aRow = 0; isMatrix && aRow < 4; ++aRow) {
+    isMatrix = aRows[aRow].type == Document::VALUE_NUMBERS && aRows[aRow].size == 4
+            && aRows[aRow].items + (4 - aRow) * 4 == aNumbers.size();
+  }
+
+  if (isMatrix) {
+    aValue.type = Document::VALUE_MATRIX;
+    aValue.size = 4;
+    aValue.items = static_cast<Document::Index> (m_document.m_matrices.size() / Document::MATRIX_SIZE);
+
+    for (size_t anIndex = aNumbers.size() - Document::MATRIX_SIZE; anIndex < aNumbers.size(); ++anIndex) {
+      m_document.m_matrixNumbers.push_back (aNumbers[anIndex]);
+      m_document.m_matrices.push_back (static_cast<float> (aNumbers[anIndex]));
+    }
+
+    aNumbers.resize (aNumbers.size() - Document::MATRIX_SIZE);
+    m_values.resize (aFirst);
+    return aValue;
+  }
+
+  std::vector<Document::Value>& aValues = m_document.m_values;
+
+  aValue.type = Document::VALUE_ARRAY;
+  aValue.items = static_cast<Document::Index> (aValues.size());
+  aValue.size = static_cast<Document::Index> (m_values.size() - aFirst);
+
+  aValues.insert (aValues.end(), m_values.begin() + aFirst, m_values.end());
+  m_values.resize (aFirst);
+
+  return aValue;
+}
+
+} // csg
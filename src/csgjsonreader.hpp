@@ -0,0 +1,112 @@
+#ifndef HEADER_CSG_JSON_READER
+#define HEADER_CSG_JSON_READER
+
+#include <string>
+#include <vector>
+
+#include <csgdocument.hpp>
+
+namespace csg {
+
+//! Schema-aware single-pass reader of CSGJS format.
+//! The text is read straight into the pools of a document without json11 values:
+//! object keys are matched against the few names of CSGJS schema, numbers are
+//! converted by parseNumber directly into number and matrix pools, and nodes are
+//! placed the same way as by DocumentBuilder (including shared definitions).
+//! Keys may go in any order (CsgWriter and json11 write them sorted).
+//! Texts which are not CSG trees of this layout (syntax errors, unknown keys or values,
+//! escaped strings, definitions after contents etc.) are left to json11 and
+//! Document::fromJson, so the results and error messages are the same as of them.
+class CsgJsonReader {
+
+public:
+
+  //! Creates reader of the given text range into the given empty document.
+  CsgJsonReader (const char* theBegin, const char* theEnd, Document& theDocument);
+
+  //! Reads CSGJS file. Returns false if the text should be read by json11
+  //! (the document should be discarded then).
+  bool read();
+
+  //! Reads CSGJS text by the schema-aware reader if possible and by json11 otherwise.
+  //! Throws std::runtime_error on syntax error or if the data is not a CSG tree.
+  static Document readDocument (const char* theBegin, const char* theEnd);
+
+private:
+
+  //! Thrown when the text should be read by json11.
+  struct Unsupported {};
+
+  //! Returns current character ('\0' at the end of input).
+  char peek() const {
+    return m_cur != m_end ? *m_cur : '\0';
+  }
+
+  //! Skips whitespaces.
+  void skipWhitespace();
+
+  //! Skips whitespaces and the given character if it is the next one.
+  bool accept (const char theChar);
+
+  //! Skips whitespaces and the given character (throws Unsupported if there is another one).
+  void expect (const char theChar);
+
+  //! Throws Unsupported if the JSON value of the given depth is nested deeper than json11 allows.
+  void checkDepth (const int theDepth);
+
+  //! Reads string without escapes into the token.
+  void readString();
+
+  //! Reads number.
+  double readNumber();
+
+  //! Reads object of CSG file.
+  void readFile();
+
+  //! Reads array of definitions (the file object is of depth 0).
+  void readDefinitions();
+
+  //! Reads array of nodes (after the bracket) appending them to the current level.
+  void readNodeList (const int theDepth);
+
+  //! Reads object of CSG node (after the brace) appending the node to the current level.
+  void readNode (const int theDepth);
+
+  //! Reads object of properties (after the brace) onto the stack of properties.
+  void readProperties (const int theDepth);
+
+  //! Reads property value (arrays are appended to the pools).
+  Document::Value readValue (const int theDepth);
+
+  //! Reads array (after the bracket) appending its items to the pools.
+  Document::Value readArray (const int theDepth);
+
+private:
+
+  const char* m_cur;
+  const char* m_end;
+
+  Document& m_document;
+
+  //! Children of the nodes being read (the first level is the root);
+  //! levels are reused, so only the first m_depth + 1 of them are valid.
+  std::vector<std::vector<Document::Node> > m_levels;
+  size_t m_depth;
+
+  //! Properties of the nodes being read.
+  std::vector<Document::Property> m_properties;
+
+  //! Items of the arrays being read.
+  std::vector<Document::Value> m_values;
+
+  //! Root nodes of shared subtrees.
+  std::vector<Document::Node> m_definitions;
+
+  //! Reusable storage of current string.
+  std::string m_token;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_JSON_READER
@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <csgjsonreader.hpp>
+#include <csglazy.hpp>
+#include <csgreader.hpp>
+
+namespace csg {
+
+namespace {
+
+  const char THE_MAGIC[4] = { 'C', 'S', 'G', 'I' };
+
+  //! Version of the layout (increased on every incompatible change).
+  const uint32_t THE_FORMAT_VERSION = 1;
+
+  //! Written in native byte order, reads differently on machines of other byte order.
+  const uint32_t THE_BYTE_ORDER_MARK = 0x01020304;
+
+  //! Number of bytes at the beginning and at the end of the file covered by the checksum.
+  const size_t THE_CHECKED_SIZE = 4096;
+
+  //! Header of index file, followed by the entries.
+  struct Header {
+    char magic[4];
+    uint32_t formatVersion;
+    uint32_t byteOrder;
+    uint32_t format;
+    uint64_t fileSize;
+    int64_t modificationTime;
+    uint64_t checksum;
+    uint64_t headerEnd;
+    uint64_t footerBegin;
+    uint64_t nbEntries;
+  };
+
+  //! Entry of index file.
+  struct StoredEntry {
+    uint64_t offset;
+    uint64_t size;
+    int64_t line;
+  };
+
+  static_assert (sizeof (Header) == 64, "Unexpected layout of index header");
+  static_assert (sizeof (StoredEntry) == 24, "Unexpected layout of index entry");
+
+  bool isSpace (const char theChar) {
+    return theChar == ' ' || theChar == '\t' || theChar == '\r' || theChar == '\n';
+  }
+
+  //! Hashes the bytes (FNV-1a).
+  uint64_t hashBytes (const char* theData, const size_t theSize, uint64_t theHash) {
+
+    for (size_t anIndex = 0; anIndex < theSize; ++anIndex) {
+      theHash = (theHash ^ static_cast<unsigned char> (theData[anIndex])) * 1099511628211ULL;
+    }
+
+    return theHash;
+  }
+}
+
+LazyDocument::LazyDocument (const std::string& theFilePath, const Format theFormat, const bool toSaveIndex)
+  : m_filePath (theFilePath),
+    m_format (theFormat),
+    m_file (new InputFile (theFilePath)),
+    m_headerEnd (0),
+    m_footerBegin (0),
+    m_isIndexReused (false) {
+
+  // not mapped inputs (pipes) have no modification time to check the index by
+  const bool isPersistent = m_file->isMapped();
+  if (!isPersistent) {
+    m_file->load();
+  }
+
+  m_isIndexReused = isPersistent && readIndex();
+
+  if (!m_isIndexReused) {
+    if (m_format == FORMAT_CSG) {
+      buildCsgIndex();
+    }
+    else {
+      buildJsonIndex();
+    }
+
+    if (isPersistent && toSaveIndex) {
+      writeIndex();
+    }
+  }
+
+  m_documents.resize (m_entries.size());
+}
+
+Document LazyDocument::read (const size_t theIndex) const {
+
+  const IndexEntry& anEntry = m_entries.at (theIndex);
+  const char* aData = m_file->data();
+
+  if (m_format == FORMAT_CSGJS) {
+    // the item replaces the whole "contents" array of the file object
+    std::string aText;
+    aText.reserve (m_headerEnd + anEntry.size + (m_file->size() - m_footerBegin));
+    aText.append (aData, m_headerEnd);
+    aText.append (aData + anEntry.offset, anEntry.size);
+    aText.append (aData + m_footerBegin, m_file->size() - m_footerBegin);
+
+    return CsgJsonReader::readDocument (aText.data(), aText.data() + aText.size());
+  }
+
+  Document aDocument;
+  DocumentBuilder aBuilder (aDocument);
+
+  // the version is read from the comments preceding the first statement
+  if (std::find (aData, aData + m_headerEnd, '#') != aData + m_headerEnd) {
+    CsgReader (aData, aData + m_headerEnd, aBuilder).read();
+  }
+
+  CsgReader aReader (aData, aData + anEntry.offset + anEntry.size, aBuilder);
+  aReader.skipTo (aData + anEntry.offset, anEntry.line);
+  aReader.read();
+
+  aBuilder.finish();
+  return aDocument;
+}
+
+const Document& LazyDocument::document (const size_t theIndex) {
+
+  std::unique_ptr<Document>& aDocument = m_documents.at (theIndex);
+  if (!aDocument) {
+    aDocument.reset (new Document (read (theIndex)));
+  }
+
+  return *aDocument;
+}
+
+void LazyDocument::release (const size_t theIndex) {
+
+  m_documents.at (theIndex).reset();
+}
+
+void LazyDocument::buildCsgIndex() {
+
+  const char* aData = m_file->data();
+  const size_t aSize = m_file->size();
+
+  std::vector<CsgStatement> aStatements;
+  if (!CsgReader::scanStatements (aData, aData + aSize, aStatements)) {
+    throw std::runtime_error ("Cannot index CSG file with unbalanced braces: " + m_filePath);
+  }
+
+  // statement ranges extend to the next statement, comments are not entries
+  for (size_t anIndex = 0; anIndex < aStatements.size(); ++anIndex) {
+    size_t anOffset = aStatements[anIndex].offset;
+    int aLine = aStatements[anIndex].line;
+
+    const size_t anEnd = anIndex + 1 < aStatements.size() ? aStatements[anIndex + 1].offset : aSize;
+    for (; anOffset < anEnd && isSpace (aData[anOffset]); ++anOffset) {
+      aLine += aData[anOffset] == '\n';
+    }
+
+    if (anOffset != anEnd && aData[anOffset] != '#') {
+      m_entries.push_back (IndexEntry (anOffset, anEnd - anOffset, aLine));
+    }
+  }
+
+  m_headerEnd = !m_entries.empty() ? m_entries.front().offset : aSize;
+  m_footerBegin = aSize;
+}
+
+void LazyDocument::buildJsonIndex() {
+
+  const char* aBegin = m_file->data();
+  const char* anEnd = aBegin + m_file->size();
+
+  int aDepth = 0;
+  int aLine = 1;
+
+  // the last string of the file object (the key of the array being opened)
+  std::string aKey;
+
+  bool isInContents = false;
+  bool isFound = false;
+
+  // the item being scanned and the end of the last token
+  const char* anItem = NULL;
+  int anItemLine = 0;
+  const char* aLast = aBegin;
+
+  auto anEndItem = [&]() {
+    if (anItem != NULL) {
+      m_entries.push_back (IndexEntry (anItem - aBegin, aLast - anItem, anItemLine));
+      anItem = NULL;
+    }
+  };
+
+  for (const char* aCur = aBegin; aCur != anEnd; ++aCur) {
+    const char aChar = *aCur;
+
+    if (aChar == '\n') {
+      ++aLine;
+      continue;
+    }
+
+    if (isSpace (aChar)) {
+      continue;
+    }
+
+    if (isInContents && aDepth == 2 && anItem == NULL && aChar != ',' && aChar != ']') {
+      anItem = aCur;
+      anItemLine = aLine;
+    }
+
+    if (aChar == '"') {
+      const char* aString = aCur + 1;
+      for (++aCur; aCur != anEnd && *aCur != '"'; ++aCur) {
+        if (*aCur == '\\' && aCur + 1 != anEnd) {
+          ++aCur;
+        }
+      }
+
+      if (aCur == anEnd) {
+        break;
+      }
+
+      if (aDepth == 1) {
+        aKey.assign (aString, aCur);
+      }
+    }
+    else if (aChar == '{' || aChar == '[') {
+      // the last "contents" wins the same way as in json11 objects
+      if (aDepth == 1 && aChar == '[' && aKey == "contents") {
+        isInContents = true;
+        m_entries.clear();
+        m_headerEnd = aCur + 1 - aBegin;
+      }
+
+      ++aDepth;
+    }
+    else if (aChar == '}' || aChar == ']') {
+      if (isInContents && aDepth == 2) {
+        anEndItem();
+        isInContents = false;
+        isFound = true;
+        m_footerBegin = aCur - aBegin;
+      }
+
+      if (--aDepth < 0) {
+        break;
+      }
+    }
+    else if (aChar == ',' && isInContents && aDepth == 2) {
+      anEndItem();
+    }
+
+    aLast = aCur + 1;
+  }
+
+  if (aDepth != 0 || !isFound) {
+    throw std::runtime_error ("Cannot index CSGJS file without balanced \"contents\" array: " + m_filePath);
+  }
+}
+
+bool LazyDocument::readIndex() {
+
+  std::unique_ptr<InputFile> anIndexFile;
+  try {
+    anIndexFile.reset (new InputFile (indexPath (m_filePath)));
+    anIndexFile->load();
+  }
+  catch (std::runtime_error&) {
+    return false;
+  }
+
+  const char* aData = anIndexFile->data();
+  const size_t aSize = anIndexFile->size();
+
+  Header aHeader;
+  if (aSize < sizeof aHeader) {
+    return false;
+  }
+
+  std::memcpy (&aHeader, aData, sizeof aHeader);
+
+  const uint64_t aFileSize = m_file->size();
+
+  if (std::memcmp (aHeader.magic, THE_MAGIC, sizeof THE_MAGIC) != 0
+   || aHeader.formatVersion != THE_FORMAT_VERSION
+   || aHeader.byteOrder != THE_BYTE_ORDER_MARK
+   || aHeader.format != static_cast<uint32_t> (m_format)
+   || aHeader.fileSize != aFileSize
+   || aHeader.modificationTime != modificationTime (m_filePath)
+   || aHeader.nbEntries != (aSize - sizeof aHeader) / sizeof (StoredEntry)
+   || (aSize - sizeof aHeader) % sizeof (StoredEntry) != 0
+   || aHeader.headerEnd > aHeader.footerBegin
+   || aHeader.footerBegin > aFileSize
+   || aHeader.checksum != checksum()) {
+    return false;
+  }
+
+  std::vector<IndexEntry> anEntries;
+  anEntries.reserve (aHeader.nbEntries);
+
+  for (uint64_t anIndex = 0; anIndex < aHeader.nbEntries; ++anIndex) {
+    StoredEntry anEntry;
+    std::memcpy (&anEntry, aData + sizeof aHeader + anIndex * sizeof anEntry, sizeof anEntry);
+
+    if (anEntry.offset < aHeader.headerEnd || anEntry.size > aHeader.footerBegin - anEntry.offset) {
+      return false;
+    }
+
+    anEntries.push_back (IndexEntry (anEntry.offset, anEntry.size, static_cast<int> (anEntry.line)));
+  }
+
+  m_entries.swap (anEntries);
+  m_headerEnd = aHeader.headerEnd;
+  m_footerBegin = aHeader.footerBegin;
+  return true;
+}
+
+void LazyDocument::writeIndex() const {
+
+  Header aHeader;
+  std::memset (&aHeader, 0, sizeof aHeader);
+  std::memcpy (aHeader.magic, THE_MAGIC, sizeof THE_MAGIC);
+  aHeader.formatVersion = THE_FORMAT_VERSION;
+  aHeader.byteOrder = THE_BYTE_ORDER_MARK;
+  aHeader.format = static_cast<uint32_t> (m_format);
+  aHeader.fileSize = m_file->size();
+  aHeader.modificationTime = modificationTime (m_filePath);
+  aHeader.checksum = checksum();
+  aHeader.headerEnd = m_headerEnd;
+  aHeader.footerBegin = m_footerBegin;
+  aHeader.nbEntries = m_entries.size();
+
+  std::vector<char> aBuffer (sizeof aHeader + m_entries.size() * sizeof (StoredEntry));
+  std::memcpy (aBuffer.data(), &aHeader, sizeof aHeader);
+
+  for (size_t anIndex = 0; anIndex < m_entries.size(); ++anIndex) {
+    StoredEntry anEntry;
+    anEntry.offset = m_entries[anIndex].offset;
+    anEntry.size = m_entries[anIndex].size;
+    anEntry.line = m_entries[anIndex].line;
+
+    std::memcpy (aBuffer.data() + sizeof aHeader + anIndex * sizeof anEntry, &anEntry, sizeof anEntry);
+  }
+
+  // e.g. read-only directory, the index is rebuilt on the next opening then
+  try {
+    OutputFile aFile (indexPath (m_filePath));
+    aFile.write (aBuffer.data(), aBuffer.size());
+    aFile.close();
+  }
+  catch (std::runtime_error&) {}
+}
+
+uint64_t LazyDocument::checksum() const {
+
+  const char* aData = m_file->data();
+  const size_t aSize = m_file->size();
+
+  const size_t aHeadSize = std::min (aSize, THE_CHECKED_SIZE);
+  const size_t aTailSize = std::min (aSize - aHeadSize, THE_CHECKED_SIZE);
+
+  const uint64_t aHash = hashBytes (aData, aHeadSize, 14695981039346656037ULL);
+  return hashBytes (aData + aSize - aTailSize, aTailSize, aHash);
+}
+
+} // csg
@@ -0,0 +1,125 @@
+#ifndef HEADER_CSG_LAZY
+#define HEADER_CSG_LAZY
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <csgdocument.hpp>
+#include <csgfile.hpp>
+
+namespace csg {
+
+//! Location of top-level object or instruction (item of "contents" in CSGJS) in the file.
+struct IndexEntry {
+
+  //! Offset of the first character.
+  size_t offset;
+
+  //! Length of the text.
+  size_t size;
+
+  //! Line number of the first character.
+  int line;
+
+  IndexEntry (const size_t theOffset, const size_t theSize, const int theLine)
+    : offset (theOffset),
+      size (theSize),
+      line (theLine) {}
+};
+
+//! CSG or CSGJS file which top-level objects are parsed on demand.
+//! Opening the file finds the ranges of top-level entries in one pass which only
+//! matches braces and skips strings (CsgReader::scanStatements for CSG), the text
+//! of an entry is parsed into its own document when the entry is accessed.
+//! The index is saved next to the file (see indexPath) and reused while the size,
+//! modification time and the checksum of the beginning and the end of the file match,
+//! so reopening a large file reads neither the text nor its index beyond a few pages.
+//! Entries of CSGJS files are read together with the rest of the file object
+//! (version and definitions), so shared subtrees are resolved in every entry.
+//! The object is not thread-safe: entries should be accessed from one thread.
+class LazyDocument {
+
+public:
+
+  //! Format of indexed file.
+  enum Format {
+    FORMAT_CSG,
+    FORMAT_CSGJS
+  };
+
+public:
+
+  //! Opens the file and loads or builds its index (saving the built one if requested).
+  //! Throws std::runtime_error on I/O error or if top-level entries can't be found
+  //! (unbalanced braces, CSGJS data which is not a CSG file object).
+  LazyDocument (const std::string& theFilePath, const Format theFormat, const bool toSaveIndex = true);
+
+  //! Returns path of the index file of the given file.
+  static std::string indexPath (const std::string& theFilePath) { return theFilePath + ".csgi"; }
+
+public:
+
+  //! Checks if the saved index has been reused instead of scanning the file.
+  bool isIndexReused() const { return m_isIndexReused; }
+
+  //! Returns number of top-level entries.
+  size_t nbEntries() const { return m_entries.size(); }
+
+  //! Returns location of the entry.
+  const IndexEntry& entry (const size_t theIndex) const { return m_entries[theIndex]; }
+
+  //! Parses the entry into new document which top-level nodes are the nodes of the entry
+  //! (throws std::runtime_error on syntax error or if the data is not a CSG tree).
+  Document read (const size_t theIndex) const;
+
+  //! Returns document of the entry parsing it on the first access (see read).
+  const Document& document (const size_t theIndex);
+
+  //! Releases document of the entry parsed by document().
+  void release (const size_t theIndex);
+
+private:
+
+  LazyDocument (const LazyDocument&);
+  LazyDocument& operator= (const LazyDocument&);
+
+  //! Finds top-level statements of CSG text.
+  void buildCsgIndex();
+
+  //! Finds items of "contents" array of CSGJS text.
+  void buildJsonIndex();
+
+  //! Loads saved index, returns false if it is missing or doesn't match the file.
+  bool readIndex();
+
+  //! Saves index next to the file (failures are ignored, the index is rebuilt then).
+  void writeIndex() const;
+
+  //! Returns checksum of the file contents which are checked on reuse of the index.
+  uint64_t checksum() const;
+
+private:
+
+  std::string m_filePath;
+  Format m_format;
+
+  std::unique_ptr<InputFile> m_file;
+
+  std::vector<IndexEntry> m_entries;
+
+  //! Text preceding the entries (comments of CSG file, CSGJS text up to "contents" items)
+  //! ends at m_headerEnd; CSGJS text following the items starts at m_footerBegin.
+  size_t m_headerEnd;
+  size_t m_footerBegin;
+
+  bool m_isIndexReused;
+
+  //! Parsed entries (NULL for not accessed ones).
+  std::vector<std::unique_ptr<Document> > m_documents;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_LAZY
@@ -0,0 +1,559 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <locale>
+#include <sstream>
+#include <string>
+
+#include <csgnumbers.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Powers of 10 exactly representable by double.
+  const double THE_POWERS_OF_10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  const int THE_MAX_EXACT_POWER = 22;
+
+  //! Maximum integer which all smaller integers are exactly representable by double.
+  const uint64_t THE_MAX_EXACT_MANTISSA = uint64_t (1) << 53;
+
+  //! Maximum number of decimal digits which always fit to 64-bit mantissa.
+  const int THE_MAX_DIGITS = 19;
+
+  bool isDigit (const char theChar) {
+    return theChar >= '0' && theChar <= '9';
+  }
+
+  //! Slow path for numbers which can't be converted exactly with a single
+  //! floating point operation (reads the range using classic locale).
+  bool parseNumberSlow (const char* theBegin, const char* theEnd, double& theValue) {
+
+    std::istringstream aStream (std::string (theBegin, theEnd));
+    aStream.imbue (std::locale::classic());
+
+    aStream >> theValue;
+    return !aStream.fail();
+  }
+
+  //! Limits below which all integers are representable (2^24 and 2^53).
+  const double THE_FLOAT_EXACT_INTEGER = 16777216.0;
+  const double THE_DOUBLE_EXACT_INTEGER = 9007199254740992.0;
+
+  //! Floating point number with 64-bit mantissa: f * 2^e.
+  struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp (const uint64_t theF, const int theE) : f (theF), e (theE) {}
+  };
+
+  //! Returns x - y (both should have the same exponent and x.f >= y.f).
+  DiyFp subtract (const DiyFp& theX, const DiyFp& theY) {
+    return DiyFp (theX.f - theY.f, theX.e);
+  }
+
+  //! Returns x * y rounded to 64-bit mantissa.
+  DiyFp multiply (const DiyFp& theX, const DiyFp& theY) {
+
+    const uint64_t aMask = 0xFFFFFFFFu;
+
+    const uint64_t anXLo = theX.f & aMask;
+    const uint64_t anXHi = theX.f >> 32;
+    const uint64_t anYLo = theY.f & aMask;
+    const uint64_t anYHi = theY.f >> 32;
+
+    const uint64_t aP0 = anXLo * anYLo;
+    const uint64_t aP1 = anXLo * anYHi;
+    const uint64_t aP2 = anXHi * anYLo;
+    const uint64_t aP3 = anXHi * anYHi;
+
+    // middle 32 bits with carries of the lower part, rounded
+    uint64_t aMiddle = (aP0 >> 32) + (aP1 & aMask) + (aP2 & aMask);
+    aMiddle += uint64_t (1) << 31;
+
+    return DiyFp (aP3 + (aP1 >> 32) + (aP2 >> 32) + (aMiddle >> 32), theX.e + theY.e + 64);
+  }
+
+  //! Shifts mantissa left until its highest bit is set.
+  DiyFp normalize (DiyFp theX) {
+
+    while ((theX.f >> 63) == 0) {
+      theX.f <<= 1;
+      --theX.e;
+    }
+
+    return theX;
+  }
+
+  //! Shifts mantissa left to get the given (smaller) exponent.
+  DiyFp normalizeTo (const DiyFp& theX, const int theE) {
+    return DiyFp (theX.f << (theX.e - theE), theE);
+  }
+
+  //! Number and the boundaries of its rounding interval (normalized).
+  struct Boundaries {
+    DiyFp w;
+    DiyFp minus;
+    DiyFp plus;
+
+    Boundaries (const DiyFp& theW, const DiyFp& theMinus, const DiyFp& thePlus)
+      : w (theW), minus (theMinus), plus (thePlus) {}
+  };
+
+  //! Computes boundaries of positive finite number stored with the given number of
+  //! mantissa bits (including the hidden one) and exponent bias: numbers between
+  //! them are rounded to this number when read back.
+  Boundaries computeBoundaries (const uint64_t theBits, const int theNbDigits, const int theBias) {
+
+    const uint64_t aHiddenBit = uint64_t (1) << (theNbDigits - 1);
+    const int aMinExp = 1 - theBias;
+
+    const uint64_t aBiasedExp = theBits >> (theNbDigits - 1);
+    const uint64_t aFraction = theBits & (aHiddenBit - 1);
+
+    const DiyFp aValue = aBiasedExp == 0 ? DiyFp (aFraction, aMinExp)
+                                         : DiyFp (aFraction + aHiddenBit, static_cast<int> (aBiasedExp) - theBias);
+
+    // the lower neighbour of powers of 2 is closer than the upper one
+    const bool isLowerCloser = aFraction == 0 && aBiasedExp > 1;
+
+    const DiyFp aPlus (2 * aValue.f + 1, aValue.e - 1);
+    const DiyFp aMinus = isLowerCloser ? DiyFp (4 * aValue.f - 1, aValue.e - 2)
+                                       : DiyFp (2 * aValue.f - 1, aValue.e - 1);
+
+    const DiyFp aNormPlus = normalize (aPlus);
+    return Boundaries (normalize (aValue), normalizeTo (aMinus, aNormPlus.e), aNormPlus);
+  }
+
+  //! Normalized power of 10: f * 2^e ~= 10^k.
+  struct CachedPower {
+    uint64_t f;
+    int e;
+    int k;
+  };
+
+  //! Powers of 10 from 10^-300 to 10^324 with step 8 (rounded to 64-bit mantissa).
+  const CachedPower THE_CACHED_POWERS[] = {
+    { 0xAB70FE17C79AC6CA, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4F, -1034, -292 },
+    { 0xBE5691EF416BD60C, -1007, -284 },
+    { 0x8DD01FAD907FFC3C,  -980, -276 },
+    { 0xD3515C2831559A83,  -954, -268 },
+    { 0x9D71AC8FADA6C9B5,  -927, -260 },
+    { 0xEA9C227723EE8BCB,  -901, -252 },
+    { 0xAECC49914078536D,  -874, -244 },
+    { 0x823C12795DB6CE57,  -847, -236 },
+    { 0xC21094364DFB5637,  -821, -228 },
+    { 0x9096EA6F3848984F,  -794, -220 },
+    { 0xD77485CB25823AC7,  -768, -212 },
+    { 0xA086CFCD97BF97F4,  -741, -204 },
+    { 0xEF340A98172AACE5,  -715, -196 },
+    { 0xB23867FB2A35B28E,  -688, -188 },
+    { 0x84C8D4DFD2C63F3B,  -661, -180 },
+    { 0xC5DD44271AD3CDBA,  -635, -172 },
+    { 0x936B9FCEBB25C996,  -608, -164 },
+    { 0xDBAC6C247D62A584,  -582, -156 },
+    { 0xA3AB66580D5FDAF6,  -555, -148 },
+    { 0xF3E2F893DEC3F126,  -529, -140 },
+    { 0xB5B5ADA8AAFF80B8,  -502, -132 },
+    { 0x87625F056C7C4A8B,  -475, -124 },
+    { 0xC9BCFF6034C13053,  -449, -116 },
+    { 0x964E858C91BA2655,  -422, -108 },
+    { 0xDFF9772470297EBD,  -396, -100 },
+    { 0xA6DFBD9FB8E5B88F,  -369,  -92 },
+    { 0xF8A95FCF88747D94,  -343,  -84 },
+    { 0xB94470938FA89BCF,  -316,  -76 },
+    { 0x8A08F0F8BF0F156B,  -289,  -68 },
+    { 0xCDB02555653131B6,  -263,  -60 },
+    { 0x993FE2C6D07B7FAC,  -236,  -52 },
+    { 0xE45C10C42A2B3B06,  -210,  -44 },
+    { 0xAA242499697392D3,  -183,  -36 },
+    { 0xFD87B5F28300CA0E,  -157,  -28 },
+    { 0xBCE5086492111AEB,  -130,  -20 },
+    { 0x8CBCCC096F5088CC,  -103,  -12 },
+    { 0xD1B71758E219652C,   -77,   -4 },
+    { 0x9C40000000000000,   -50,    4 },
+    { 0xE8D4A51000000000,   -24,   12 },
+    { 0xAD78EBC5AC620000,     3,   20 },
+    { 0x813F3978F8940984,    30,   28 },
+    { 0xC097CE7BC90715B3,    56,   36 },
+    { 0x8F7E32CE7BEA5C70,    83,   44 },
+    { 0xD5D238A4ABE98068,   109,   52 },
+    { 0x9F4F2726179A2245,   136,   60 },
+    { 0xED63A231D4C4FB27,   162,   68 },
+    { 0xB0DE65388CC8ADA8,   189,   76 },
+    { 0x83C7088E1AAB65DB,   216,   84 },
+    { 0xC45D1DF942711D9A,   242,   92 },
+    { 0x924D692CA61BE758,   269,  100 },
+    { 0xDA01EE641A708DEA,   295,  108 },
+    { 0xA26DA3999AEF774A,   322,  116 },
+    { 0xF209787BB47D6B85,   348,  124 },
+    { 0xB454E4A179DD1877,   375,  132 },
+    { 0x865B86925B9BC5C2,   402,  140 },
+    { 0xC83553C5C8965D3D,   428,  148 },
+    { 0x952AB45CFA97A0B3,   455,  156 },
+    { 0xDE469FBD99A05FE3,   481,  164 },
+    { 0xA59BC234DB398C25,   508,  172 },
+    { 0xF6C69A72A3989F5C,   534,  180 },
+    { 0xB7DCBF5354E9BECE,   561,  188 },
+    { 0x88FCF317F22241E2,   588,  196 },
+    { 0xCC20CE9BD35C78A5,   614,  204 },
+    { 0x98165AF37B2153DF,   641,  212 },
+    { 0xE2A0B5DC971F303A,   667,  220 },
+    { 0xA8D9D1535CE3B396,   694,  228 },
+    { 0xFB9B7CD9A4A7443C,   720,  236 },
+    { 0xBB764C4CA7A44410,   747,  244 },
+    { 0x8BAB8EEFB6409C1A,   774,  252 },
+    { 0xD01FEF10A657842C,   800,  260 },
+    { 0x9B10A4E5E9913129,   827,  268 },
+    { 0xE7109BFBA19C0C9D,   853,  276 },
+    { 0xAC2820D9623BF429,   880,  284 },
+    { 0x80444B5E7AA7CF85,   907,  292 },
+    { 0xBF21E44003ACDD2D,   933,  300 },
+    { 0x8E679C2F5E44FF8F,   960,  308 },
+    { 0xD433179D9C8CB841,   986,  316 },
+    { 0x9E19DB92B4E31BA9,  1013,  324 }
+  };
+
+  const int THE_CACHED_POWERS_MIN_EXP = -300;
+  const int THE_CACHED_POWERS_STEP = 8;
+
+  //! Range of binary exponents of scaled numbers, such that their integral part
+  //! fits 32 bits and digits are generated with 64-bit arithmetic.
+  const int THE_ALPHA = -60;
+  const int THE_GAMMA = -32;
+
+  //! Returns cached power c = 10^-k such that binary exponent of c * 2^e is in [THE_ALPHA, THE_GAMMA].
+  const CachedPower& cachedPower (const int theE) {
+
+    // k = ceil ((THE_ALPHA - e - 1) * log10 (2))
+    const int aF = THE_ALPHA - theE - 1;
+    const int aK = (aF * 78913) / (1 << 18) + (aF > 0 ? 1 : 0);
+
+    const int anIndex = (-THE_CACHED_POWERS_MIN_EXP + aK + (THE_CACHED_POWERS_STEP - 1)) / THE_CACHED_POWERS_STEP;
+    return THE_CACHED_POWERS[anIndex];
+  }
+
+  //! Returns number of decimal digits of the number and the largest power of 10 not above it.
+  int largestPow10 (const uint32_t theNumber, uint32_t& thePow10) {
+
+    int aNbDigits = 10;
+    for (thePow10 = 1000000000u; thePow10 > theNumber && thePow10 > 1; thePow10 /= 10) {
+      --aNbDigits;
+    }
+
+    return aNbDigits;
+  }
+
+  //! Moves the last digit closer to the number while it stays within the rounding interval.
+  void roundDigits (char* theDigits, const int theLength,
+                    const uint64_t theDist, const uint64_t theDelta,
+                    uint64_t theRest, const uint64_t theTenK) {
+
+    while (theRest < theDist
+        && theDelta - theRest >= theTenK
+        && (theRest + theTenK < theDist || theDist - theRest > theRest + theTenK - theDist)) {
+      --theDigits[theLength - 1];
+      theRest += theTenK;
+    }
+  }
+
+  //! Generates the shortest digits of number within (theMinus, thePlus) that is closest to theW
+  //! (Grisu2). The number is digits * 10^theExponent.
+  void generateDigits (const Boundaries& theBoundaries, char* theDigits, int& theLength, int& theExponent) {
+
+    const CachedPower& aPower = cachedPower (theBoundaries.plus.e);
+    const DiyFp aScale (aPower.f, aPower.e);
+
+    const DiyFp aW = multiply (theBoundaries.w, aScale);
+    const DiyFp aMinus = multiply (theBoundaries.minus, aScale);
+    const DiyFp aPlus = multiply (theBoundaries.plus, aScale);
+
+    // products are inexact by 1 ulp, so the interval is narrowed by 1 ulp
+    const DiyFp aLow (aMinus.f + 1, aMinus.e);
+    const DiyFp aHigh (aPlus.f - 1, aPlus.e);
+
+    theExponent = -aPower.k;
+    theLength = 0;
+
+    // aOne = 2^-e, the high part splits into integral (p1) and fractional (p2) parts
+    const DiyFp aOne (uint64_t (1) << -aHigh.e, aHigh.e);
+
+    uint32_t aP1 = static_cast<uint32_t> (aHigh.f >> -aOne.e);
+    uint64_t aP2 = aHigh.f & (aOne.f - 1);
+
+    uint64_t aDelta = subtract (aHigh, aLow).f;
+    uint64_t aDist = subtract (aHigh, aW).f;
+
+    uint32_t aPow10 = 0;
+    int aNbDigits = largestPow10 (aP1, aPow10);
+
+    while (aNbDigits > 0) {
+      theDigits[theLength++] = static_cast<char> ('0' + aP1 / aPow10);
+      aP1 %= aPow10;
+      --aNbDigits;
+
+      const uint64_t aRest = (uint64_t (aP1) << -aOne.e) + aP2;
+      if (aRest <= aDelta) {
+        theExponent += aNbDigits;
+        roundDigits (theDigits, theLength, aDist, aDelta, aRest, uint64_t (aPow10) << -aOne.e);
+        return;
+      }
+
+      aPow10 /= 10;
+    }
+
+    for (;;) {
+      aP2 *= 10;
+      theDigits[theLength++] = static_cast<char> ('0' + (aP2 >> -aOne.e));
+      aP2 &= aOne.f - 1;
+      --theExponent;
+
+      aDelta *= 10;
+      aDist *= 10;
+
+      if (aP2 <= aDelta) {
+        break;
+      }
+    }
+
+    roundDigits (theDigits, theLength, aDist, aDelta, aP2, aOne.f);
+  }
+
+  //! Writes digits * 10^exponent in printf ("%g") manner.
+  size_t formatDigits (const char* theDigits, const int theLength, const int theExponent, char* theBuffer) {
+
+    // position of decimal point relative to the first digit
+    const int aPoint = theLength + theExponent;
+
+    char* aCur = theBuffer;
+
+    if (aPoint - 1 < -4 || aPoint - 1 > 16) {
+      *aCur++ = theDigits[0];
+      if (theLength > 1) {
+        *aCur++ = '.';
+        for (int anIndex = 1; anIndex < theLength; ++anIndex) {
+          *aCur++ = theDigits[anIndex];
+        }
+      }
+
+      int anExp = aPoint - 1;
+      *aCur++ = 'e';
+      if (anExp < 0) {
+        *aCur++ = '-';
+        anExp = -anExp;
+      }
+
+      char anExpDigits[4];
+      int aNbExpDigits = 0;
+      do {
+        anExpDigits[aNbExpDigits++] = static_cast<char> ('0' + anExp % 10);
+        anExp /= 10;
+      } while (anExp != 0);
+
+      while (aNbExpDigits > 0) {
+        *aCur++ = anExpDigits[--aNbExpDigits];
+      }
+    }
+    else if (aPoint <= 0) {
+      *aCur++ = '0';
+      *aCur++ = '.';
+      for (int anIndex = aPoint; anIndex < 0; ++anIndex) {
+        *aCur++ = '0';
+      }
+      for (int anIndex = 0; anIndex < theLength; ++anIndex) {
+        *aCur++ = theDigits[anIndex];
+      }
+    }
+    else {
+      for (int anIndex = 0; anIndex < theLength || anIndex < aPoint; ++anIndex) {
+        if (anIndex == aPoint) {
+          *aCur++ = '.';
+        }
+        *aCur++ = anIndex < theLength ? theDigits[anIndex] : '0';
+      }
+    }
+
+    return aCur - theBuffer;
+  }
+}
+
+bool parseNumber (const char* theBegin, const char* theEnd, double& theValue) {
+
+  const char* aCur = theBegin;
+
+  const bool isNegative = aCur != theEnd && *aCur == '-';
+  if (isNegative) {
+    ++aCur;
+  }
+
+  uint64_t aMantissa = 0;
+  int aNbDigits = 0;
+  int anExponent = 0;
+
+  // significant digits which do not fit to the mantissa are dropped,
+  // that makes the mantissa inexact and forces the slow path
+  bool isTruncated = false;
+
+  const char* anIntBegin = aCur;
+  for (; aCur != theEnd && isDigit (*aCur); ++aCur) {
+    if (aNbDigits < THE_MAX_DIGITS) {
+      aMantissa = aMantissa * 10 + (*aCur - '0');
+      aNbDigits += aMantissa != 0 ? 1 : 0;
+    }
+    else {
+      isTruncated |= *aCur != '0';
+      ++anExponent;
+    }
+  }
+
+  if (aCur == anIntBegin) {
+    return false;
+  }
+
+  if (aCur != theEnd && *aCur == '.') {
+    const char* aFracBegin = ++aCur;
+    for (; aCur != theEnd && isDigit (*aCur); ++aCur) {
+      if (aNbDigits < THE_MAX_DIGITS) {
+        aMantissa = aMantissa * 10 + (*aCur - '0');
+        aNbDigits += aMantissa != 0 ? 1 : 0;
+        --anExponent;
+      }
+      else {
+        isTruncated |= *aCur != '0';
+      }
+    }
+
+    if (aCur == aFracBegin) {
+      return false;
+    }
+  }
+
+  if (aCur != theEnd && (*aCur == 'e' || *aCur == 'E')) {
+    ++aCur;
+
+    const bool isNegativeExp = aCur != theEnd && *aCur == '-';
+    if (aCur != theEnd && (*aCur == '-' || *aCur == '+')) {
+      ++aCur;
+    }
+
+    const char* anExpBegin = aCur;
+    int anExpValue = 0;
+    for (; aCur != theEnd && isDigit (*aCur); ++aCur) {
+      // large exponents are left to the slow path anyway
+      if (anExpValue < 100000) {
+        anExpValue = anExpValue * 10 + (*aCur - '0');
+      }
+    }
+
+    if (aCur == anExpBegin) {
+      return false;
+    }
+
+    anExponent += isNegativeExp ? -anExpValue : anExpValue;
+  }
+
+  if (aCur != theEnd) {
+    return false;
+  }
+
+  // Clinger's fast path: both the mantissa and the power of 10 are exact doubles,
+  // so the correctly rounded product (quotient) is the correctly rounded result
+  double aValue = static_cast<double> (aMantissa);
+  bool isExact = !isTruncated && aMantissa <= THE_MAX_EXACT_MANTISSA;
+
+  if (isExact && aMantissa != 0) {
+    if (anExponent < 0 && anExponent >= -THE_MAX_EXACT_POWER) {
+      aValue /= THE_POWERS_OF_10[-anExponent];
+    }
+    else if (anExponent >= 0 && anExponent <= THE_MAX_EXACT_POWER) {
+      aValue *= THE_POWERS_OF_10[anExponent];
+    }
+    else if (anExponent > THE_MAX_EXACT_POWER && anExponent <= THE_MAX_EXACT_POWER + 15) {
+      // move extra power of 10 to the mantissa while it stays exact
+      aValue *= THE_POWERS_OF_10[anExponent - THE_MAX_EXACT_POWER];
+      isExact = aValue < static_cast<double> (THE_MAX_EXACT_MANTISSA);
+      aValue *= THE_POWERS_OF_10[THE_MAX_EXACT_POWER];
+    }
+    else {
+      isExact = false;
+    }
+  }
+
+  if (!isExact) {
+    return parseNumberSlow (theBegin, theEnd, theValue);
+  }
+
+  theValue = isNegative ? -aValue : aValue;
+  return true;
+}
+
+size_t formatNumber (const double theValue, const NumberPrecision thePrecision, char* theBuffer) {
+
+  char* aCur = theBuffer;
+
+  if (std::signbit (theValue)) {
+    *aCur++ = '-';
+  }
+
+  // numbers out of float range are kept in double precision
+  const bool isFloat = thePrecision == PRECISION_FLOAT && std::fabs (theValue) <= FLT_MAX;
+
+  if (isFloat ? static_cast<float> (theValue) == 0.0f : theValue == 0.0) {
+    *aCur++ = '0';
+    return aCur - theBuffer;
+  }
+
+  // integers (common in matrices and sizes) are written as is while all integers
+  // of their magnitude are representable, so no shorter text is read back the same
+  const double anAbsValue = std::fabs (isFloat ? static_cast<float> (theValue) : theValue);
+  if (anAbsValue < (isFloat ? THE_FLOAT_EXACT_INTEGER : THE_DOUBLE_EXACT_INTEGER)
+   && anAbsValue == std::floor (anAbsValue)) {
+    char aDigits[MAX_NUMBER_LENGTH];
+    int aLength = 0;
+    for (uint64_t anInteger = static_cast<uint64_t> (anAbsValue); anInteger != 0; anInteger /= 10) {
+      aDigits[aLength++] = static_cast<char> ('0' + anInteger % 10);
+    }
+
+    while (aLength > 0) {
+      *aCur++ = aDigits[--aLength];
+    }
+
+    return aCur - theBuffer;
+  }
+
+  Boundaries aBoundaries (DiyFp (0, 0), DiyFp (0, 0), DiyFp (0, 0));
+
+  if (isFloat) {
+    const float aValue = std::fabs (static_cast<float> (theValue));
+
+    uint32_t aBits = 0;
+    std::memcpy (&aBits, &aValue, sizeof aBits);
+
+    aBoundaries = computeBoundaries (aBits, FLT_MANT_DIG, FLT_MAX_EXP - 1 + FLT_MANT_DIG - 1);
+  }
+  else {
+    const double aValue = std::fabs (theValue);
+
+    uint64_t aBits = 0;
+    std::memcpy (&aBits, &aValue, sizeof aBits);
+
+    aBoundaries = computeBoundaries (aBits, DBL_MANT_DIG, DBL_MAX_EXP - 1 + DBL_MANT_DIG - 1);
+  }
+
+  char aDigits[MAX_NUMBER_LENGTH];
+  int aLength = 0;
+  int anExponent = 0;
+
+  generateDigits (aBoundaries, aDigits, aLength, anExponent);
+
+  return (aCur - theBuffer) + formatDigits (aDigits, aLength, anExponent, aCur);
+}
+
+} // csg
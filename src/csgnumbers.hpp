@@ -0,0 +1,31 @@
+#ifndef HEADER_CSG_NUMBERS
+#define HEADER_CSG_NUMBERS
+
+#include <cstddef>
+
+namespace csg {
+
+//! Precision of formatted numbers.
+enum NumberPrecision {
+  PRECISION_DOUBLE, //!< the text is read back as the same double
+  PRECISION_FLOAT   //!< the text is read back as the same float (numbers are rounded to float first)
+};
+
+//! Size of buffer enough for any formatted number.
+const size_t MAX_NUMBER_LENGTH = 32;
+
+//! Writes the shortest decimal representation of finite number which is read back
+//! as the same value of the given precision (Grisu2 algorithm, the result is the shortest
+//! in the vast majority of cases and always round-trips). Like printf ("%.17g"), exponent
+//! form is used for decimal exponents below -4 or above 16, but the exponent has no '+'
+//! sign and leading zeros, so the text matches CSG grammar. Returns length of the text.
+size_t formatNumber (const double theValue, const NumberPrecision thePrecision, char* theBuffer);
+
+//! Parses the whole range as decimal number ('-'? [0-9]+ ('.' [0-9]+)? ([eE] [+-]? [0-9]+)?).
+//! Unlike std::stod the result does not depend on current C locale.
+//! Returns false if the range is not a number or its value is out of double range.
+bool parseNumber (const char* theBegin, const char* theEnd, double& theValue);
+
+} // csg
+
+#endif // HEADER_CSG_NUMBERS
@@ -1,12 +1,23 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <exception>
 #include <list>
+#include <sstream>
 
 #include <json11/json11.hpp>
 #include <parser/parser.h>
 
+#include <csgbinary.hpp>
+#include <csgfile.hpp>
+#include <csgjsonreader.hpp>
+#include <csgnumbers.hpp>
 #include <csgparser.hpp>
+#include <csgreader.hpp>
+#include <csgthreads.hpp>
+#include <csgvalidator.hpp>
+#include <csgwriter.hpp>
 
 using namespace lars;
 
@@ -18,7 +29,9 @@ class CsgVisitor{
 public:
 
   CsgVisitor()
-    : m_versionName ("undefined"),
+    : m_number (0.0),
+      m_isNumber (false),
+      m_versionName ("undefined"),
       m_majorVersion (0),
       m_minorVersion (0) {}
 
@@ -46,6 +59,17 @@ public:
   json11::Json getValue (expression<CsgVisitor> e) {
 
     e.accept (this);
+    return takeValue();
+  }
+
+  //! Returns value of just visited expression (boxing the number if any).
+  json11::Json takeValue() {
+
+    if (m_isNumber) {
+      m_isNumber = false;
+      return m_number;
+    }
+
     return m_value;
   }
 
@@ -56,12 +80,17 @@ public:
 
   void visitNumber (expression<CsgVisitor> e) {
 
-    m_value = std::stod (e.string());
+    // numbers are kept unboxed until the consumer decides how to store them
+    if (!parseNumber (e.string_begin(), e.string_end(), m_number)) {
+      throw std::runtime_error ("Number is out of range: " + e.string());
+    }
+
+    m_isNumber = true;
   }
 
   void visitBoolean (expression<CsgVisitor> e) {
 
-    m_value = e.string() == "true";
+    m_value = *e.string_begin() == 't';
   }
 
   void visitString (expression<CsgVisitor> e) {
@@ -95,12 +124,35 @@ public:
   void visitArray (expression<CsgVisitor> e) {
 
     json11::Json::array anArray;
+    json11::Json::number_array aNumbers;
+    aNumbers.reserve (e.size());
+
+    // arrays of numbers only (vectors, matrix rows) are stored compactly
+    bool isNumeric = true;
 
     for (int i = 0; i < e.size(); ++i) {
-      anArray.push_back (getValue (e[i]));
+      e[i].accept (this);
+
+      if (isNumeric && m_isNumber) {
+        aNumbers.push_back (m_number);
+        m_isNumber = false;
+        continue;
+      }
+
+      if (isNumeric) {
+        anArray.assign (aNumbers.begin(), aNumbers.end());
+        isNumeric = false;
+      }
+
+      anArray.push_back (takeValue());
     }
 
-    m_value = anArray;
+    if (isNumeric) {
+      m_value = std::move (aNumbers);
+    }
+    else {
+      m_value = std::move (anArray);
+    }
   }
  
   void visitObject (expression<CsgVisitor> e) {
@@ -132,14 +184,122 @@ private:
 
   json11::Json m_value;
 
+  //! Last visited number (valid if the flag is set).
+  double m_number;
+  bool m_isNumber;
+
   std::string m_versionName;
   int m_majorVersion;
   int m_minorVersion;
   
 };
 
-//! Creates the parser built on CSG format grammar.
-static lars::parser<CsgVisitor> createParser() {
+//! Helper class building JSON representation of CSG file from parsing events.
+class JsonBuilder : public Handler {
+
+public:
+
+  JsonBuilder()
+    : m_stack (1),
+      m_hasVersion (false),
+      m_versionName ("undefined"),
+      m_majorVersion (0),
+      m_minorVersion (0) {}
+
+  //! Appends contents read by another builder (which follow contents of this one).
+  void append (const JsonBuilder& theOther) {
+
+    json11::Json::array& anObjects = m_stack.front().objects;
+    anObjects.insert (anObjects.end(), theOther.m_stack.front().objects.begin(),
+                                       theOther.m_stack.front().objects.end());
+
+    // the last version comment wins
+    if (theOther.m_hasVersion) {
+      version (theOther.m_versionName, theOther.m_majorVersion, theOther.m_minorVersion);
+    }
+  }
+
+  json11::Json getResult() {
+
+    json11::Json::object aResult = json11::Json::object({
+      { "type", "CSG file" },
+      { "version-name", m_versionName },
+      { "version-major", m_majorVersion },
+      { "version-minor", m_minorVersion },
+      { "contents", m_stack.front().objects },
+    });
+
+    return aResult;
+  }
+
+  virtual void version (const std::string& theName, const int theMajor, const int theMinor) {
+
+    m_hasVersion = true;
+    m_versionName = theName;
+    m_majorVersion = theMajor;
+    m_minorVersion = theMinor;
+  }
+
+  virtual void object (const std::string& theType, const json11::Json::object& theProperties) {
+
+    m_stack.back().objects.push_back (json11::Json::object({
+      { "type", theType },
+      { "properties", theProperties },
+    }));
+  }
+
+  virtual void beginInstruction (const std::string& theType, const json11::Json::object& theProperties) {
+
+    m_stack.push_back (Level (theType, theProperties));
+  }
+
+  virtual void beginMatrix (const std::string& theType, const json11::Json::array& theMatrix) {
+
+    m_stack.push_back (Level (theType, theMatrix));
+  }
+
+  virtual void endInstruction() {
+
+    Level& aLevel = m_stack.back();
+
+    json11::Json anInstruction = json11::Json::object({
+      { "type", aLevel.type },
+      { "properties", aLevel.properties },
+      { "objects", aLevel.objects },
+    });
+
+    m_stack.pop_back();
+    m_stack.back().objects.push_back (anInstruction);
+  }
+
+private:
+
+  //! Instruction being read.
+  struct Level {
+
+    Level() {}
+
+    Level (const std::string& theType, const json11::Json& theProperties)
+      : type (theType),
+        properties (theProperties) {}
+
+    std::string type;
+    json11::Json properties;
+    json11::Json::array objects;
+  };
+
+  //! Stack of open instructions (the first level collects file contents).
+  std::vector<Level> m_stack;
+
+  bool m_hasVersion;
+  std::string m_versionName;
+  int m_majorVersion;
+  int m_minorVersion;
+
+};
+
+//! Builds CSG format grammar.
+static std::shared_ptr<parsing_expression_grammar<CsgVisitor>> createGrammar() {
 
   parsing_expression_grammar_builder<CsgVisitor> aGrammar;
   using expression = expression<CsgVisitor>;
@@ -172,20 +332,122 @@ static lars::parser<CsgVisitor> createParser() {
 
   aGrammar.set_separator_rule ("Whitespace");
 
-  return aGrammar.get_parser();
+  return aGrammar.get_grammar();
+}
+
+//! Creates the parser built on CSG format grammar.
+//! The grammar is built once and shared (read-only) by all parsers,
+//! while parsing state is created by each parse call.
+static lars::parser<CsgVisitor> createParser() {
+
+  static const std::shared_ptr<parsing_expression_grammar<CsgVisitor>> aGrammar = createGrammar();
+
+  return create_packrat_parser (aGrammar);
 }
 
-json11::Json Parser::parse (const std::string theFilePath) {
+//! Reads top-level statements of CSG text on several threads.
+//! Throws std::runtime_error on syntax error (like sequential reading), other exceptions
+//! of the threads (e.g. std::bad_alloc) are rethrown after all threads are joined.
+static void readParallel (const char* theBegin,
+                          const char* theEnd,
+                          const int theNbThreads,
+                          JsonBuilder& theBuilder) {
+
+  std::vector<CsgStatement> aStatements;
+
+  const int aNbThreads = theNbThreads > 0 ? theNbThreads : hardwareThreads();
+
+  if (aNbThreads == 1 || !CsgReader::scanStatements (theBegin, theEnd, aStatements) || aStatements.size() < 2) {
+    CsgReader (theBegin, theEnd, theBuilder).read();
+    return;
+  }
+
+  // group statements into chunks of similar size for load balancing
+  const size_t aChunkSize = std::max<size_t> ((theEnd - theBegin) / (aNbThreads * 8), 1 << 16);
+
+  std::vector<size_t> aChunks;
+  for (size_t anIdx = 0; anIdx < aStatements.size(); ++anIdx) {
+    if (aChunks.empty() || aStatements[anIdx].offset - aStatements[aChunks.back()].offset >= aChunkSize) {
+      aChunks.push_back (anIdx);
+    }
+  }
+
+  std::vector<JsonBuilder> aBuilders (aChunks.size());
+  std::vector<char> isFailed (aChunks.size(), 0);
+  std::vector<std::exception_ptr> anErrors (aChunks.size());
+
+  parallelFor (static_cast<int> (aChunks.size()), aNbThreads, [&] (const int theChunk) {
+    const CsgStatement& aFirst = aStatements[aChunks[theChunk]];
+
+    const char* aChunkEnd = theChunk + 1 < static_cast<int> (aChunks.size()) ?
+      theBegin + aStatements[aChunks[theChunk + 1]].offset : theEnd;
+
+    try {
+      CsgReader aReader (theBegin, aChunkEnd, aBuilders[theChunk]);
+      aReader.skipTo (theBegin + aFirst.offset, aFirst.line);
+      aReader.read();
+    }
+    catch (std::runtime_error&) {
+      isFailed[theChunk] = 1;
+    }
+    catch (...) {
+      // exceptions must not leave the thread
+      anErrors[theChunk] = std::current_exception();
+    }
+  });
+
+  for (auto& anError : anErrors) {
+    if (anError) {
+      std::rethrow_exception (anError);
+    }
+  }
+
+  if (std::find (isFailed.begin(), isFailed.end(), 1) != isFailed.end()) {
+    // report exactly the same error as sequential reading
+    CsgReader (theBegin, theEnd, theBuilder).read();
+    return;
+  }
+
+  for (auto& aBuilder : aBuilders) {
+    theBuilder.append (aBuilder);
+  }
+}
+
+json11::Json Parser::parse (const std::string theFilePath, const Engine theEngine, const int theNbThreads) {
+
+  if (theEngine == ENGINE_DIRECT) {
+    JsonBuilder aBuilder;
+
+    try {
+      InputFile aFile (theFilePath);
+
+      if (aFile.isMapped() && theNbThreads != 1) {
+        readParallel (aFile.data(), aFile.data() + aFile.size(), theNbThreads, aBuilder);
+      }
+      else {
+        CsgReader (aFile, aBuilder).read();
+      }
+    }
+    catch (std::runtime_error& anError) {
+      std::cout << anError.what() << std::endl;
+      return JsonBuilder().getResult();
+    }
+
+    return aBuilder.getResult();
+  }
 
   auto aParser = createParser();
   CsgVisitor aVisitor;
 
-  std::ifstream aStream (theFilePath);
-  std::stringstream aBuffer;
-  aBuffer << aStream.rdbuf();
-
   try { 
-    aParser.parse (aBuffer.str()).accept (&aVisitor); 
+    InputFile aFile (theFilePath);
+    aFile.load();
+
+    // packrat parser keeps its own copy of the text
+    aParser.parse (std::string (aFile.data(), aFile.size())).accept (&aVisitor); 
+  }
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
   }
   catch (parser<CsgVisitor>::error e) {
     for(auto i UNUSED :range (e.begin_position().character - 1)) {
@@ -202,14 +464,30 @@ json11::Json Parser::parse (const std::string theFilePath) {
   return aVisitor.getResult();
 }
 
+void Parser::parseEvents (const std::string theFilePath, Handler& theHandler) {
+
+  InputFile aFile (theFilePath);
+
+  CsgReader aReader (aFile, theHandler);
+  aReader.read();
+}
+
 json11::Json Parser::parseJSON (const std::string theFilePath) {
-  
-  std::ifstream aStream (theFilePath);
-  std::stringstream aBuffer;
-  aBuffer << aStream.rdbuf();
+
+  std::string aText;
+
+  try {
+    InputFile aFile (theFilePath);
+    aFile.load();
+
+    aText.assign (aFile.data(), aFile.size());
+  }
+  catch (std::runtime_error& anError) {
+    std::cout << anError.what() << std::endl;
+  }
 
   std::string anErrors;
-  json11::Json aCsg = json11::Json::parse (aBuffer.str(), anErrors);
+  json11::Json aCsg = json11::Json::parse (aText, anErrors);
 
   if (!anErrors.empty()) {
     std::cout << anErrors << std::endl;
@@ -220,181 +498,107 @@ json11::Json Parser::parseJSON (const std::string theFilePath) {
   return aCsg;
 }
 
-void Parser::writeProperties (std::ostream& theStream, const json11::Json theData) {
-  if (!theData["properties"].is_object()) {
-    throw std::runtime_error ("Object properties should be represented with a dictionary");
-  }
+Document Parser::parseJSONDocument (const std::string theFilePath) {
 
-  if (theData["properties"].object_items().empty()) {
-    return; // not an error
+  InputFile aFile (theFilePath);
+  if (!aFile.isMapped()) {
+    aFile.load();
   }
 
-  auto aProperties = theData["properties"].object_items();
+  return CsgJsonReader::readDocument (aFile.data(), aFile.data() + aFile.size());
+}
 
-  // comma separated lists are messy
-  auto anIter = aProperties.begin();
-  theStream << anIter->first << " = " << anIter->second.dump();
-  anIter++;
-  for (; anIter != aProperties.end(); ++anIter) {
+Document Parser::parseDocument (const std::string theFilePath) {
 
-    theStream << ", " << anIter->first << " = " << anIter->second.dump();
-  }
-}
+  Document aDocument;
+  DocumentBuilder aBuilder (aDocument);
 
-void Parser::writeObject (std::ostream& theStream, const json11::Json theData, const std::string& theIndent) {
+  parseEvents (theFilePath, aBuilder);
+  aBuilder.finish();
 
-  theStream << theIndent << theData["type"].string_value() << "(";
-  writeProperties (theStream, theData);
-  theStream << ");\n";
+  return aDocument;
 }
 
-void Parser::writeInstruction (std::ostream& theStream, const json11::Json theData, const std::string& theIndent) {
+Document Parser::parseBinary (const std::string theFilePath) {
 
-  theStream << theIndent << theData["type"].string_value() << "(";
-  writeProperties (theStream, theData);
-  theStream << ") {\n";
-  for (auto& anObject: theData["objects"].array_items()) {
-    writeData (theStream, anObject, theIndent + "  ");
-  }
-  theStream << theIndent << "}\n";
+  return BinaryFormat::read (theFilePath);
 }
 
-void Parser::assertChildrenNum (const json11::Json theData, int theChildrenNum) {
-  
-  if (theData["objects"].array_items().size() < 2) {
-    throw std::runtime_error ("Too few children objects for instruction: " + theData["type"].dump());
-  }
+void Parser::write (const json11::Json theData, const std::string theFilePath) {
+
+  write (Document::fromJson (theData), theFilePath);
 }
 
-void Parser::writeData (std::ostream& theStream, const json11::Json theData, const std::string& theIndent) {
+void Parser::write (const Document& theDocument, const std::string theFilePath, const NumberPrecision thePrecision) {
 
-  if (theData.is_array()) {
-    for (auto& anObject: theData.array_items()) {
-      writeData (theStream, anObject, theIndent);
-    }
+  OutputFile aFile (theFilePath);
+  CsgWriter (theDocument, aFile, thePrecision).writeCsg();
+  aFile.close();
+}
 
-    return;
-  }
+std::vector<Diagnostic> Parser::validate (const json11::Json theData) {
 
-  if (theData.is_null()) {
-    throw std::runtime_error ("Unexpected NULL object");
+  Document aDocument;
+  try {
+    aDocument = Document::fromJson (theData);
   }
-
-  if (!theData.is_object()) {
-    throw std::runtime_error ("Dictionary expected: " + theData.dump());
+  catch (std::exception& e) {
+    std::cout << "Serialization error: " << e.what() << std::endl;
+    return std::vector<Diagnostic> (1, Diagnostic ("", e.what()));
   }
 
-  std::string aType = theData["type"].string_value();
+  return validate (aDocument);
+}
 
-  if (aType == "CSG file") {
+std::vector<Diagnostic> Parser::validate (const Document& theDocument) {
 
-    theStream << theIndent << "# " << theData["version-name"].string_value() <<
-                              " " << theData["version-major"].dump() <<
-                              "." << theData["version-minor"].dump() << std::endl;
+  std::vector<Diagnostic> aDiagnostics = Validator::validate (theDocument);
 
-    writeData (theStream, theData["contents"], theIndent);
+  for (auto& aDiagnostic : aDiagnostics) {
+    std::cout << "Validation error: " << aDiagnostic.path << ": " << aDiagnostic.message << std::endl;
   }
-  else if (aType == "group") {
 
-    // OpenScad compatibility empty group
-    if (theData["objects"].array_items().empty()) {
-      theStream << theIndent << "group();" << std::endl;
-    }
-    else {
-      assertChildrenNum (theData, 1);
-      writeInstruction (theStream, theData, theIndent);
-    }
-  }
-  else if (aType == "multmatrix") {
+  return aDiagnostics;
+}
 
-    // OpenScad compatibility matrix
-    if (theData["properties"].is_array()) {
+void Parser::writeJSON (const json11::Json theData, const std::string theFilePath) {
 
-      // TODO: validate matrix
-      theStream << theIndent << theData["type"].string_value() << "(";
-      theStream << theData["properties"].dump();
-      theStream << ") {\n";
-      for (auto& anObject: theData["objects"].array_items()) {
-        writeData (theStream, anObject, theIndent + "  ");
-      }
-      theStream << theIndent << "}\n";
-    }
-    else {
-      writeInstruction (theStream, theData, theIndent);
-    }
-  }
-  else if (aType == "union") {
-    assertChildrenNum (theData, 2);
-    writeInstruction (theStream, theData, theIndent);
-  }
-  else if (aType == "difference") {
-    assertChildrenNum (theData, 2);
-    writeInstruction (theStream, theData, theIndent);
-  }
-  else if (aType == "intersection") {
-    assertChildrenNum (theData, 2);
-    writeInstruction (theStream, theData, theIndent);
-  }
-  else if (aType == "smin") {
-    assertChildrenNum (theData, 2);
-    writeInstruction (theStream, theData, theIndent);
-  }
-  else if (aType == "cube") {
-    writeObject (theStream, theData, theIndent);
-  }
-  else if (aType == "sphere") {
-    writeObject (theStream, theData, theIndent);
-  }
-  else if (aType == "cylinder") {
-    writeObject (theStream, theData, theIndent);
-  }
-  else if (aType == "cone") {
-    writeObject (theStream, theData, theIndent);
-  }
-  else {
-    throw std::runtime_error ("Unknown object type: " + theData["type"].dump());
-  }
+  writeJSON (Document::fromJson (theData), theFilePath);
 }
 
-void Parser::write (const json11::Json theData, const std::string theFilePath) {
+void Parser::writeJSON (const Document& theDocument,
+                        const std::string theFilePath,
+                        const NumberPrecision thePrecision,
+                        const bool toShareSubtrees) {
+
+  validate (theDocument);
 
-  std::ofstream aFile (theFilePath);
-  writeData (aFile, theData, "");
+  OutputFile aFile (theFilePath);
+  CsgWriter (theDocument, aFile, thePrecision).writeJson (toShareSubtrees);
   aFile.close();
 }
 
-void Parser::validate (const json11::Json theData) {
+void Parser::writeBinary (const Document& theDocument, const std::string theFilePath) {
 
-  std::stringstream aBuffer;
-  try { 
-    writeData (aBuffer, theData, "");
-  }
-  catch (std::exception e) {
-    std::cout << "Serialization error: " << e.what() << std::endl;
-    return;
-  }
+  // standard output can't be opened by std::ofstream, the data is passed to it in one block
+  if (theFilePath == "-") {
+    std::ostringstream aStream (std::ios::binary);
+    BinaryFormat::write (theDocument, aStream);
 
-  auto aParser = createParser();
-  CsgVisitor aVisitor;
+    const std::string aData = aStream.str();
 
-  try { 
-    aParser.parse (aBuffer.str()).accept (&aVisitor); 
-  }
-  catch (parser<CsgVisitor>::error e) {
-    std::cout << "Validation error: " << e.what() << std::endl;
+    OutputFile aFile (theFilePath);
+    aFile.write (aData.data(), aData.size());
+    aFile.close();
+    return;
   }
-}
 
-void Parser::writeJSON (const json11::Json theData, const std::string theFilePath) {
-
-  validate (theData);
-  
-  std::string aCsgJs = theData.dump();
+  std::ofstream aFile (theFilePath, std::ios::binary);
+  if (!aFile) {
+    throw std::runtime_error ("Cannot write file: " + theFilePath);
+  }
 
-  std::ofstream aFile;
-  aFile.open (theFilePath);
-  aFile << aCsgJs;
-  aFile.close();
+  BinaryFormat::write (theDocument, aFile);
 }
 
 } // csg
\ No newline at end of file
@@ -1,7 +1,15 @@
+#ifndef HEADER_CSG_PARSER
+#define HEADER_CSG_PARSER
+
 #include <string>
+#include <vector>
 
 #include <json11/json11.hpp>
 
+#include <csgdocument.hpp>
+#include <csghandler.hpp>
+#include <csgvalidator.hpp>
+
 // TODO: export for windows dll
 #define CSG_EXPORT
 
@@ -9,40 +17,74 @@ namespace csg {
 
 class Parser {
   
+public:
+
+  //! Engine used to read CSG text.
+  enum Engine {
+    ENGINE_DIRECT, //!< hand-written single-pass reader
+    ENGINE_PEG     //!< packrat parser built from the grammar
+  };
+
 public:
 
   //! Reads CSG file.
-  CSG_EXPORT static json11::Json parse (const std::string theFilePath);
+  //! Top-level objects of mapped files are read by ENGINE_DIRECT on the given
+  //! number of threads (0 means all hardware threads).
+  CSG_EXPORT static json11::Json parse (const std::string theFilePath,
+                                        const Engine theEngine = ENGINE_DIRECT,
+                                        const int theNbThreads = 1);
+
+  //! Reads CSG file reporting its contents to the handler as the text is consumed.
+  //! Unlike parse, throws std::runtime_error on I/O or syntax error.
+  CSG_EXPORT static void parseEvents (const std::string theFilePath, Handler& theHandler);
+
+  //! Reads CSG file into compact document.
+  //! Unlike parse, throws std::runtime_error on I/O or syntax error.
+  CSG_EXPORT static Document parseDocument (const std::string theFilePath);
 
   //! Reads CSGJS file.
   CSG_EXPORT static json11::Json parseJSON (const std::string theFilePath);
 
-  //! Validates CSG data.
-  CSG_EXPORT static void validate (const json11::Json theData);
+  //! Reads CSGJS file into compact document by the schema-aware reader (see CsgJsonReader).
+  //! Unlike parseJSON, throws std::runtime_error on I/O or syntax error.
+  CSG_EXPORT static Document parseJSONDocument (const std::string theFilePath);
 
-  //! Writes CSG file.
-  CSG_EXPORT static void write (const json11::Json theData, const std::string theFilePath);
+  //! Loads binary CSG file (.csgb) written by writeBinary; the file is mapped, not parsed.
+  //! Throws std::runtime_error on I/O error or corrupted file.
+  CSG_EXPORT static Document parseBinary (const std::string theFilePath);
 
-  //! Writes CSGJS file.
-  CSG_EXPORT static void writeJSON (const json11::Json theData, const std::string theFilePath);
+  //! Validates CSG data, prints and returns found problems.
+  CSG_EXPORT static std::vector<Diagnostic> validate (const json11::Json theData);
 
-private:
+  //! Validates CSG document, prints and returns found problems (see Validator).
+  CSG_EXPORT static std::vector<Diagnostic> validate (const Document& theDocument);
+
+  //! Writes CSG file.
+  CSG_EXPORT static void write (const json11::Json theData, const std::string theFilePath);
 
-  // Serializes JSON objects into CSG format.
-  static void writeData (std::ostream& theStream, const json11::Json theData, const std::string& theIndent);
+  //! Writes CSG file from document (throws std::runtime_error on I/O error
+  //! or if the document can't be represented in CSG format).
+  //! Numbers are written in the shortest form which is read back with the given precision
+  //! (PRECISION_FLOAT matches what CsgLoader uses and gives smaller files).
+  CSG_EXPORT static void write (const Document& theDocument, const std::string theFilePath,
+                                const NumberPrecision thePrecision = PRECISION_DOUBLE);
 
-  // Serializes properties of objects and instructions.
-  static void writeProperties (std::ostream& theStream, const json11::Json theData);
+  //! Writes CSGJS file (throws std::runtime_error if the data is not CSG document).
+  CSG_EXPORT static void writeJSON (const json11::Json theData, const std::string theFilePath);
 
-  // Serializes CSG object.
-  static void writeObject (std::ostream& theStream, const json11::Json theData, const std::string& theIndent);
+  //! Writes CSGJS file from document (the layout is the same as for its JSON representation,
+  //! numbers are written as by write). Throws std::runtime_error on I/O error.
+  //! If subtrees are shared, repeated subtrees are written once as definitions
+  //! referenced by index (see CsgWriter::writeJson), which makes instance-heavy files smaller.
+  CSG_EXPORT static void writeJSON (const Document& theDocument, const std::string theFilePath,
+                                    const NumberPrecision thePrecision = PRECISION_DOUBLE,
+                                    const bool toShareSubtrees = false);
 
-  // Serializes CSG instruction.
-  static void writeInstruction (std::ostream& theStream, const json11::Json theData, const std::string& theIndent);
+  //! Writes binary CSG file (.csgb, "-" for standard output), throws std::runtime_error on I/O error.
+  CSG_EXPORT static void writeBinary (const Document& theDocument, const std::string theFilePath);
 
-  //! Checks if object has at least specified children count
-  static void assertChildrenNum (const json11::Json theData, int theChildrenNum);
-  
 };
 
-} // csg
\ No newline at end of file
+} // csg
+
+#endif // HEADER_CSG_PARSER
@@ -0,0 +1,458 @@
+#include <sstream>
+#include <stdexcept>
+
+#include <csgnumbers.hpp>
+#include <csgreader.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Size of chunks not mapped files are consumed by.
+  const size_t THE_CHUNK_SIZE = 1 << 16;
+
+  bool isSpace (const char theChar) {
+    return theChar == ' ' || theChar == '\t' || theChar == '\n' || theChar == '\r';
+  }
+
+  bool isAlpha (const char theChar) {
+    return (theChar >= 'a' && theChar <= 'z') || (theChar >= 'A' && theChar <= 'Z');
+  }
+
+  bool isDigit (const char theChar) {
+    return theChar >= '0' && theChar <= '9';
+  }
+
+  bool isNumeric (const char theChar) {
+    return isDigit (theChar) || theChar == '-' || theChar == '.' || theChar == 'e';
+  }
+}
+
+CsgReader::CsgReader (const char* theBegin, const char* theEnd, Handler& theHandler)
+  : m_handler (theHandler),
+    m_file (NULL),
+    m_data (theBegin),
+    m_cur (theBegin),
+    m_end (theEnd),
+    m_offset (0),
+    m_lineStart (0),
+    m_line (1) {}
+
+CsgReader::CsgReader (InputFile& theFile, Handler& theHandler)
+  : m_handler (theHandler),
+    m_file (theFile.isMapped() ? NULL : &theFile),
+    m_data (theFile.data()),
+    m_cur (theFile.data()),
+    m_end (theFile.data() + theFile.size()),
+    m_offset (0),
+    m_lineStart (0),
+    m_line (1) {
+
+  if (m_file != NULL) {
+    m_buffer.resize (THE_CHUNK_SIZE);
+  }
+}
+
+bool CsgReader::refill() {
+
+  if (m_file == NULL) {
+    return false;
+  }
+
+  m_offset += m_end - m_data;
+
+  const size_t aCount = m_file->read (m_buffer.data(), m_buffer.size());
+
+  m_data = m_buffer.data();
+  m_cur = m_data;
+  m_end = m_data + aCount;
+
+  if (aCount == 0) {
+    m_file = NULL; // end of input
+  }
+
+  return m_cur != m_end;
+}
+
+void CsgReader::read() {
+
+  readObjectList (false);
+
+  if (peek() != '\0') {
+    error ("object or instruction");
+  }
+}
+
+void CsgReader::skipTo (const char* thePosition, const int theLine) {
+
+  m_cur = thePosition;
+  m_line = theLine;
+
+  const char* aLineStart = thePosition;
+  while (aLineStart != m_data && aLineStart[-1] != '\n') {
+    --aLineStart;
+  }
+
+  m_lineStart = m_offset + (aLineStart - m_data);
+}
+
+bool CsgReader::scanStatements (const char* theBegin,
+                                const char* theEnd,
+                                std::vector<CsgStatement>& theStatements) {
+
+  theStatements.clear();
+  theStatements.push_back (CsgStatement (0, 1));
+
+  int aDepth = 0;
+  int aLine = 1;
+
+  // the first statement is already registered
+  bool isEnded = false;
+
+  for (const char* aCur = theBegin; aCur != theEnd; ++aCur) {
+    const char aChar = *aCur;
+
+    if (aChar == '\n') {
+      ++aLine;
+      continue;
+    }
+
+    if (isSpace (aChar)) {
+      continue;
+    }
+
+    if (isEnded && aDepth == 0) {
+      theStatements.push_back (CsgStatement (aCur - theBegin, aLine));
+      isEnded = false;
+    }
+
+    if (aChar == '"') {
+      for (++aCur; aCur != theEnd && *aCur != '"'; ++aCur) {
+        aLine += *aCur == '\n';
+      }
+
+      if (aCur == theEnd) {
+        break;
+      }
+    }
+    else if (aChar == '#') {
+      while (aCur + 1 != theEnd && aCur[1] != '\n') {
+        ++aCur;
+      }
+
+      isEnded = aDepth == 0;
+    }
+    else if (aChar == '{') {
+      ++aDepth;
+    }
+    else if (aChar == '}') {
+      if (--aDepth < 0) {
+        return false;
+      }
+
+      isEnded = aDepth == 0;
+    }
+    else if (aChar == ';') {
+      isEnded = aDepth == 0;
+    }
+  }
+
+  return aDepth == 0;
+}
+
+void CsgReader::skipWhitespace() {
+
+  for (char aChar = peek(); isSpace (aChar); aChar = peek()) {
+    if (aChar == '\n') {
+      newLine();
+    }
+    next();
+  }
+}
+
+bool CsgReader::accept (const char theChar) {
+
+  if (peek() == theChar) {
+    next();
+    return true;
+  }
+
+  return false;
+}
+
+void CsgReader::expect (const char theChar) {
+
+  if (!accept (theChar)) {
+    error (std::string ("'") + theChar + "'");
+  }
+}
+
+void CsgReader::error (const std::string& theExpected) {
+
+  std::stringstream aMessage;
+  aMessage << "Syntax error at line " << m_line << ", character " << (offset() - m_lineStart + 1)
+           << ": expected " << theExpected;
+
+  if (peek() != '\0') {
+    aMessage << " but found '" << *m_cur << "'";
+  }
+  else {
+    aMessage << " but found end of file";
+  }
+
+  throw std::runtime_error (aMessage.str());
+}
+
+void CsgReader::readComment() {
+
+  // '#' is already consumed, version string is "<name> <digit>.<digit>"
+  while (peek() == ' ' || peek() == '\t') {
+    next();
+  }
+
+  std::string aName;
+  for (char aChar = peek(); aChar != '\0' && aChar != ' ' && aChar != '\n' && aChar != '\''; aChar = peek()) {
+    aName += aChar;
+    next();
+  }
+
+  while (peek() == ' ' || peek() == '\t') {
+    next();
+  }
+
+  char aVersion[3] = { 0, 0, 0 };
+  for (int anIdx = 0; anIdx < 3 && peek() != '\n' && peek() != '\0'; ++anIdx) {
+    aVersion[anIdx] = peek();
+    next();
+  }
+
+  if (!aName.empty() && isDigit (aVersion[0]) && aVersion[1] == '.' && isDigit (aVersion[2])) {
+    m_handler.version (aName, aVersion[0] - '0', aVersion[2] - '0');
+  }
+
+  while (peek() != '\n' && peek() != '\0') {
+    next();
+  }
+}
+
+void CsgReader::readObjectList (const bool theIsNested) {
+
+  // comments also count as list items for the grammar
+  int aNbItems = 0;
+
+  for (;; ++aNbItems) {
+    skipWhitespace();
+
+    const char aChar = peek();
+
+    if (aChar == '\0' || (theIsNested && aChar == '}')) {
+      break;
+    }
+
+    if (aChar == '#') {
+      next();
+      readComment();
+    }
+    else {
+      readStatement();
+    }
+  }
+
+  if (aNbItems == 0) {
+    error ("object or instruction");
+  }
+}
+
+void CsgReader::readStatement() {
+
+  readName();
+  const std::string aType = m_token;
+
+  skipWhitespace();
+  expect ('(');
+  skipWhitespace();
+
+  // OpenScad compatibility matrix
+  if (peek() == '[') {
+    const json11::Json aMatrix = readArray();
+
+    skipWhitespace();
+    expect (')');
+    skipWhitespace();
+    expect ('{');
+
+    m_handler.beginMatrix (aType, aMatrix.array_items());
+  }
+  else {
+    json11::Json::object aProperties;
+    readProperties (aProperties);
+
+    skipWhitespace();
+    expect (')');
+    skipWhitespace();
+
+    if (accept (';')) {
+      m_handler.object (aType, aProperties);
+      return;
+    }
+
+    if (!accept ('{')) {
+      error ("';' or '{'");
+    }
+
+    m_handler.beginInstruction (aType, aProperties);
+  }
+
+  readObjectList (true);
+
+  expect ('}');
+
+  m_handler.endInstruction();
+}
+
+void CsgReader::readName() {
+
+  m_token.clear();
+
+  if (accept ('$')) {
+    m_token += '$';
+  }
+
+  if (!isAlpha (peek())) {
+    error ("name");
+  }
+
+  for (char aChar = peek(); isAlpha (aChar); aChar = peek()) {
+    m_token += aChar;
+    next();
+  }
+}
+
+void CsgReader::readProperties (json11::Json::object& theProperties) {
+
+  if (peek() != '$' && !isAlpha (peek())) {
+    return; // not an error
+  }
+
+  do {
+    skipWhitespace();
+    readName();
+    const std::string aName = m_token;
+
+    skipWhitespace();
+    expect ('=');
+    skipWhitespace();
+
+    theProperties[aName] = readValue();
+
+    skipWhitespace();
+  }
+  while (accept (','));
+}
+
+json11::Json CsgReader::readValue() {
+
+  const char aChar = peek();
+
+  if (aChar == '-' || isDigit (aChar)) {
+    return readNumber();
+  }
+  else if (aChar == '"') {
+    next();
+
+    // the packrat grammar skips separators in front of the String rule
+    skipWhitespace();
+
+    m_token.clear();
+    for (char aNext = peek(); aNext != '"' && aNext != '\0'; aNext = peek()) {
+      if (aNext == '\n') {
+        newLine();
+      }
+      m_token += aNext;
+      next();
+    }
+
+    expect ('"');
+    return m_token;
+  }
+  else if (aChar == '[') {
+    return readArray();
+  }
+  else if (aChar == 't' || aChar == 'f') {
+    readName();
+
+    if (m_token == "true" || m_token == "false") {
+      return m_token == "true";
+    }
+  }
+
+  error ("value");
+  return json11::Json();
+}
+
+double CsgReader::readNumber() {
+
+  m_token.clear();
+  for (char aChar = peek(); isNumeric (aChar); aChar = peek()) {
+    m_token += aChar;
+    next();
+  }
+
+  // nothing valid may follow a number without separator
+  double aValue = 0.0;
+  if (!parseNumber (m_token.data(), m_token.data() + m_token.size(), aValue)) {
+    error ("number");
+  }
+
+  return aValue;
+}
+
+json11::Json CsgReader::readArray() {
+
+  json11::Json::array anArray;
+
+  // numbers of the array are collected on top of the shared stack
+  // while the array is numeric (nested arrays are read above them)
+  const size_t aNumbersBegin = m_numbers.size();
+  bool isNumeric = true;
+
+  expect ('[');
+  skipWhitespace();
+
+  if (!accept (']')) {
+    do {
+      skipWhitespace();
+
+      const char aChar = peek();
+      if (isNumeric && (aChar == '-' || isDigit (aChar))) {
+        m_numbers.push_back (readNumber());
+      }
+      else {
+        if (isNumeric) {
+          anArray.assign (m_numbers.begin() + aNumbersBegin, m_numbers.end());
+          m_numbers.resize (aNumbersBegin);
+          isNumeric = false;
+        }
+
+        anArray.push_back (readValue());
+      }
+
+      skipWhitespace();
+    }
+    while (accept (','));
+
+    expect (']');
+  }
+
+  if (!isNumeric) {
+    return anArray;
+  }
+
+  // arrays of numbers only (vectors, matrix rows) are stored compactly
+  json11::Json::number_array aNumbers (m_numbers.begin() + aNumbersBegin, m_numbers.end());
+  m_numbers.resize (aNumbersBegin);
+
+  return json11::Json (std::move (aNumbers));
+}
+
+} // csg
@@ -0,0 +1,145 @@
+#ifndef HEADER_CSG_READER
+#define HEADER_CSG_READER
+
+#include <string>
+#include <vector>
+
+#include <csgfile.hpp>
+#include <csgparser.hpp>
+
+namespace csg {
+
+//! Position of top-level statement in CSG text.
+struct CsgStatement {
+
+  //! Offset of the first character.
+  size_t offset;
+
+  //! Line number of the first character.
+  int line;
+
+  CsgStatement (const size_t theOffset, const int theLine)
+    : offset (theOffset),
+      line (theLine) {}
+};
+
+//! Hand-written single-pass reader of CSG format.
+//! Accepts the same grammar as the packrat parser of csgparser.cpp,
+//! but consumes the text once without memoization and parse tree.
+//! Parsed data is reported to the handler as soon as it is read.
+class CsgReader {
+
+public:
+
+  //! Creates reader of the given text range.
+  CsgReader (const char* theBegin, const char* theEnd, Handler& theHandler);
+
+  //! Creates reader of the file (mapped files are read in place,
+  //! other inputs are consumed by fixed-size chunks).
+  CsgReader (InputFile& theFile, Handler& theHandler);
+
+  //! Reads CSG file (throws std::runtime_error on syntax error).
+  void read();
+
+  //! Moves to the given character of the text range (which line number is known).
+  void skipTo (const char* thePosition, const int theLine);
+
+  //! Finds beginnings of top-level statements (objects, instructions and comments)
+  //! by brace matching without parsing them. Statement ranges extend to the
+  //! beginning of the next one (the first range always starts at the text beginning).
+  //! Returns false if braces are unbalanced (the text can't be split then).
+  static bool scanStatements (const char* theBegin,
+                              const char* theEnd,
+                              std::vector<CsgStatement>& theStatements);
+
+private:
+
+  //! Returns current character ('\0' at the end of input).
+  char peek() {
+    return m_cur != m_end || refill() ? *m_cur : '\0';
+  }
+
+  //! Moves to the next character.
+  void next() {
+    ++m_cur;
+  }
+
+  //! Loads next chunk of not mapped file (if any).
+  bool refill();
+
+  //! Returns absolute offset of current character.
+  size_t offset() const {
+    return m_offset + (m_cur - m_data);
+  }
+
+  //! Registers line break at the current character.
+  void newLine() {
+    ++m_line;
+    m_lineStart = offset() + 1;
+  }
+
+  //! Skips whitespaces (including line breaks).
+  void skipWhitespace();
+
+  //! Skips comment or reads version string from it.
+  void readComment();
+
+  //! Reads list of objects and instructions.
+  void readObjectList (const bool theIsNested);
+
+  //! Reads CSG object or instruction.
+  void readStatement();
+
+  //! Reads name of object, instruction or property into the token.
+  void readName();
+
+  //! Reads (possibly empty) comma separated list of properties.
+  void readProperties (json11::Json::object& theProperties);
+
+  //! Reads value of property.
+  json11::Json readValue();
+
+  //! Reads numeric value.
+  double readNumber();
+
+  //! Reads array of values (arrays of numbers are compact).
+  json11::Json readArray();
+
+  //! Checks if the current character is the given one and skips it.
+  bool accept (const char theChar);
+
+  //! Skips the given character or reports syntax error.
+  void expect (const char theChar);
+
+  //! Throws syntax error exception at current position.
+  void error (const std::string& theExpected);
+
+private:
+
+  Handler& m_handler;
+
+  InputFile* m_file;
+  std::vector<char> m_buffer;
+
+  const char* m_data;
+  const char* m_cur;
+  const char* m_end;
+
+  //! Offset of the first character of current data.
+  size_t m_offset;
+
+  //! Offset of the first character of current line.
+  size_t m_lineStart;
+  int m_line;
+
+  //! Reusable storage of current token.
+  std::string m_token;
+
+  //! Reusable stack of numbers of arrays being read.
+  json11::Json::number_array m_numbers;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_READER
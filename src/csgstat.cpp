@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <csgfile.hpp>
+#include <csgheap.hpp>
+#include <csgjsonreader.hpp>
+#include <csglazy.hpp>
+#include <csgparser.hpp>
+#include <csgreader.hpp>
+#include <csgvalidator.hpp>
+#include <csgframework/CsgLoader.hpp>
+
+namespace {
+
+  //! Number of reported largest sibling lists.
+  const size_t THE_NB_LARGEST_LISTS = 5;
+
+  //! Distance between bytes read to bring mapped pages into memory.
+  const size_t THE_PAGE_SIZE = 4096;
+
+  void printHelp() {
+
+    std::cout << "Usage: csgstat [--from <ext>] [--entry <n>] <input_file>...\n"
+                 "  csgstat reports statistics of CSG, CSGJS and binary CSG (.csgb) files\n"
+                 "  as one JSON object per file and line: numbers of nodes of each type,\n"
+                 "  nesting depth, largest sibling lists, the loaded CSG tree and its bounds,\n"
+                 "  time (in seconds) and heap memory (in bytes) of each phase.\n"
+                 "  Options:\n"
+                 "    --from <ext>  input format (csg, csgjs or csgb) instead of the file extension\n"
+                 "    --entry <n>   statistics of the n-th top-level object only (counted from 0);\n"
+                 "                  only this object is parsed, the index of top-level objects\n"
+                 "                  is saved next to the file (<input_file>.csgi) and reused\n"
+                 "  Example:\n"
+                 "    csgstat parts/*.csg > stats.jsonl\n"
+                 "    csgstat --entry 42 scene.csgjs\n";
+  }
+
+  //! Extracts file extension in lower case.
+  std::string getFileExtension (const std::string& theFileName) {
+
+    std::string anExt;
+    std::string::size_type anIdx = theFileName.rfind (".");
+    if (anIdx != std::string::npos) {
+      anExt = theFileName.substr (anIdx + 1);
+    }
+
+    // no Unicode please
+    std::transform (anExt.begin(), anExt.end(), anExt.begin(), ::tolower);
+    return anExt;
+  }
+
+  //! Measures wall-clock time and heap memory of phases.
+  class PhaseTimer {
+
+  public:
+
+    PhaseTimer() : m_start (std::chrono::steady_clock::now()) {
+
+      csg::resetHeapPeak();
+    }
+
+    //! Returns the measurements: time, peak of heap allocated during the phase
+    //! and heap allocated by the phase which is still in use.
+    json11::Json result() const {
+
+      auto aStop = std::chrono::steady_clock::now();
+
+      return json11::Json::object {
+        { "time", std::chrono::duration<double> (aStop - m_start).count() },
+        { "heap-peak", csg::heapPeak() },
+        { "heap-retained", csg::heapUsed() }
+      };
+    }
+
+  private:
+
+    std::chrono::steady_clock::time_point m_start;
+
+  };
+
+  //! Collects node statistics of the document.
+  class DocumentStats {
+
+  public:
+
+    explicit DocumentStats (const csg::Document& theDocument)
+      : m_document (theDocument),
+        m_nbNodes (0),
+        m_maxDepth (0) {
+
+      // known types are reported even if they are not used
+      for (int aType = 0; aType < csg::Document::TYPE_NB; ++aType) {
+        m_counts[theDocument.name (aType)] = 0;
+      }
+
+      visitChildren (theDocument.root());
+    }
+
+    //! Returns statistics as JSON.
+    json11::Json result() const {
+
+      json11::Json::object aCounts;
+      for (auto& aCount : m_counts) {
+        aCounts[aCount.first] = static_cast<double> (aCount.second);
+      }
+
+      json11::Json::array aLists;
+      for (auto& aList : m_largestLists) {
+        aLists.push_back (json11::Json::object {
+          { "path", aList.second },
+          { "size", static_cast<double> (aList.first) }
+        });
+      }
+
+      return json11::Json::object {
+        { "nodes", static_cast<double> (m_nbNodes) },
+        { "types", aCounts },
+        { "max-depth", m_maxDepth },
+        { "largest-sibling-lists", aLists }
+      };
+    }
+
+  private:
+
+    void visitChildren (const csg::Document::Node& theNode) {
+
+      registerList (theNode.nbChildren);
+
+      const csg::Document::Node* aChildren = m_document.children (theNode);
+      for (csg::Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+        m_path.push_back (anIndex);
+        visitNode (aChildren[anIndex]);
+        m_path.pop_back();
+      }
+    }
+
+    void visitNode (const csg::Document::Node& theNode) {
+
+      ++m_nbNodes;
+      ++m_counts[m_document.name (theNode.type)];
+      m_maxDepth = std::max (m_maxDepth, static_cast<int> (m_path.size()));
+
+      visitChildren (theNode);
+    }
+
+    //! Keeps the list of the current node if it is one of the largest.
+    void registerList (const size_t theSize) {
+
+      if (theSize == 0
+       || (m_largestLists.size() == THE_NB_LARGEST_LISTS && theSize <= m_largestLists.back().first)) {
+        return;
+      }
+
+      // the location is formatted the same way as by Validator
+      std::string aPath = "contents";
+      for (size_t anIndex = 0; anIndex < m_path.size(); ++anIndex) {
+        aPath += (anIndex == 0 ? "[" : ".objects[") + std::to_string (m_path[anIndex]) + "]";
+      }
+      aPath += m_path.empty() ? "" : ".objects";
+
+      auto aPlace = std::upper_bound (m_largestLists.begin(), m_largestLists.end(), theSize,
+        [] (const size_t theValue, const std::pair<size_t, std::string>& theList) {
+          return theValue > theList.first;
+        });
+
+      m_largestLists.insert (aPlace, std::make_pair (theSize, aPath));
+      if (m_largestLists.size() > THE_NB_LARGEST_LISTS) {
+        m_largestLists.pop_back();
+      }
+    }
+
+  private:
+
+    const csg::Document& m_document;
+
+    std::map<std::string, size_t> m_counts;
+    size_t m_nbNodes;
+    int m_maxDepth;
+
+    //! Sizes and locations of the largest lists of children (in descending order).
+    std::vector<std::pair<size_t, std::string> > m_largestLists;
+
+    //! Indices of nodes leading to the current one.
+    std::vector<csg::Document::Index> m_path;
+
+  };
+
+  //! Reads the file to document measuring its phases (throws std::runtime_error on failure).
+  void readFile (const std::string& theFilePath,
+                 const std::string& theFormat,
+                 json11::Json::object& thePhases,
+                 json11::Json::object& theResult,
+                 csg::Document& theDocument) {
+
+    std::unique_ptr<csg::InputFile> aFile;
+
+    {
+      PhaseTimer aTimer;
+
+      aFile.reset (new csg::InputFile (theFilePath));
+      if (!aFile->isMapped()) {
+        aFile->load();
+      }
+
+      // mapped pages are loaded by the first access
+      volatile char aSum = 0;
+      for (size_t anOffset = 0; anOffset < aFile->size(); anOffset += THE_PAGE_SIZE) {
+        aSum += aFile->data()[anOffset];
+      }
+
+      thePhases["read"] = aTimer.result();
+    }
+
+    theResult["size"] = static_cast<double> (aFile->size());
+
+    PhaseTimer aTimer;
+
+    if (theFormat == "csg") {
+      csg::DocumentBuilder aBuilder (theDocument);
+      csg::CsgReader aReader (aFile->data(), aFile->data() + aFile->size(), aBuilder);
+      aReader.read();
+      aBuilder.finish();
+    }
+    else if (theFormat == "csgjs") {
+      theDocument = csg::CsgJsonReader::readDocument (aFile->data(), aFile->data() + aFile->size());
+    }
+    else if (theFormat == "csgb") {
+      theDocument = csg::Parser::parseBinary (theFilePath);
+    }
+    else {
+      throw std::runtime_error ("Unrecognized extension: " + theFormat);
+    }
+
+    thePhases["parse"] = aTimer.result();
+  }
+
+  //! Reads the top-level entry of the file to document through the index of top-level entries
+  //! measuring its phases (throws std::runtime_error on failure).
+  void readEntry (const std::string& theFilePath,
+                  const std::string& theFormat,
+                  const size_t theEntry,
+                  json11::Json::object& thePhases,
+                  json11::Json::object& theResult,
+                  csg::Document& theDocument) {
+
+    if (theFormat != "csg" && theFormat != "csgjs") {
+      throw std::runtime_error ("Entries can be read from CSG and CSGJS files only");
+    }
+
+    std::unique_ptr<csg::LazyDocument> aFile;
+
+    {
+      PhaseTimer aTimer;
+      aFile.reset (new csg::LazyDocument (theFilePath, theFormat == "csg" ? csg::LazyDocument::FORMAT_CSG
+                                                                           : csg::LazyDocument::FORMAT_CSGJS));
+      thePhases["index"] = aTimer.result();
+    }
+
+    theResult["entries"] = static_cast<double> (aFile->nbEntries());
+    theResult["index"] = aFile->isIndexReused() ? "reused" : "built";
+
+    if (theEntry >= aFile->nbEntries()) {
+      throw std::runtime_error ("No top-level entry " + std::to_string (theEntry));
+    }
+
+    const csg::IndexEntry& anEntry = aFile->entry (theEntry);
+    theResult["entry"] = json11::Json::object {
+      { "index", static_cast<double> (theEntry) },
+      { "offset", static_cast<double> (anEntry.offset) },
+      { "size", static_cast<double> (anEntry.size) },
+      { "line", anEntry.line }
+    };
+
+    PhaseTimer aTimer;
+    theDocument = aFile->read (theEntry);
+    thePhases["parse"] = aTimer.result();
+  }
+
+  //! Collects statistics of the file, returns false on error.
+  //! Statistics of the single top-level entry are collected if it's given (not negative).
+  bool collectStats (const std::string& theFilePath,
+                     const std::string& theFormat,
+                     const long theEntry,
+                     json11::Json::object& theResult) {
+
+    json11::Json::object aPhases;
+
+    theResult["file"] = theFilePath;
+    theResult["format"] = theFormat;
+
+    try {
+      csg::Document aDocument;
+      if (theEntry >= 0) {
+        readEntry (theFilePath, theFormat, static_cast<size_t> (theEntry), aPhases, theResult, aDocument);
+      }
+      else {
+        readFile (theFilePath, theFormat, aPhases, theResult, aDocument);
+      }
+
+      {
+        PhaseTimer aTimer;
+        theResult["diagnostics"] = static_cast<double> (csg::Validator::validate (aDocument).size());
+        aPhases["validate"] = aTimer.result();
+      }
+
+      theResult["document"] = DocumentStats (aDocument).result();
+
+      std::unique_ptr<CsgNode> aTree;
+
+      {
+        PhaseTimer aTimer;
+        aTree.reset (CsgLoader::LoadDocument (aDocument));
+        aPhases["load"] = aTimer.result();
+      }
+
+      theResult["tree"] = json11::Json::object {
+        { "height", aTree->Height() },
+        { "primitives", aTree->NbPrimitives() },
+        { "operations", aTree->NbOperations() }
+      };
+
+      {
+        PhaseTimer aTimer;
+        aTree->InitializeBounds();
+        aPhases["bounds"] = aTimer.result();
+      }
+
+      const Vec4f aMin = aTree->Bounds().CornerMin();
+      const Vec4f aMax = aTree->Bounds().CornerMax();
+
+      theResult["bounds"] = json11::Json::object {
+        { "min", json11::Json::array { aMin.x(), aMin.y(), aMin.z() } },
+        { "max", json11::Json::array { aMax.x(), aMax.y(), aMax.z() } }
+      };
+    }
+    catch (std::runtime_error& anError) {
+      theResult["error"] = anError.what();
+    }
+    catch (std::bad_alloc&) {
+      theResult["error"] = "Out of memory";
+    }
+
+    theResult["phases"] = aPhases;
+    return theResult.find ("error") == theResult.end();
+  }
+}
+
+int main (int argc, char ** argv) {
+
+  std::string aFormat;
+  long anEntry = -1;
+  std::vector<std::string> aFiles;
+
+  for (int anIndex = 1; anIndex < argc; ++anIndex) {
+    const std::string anArg = argv[anIndex];
+
+    if (anArg == "--from" && anIndex + 1 < argc) {
+      aFormat = argv[++anIndex];
+    }
+    else if (anArg == "--entry" && anIndex + 1 < argc) {
+      anEntry = std::atol (argv[++anIndex]);
+    }
+    else {
+      aFiles.push_back (anArg);
+    }
+  }
+
+  if (aFiles.empty()) {
+    printHelp();
+    return 0;
+  }
+
+  bool isOk = true;
+
+  for (auto& aFile : aFiles) {
+    json11::Json::object aResult;
+    isOk = collectStats (aFile, aFormat.empty() ? getFileExtension (aFile) : aFormat, anEntry, aResult) && isOk;
+
+    std::cout << json11::Json (aResult).dump() << std::endl;
+  }
+
+  return isOk ? 0 : 1;
+}
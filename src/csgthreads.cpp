@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <csgthreads.hpp>
+
+namespace csg {
+
+int hardwareThreads() {
+
+  return std::max (1, static_cast<int> (std::thread::hardware_concurrency()));
+}
+
+void parallelFor (const int theCount, const int theNbThreads, const std::function<void (const int)>& theFunction) {
+
+  const int aNbThreads = std::min (theCount, theNbThreads > 0 ? theNbThreads : hardwareThreads());
+
+  if (aNbThreads <= 1) {
+    for (int anIndex = 0; anIndex < theCount; ++anIndex) {
+      theFunction (anIndex);
+    }
+
+    return;
+  }
+
+  std::atomic<int> aNextIndex (0);
+
+  auto aWorker = [&]() {
+    for (int anIndex = aNextIndex++; anIndex < theCount; anIndex = aNextIndex++) {
+      theFunction (anIndex);
+    }
+  };
+
+  // the calling thread is one of the workers
+  std::vector<std::thread> aThreads;
+  for (int aThread = 1; aThread < aNbThreads; ++aThread) {
+    aThreads.push_back (std::thread (aWorker));
+  }
+
+  aWorker();
+
+  for (auto& aThread : aThreads) {
+    aThread.join();
+  }
+}
+
+} // csg
@@ -0,0 +1,18 @@
+#ifndef HEADER_CSG_THREADS
+#define HEADER_CSG_THREADS
+
+#include <functional>
+
+namespace csg {
+
+//! Returns number of threads supported by hardware (at least 1).
+int hardwareThreads();
+
+//! Calls the function for each index of [0, theCount) range using the given
+//! number of threads (0 means hardware threads). Indices are handed out to
+//! threads dynamically. The function is expected to catch its own exceptions.
+void parallelFor (const int theCount, const int theNbThreads, const std::function<void (const int)>& theFunction);
+
+} // csg
+
+#endif // HEADER_CSG_THREADS
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cmath>
+
+#include <csgvalidator.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Expected value of known property.
+  enum PropertyKind {
+    PROPERTY_NUMBER,
+    PROPERTY_BOOLEAN,
+    PROPERTY_SIZE     //!< number or array of 3 numbers
+  };
+
+  //! Known property of node type (of any type if the type is TYPE_NB).
+  struct PropertySchema {
+    int type;
+    const char* name;
+    PropertyKind kind;
+  };
+
+  const PropertySchema THE_PROPERTIES[] = {
+    { Document::TYPE_CUBE,     "size",   PROPERTY_SIZE },
+    { Document::TYPE_CUBE,     "center", PROPERTY_BOOLEAN },
+    { Document::TYPE_SPHERE,   "r",      PROPERTY_NUMBER },
+    { Document::TYPE_CYLINDER, "h",      PROPERTY_NUMBER },
+    { Document::TYPE_CYLINDER, "r",      PROPERTY_NUMBER },
+    { Document::TYPE_CYLINDER, "center", PROPERTY_BOOLEAN },
+    { Document::TYPE_CONE,     "h",      PROPERTY_NUMBER },
+    { Document::TYPE_CONE,     "r",      PROPERTY_NUMBER },
+    { Document::TYPE_CONE,     "center", PROPERTY_BOOLEAN },
+    { Document::TYPE_NB,       "$fn",    PROPERTY_NUMBER },
+    { Document::TYPE_NB,       "$fa",    PROPERTY_NUMBER },
+    { Document::TYPE_NB,       "$fs",    PROPERTY_NUMBER }
+  };
+
+  const size_t THE_NB_PROPERTIES = sizeof (THE_PROPERTIES) / sizeof (THE_PROPERTIES[0]);
+
+  //! Minimum number of children of Document::NodeType values (-1 for primitives without children).
+  //! Empty groups are written as objects, other instructions need at least one child
+  //! to be read back, operations are meaningless with less than two operands.
+  const int THE_MIN_CHILDREN[Document::TYPE_NB] = {
+    0,  // group
+    1,  // multmatrix
+    2,  // union
+    2,  // difference
+    2,  // intersection
+    2,  // smin
+    -1, // cube
+    -1, // sphere
+    -1, // cylinder
+    -1  // cone
+  };
+
+  bool isLetter (const char theChar) {
+    return (theChar >= 'a' && theChar <= 'z') || (theChar >= 'A' && theChar <= 'Z');
+  }
+
+  //! Checks if the name matches CSG grammar ('$'? [a-zA-Z]+).
+  bool isValidName (const std::string& theName) {
+
+    size_t anIndex = !theName.empty() && theName[0] == '$' ? 1 : 0;
+    if (anIndex == theName.size()) {
+      return false;
+    }
+
+    for (; anIndex < theName.size(); ++anIndex) {
+      if (!isLetter (theName[anIndex])) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //! Walks the document collecting diagnostics.
+  //! Locations are kept as index stacks and formatted only when a problem is reported.
+  class Checker {
+
+  public:
+
+    explicit Checker (const Document& theDocument)
+      : m_document (theDocument),
+        m_property (NULL),
+        m_checkedChildren (theDocument.nbNodes(), 0) {
+
+      for (size_t anIndex = 0; anIndex < THE_NB_PROPERTIES; ++anIndex) {
+        m_propertyNames[anIndex] = theDocument.find (THE_PROPERTIES[anIndex].name);
+      }
+    }
+
+    //! Checks children of the node.
+    void checkChildren (const Document::Node& theNode) {
+
+      const Document::Node* aChildren = m_document.children (theNode);
+      for (Document::Index anIndex = 0; anIndex < theNode.nbChildren && !isFull(); ++anIndex) {
+        m_nodePath.push_back (anIndex);
+        checkNode (aChildren[anIndex]);
+        m_nodePath.pop_back();
+      }
+    }
+
+    //! Returns collected diagnostics.
+    std::vector<Diagnostic>& diagnostics() { return m_diagnostics; }
+
+  private:
+
+    bool isFull() const {
+      return m_diagnostics.size() >= Validator::MAX_DIAGNOSTICS;
+    }
+
+    //! Checks the node and its subtree.
+    void checkNode (const Document::Node& theNode) {
+
+      const int aMinChildren = theNode.type < Document::TYPE_NB ? THE_MIN_CHILDREN[theNode.type] : 0;
+
+      if (theNode.type >= Document::TYPE_NB) {
+        report ("Unknown object type: " + quotedName (theNode.type));
+      }
+      else if (aMinChildren < 0 && theNode.nbChildren > 0) {
+        report ("Object can't have children: " + quotedName (theNode.type));
+      }
+      else if (theNode.nbChildren < static_cast<Document::Index> (std::max (aMinChildren, 0))) {
+        report ("Too few children objects for instruction: " + quotedName (theNode.type));
+      }
+
+      if (theNode.type == Document::TYPE_MULTMATRIX) {
+        checkMatrix (theNode);
+      }
+      else if (theNode.kind == Document::NODE_MATRIX) {
+        report ("Object properties should be represented with a dictionary");
+      }
+      else {
+        const Document::Property* aProperties = m_document.properties (theNode);
+        for (Document::Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+          m_property = &aProperties[anIndex];
+          checkProperty (theNode, aProperties[anIndex]);
+          m_property = NULL;
+        }
+      }
+
+      // shared subtrees (see DocumentBuilder::useDefinition) are checked once
+      // unless problems are found in them
+      if (theNode.nbChildren != 0 && m_checkedChildren[theNode.children] == theNode.nbChildren) {
+        return;
+      }
+
+      const size_t aNbDiagnostics = m_diagnostics.size();
+      checkChildren (theNode);
+
+      if (theNode.nbChildren != 0 && m_diagnostics.size() == aNbDiagnostics) {
+        m_checkedChildren[theNode.children] = theNode.nbChildren;
+      }
+    }
+
+    //! Checks that the instruction has 4x4 transformation matrix.
+    void checkMatrix (const Document::Node& theNode) {
+
+      if (theNode.kind != Document::NODE_MATRIX) {
+        report ("Transformation matrix expected: " + quotedName (theNode.type));
+        return;
+      }
+
+      m_property = m_document.properties (theNode);
+
+      const Document::Value& aMatrix = m_document.matrix (theNode);
+      if (aMatrix.type != Document::VALUE_MATRIX) {
+        report ("Matrix should be 4x4 array of numbers");
+      }
+      else {
+        checkValue (aMatrix);
+      }
+
+      m_property = NULL;
+    }
+
+    //! Checks name and value of the property.
+    void checkProperty (const Document::Node& theNode, const Document::Property& theProperty) {
+
+      if (!isValidName (m_document.name (theProperty.name))) {
+        report ("Invalid property name: " + quotedName (theProperty.name));
+      }
+
+      checkValue (theProperty.value);
+
+      for (size_t anIndex = 0; anIndex < THE_NB_PROPERTIES; ++anIndex) {
+        const PropertySchema& aSchema = THE_PROPERTIES[anIndex];
+
+        if (m_propertyNames[anIndex] == theProperty.name
+         && (aSchema.type == static_cast<int> (theNode.type) || aSchema.type == Document::TYPE_NB)) {
+          checkKind (theProperty.value, aSchema.kind);
+          return;
+        }
+      }
+    }
+
+    //! Checks that value of known property has expected type.
+    void checkKind (const Document::Value& theValue, const PropertyKind theKind) {
+
+      switch (theKind) {
+        case PROPERTY_NUMBER:
+          if (theValue.type != Document::VALUE_NUMBER) {
+            report ("Number expected");
+          }
+          break;
+        case PROPERTY_BOOLEAN:
+          if (theValue.type != Document::VALUE_BOOLEAN) {
+            report ("Boolean expected");
+          }
+          break;
+        case PROPERTY_SIZE:
+          if (theValue.type != Document::VALUE_NUMBER
+           && (theValue.type != Document::VALUE_NUMBERS || theValue.size != 3)) {
+            report ("Number or array of 3 numbers expected");
+          }
+          break;
+      }
+    }
+
+    //! Checks that the value (and its items) can be written in CSG format.
+    void checkValue (const Document::Value& theValue) {
+
+      switch (theValue.type) {
+        case Document::VALUE_NUMBER:
+          checkNumber (theValue.number);
+          break;
+        case Document::VALUE_BOOLEAN:
+          break;
+        case Document::VALUE_STRING:
+          // CSG strings have no escapes
+          if (m_document.name (theValue.string).find ('"') != std::string::npos) {
+            report ("String can't contain quotes: " + quotedName (theValue.string));
+          }
+          break;
+        case Document::VALUE_NUMBERS:
+          for (Document::Index anIndex = 0; anIndex < theValue.size; ++anIndex) {
+            m_itemPath.push_back (anIndex);
+            checkNumber (m_document.numbers (theValue)[anIndex]);
+            m_itemPath.pop_back();
+          }
+          break;
+        case Document::VALUE_MATRIX:
+          for (Document::Index anIndex = 0; anIndex < Document::MATRIX_SIZE; ++anIndex) {
+            m_itemPath.push_back (anIndex / 4);
+            m_itemPath.push_back (anIndex % 4);
+            checkNumber (m_document.matrixNumbers (theValue)[anIndex]);
+            m_itemPath.resize (m_itemPath.size() - 2);
+          }
+          break;
+        case Document::VALUE_ARRAY:
+          for (Document::Index anIndex = 0; anIndex < theValue.size; ++anIndex) {
+            m_itemPath.push_back (anIndex);
+            checkValue (m_document.items (theValue)[anIndex]);
+            m_itemPath.pop_back();
+          }
+          break;
+      }
+    }
+
+    void checkNumber (const double theValue) {
+
+      // non-finite numbers are written as null
+      if (!std::isfinite (theValue)) {
+        report ("Number should be finite");
+      }
+    }
+
+    //! Returns JSON serialization of interned name.
+    std::string quotedName (const Document::Index theName) const {
+
+      std::string aName;
+      m_document.dumpName (theName, aName);
+      return aName;
+    }
+
+    //! Adds diagnostic at the current location.
+    void report (const std::string& theMessage) {
+
+      if (isFull()) {
+        return;
+      }
+
+      std::string aPath;
+      for (size_t anIndex = 0; anIndex < m_nodePath.size(); ++anIndex) {
+        aPath += anIndex == 0 ? "contents[" : ".objects[";
+        aPath += std::to_string (m_nodePath[anIndex]) + "]";
+      }
+
+      if (m_property != NULL) {
+        aPath += ".properties";
+
+        // matrices are unnamed
+        if (m_property->name != Document::INVALID_INDEX) {
+          aPath += "." + m_document.name (m_property->name);
+        }
+
+        for (auto anItem : m_itemPath) {
+          aPath += "[" + std::to_string (anItem) + "]";
+        }
+      }
+
+      m_diagnostics.push_back (Diagnostic (aPath, theMessage));
+    }
+
+  private:
+
+    const Document& m_document;
+
+    //! Interned names of THE_PROPERTIES (INVALID_INDEX if not used by the document).
+    Document::Index m_propertyNames[THE_NB_PROPERTIES];
+
+    //! Location being checked: indices of nodes, property and indices of array items.
+    std::vector<Document::Index> m_nodePath;
+    const Document::Property* m_property;
+    std::vector<Document::Index> m_itemPath;
+
+    //! Sizes of ranges of children checked without problems by their first children.
+    std::vector<Document::Index> m_checkedChildren;
+
+    std::vector<Diagnostic> m_diagnostics;
+
+  };
+}
+
+std::vector<Diagnostic> Validator::validate (const Document& theDocument) {
+
+  Checker aChecker (theDocument);
+  aChecker.checkChildren (theDocument.root());
+
+  return std::move (aChecker.diagnostics());
+}
+
+} // csg
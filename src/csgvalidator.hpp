@@ -0,0 +1,43 @@
+#ifndef HEADER_CSG_VALIDATOR
+#define HEADER_CSG_VALIDATOR
+
+#include <string>
+#include <vector>
+
+#include <csgdocument.hpp>
+
+namespace csg {
+
+//! Problem found by validation of CSG data.
+struct Diagnostic {
+
+  //! Location of the problem in JSON representation, e.g. "contents[1].objects[0].properties.r".
+  std::string path;
+
+  std::string message;
+
+  Diagnostic (const std::string& thePath, const std::string& theMessage)
+    : path (thePath),
+      message (theMessage) {}
+};
+
+//! Schema validator of CSG documents.
+//! Checks that the document can be written in CSG format and read back unchanged:
+//! node types and their numbers of children, property names and values (including
+//! types of known properties) and shape of transformation matrices.
+//! The document is walked once, so the cost is linear in its size.
+class Validator {
+
+public:
+
+  //! Maximum number of reported problems (the rest of the document is not checked).
+  static const size_t MAX_DIAGNOSTICS = 100;
+
+  //! Returns problems found in the document (empty if the document is valid).
+  static std::vector<Diagnostic> validate (const Document& theDocument);
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_VALIDATOR
@@ -3,6 +3,8 @@
 #include <stdgl/Texture3D.hpp>
 #include <csgframework/CsgTree.hpp>
 #include <csgframework/CsgLoader.hpp>
+#include <csgframework/CsgEvaluator.hpp>
+#include <csgframework/CsgScene.hpp>
 
 #include <stdio.h>
 #include <iostream>
@@ -275,81 +277,8 @@ const char* fs_str = SHADER_PREFIX TO_STRING
 
 );
 
-#define MAXFLOAT 1.0e15f
-
 namespace
 {
-  float evalPrimitiveDistance (const Vec4f& thePos, CsgPrimitiveNode* theNode)
-  {
-    float aDistance = MAXFLOAT;
-    Vec3f aScaling;
-
-    Mat4f aMatWithoutScale = theNode->Transform();
-    for (int i = 0; i < 3; ++i)
-    {
-      float aScaleI = aMatWithoutScale.col (i).head<3>().norm();
-      aScaling[i] = aScaleI;
-      aMatWithoutScale.col (i).head<3>() *= 1.f / aScaleI;
-    }
-
-    Vec4f aTransformedPos = aMatWithoutScale.inverse() * thePos;
-    aTransformedPos /= aTransformedPos.w();
-    const Vec3f& aPoint = aTransformedPos.head<3>();
-
-    switch (theNode->TypeID())
-    {
-      case CSG_SPHERE:
-      {
-        aDistance = aPoint.norm() - aScaling.x(); // only uniform scaling for spheres
-        break;
-      }
-      case CSG_BOX:
-      {
-        Vec3f d = aPoint.cwiseAbs() - aScaling;
-        aDistance = std::min (std::max (d.x(), std::max (d.y(), d.z())), 0.f)
-                      + (d.cwiseMax (Vec3f (0.f, 0.f, 0.f))).norm();
-        break;
-      }
-    }
-
-    return aDistance;
-  }
-
-  float evalDistance (const Vec4f& thePos, CsgNode* theNode)
-  {
-    if (theNode->IsLeaf())
-    {
-      return evalPrimitiveDistance (thePos, static_cast<CsgPrimitiveNode*> (theNode));
-    }
-
-    float aDistance = MAXFLOAT;
-    CsgOperationNode* anOpNode = static_cast<CsgOperationNode*> (theNode);
-
-    switch (theNode->TypeID())
-    {
-      case CSG_OP_UNION:
-      {
-        aDistance = std::min (evalDistance (thePos, anOpNode->Child<0>()),
-                              evalDistance (thePos, anOpNode->Child<1>()));
-        break;
-      }
-      case CSG_OP_INTER:
-      {
-        aDistance = std::max (evalDistance (thePos, anOpNode->Child<0>()),
-                              evalDistance (thePos, anOpNode->Child<1>()));
-        break;
-      }
-      case CSG_OP_MINUS:
-      {
-        aDistance = std::max ( evalDistance (thePos, anOpNode->Child<0>()),
-                              -evalDistance (thePos, anOpNode->Child<1>()));
-        break;
-      }
-    }
-
-    return aDistance;
-  }
-
   static const GLfloat aQuadVertices[] = { -1.f, -1.f,  0.f,
                                            -1.f,  1.f,  0.f,
                                             1.f,  1.f,  0.f,
@@ -395,31 +324,10 @@ int main (int, char**)
                             aTree->Bounds().CornerMin(),
                             aTree->Bounds().CornerMax());
 
-  const float aMinPointX = aDistanceFiled.MinCorner.x() + 0.5f * aDistanceFiled.CellSize.x();
-  const float aMinPointY = aDistanceFiled.MinCorner.y() + 0.5f * aDistanceFiled.CellSize.y();
-  const float aMinPointZ = aDistanceFiled.MinCorner.z() + 0.5f * aDistanceFiled.CellSize.z();
-
   std::cout << aDistanceFiled.MinCorner.transpose() << std::endl;
   std::cout << aDistanceFiled.MaxCorner.transpose() << std::endl;
 
-  Vec4f aQuery (0.f, 0.f, 0.f, 1.f);
-
-  for (int aX = 0; aX < aDistanceFiled.SizeX; ++aX)
-  {
-    aQuery[0] = aMinPointX + aX * aDistanceFiled.CellSize.x();
-
-    for (int aY = 0; aY < aDistanceFiled.SizeY; ++aY)
-    {
-      aQuery[1] = aMinPointY + aY * aDistanceFiled.CellSize.y();
-
-      for (int aZ = 0; aZ < aDistanceFiled.SizeZ; ++aZ)
-      {
-        aQuery[2] = aMinPointZ + aZ * aDistanceFiled.CellSize.z();
-
-        aDistanceFiled.Value (aX, aY, aZ) = evalDistance (aQuery, aTree.get());
-      }
-    }
-  }
+  CsgEvaluator::FillVoxels (CsgScene (aTree.get()), aDistanceFiled);
 
   // Setup window
   GLFWwindow* aWindow = glfwCreateWindow (1280, 720, "csgviewer", NULL, NULL);
@@ -0,0 +1,701 @@
+#include <stdexcept>
+#include <unordered_map>
+
+#include <csgwriter.hpp>
+
+namespace csg {
+
+namespace {
+
+  //! Size of blocks passed to the file.
+  const size_t THE_BLOCK_SIZE = 1 << 20;
+
+  //! Spaces appended for each nesting level.
+  const size_t THE_INDENT_SIZE = 2;
+
+  //! Numbers subtrees of the document so that identical subtrees get the same number
+  //! (hash-consing). Subtree is numbered after its children and identified by its type,
+  //! properties and numbers of its children, so each subtree is hashed in constant time
+  //! (apart from the properties) and numbers of children are less than number of their parent.
+  class SubtreeNumbering {
+
+  public:
+
+    explicit SubtreeNumbering (const Document& theDocument)
+      : m_document (theDocument),
+        m_numbers (theDocument.nbNodes(), Document::INVALID_INDEX) {}
+
+    //! Returns number of the subtree of the node, numbers the subtree if necessary.
+    Document::Index number (const Document::Node& theNode) {
+
+      Document::Index& aNumber = m_numbers[m_document.nodeIndex (theNode)];
+      if (aNumber != Document::INVALID_INDEX) {
+        return aNumber;
+      }
+
+      const Document::Node* aChildren = m_document.children (theNode);
+      for (Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+        number (aChildren[anIndex]);
+      }
+
+      // the key is built after children, so the buffer is reused by all of them
+      m_key.clear();
+      append (theNode.type);
+      append (static_cast<Document::Index> (theNode.kind));
+      append (theNode.nbChildren);
+
+      if (theNode.kind == Document::NODE_MATRIX) {
+        m_document.dump (m_document.matrix (theNode), m_key);
+      }
+      else {
+        // values are written in the shortest round-trip form, so equal strings mean equal values
+        const Document::Property* aProperties = m_document.properties (theNode);
+        for (Document::Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+          append (aProperties[anIndex].name);
+          m_document.dump (aProperties[anIndex].value, m_key);
+          m_key += '\0';
+        }
+      }
+
+      for (Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+        append (m_numbers[m_document.nodeIndex (aChildren[anIndex])]);
+      }
+
+      auto anIter = m_subtrees.insert (std::make_pair (m_key, static_cast<Document::Index> (m_nodes.size())));
+      if (anIter.second) {
+        m_nodes.push_back (&theNode);
+      }
+
+      aNumber = anIter.first->second;
+      return aNumber;
+    }
+
+    //! Returns number of the subtree of the node (INVALID_INDEX if it is not numbered).
+    Document::Index numberOf (const Document::Node& theNode) const { return m_numbers[m_document.nodeIndex (theNode)]; }
+
+    //! Returns number of the subtree of the node with the given index in the nodes pool.
+    Document::Index numberAt (const size_t theNodeIndex) const { return m_numbers[theNodeIndex]; }
+
+    //! Returns number of distinct subtrees.
+    size_t nbSubtrees() const { return m_nodes.size(); }
+
+    //! Returns the first numbered node of the subtree with the given number.
+    const Document::Node& subtree (const Document::Index theNumber) const { return *m_nodes[theNumber]; }
+
+  private:
+
+    void append (const Document::Index theValue) {
+      m_key.append (reinterpret_cast<const char*> (&theValue), sizeof (theValue));
+    }
+
+  private:
+
+    const Document& m_document;
+
+    //! Numbers of subtrees by indices of nodes.
+    std::vector<Document::Index> m_numbers;
+
+    //! Numbers of subtrees by their keys.
+    std::unordered_map<std::string, Document::Index> m_subtrees;
+
+    //! Nodes of the subtrees by their numbers.
+    std::vector<const Document::Node*> m_nodes;
+
+    std::string m_key;
+
+  };
+}
+
+CsgWriter::CsgWriter (const Document& theDocument, OutputFile& theFile, const NumberPrecision thePrecision)
+  : m_document (theDocument),
+    m_file (theFile),
+    m_precision (thePrecision),
+    m_depth (0) {
+
+  // nodes are small, so the buffer rarely grows over the block size
+  m_buffer.reserve (THE_BLOCK_SIZE + THE_BLOCK_SIZE / 4);
+}
+
+void CsgWriter::writeCsg() {
+
+  m_buffer += "# ";
+  m_buffer += m_document.versionName();
+  m_buffer += " " + std::to_string (m_document.majorVersion());
+  m_buffer += "." + std::to_string (m_document.minorVersion());
+  m_buffer += "\n";
+
+  const Document::Node& aRoot = m_document.root();
+  const Document::Node* aChildren = m_document.children (aRoot);
+  for (Document::Index anIndex = 0; anIndex < aRoot.nbChildren; ++anIndex) {
+    writeNode (aChildren[anIndex]);
+  }
+
+  flush();
+}
+
+void CsgWriter::writeJson (const bool toShareSubtrees) {
+
+  m_buffer += "{";
+
+  if (toShareSubtrees) {
+    const std::vector<const Document::Node*> aDefinitions = findSharedSubtrees();
+
+    // definitions precede the contents, so readers meet them before the references
+    if (!aDefinitions.empty()) {
+      m_buffer += "\"definitions\": [";
+
+      for (size_t anIndex = 0; anIndex < aDefinitions.size(); ++anIndex) {
+        m_buffer += anIndex == 0 ? "" : ", ";
+        writeJsonNode (*aDefinitions[anIndex]);
+      }
+
+      m_buffer += "], ";
+    }
+  }
+
+  m_buffer += "\"contents\": [";
+
+  const Document::Node& aRoot = m_document.root();
+  const Document::Node* aChildren = m_document.children (aRoot);
+  for (Document::Index anIndex = 0; anIndex < aRoot.nbChildren; ++anIndex) {
+    m_buffer += anIndex == 0 ? "" : ", ";
+    writeJsonChild (aChildren[anIndex]);
+  }
+
+  m_buffer += "], \"type\": \"CSG file\", \"version-major\": " + std::to_string (m_document.majorVersion());
+  m_buffer += ", \"version-minor\": " + std::to_string (m_document.minorVersion());
+  m_buffer += ", \"version-name\": ";
+  Document::dumpString (m_document.versionName(), m_buffer);
+  m_buffer += "}";
+
+  flush();
+  m_definitions.clear();
+}
+
+std::vector<const Document::Node*> CsgWriter::findSharedSubtrees() {
+
+  SubtreeNumbering aNumbering (m_document);
+
+  const Document::Node& aRoot = m_document.root();
+  const Document::Node* aRootChildren = m_document.children (aRoot);
+  for (Document::Index anIndex = 0; anIndex < aRoot.nbChildren; ++anIndex) {
+    aNumbering.number (aRootChildren[anIndex]);
+  }
+
+  // each distinct subtree is written once, so its children are counted once
+  // no matter how many times the subtree itself is referenced
+  std::vector<Document::Index> aNbReferences (aNumbering.nbSubtrees(), 0);
+
+  for (Document::Index anIndex = 0; anIndex < aRoot.nbChildren; ++anIndex) {
+    ++aNbReferences[aNumbering.numberOf (aRootChildren[anIndex])];
+  }
+
+  for (size_t aNumber = 0; aNumber < aNumbering.nbSubtrees(); ++aNumber) {
+    const Document::Node& aNode = aNumbering.subtree (static_cast<Document::Index> (aNumber));
+    const Document::Node* aChildren = m_document.children (aNode);
+
+    for (Document::Index anIndex = 0; anIndex < aNode.nbChildren; ++anIndex) {
+      ++aNbReferences[aNumbering.numberOf (aChildren[anIndex])];
+    }
+  }
+
+  // children are numbered before their parents, so definitions are written
+  // after the definitions they refer to
+  std::vector<const Document::Node*> aDefinitions;
+  std::vector<Document::Index> aDefinitionIndices (aNumbering.nbSubtrees(), Document::INVALID_INDEX);
+
+  for (size_t aNumber = 0; aNumber < aNumbering.nbSubtrees(); ++aNumber) {
+    if (aNbReferences[aNumber] > 1) {
+      aDefinitionIndices[aNumber] = static_cast<Document::Index> (aDefinitions.size());
+      aDefinitions.push_back (&aNumbering.subtree (static_cast<Document::Index> (aNumber)));
+    }
+  }
+
+  if (aDefinitions.empty()) {
+    return aDefinitions;
+  }
+
+  m_definitions.assign (m_document.nbNodes(), Document::INVALID_INDEX);
+
+  for (size_t anIndex = 0; anIndex < m_document.nbNodes(); ++anIndex) {
+    const Document::Index aNumber = aNumbering.numberAt (anIndex);
+
+    // nodes of unused definitions are not numbered
+    if (aNumber != Document::INVALID_INDEX) {
+      m_definitions[anIndex] = aDefinitionIndices[aNumber];
+    }
+  }
+
+  return aDefinitions;
+}
+
+void CsgWriter::writeProperties (const Document::Node& theNode) {
+
+  if (theNode.kind == Document::NODE_MATRIX) {
+    throw std::runtime_error ("Object properties should be represented with a dictionary");
+  }
+
+  // comma separated lists are messy
+  const Document::Property* aProperties = m_document.properties (theNode);
+  for (Document::Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+    m_buffer += anIndex == 0 ? "" : ", ";
+    m_buffer += m_document.name (aProperties[anIndex].name);
+    m_buffer += " = ";
+    m_document.dump (aProperties[anIndex].value, m_buffer, m_precision);
+  }
+}
+
+void CsgWriter::writeObject (const Document::Node& theNode) {
+
+  indent();
+  m_buffer += m_document.name (theNode.type);
+  m_buffer += "(";
+  writeProperties (theNode);
+  m_buffer += ");\n";
+}
+
+void CsgWriter::writeInstruction (const Document::Node& theNode) {
+
+  indent();
+  m_buffer += m_document.name (theNode.type);
+  m_buffer += "(";
+
+  // OpenScad compatibility matrix
+  if (theNode.kind == Document::NODE_MATRIX && theNode.type == Document::TYPE_MULTMATRIX) {
+    m_document.dump (m_document.matrix (theNode), m_buffer, m_precision);
+  }
+  else {
+    writeProperties (theNode);
+  }
+
+  m_buffer += ") {\n";
+
+  ++m_depth;
+  const Document::Node* aChildren = m_document.children (theNode);
+  for (Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+    writeNode (aChildren[anIndex]);
+  }
+  --m_depth;
+
+  indent();
+  m_buffer += "}\n";
+}
+
+void CsgWriter::assertChildrenNum (const Document::Node& theNode, const Document::Index theChildrenNum) {
+
+  if (theNode.nbChildren < theChildrenNum) {
+    std::string aType;
+    m_document.dumpName (theNode.type, aType);
+    throw std::runtime_error ("Too few children objects for instruction: " + aType);
+  }
+}
+
+void CsgWriter::writeNode (const Document::Node& theNode) {
+
+  switch (theNode.type) {
+    case Document::TYPE_GROUP:
+      // OpenScad compatibility empty group
+      if (theNode.nbChildren == 0) {
+        indent();
+        m_buffer += "group();\n";
+      }
+      else {
+        assertChildrenNum (theNode, 1);
+        writeInstruction (theNode);
+      }
+      break;
+    case Document::TYPE_MULTMATRIX:
+      writeInstruction (theNode);
+      break;
+    case Document::TYPE_UNION:
+    case Document::TYPE_DIFFERENCE:
+    case Document::TYPE_INTERSECTION:
+    case Document::TYPE_SMIN:
+      assertChildrenNum (theNode, 2);
+      writeInstruction (theNode);
+      break;
+    case Document::TYPE_CUBE:
+    case Document::TYPE_SPHERE:
+    case Document::TYPE_CYLINDER:
+    case Document::TYPE_CONE:
+      writeObject (theNode);
+      break;
+    default: {
+      std::string aType;
+      m_document.dumpName (theNode.type, aType);
+      throw std::runtime_error ("Unknown object type: " + aType);
+    }
+  }
+
+  flushIfFull();
+}
+
+void CsgWriter::writeJsonNode (const Document::Node& theNode) {
+
+  // keys are written in the order json11 sorts them
+  m_buffer += "{";
+
+  if (theNode.kind != Document::NODE_OBJECT) {
+    m_buffer += "\"objects\": [";
+
+    const Document::Node* aChildren = m_document.children (theNode);
+    for (Document::Index anIndex = 0; anIndex < theNode.nbChildren; ++anIndex) {
+      m_buffer += anIndex == 0 ? "" : ", ";
+      writeJsonChild (aChildren[anIndex]);
+    }
+
+    m_buffer += "], ";
+  }
+
+  m_buffer += "\"properties\": ";
+
+  if (theNode.kind == Document::NODE_MATRIX) {
+    m_document.dump (m_document.matrix (theNode), m_buffer, m_precision);
+  }
+  else {
+    m_buffer += "{";
+
+    const Document::Property* aProperties = m_document.properties (theNode);
+    for (Document::Index anIndex = 0; anIndex < theNode.nbProperties; ++anIndex) {
+      m_buffer += anIndex == 0 ? "" : ", ";
+      m_document.dumpName (aProperties[anIndex].name, m_buffer);
+      m_buffer += ": ";
+      m_document.dump (aProperties[anIndex].value, m_buffer, m_precision);
+    }
+
+    m_buffer += "}";
+  }
+
+  m_buffer += ", \"type\": ";
+  m_document.dumpName (theNode.type, m_buffer);
+  m_buffer += "}";
+
+  flushIfFull();
+}
+
+void CsgWriter::writeJsonChild (const Document::Node& theNode) {
+
+  const Document::Index aDefinition = m_definitions.empty() ?
+    Document::INVALID_INDEX : m_definitions[m_document.nodeIndex (theNode)];
+
+  if (aDefinition == Document::INVALID_INDEX) {
+    writeJsonNode (theNode);
+    return;
+  }
+
+  m_buffer += "{\"use\": ";
+  m_buffer += std::to_string (aDefinition);
+  m_buffer += "}";
+}
+
+void CsgWriter::indent() {
+
+  m_buffer.append (m_depth * THE_INDENT_SIZE, ' ');
+}
+
+void CsgWriter::flushIfFull() {
+
+  if (m_buffer.size() >= THE_BLOCK_SIZE) {
+    flush();
+  }
+}
+
+void CsgWriter::flush() {
+
+  m_file.write (m_buffer.data(), m_buffer.size());
+  m_buffer.clear();
+}
+
+CsgStreamWriter::CsgStreamWriter (OutputFile& theFile, const Format theFormat, const NumberPrecision thePrecision)
+  : m_file (theFile),
+    m_format (theFormat),
+    m_precision (thePrecision),
+    m_versionName ("undefined"),
+    m_majorVersion (0),
+    m_minorVersion (0),
+    m_isStarted (false),
+    m_nbStatements (0) {
+
+  m_buffer.reserve (THE_BLOCK_SIZE + THE_BLOCK_SIZE / 4);
+}
+
+void CsgStreamWriter::version (const std::string& theName, const int theMajor, const int theMinor) {
+
+  m_versionName = theName;
+  m_majorVersion = theMajor;
+  m_minorVersion = theMinor;
+}
+
+void CsgStreamWriter::object (const std::string& theType, const json11::Json::object& theProperties) {
+
+  checkNode (theType, 0, false);
+  beginChild();
+
+  if (m_format == FORMAT_CSGJS) {
+    m_buffer += "{\"properties\": ";
+    dumpValue (theProperties);
+    m_buffer += ", \"type\": ";
+    Document::dumpString (theType, m_buffer);
+    m_buffer += "}";
+  }
+  // OpenScad compatibility empty group
+  else if (Document::nodeType (theType) == Document::TYPE_GROUP) {
+    m_buffer.append (m_levels.size() * THE_INDENT_SIZE, ' ');
+    m_buffer += "group();\n";
+  }
+  else {
+    writeCsgHeader (theType, theProperties);
+    m_buffer += ";\n";
+  }
+
+  flushIfNeeded();
+}
+
+void CsgStreamWriter::beginInstruction (const std::string& theType, const json11::Json::object& theProperties) {
+
+  beginChild();
+
+  Level aLevel;
+  aLevel.type = theType;
+  aLevel.nbChildren = 0;
+
+  if (m_format == FORMAT_CSGJS) {
+    aLevel.properties = theProperties;
+    m_buffer += "{\"objects\": [";
+  }
+  else {
+    writeCsgHeader (theType, theProperties);
+    m_buffer += " {\n";
+  }
+
+  m_levels.push_back (aLevel);
+}
+
+void CsgStreamWriter::beginMatrix (const std::string& theType, const json11::Json::array& theMatrix) {
+
+  if (m_format == FORMAT_CSG && Document::nodeType (theType) != Document::TYPE_MULTMATRIX) {
+    throw std::runtime_error ("Object properties should be represented with a dictionary");
+  }
+
+  beginChild();
+
+  Level aLevel;
+  aLevel.type = theType;
+  aLevel.nbChildren = 0;
+
+  if (m_format == FORMAT_CSGJS) {
+    aLevel.properties = theMatrix;
+    m_buffer += "{\"objects\": [";
+  }
+  else {
+    writeCsgHeader (theType, theMatrix);
+    m_buffer += " {\n";
+  }
+
+  m_levels.push_back (aLevel);
+}
+
+void CsgStreamWriter::endInstruction() {
+
+  if (m_levels.empty()) {
+    throw std::runtime_error ("Unexpected end of instruction");
+  }
+
+  const Level aLevel = m_levels.back();
+  m_levels.pop_back();
+
+  checkNode (aLevel.type, aLevel.nbChildren, true);
+
+  if (m_format == FORMAT_CSGJS) {
+    m_buffer += "], \"properties\": ";
+    dumpValue (aLevel.properties);
+    m_buffer += ", \"type\": ";
+    Document::dumpString (aLevel.type, m_buffer);
+    m_buffer += "}";
+  }
+  else {
+    m_buffer.append (m_levels.size() * THE_INDENT_SIZE, ' ');
+    m_buffer += "}\n";
+  }
+
+  flushIfNeeded();
+}
+
+void CsgStreamWriter::finish() {
+
+  if (!m_levels.empty()) {
+    throw std::runtime_error ("Unexpected end of input");
+  }
+
+  writeHeader();
+
+  if (m_format == FORMAT_CSGJS) {
+    m_buffer += "], \"type\": \"CSG file\", \"version-major\": " + std::to_string (m_majorVersion);
+    m_buffer += ", \"version-minor\": " + std::to_string (m_minorVersion);
+    m_buffer += ", \"version-name\": ";
+    Document::dumpString (m_versionName, m_buffer);
+    m_buffer += "}";
+  }
+
+  m_file.write (m_buffer.data(), m_buffer.size());
+  m_buffer.clear();
+}
+
+void CsgStreamWriter::writeHeader() {
+
+  if (m_isStarted) {
+    return;
+  }
+
+  m_isStarted = true;
+
+  if (m_format == FORMAT_CSGJS) {
+    m_buffer += "{\"contents\": [";
+  }
+  else {
+    m_buffer += "# " + m_versionName;
+    m_buffer += " " + std::to_string (m_majorVersion);
+    m_buffer += "." + std::to_string (m_minorVersion);
+    m_buffer += "\n";
+  }
+}
+
+void CsgStreamWriter::beginChild() {
+
+  writeHeader();
+
+  int& aNbChildren = m_levels.empty() ? m_nbStatements : m_levels.back().nbChildren;
+
+  if (m_format == FORMAT_CSGJS && aNbChildren != 0) {
+    m_buffer += ", ";
+  }
+
+  ++aNbChildren;
+}
+
+void CsgStreamWriter::checkNode (const std::string& theType, const int theNbChildren, const bool isInstruction) {
+
+  if (m_format != FORMAT_CSG) {
+    return;
+  }
+
+  switch (Document::nodeType (theType)) {
+    case Document::TYPE_GROUP:
+      return;
+    case Document::TYPE_MULTMATRIX:
+      if (theNbChildren >= 1) {
+        return;
+      }
+      break;
+    case Document::TYPE_UNION:
+    case Document::TYPE_DIFFERENCE:
+    case Document::TYPE_INTERSECTION:
+    case Document::TYPE_SMIN:
+      if (theNbChildren >= 2) {
+        return;
+      }
+      break;
+    case Document::TYPE_CUBE:
+    case Document::TYPE_SPHERE:
+    case Document::TYPE_CYLINDER:
+    case Document::TYPE_CONE:
+      if (!isInstruction) {
+        return;
+      }
+      throw std::runtime_error ("Object can't have children: \"" + theType + "\"");
+    default:
+      throw std::runtime_error ("Unknown object type: \"" + theType + "\"");
+  }
+
+  throw std::runtime_error ("Too few children objects for instruction: \"" + theType + "\"");
+}
+
+void CsgStreamWriter::writeCsgHeader (const std::string& theType, const json11::Json& theProperties) {
+
+  m_buffer.append (m_levels.size() * THE_INDENT_SIZE, ' ');
+  m_buffer += theType;
+  m_buffer += "(";
+
+  // OpenScad compatibility matrix
+  if (theProperties.is_array()) {
+    dumpValue (theProperties);
+  }
+  else {
+    // comma separated lists are messy
+    bool isFirst = true;
+    for (auto& aProperty : theProperties.object_items()) {
+      m_buffer += isFirst ? "" : ", ";
+      m_buffer += aProperty.first;
+      m_buffer += " = ";
+      dumpValue (aProperty.second);
+      isFirst = false;
+    }
+  }
+
+  m_buffer += ")";
+}
+
+void CsgStreamWriter::dumpValue (const json11::Json& theValue) {
+
+  switch (theValue.type()) {
+    case json11::Json::NUL:
+      m_buffer += "null";
+      return;
+    case json11::Json::NUMBER:
+      Document::dumpNumber (theValue.number_value(), m_buffer, m_precision);
+      return;
+    case json11::Json::BOOL:
+      m_buffer += theValue.bool_value() ? "true" : "false";
+      return;
+    case json11::Json::STRING:
+      Document::dumpString (theValue.string_value(), m_buffer);
+      return;
+    case json11::Json::ARRAY:
+      break;
+    case json11::Json::OBJECT: {
+      m_buffer += "{";
+
+      bool isFirst = true;
+      for (auto& anItem : theValue.object_items()) {
+        m_buffer += isFirst ? "" : ", ";
+        Document::dumpString (anItem.first, m_buffer);
+        m_buffer += ": ";
+        dumpValue (anItem.second);
+        isFirst = false;
+      }
+
+      m_buffer += "}";
+      return;
+    }
+  }
+
+  m_buffer += "[";
+
+  // compact arrays of numbers are not expanded
+  const json11::Json::number_array& aNumbers = theValue.number_items();
+  if (!aNumbers.empty()) {
+    for (size_t anIndex = 0; anIndex < aNumbers.size(); ++anIndex) {
+      m_buffer += anIndex == 0 ? "" : ", ";
+      Document::dumpNumber (aNumbers[anIndex], m_buffer, m_precision);
+    }
+  }
+  else {
+    const json11::Json::array& anItems = theValue.array_items();
+    for (size_t anIndex = 0; anIndex < anItems.size(); ++anIndex) {
+      m_buffer += anIndex == 0 ? "" : ", ";
+      dumpValue (anItems[anIndex]);
+    }
+  }
+
+  m_buffer += "]";
+}
+
+void CsgStreamWriter::flushIfNeeded() {
+
+  if (m_levels.empty() || m_buffer.size() >= THE_BLOCK_SIZE) {
+    m_file.write (m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+  }
+}
+
+} // csg
@@ -0,0 +1,179 @@
+#ifndef HEADER_CSG_WRITER
+#define HEADER_CSG_WRITER
+
+#include <string>
+#include <vector>
+
+#include <csgdocument.hpp>
+#include <csgfile.hpp>
+#include <csghandler.hpp>
+
+namespace csg {
+
+//! Streaming writer of CSG and CSGJS formats.
+//! Output is formatted into a reusable buffer which is passed to the file
+//! by large blocks; indentation is derived from the nesting depth.
+class CsgWriter {
+
+public:
+
+  //! Creates writer of the document to the file.
+  //! Numbers are written in the shortest form which is read back with the given precision.
+  CsgWriter (const Document& theDocument, OutputFile& theFile,
+             const NumberPrecision thePrecision = PRECISION_DOUBLE);
+
+  //! Writes the document in CSG format.
+  //! Throws std::runtime_error if the document can't be represented in CSG format
+  //! (the output written so far is not reverted then).
+  void writeCsg();
+
+  //! Writes the document in CSGJS format (the same layout as json11 serialization).
+  //! If subtrees are shared, identical subtrees referenced more than once are written
+  //! once in "definitions" list (preceding "contents") and replaced by {"use": <index>}.
+  void writeJson (const bool toShareSubtrees = false);
+
+private:
+
+  //! Serializes CSG object or instruction.
+  void writeNode (const Document::Node& theNode);
+
+  //! Serializes properties of objects and instructions.
+  void writeProperties (const Document::Node& theNode);
+
+  //! Serializes CSG object.
+  void writeObject (const Document::Node& theNode);
+
+  //! Serializes CSG instruction.
+  void writeInstruction (const Document::Node& theNode);
+
+  //! Serializes CSG object or instruction into CSGJS format.
+  void writeJsonNode (const Document::Node& theNode);
+
+  //! Serializes child node into CSGJS format (as reference if its subtree is shared).
+  void writeJsonChild (const Document::Node& theNode);
+
+  //! Finds subtrees to be shared, returns their root nodes in the order of definitions.
+  std::vector<const Document::Node*> findSharedSubtrees();
+
+  //! Checks if object has at least specified children count.
+  void assertChildrenNum (const Document::Node& theNode, const Document::Index theChildrenNum);
+
+  //! Appends indentation of current depth.
+  void indent();
+
+  //! Passes the buffer to the file if it is large enough.
+  void flushIfFull();
+
+  //! Passes the buffer to the file.
+  void flush();
+
+private:
+
+  const Document& m_document;
+  OutputFile& m_file;
+  NumberPrecision m_precision;
+
+  std::string m_buffer;
+
+  //! Nesting depth of the node being written.
+  int m_depth;
+
+  //! Indices of definitions by indices of nodes (INVALID_INDEX for nodes written in place),
+  //! empty if subtrees are not shared.
+  std::vector<Document::Index> m_definitions;
+
+};
+
+//! Handler which writes CSG data in CSG or CSGJS format as soon as it is read
+//! (e.g. from Parser::parseEvents), without building the tree in memory.
+//! Memory usage is bounded by nesting depth. Output is passed to the file
+//! at the end of each top-level statement and by large blocks inside them,
+//! so consumers of a pipe receive it while the input is still being read.
+//! The output is the same as CsgWriter writes for the document of the same data,
+//! except that the CSG version comment is taken from the data read before
+//! the first statement.
+class CsgStreamWriter : public Handler {
+
+public:
+
+  //! Output format.
+  enum Format {
+    FORMAT_CSG,
+    FORMAT_CSGJS
+  };
+
+public:
+
+  //! Creates writer of the given format to the file.
+  CsgStreamWriter (OutputFile& theFile, const Format theFormat,
+                   const NumberPrecision thePrecision = PRECISION_DOUBLE);
+
+  virtual void version (const std::string& theName, const int theMajor, const int theMinor);
+
+  virtual void object (const std::string& theType, const json11::Json::object& theProperties);
+
+  virtual void beginInstruction (const std::string& theType, const json11::Json::object& theProperties);
+
+  virtual void beginMatrix (const std::string& theType, const json11::Json::array& theMatrix);
+
+  virtual void endInstruction();
+
+  //! Writes the rest of output. Throws std::runtime_error if instructions are not closed.
+  //! Handler methods throw std::runtime_error if the data can't be represented in CSG format
+  //! (the output written so far is not reverted then).
+  void finish();
+
+private:
+
+  //! Instruction being written.
+  struct Level {
+    std::string type;
+    int nbChildren;
+
+    //! Properties (or the matrix) which are written after children in CSGJS format.
+    json11::Json properties;
+  };
+
+  //! Writes the beginning of output if it is not written yet.
+  void writeHeader();
+
+  //! Counts new child of the current instruction, writes separator of CSGJS items.
+  void beginChild();
+
+  //! Checks node type and number of children for CSG format.
+  void checkNode (const std::string& theType, const int theNbChildren, const bool isInstruction);
+
+  //! Writes CSG instruction or object header (the type and properties).
+  void writeCsgHeader (const std::string& theType, const json11::Json& theProperties);
+
+  //! Appends JSON value.
+  void dumpValue (const json11::Json& theValue);
+
+  //! Passes the buffer to the file at the end of top-level statement or if it is large enough.
+  void flushIfNeeded();
+
+private:
+
+  OutputFile& m_file;
+  Format m_format;
+  NumberPrecision m_precision;
+
+  std::string m_buffer;
+
+  std::string m_versionName;
+  int m_majorVersion;
+  int m_minorVersion;
+
+  bool m_isStarted;
+
+  //! Number of top-level statements.
+  int m_nbStatements;
+
+  //! Open instructions.
+  std::vector<Level> m_levels;
+
+};
+
+} // csg
+
+#endif // HEADER_CSG_WRITER
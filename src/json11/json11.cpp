@@ -25,6 +25,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <limits>
+#include <mutex>
 
 namespace json11 {
 
@@ -114,6 +115,18 @@ static void dump(const Json::array &values, string &out) {
     out += "]";
 }
 
+static void dump(const Json::number_array &values, string &out) {
+    bool first = true;
+    out += "[";
+    for (const auto &value : values) {
+        if (!first)
+            out += ", ";
+        dump(value, out);
+        first = false;
+    }
+    out += "]";
+}
+
 static void dump(const Json::object &values, string &out) {
     bool first = true;
     out += "{";
@@ -136,6 +149,11 @@ void Json::dump(string &out) const {
  * Value wrappers
  */
 
+// nullptr_t values are all equal (they have no ordered comparison)
+template <typename T>
+static bool less_value(const T &a, const T &b) { return a < b; }
+static bool less_value(const std::nullptr_t &, const std::nullptr_t &) { return false; }
+
 template <Json::Type tag, typename T>
 class Value : public JsonValue {
 protected:
@@ -154,7 +172,7 @@ protected:
         return m_value == static_cast<const Value<tag, T> *>(other)->m_value;
     }
     bool less(const JsonValue * other) const override {
-        return m_value < static_cast<const Value<tag, T> *>(other)->m_value;
+        return less_value(m_value, static_cast<const Value<tag, T> *>(other)->m_value);
     }
 
     const T m_value;
@@ -195,11 +213,36 @@ public:
 class JsonArray final : public Value<Json::ARRAY, Json::array> {
     const Json::array &array_items() const override { return m_value; }
     const Json & operator[](size_t i) const override;
+    bool equals(const JsonValue * other) const override { return m_value == other->array_items(); }
+    bool less(const JsonValue * other)   const override { return m_value <  other->array_items(); }
 public:
     explicit JsonArray(const Json::array &value) : Value(value) {}
     explicit JsonArray(Json::array &&value)      : Value(move(value)) {}
 };
 
+class JsonNumberArray final : public Value<Json::ARRAY, Json::number_array> {
+    const Json::number_array &number_items() const override { return m_value; }
+    const Json::array &array_items() const override;
+    const Json & operator[](size_t i) const override;
+    bool equals(const JsonValue * other) const override {
+        if (other->number_items().size() == m_value.size())
+            return m_value == other->number_items();
+        return array_items() == other->array_items();
+    }
+    bool less(const JsonValue * other) const override {
+        if (other->number_items().size() == m_value.size())
+            return m_value < other->number_items();
+        return array_items() < other->array_items();
+    }
+
+    // Regular array of the numbers, created on demand.
+    mutable std::once_flag m_items_flag;
+    mutable Json::array m_items;
+public:
+    explicit JsonNumberArray(const Json::number_array &value) : Value(value) {}
+    explicit JsonNumberArray(Json::number_array &&value)      : Value(move(value)) {}
+};
+
 class JsonObject final : public Value<Json::OBJECT, Json::object> {
     const Json::object &object_items() const override { return m_value; }
     const Json & operator[](const string &key) const override;
@@ -222,6 +265,7 @@ struct Statics {
     const std::shared_ptr<JsonValue> f = make_shared<JsonBoolean>(false);
     const string empty_string;
     const vector<Json> empty_vector;
+    const vector<double> empty_number_vector;
     const map<string, Json> empty_map;
     Statics() {}
 };
@@ -253,6 +297,13 @@ Json::Json(const Json::array &values)  : m_ptr(make_shared<JsonArray>(values)) {
 Json::Json(Json::array &&values)       : m_ptr(make_shared<JsonArray>(move(values))) {}
 Json::Json(const Json::object &values) : m_ptr(make_shared<JsonObject>(values)) {}
 Json::Json(Json::object &&values)      : m_ptr(make_shared<JsonObject>(move(values))) {}
+// Number arrays are never empty, so sizes of number_items() tell compact arrays apart
+Json::Json(const Json::number_array &values)
+    : m_ptr(values.empty() ? std::shared_ptr<JsonValue>(make_shared<JsonArray>(Json::array()))
+                           : make_shared<JsonNumberArray>(values)) {}
+Json::Json(Json::number_array &&values)
+    : m_ptr(values.empty() ? std::shared_ptr<JsonValue>(make_shared<JsonArray>(Json::array()))
+                           : make_shared<JsonNumberArray>(move(values))) {}
 
 /* * * * * * * * * * * * * * * * * * * *
  * Accessors
@@ -264,6 +315,7 @@ int Json::int_value()                             const { return m_ptr->int_valu
 bool Json::bool_value()                           const { return m_ptr->bool_value();   }
 const string & Json::string_value()               const { return m_ptr->string_value(); }
 const vector<Json> & Json::array_items()          const { return m_ptr->array_items();  }
+const vector<double> & Json::number_items()       const { return m_ptr->number_items(); }
 const map<string, Json> & Json::object_items()    const { return m_ptr->object_items(); }
 const Json & Json::operator[] (size_t i)          const { return (*m_ptr)[i];           }
 const Json & Json::operator[] (const string &key) const { return (*m_ptr)[key];         }
@@ -273,6 +325,7 @@ int                       JsonValue::int_value()                 const { return
 bool                      JsonValue::bool_value()                const { return false; }
 const string &            JsonValue::string_value()              const { return statics().empty_string; }
 const vector<Json> &      JsonValue::array_items()               const { return statics().empty_vector; }
+const vector<double> &    JsonValue::number_items()              const { return statics().empty_number_vector; }
 const map<string, Json> & JsonValue::object_items()              const { return statics().empty_map; }
 const Json &              JsonValue::operator[] (size_t)         const { return static_null(); }
 const Json &              JsonValue::operator[] (const string &) const { return static_null(); }
@@ -286,6 +339,15 @@ const Json & JsonArray::operator[] (size_t i) const {
     else return m_value[i];
 }
 
+const Json::array & JsonNumberArray::array_items() const {
+    std::call_once(m_items_flag, [this] { m_items.assign(m_value.begin(), m_value.end()); });
+    return m_items;
+}
+const Json & JsonNumberArray::operator[] (size_t i) const {
+    if (i >= m_value.size()) return static_null();
+    else return array_items()[i];
+}
+
 /* * * * * * * * * * * * * * * * * * * *
  * Comparison
  */
@@ -75,6 +75,9 @@ public:
     typedef std::vector<Json> array;
     typedef std::map<std::string, Json> object;
 
+    // Numbers of an array stored contiguously (see Json(const number_array &)).
+    typedef std::vector<double> number_array;
+
     // Constructors for the various types of JSON value.
     Json() noexcept;                // NUL
     Json(std::nullptr_t) noexcept;  // NUL
@@ -89,6 +92,12 @@ public:
     Json(const object &values);     // OBJECT
     Json(object &&values);          // OBJECT
 
+    // ARRAY of numbers kept in a single buffer instead of one value per element.
+    // It behaves as a regular array; array_items() and operator[] expand it on
+    // first use, number_items() gives access to the numbers without expanding.
+    Json(const number_array &values);
+    Json(number_array &&values);
+
     // Implicit constructor: anything with a to_json() function.
     template <class T, class = decltype(&T::to_json)>
     Json(const T & t) : Json(t.to_json()) {}
@@ -132,6 +141,8 @@ public:
     const std::string &string_value() const;
     // Return the enclosed std::vector if this is an array, or an empty vector otherwise.
     const array &array_items() const;
+    // Return the enclosed numbers if this is a compact number array, or an empty vector otherwise.
+    const number_array &number_items() const;
     // Return the enclosed std::map if this is an object, or an empty map otherwise.
     const object &object_items() const;
 
@@ -193,6 +204,8 @@ protected:
     friend class Json;
     friend class JsonInt;
     friend class JsonDouble;
+    friend class JsonArray;
+    friend class JsonNumberArray;
     virtual Json::Type type() const = 0;
     virtual bool equals(const JsonValue * other) const = 0;
     virtual bool less(const JsonValue * other) const = 0;
@@ -202,6 +215,7 @@ protected:
     virtual bool bool_value() const;
     virtual const std::string &string_value() const;
     virtual const Json::array &array_items() const;
+    virtual const Json::number_array &number_items() const;
     virtual const Json &operator[](size_t i) const;
     virtual const Json::object &object_items() const;
     virtual const Json &operator[](const std::string &key) const;
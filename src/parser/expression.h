@@ -115,6 +115,8 @@ namespace lars {
     
     const std::string & full_string()const{ return expr_data->parsed_string; }
     std::string string()const{uintptr_t b=raw_expression().begin.location,e=raw_expression().end.location; return full_string().substr(b,e-b); }
+    const char * string_begin()const{ return full_string().data()+raw_expression().begin.location; }
+    const char * string_end()const{ return full_string().data()+raw_expression().end.location; }
     char character(uintptr_t pos = 0)const{ return full_string()[begin_position().location+pos]; }
     
     std::string intermediate(uintptr_t i=1)const{
@@ -33,7 +33,7 @@ namespace lars {
     
     expression<I> parse(std::string str){
       expression<I> e(default_visitor);
-      e.get_global_data()->parsed_string = str;
+      e.get_global_data()->parsed_string = std::move(str);
       e.get_global_data()->abort = false;
       
       state s(e.get_global_data(),&*grammar,default_visitor);
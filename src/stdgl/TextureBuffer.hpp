@@ -1,6 +1,8 @@
 #ifndef HEADER_TEXTURE_BUFFER
 #define HEADER_TEXTURE_BUFFER
 
+#include <cstddef>
+
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 